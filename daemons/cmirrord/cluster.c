@@ -112,6 +112,7 @@ struct clog_cpg {
 	int resend_requests;
 	struct dm_list startup_list;
 	struct dm_list working_list;
+	struct dm_list flush_list;	/* responses awaiting a disk log write */
 
 	int checkpoints_needed;
 	uint32_t checkpoint_requesters[MAX_CHECKPOINT_REQUESTERS];
@@ -221,8 +222,35 @@ static struct clog_request *get_matching_rq(struct clog_request *rq,
 	return NULL;
 }
 
+/*
+ * send_flush_responses
+ * @entry
+ *
+ * As server, answer the flushes that arrived since the last call,
+ * once one write of the disk log has covered all of them.
+ */
+static void send_flush_responses(struct clog_cpg *entry)
+{
+	int r;
+	struct clog_request *rq, *n;
+
+	dm_list_iterate_items_gen_safe(rq, n, &entry->flush_list, u.list) {
+		dm_list_del(&rq->u.list);
+
+		/* Only the first request of each log writes it */
+		rq->u_rq.error = log_flush_pending(entry->name.value,
+						   rq->u_rq.luid);
+		rq->u_rq.request_type |= DM_ULOG_RESPONSE;
+
+		r = cluster_send(rq);
+		if (r < 0)
+			LOG_ERROR("cluster_send failed: %s", strerror(-r));
+		free(rq);
+	}
+}
+
 static char rq_buffer[DM_ULOG_REQUEST_SIZE];
-static int handle_cluster_request(struct clog_cpg *entry __attribute__((unused)),
+static int handle_cluster_request(struct clog_cpg *entry,
 				  struct clog_request *rq, int server)
 {
 	int r = 0;
@@ -256,6 +284,23 @@ static int handle_cluster_request(struct clog_cpg *entry __attribute__((unused))
 
 	r = do_request(tmp, server);
 
+	/* Answered by send_flush_responses() */
+	if (server && (tmp->u_rq.request_type == DM_ULOG_FLUSH) &&
+	    !tmp->u_rq.error) {
+		size_t size = sizeof(struct clog_request) + tmp->u_rq.data_size;
+		struct clog_request *flush = malloc(size);
+
+		if (flush) {
+			memcpy(flush, tmp, size);
+			dm_list_add(&entry->flush_list, &flush->u.list);
+			return r;
+		}
+
+		/* Flush now rather than leave the request unanswered */
+		tmp->u_rq.error = log_flush_pending(entry->name.value,
+						    tmp->u_rq.luid);
+	}
+
 	if (server &&
 	    (tmp->u_rq.request_type != DM_ULOG_CLEAR_REGION) &&
 	    (tmp->u_rq.request_type != DM_ULOG_POSTSUSPEND)) {
@@ -949,6 +994,8 @@ static int do_cluster_work(void *data __attribute__((unused)))
 		if (r != CS_OK)
 			LOG_ERROR("cpg_dispatch failed: %d", r);
 
+		send_flush_responses(entry);
+
 		if (entry->free_me) {
 			free(entry);
 			continue;
@@ -1571,6 +1618,7 @@ int create_cluster_cpg(char *uuid, uint64_t luid)
 	new->lowest_id = 0xDEAD;
 	dm_list_init(&new->startup_list);
 	dm_list_init(&new->working_list);
+	dm_list_init(&new->flush_list);
 
 	size = ((strlen(uuid) + 1) > CPG_MAX_NAME_LENGTH) ?
 		CPG_MAX_NAME_LENGTH : (strlen(uuid) + 1);
@@ -1653,6 +1701,9 @@ static int _destroy_cluster_cpg(struct clog_cpg *del)
 	*/
 	do_checkpoints(del, 1);
 
+	/* Answer flushes while we can still send */
+	send_flush_responses(del);
+
 	state = del->state;
 
 	del->cpg_state = INVALID;
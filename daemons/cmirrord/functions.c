@@ -16,9 +16,12 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
+#include <linux/fs.h>
 
 #define BYTE_SHIFT 3
 
@@ -30,6 +33,7 @@
 #define MIRROR_MAGIC 0x4D695272
 #define MIRROR_DISK_VERSION 2
 #define LOG_OFFSET 2
+#define LOG_BITS_OFFSET 1024	/* clean bits follow the header */
 
 #define RESYNC_HISTORY 50
 //static char resync_history[RESYNC_HISTORY][128];
@@ -87,6 +91,15 @@ struct log_c {
 	uint64_t disk_nr_regions;
 	size_t disk_size;       /* size of disk_buffer in bytes */
 	void *disk_buffer;      /* aligned memory for O_DIRECT */
+	size_t block_size;      /* unit of writes to the log device */
+	dm_bitset_t dirty_blocks; /* blocks with clean_bits not yet written */
+
+	int flush_pending;      /* flush deferred to log_flush_pending() */
+	int flush_error;        /* result of the last deferred flush */
+	uint64_t flush_count;   /* disk log writes and their cost */
+	uint64_t flush_bytes;
+	uint64_t flush_usecs;
+	uint64_t flush_max_usecs;
 	int idx;
 	char resync_history[RESYNC_HISTORY][128];
 };
@@ -110,36 +123,69 @@ static int log_test_bit(dm_bitset_t bs, int bit)
 	return dm_bit(bs, bit) ? 1 : 0;
 }
 
+/*
+ * mark_dirty
+ *
+ * Note which blocks of the disk log hold the clean bits from
+ * 'start' to 'start + count - 1', so the next flush writes them.
+ */
+static void mark_dirty(struct log_c *lc, dm_bitset_t bs,
+		       unsigned start, unsigned count)
+{
+	size_t first, last;
+
+	if ((bs != lc->clean_bits) || !lc->dirty_blocks || !count)
+		return;
+
+	/* clean_bits reach the disk a 32-bit word at a time */
+	first = LOG_BITS_OFFSET + (start / DM_BITS_PER_INT) * sizeof(uint32_t);
+	last = LOG_BITS_OFFSET + ((start + count - 1) / DM_BITS_PER_INT) * sizeof(uint32_t);
+	first /= lc->block_size;
+	last /= lc->block_size;
+
+	dm_bit_set_range(lc->dirty_blocks, first, last - first + 1);
+}
+
 static void log_set_bit(struct log_c *lc, dm_bitset_t bs, int bit)
 {
 	dm_bit_set(bs, bit);
+	mark_dirty(lc, bs, bit, 1);
 	lc->touched = 1;
 }
 
 static void log_clear_bit(struct log_c *lc, dm_bitset_t bs, int bit)
 {
 	dm_bit_clear(bs, bit);
+	mark_dirty(lc, bs, bit, 1);
 	lc->touched = 1;
 }
 
-static uint64_t find_next_zero_bit(dm_bitset_t bs, unsigned start)
+static void log_set_range(struct log_c *lc, dm_bitset_t bs,
+			  unsigned start, unsigned count)
 {
-	for (; dm_bit(bs, start); start++)
-		if (start >= *bs)
-			return (uint64_t)-1;
+	dm_bit_set_range(bs, start, count);
+	mark_dirty(lc, bs, start, count);
+	lc->touched = 1;
+}
 
-	return start;
+static void log_clear_range(struct log_c *lc, dm_bitset_t bs,
+			    unsigned start, unsigned count)
+{
+	dm_bit_clear_range(bs, start, count);
+	mark_dirty(lc, bs, start, count);
+	lc->touched = 1;
 }
 
-static uint64_t count_bits32(dm_bitset_t bs)
+static uint64_t find_next_zero_bit(dm_bitset_t bs, unsigned start)
 {
-	unsigned i, size = bs[0]/(unsigned)DM_BITS_PER_INT + 1;
-	unsigned count = 0;
+	int bit = dm_bit_get_next_clear(bs, (int) start - 1);
 
-	for (i = 1; i <= size; i++)
-		count += hweight32(bs[i]);
+	return (bit < 0) ? (uint64_t)-1 : (uint64_t)bit;
+}
 
-	return (uint64_t)count;
+static uint64_t count_bits32(dm_bitset_t bs)
+{
+	return (uint64_t)dm_bit_count(bs);
 }
 
 /*
@@ -252,11 +298,52 @@ static int read_log(struct log_c *lc)
 	bitset_size += (lc->region_count % 8) ? 1 : 0;
 
 	/* 'lc->clean_bits + 1' becasue dm_bitset_t leads with a uint32_t */
-	memcpy(lc->clean_bits + 1, (char *)lc->disk_buffer + 1024, bitset_size);
+	memcpy(lc->clean_bits + 1, (char *)lc->disk_buffer + LOG_BITS_OFFSET, bitset_size);
 
 	return 0;
 }
 
+static uint64_t now_usecs(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void account_write(struct log_c *lc, size_t bytes, uint64_t start)
+{
+	uint64_t usecs = now_usecs() - start;
+
+	lc->flush_count++;
+	lc->flush_bytes += bytes;
+	lc->flush_usecs += usecs;
+	if (usecs > lc->flush_max_usecs)
+		lc->flush_max_usecs = usecs;
+}
+
+static size_t disk_bitset_size(struct log_c *lc)
+{
+	size_t bitset_size;
+
+	bitset_size = lc->region_count / 8;
+	bitset_size += (lc->region_count % 8) ? 1 : 0;
+
+	return bitset_size;
+}
+
+static void disk_header(struct log_c *lc)
+{
+	struct log_header lh;
+
+	lh.magic = MIRROR_MAGIC;
+	lh.version = MIRROR_DISK_VERSION;
+	lh.nr_regions = lc->region_count;
+
+	header_to_disk(&lh, lc->disk_buffer);
+}
+
 /*
  * write_log
  * @lc
@@ -265,29 +352,106 @@ static int read_log(struct log_c *lc)
  */
 static int write_log(struct log_c *lc)
 {
-	struct log_header lh;
-	size_t bitset_size;
-
-	lh.magic = MIRROR_MAGIC;
-	lh.version = MIRROR_DISK_VERSION;
-	lh.nr_regions = lc->region_count;
+	uint64_t start = now_usecs();
 
-	header_to_disk(&lh, lc->disk_buffer);
+	disk_header(lc);
 
 	/* Write disk bits from clean_bits */
-	bitset_size = lc->region_count / 8;
-	bitset_size += (lc->region_count % 8) ? 1 : 0;
-
 	/* 'lc->clean_bits + 1' becasue dm_bitset_t leads with a uint32_t */
-	memcpy((char *)lc->disk_buffer + 1024, lc->clean_bits + 1, bitset_size);
+	memcpy((char *)lc->disk_buffer + LOG_BITS_OFFSET, lc->clean_bits + 1,
+	       disk_bitset_size(lc));
 
 	if (rw_log(lc, 1)) {
 		lc->log_dev_failed = 1;
 		return -EIO; /* Failed disk write */
 	}
+
+	if (lc->dirty_blocks)
+		dm_bit_clear_all(lc->dirty_blocks);
+	account_write(lc, lc->disk_size, start);
+
 	return 0;
 }
 
+/*
+ * flush_log
+ * @lc
+ *
+ * Like write_log, but only writes the blocks whose clean bits have
+ * changed since the log was last written, with one write for each
+ * run of adjacent blocks.
+ *
+ * Returns: 0 on success, -EIO on failure
+ */
+static int flush_log(struct log_c *lc)
+{
+	char *buf = lc->disk_buffer;
+	size_t bitset_end = LOG_BITS_OFFSET + disk_bitset_size(lc);
+	size_t start, end, from, to, bytes = 0;
+	uint64_t begin = now_usecs();
+	int first, last;
+	ssize_t r;
+
+	if (!lc->dirty_blocks)
+		return write_log(lc);
+
+	/* Blocks may be shared with the header */
+	disk_header(lc);
+
+	for (first = dm_bit_get_first(lc->dirty_blocks); first >= 0;
+	     first = dm_bit_get_next(lc->dirty_blocks, last - 1)) {
+		if ((last = dm_bit_get_next_clear(lc->dirty_blocks, first)) < 0)
+			last = (int)*lc->dirty_blocks;
+
+		start = first * lc->block_size;
+		end = last * lc->block_size;
+
+		/* Bring in the clean bits held by these blocks */
+		from = (start > LOG_BITS_OFFSET) ? start : LOG_BITS_OFFSET;
+		to = (end < bitset_end) ? end : bitset_end;
+		if (from < to)
+			memcpy(buf + from, (char *)(lc->clean_bits + 1) +
+			       (from - LOG_BITS_OFFSET), to - from);
+
+		r = pwrite(lc->disk_fd, buf + start, end - start, (off_t)start);
+		if (r != (ssize_t)(end - start)) {
+			LOG_ERROR("[%s] flush_log:  write failure: %s",
+				  SHORT_UUID(lc->uuid),
+				  (r < 0) ? strerror(errno) : "short write");
+			lc->log_dev_failed = 1;
+			return -EIO; /* Failed disk write */
+		}
+
+		dm_bit_clear_range(lc->dirty_blocks, first, last - first);
+		bytes += end - start;
+	}
+
+	account_write(lc, bytes, begin);
+
+	return 0;
+}
+
+/*
+ * flush_pending
+ * @lc
+ *
+ * Write out a flush deferred by clog_flush.
+ */
+static void flush_pending(struct log_c *lc)
+{
+	if (!lc->flush_pending)
+		return;
+
+	lc->flush_pending = 0;
+	lc->flush_error = flush_log(lc);
+
+	if (lc->flush_error)
+		LOG_ERROR("[%s] Error writing to disk log",
+			  SHORT_UUID(lc->uuid));
+	else
+		LOG_DBG("[%s] Disk log written", SHORT_UUID(lc->uuid));
+}
+
 /* FIXME Rewrite this function taking advantage of the udev changes (where in use) to improve its efficiency! */
 static int find_disk_path(char *major_minor_str, char *path_rtn, int *unlink_path __attribute__((unused)))
 {
@@ -379,6 +543,7 @@ static int _clog_ctr(char *uuid, uint64_t luid,
 	int unlink_path = 0;
 	long page_size;
 	int pages;
+	int block_size;
 
 	/* If core log request, then argv[0] will be region_size */
 	if (!strtoll(argv[0], &p, 0) || *p) {
@@ -507,6 +672,20 @@ static int _clog_ctr(char *uuid, uint64_t luid,
 		lc->disk_fd = r;
 		lc->disk_size = pages * page_size;
 
+		/* Fall back to pages, which O_DIRECT always accepts */
+		if (ioctl(lc->disk_fd, BLKSSZGET, &block_size) ||
+		    (block_size <= 0) || (page_size % block_size))
+			block_size = (int)page_size;
+		lc->block_size = (size_t)block_size;
+
+		lc->dirty_blocks = dm_bitset_create(NULL, lc->disk_size /
+						    lc->block_size);
+		if (!lc->dirty_blocks) {
+			LOG_ERROR("Unable to allocate dirty block bitset");
+			r = -ENOMEM;
+			goto fail;
+		}
+
 		r = posix_memalign(&(lc->disk_buffer), page_size,
 				   lc->disk_size);
 		if (r) {
@@ -526,6 +705,7 @@ fail:
 			LOG_ERROR("Close device error, %s: %s",
 				  disk_path, strerror(errno));
 		free(lc->disk_buffer);
+		dm_free(lc->dirty_blocks);
 		dm_free(lc->sync_bits);
 		dm_free(lc->clean_bits);
 		dm_free(lc);
@@ -641,12 +821,15 @@ static int clog_dtr(struct dm_ulog_request *rq)
 
 	LOG_DBG("[%s] Cluster log removed", SHORT_UUID(lc->uuid));
 
+	flush_pending(lc);
+
 	dm_list_del(&lc->list);
 	if (lc->disk_fd != -1 && close(lc->disk_fd))
 		LOG_ERROR("Failed to close disk log: %s",
 			  strerror(errno));
 	if (lc->disk_buffer)
 		free(lc->disk_buffer);
+	dm_free(lc->dirty_blocks);
 	dm_free(lc->clean_bits);
 	dm_free(lc->sync_bits);
 	dm_free(lc);
@@ -669,6 +852,8 @@ static int clog_presuspend(struct dm_ulog_request *rq)
 	if (lc->touched)
 		LOG_DBG("WARNING: log still marked as 'touched' during suspend");
 
+	flush_pending(lc);
+
 	lc->recovery_halted = 1;
 
 	return 0;
@@ -801,12 +986,14 @@ static int clog_resume(struct dm_ulog_request *rq)
 
 no_disk:
 	/* If mirror has grown, set bits appropriately */
-	if (lc->sync == NOSYNC)
-		for (i = lc->disk_nr_regions; i < lc->region_count; i++)
-			log_set_bit(lc, lc->clean_bits, i);
-	else
-		for (i = lc->disk_nr_regions; i < lc->region_count; i++)
-			log_clear_bit(lc, lc->clean_bits, i);
+	if (lc->disk_nr_regions < lc->region_count) {
+		if (lc->sync == NOSYNC)
+			log_set_range(lc, lc->clean_bits, lc->disk_nr_regions,
+				      lc->region_count - lc->disk_nr_regions);
+		else
+			log_clear_range(lc, lc->clean_bits, lc->disk_nr_regions,
+					lc->region_count - lc->disk_nr_regions);
+	}
 
 	/* Clear any old bits if device has shrunk */
 	for (i = lc->region_count; i % 32; i++)
@@ -1033,7 +1220,6 @@ static int clog_in_sync(struct dm_ulog_request *rq)
  */
 static int clog_flush(struct dm_ulog_request *rq, int server)
 {
-	int r = 0;
 	struct log_c *lc = get_log(rq->uuid, rq->luid);
 
 	if (!lc)
@@ -1044,21 +1230,19 @@ static int clog_flush(struct dm_ulog_request *rq, int server)
 
 	/*
 	 * Do the actual flushing of the log only
-	 * if we are the server.
+	 * if we are the server.  The write waits for
+	 * log_flush_pending(), once the cluster messages
+	 * that arrived together have all been handled,
+	 * so flushes from several nodes share it.
 	 */
-	if (server && (lc->disk_fd >= 0)) {
-		r = rq->error = write_log(lc);
-		if (r)
-			LOG_ERROR("[%s] Error writing to disk log",
-				  SHORT_UUID(lc->uuid));
-		else 
-			LOG_DBG("[%s] Disk log written", SHORT_UUID(lc->uuid));
+	if (server && (lc->disk_fd >= 0) && !lc->flush_pending) {
+		lc->flush_pending = 1;
+		lc->flush_error = 0;
 	}
 
 	lc->touched = 0;
 
-	return r;
-
+	return 0;
 }
 
 /*
@@ -1358,6 +1542,11 @@ static int clog_set_region_sync(struct dm_ulog_request *rq, uint32_t originator)
 			   (unsigned long long)pkg->region);
 	}
 
+#ifdef DEBUG
+	/*
+	 * sync_count is kept up to date as bits change, so recounting
+	 * the whole bitmap on every request is only worth it here.
+	 */
 	if (lc->sync_count != count_bits32(lc->sync_bits)) {
 		unsigned long long reset = count_bits32(lc->sync_bits);
 
@@ -1365,11 +1554,10 @@ static int clog_set_region_sync(struct dm_ulog_request *rq, uint32_t originator)
 			   "sync_count(%llu) != bitmap count(%llu)",
 			   rq->seq, SHORT_UUID(lc->uuid), originator,
 			   (unsigned long long)lc->sync_count, reset);
-#ifdef DEBUG
 		kill(getpid(), SIGUSR1);
-#endif
 		lc->sync_count = reset;
 	}
+#endif
 
 	if (lc->sync_count > lc->region_count)
 		LOG_SPRINT(lc, "SET - SEQ#=%u, UUID=%s, nodeid = %u:: "
@@ -1408,6 +1596,7 @@ static int clog_get_sync_count(struct dm_ulog_request *rq, uint32_t originator)
 
 	rq->data_size = sizeof(*sync_count);
 
+#ifdef DEBUG
 	if (lc->sync_count != count_bits32(lc->sync_bits)) {
 		unsigned long long reset = count_bits32(lc->sync_bits);
 
@@ -1415,11 +1604,10 @@ static int clog_get_sync_count(struct dm_ulog_request *rq, uint32_t originator)
 			   "sync_count(%llu) != bitmap count(%llu)",
 			   rq->seq, SHORT_UUID(lc->uuid), originator,
 			   (unsigned long long)lc->sync_count, reset);
-#ifdef DEBUG
 		kill(getpid(), SIGUSR1);
-#endif
 		lc->sync_count = reset;
 	}
+#endif
 
 	return 0;
 }
@@ -1859,16 +2047,24 @@ int pull_state(const char *uuid, uint64_t luid,
 	if (!strncmp(which, "sync_bits", 9)) {
 		lc->resume_override += 1;
 		memcpy(lc->sync_bits + 1, buf, bitset_size);
+		lc->sync_count = count_bits32(lc->sync_bits);
 
 		LOG_DBG("[%s] loading sync_bits (sync_count = %llu):",
-			SHORT_UUID(lc->uuid),(unsigned long long)
-			count_bits32(lc->sync_bits));
+			SHORT_UUID(lc->uuid),
+			(unsigned long long)lc->sync_count);
 
 		print_bits(lc->sync_bits, 0);
 	} else if (!strncmp(which, "clean_bits", 9)) {
 		lc->resume_override += 2;
 		memcpy(lc->clean_bits + 1, buf, bitset_size);
 
+		/*
+		 * The disk may not hold what the checkpoint does, so
+		 * the first flush as server must write the whole log.
+		 */
+		if (lc->dirty_blocks)
+			dm_bit_set_all(lc->dirty_blocks);
+
 		LOG_DBG("[%s] loading clean_bits:", SHORT_UUID(lc->uuid));
 
 		print_bits(lc->clean_bits, 0);
@@ -1889,6 +2085,45 @@ int log_get_state(struct dm_ulog_request *rq)
 	return (int)lc->state;
 }
 
+/*
+ * log_flush_pending
+ * @uuid
+ * @luid
+ *
+ * Write out any flush of the log that clog_flush deferred.
+ * Every flush answered before clog_flush defers another write
+ * shares this one, so its result is kept for all of them.
+ *
+ * Returns: 0 on success, -EXXX from the write on failure
+ */
+int log_flush_pending(const char *uuid, uint64_t luid)
+{
+	struct log_c *lc = get_log(uuid, luid);
+
+	if (!lc)
+		lc = get_pending_log(uuid, luid);
+
+	/* Already written by clog_dtr */
+	if (!lc)
+		return 0;
+
+	flush_pending(lc);
+
+	return lc->flush_error;
+}
+
+static void print_flush_stats(struct log_c *lc)
+{
+	if (lc->disk_fd < 0)
+		return;
+
+	LOG_PRINT("[%s] %" PRIu64 " disk log writes, %" PRIu64 " bytes, "
+		  "%" PRIu64 "us average, %" PRIu64 "us max",
+		  SHORT_UUID(lc->uuid), lc->flush_count, lc->flush_bytes,
+		  lc->flush_count ? lc->flush_usecs / lc->flush_count : 0,
+		  lc->flush_max_usecs);
+}
+
 /*
  * log_status
  *
@@ -1896,6 +2131,14 @@ int log_get_state(struct dm_ulog_request *rq)
  */
 int log_status(void)
 {
+	struct log_c *lc;
+
+	dm_list_iterate_items(lc, &log_list)
+		print_flush_stats(lc);
+
+	dm_list_iterate_items(lc, &log_pending_list)
+		print_flush_stats(lc);
+
 	if (!dm_list_empty(&log_list) || !dm_list_empty(&log_pending_list))
 		return 1;
 
@@ -1914,6 +2157,7 @@ void log_debug(void)
 	LOG_ERROR("Pending log list:");
 	dm_list_iterate_items(lc, &log_pending_list) {
 		LOG_ERROR("%s", lc->uuid);
+		print_flush_stats(lc);
 		LOG_ERROR("sync_bits:");
 		print_bits(lc->sync_bits, 1);
 		LOG_ERROR("clean_bits:");
@@ -1926,6 +2170,7 @@ void log_debug(void)
 		LOG_ERROR("  recovering_region: %" PRIu64, lc->recovering_region);
 		LOG_ERROR("  recovery_halted  : %s", (lc->recovery_halted) ?
 			  "YES" : "NO");
+		print_flush_stats(lc);
 		LOG_ERROR("sync_bits:");
 		print_bits(lc->sync_bits, 1);
 		LOG_ERROR("clean_bits:");
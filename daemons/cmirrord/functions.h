@@ -28,6 +28,7 @@ int pull_state(const char *uuid, uint64_t luid,
 	       const char *which, char *buf, int size);
 
 int log_get_state(struct dm_ulog_request *rq);
+int log_flush_pending(const char *uuid, uint64_t luid);
 int log_status(void);
 void log_debug(void);
 
@@ -86,29 +86,52 @@ static volatile sig_atomic_t _thread_registries_empty = 1;	/* registries are emp
   - adding or removing elements from thread list
   - changing or reading thread_status's fields:
     processing, status, events
+  - changing or reading the event queue of a dso_data
   Use _lock_mutex() and _unlock_mutex() to hold/release it
 */
 static pthread_mutex_t _global_mutex;
 
 /*
-  There are three states a thread can attain (see struct
+  There are two states a monitored device can attain (see struct
   thread_status, field int status):
 
-  - DM_THREAD_RUNNING: thread has started up and is either working or
-  waiting for events... transitions to either SHUTDOWN or DONE
-  - DM_THREAD_SHUTDOWN: thread is still doing something, but it is
-  supposed to terminate (and transition to DONE) as soon as it
-  finishes whatever it was doing at the point of flipping state to
-  SHUTDOWN... the thread is still on the thread list
-  - DM_THREAD_DONE: thread has terminated and has been moved over to
-  unused thread list, cleanup pending
+  - DM_THREAD_RUNNING: device is on the thread list and checked
+  by the monitor threads... transitions to SHUTDOWN
+  - DM_THREAD_SHUTDOWN: device was unregistered or has disappeared
+  and has been moved over to unused thread list, cleanup pending
+  as soon as no monitor thread is processing it
  */
 #define DM_THREAD_RUNNING  0
 #define DM_THREAD_SHUTDOWN 1
-#define DM_THREAD_DONE     2
 
 #define THREAD_STACK_SIZE (300*1024)
 
+/*
+  Devices do not get a thread each.  A fixed pool of monitor threads
+  compares the event number of every registered device about every
+  MONITOR_INTERVAL_MS and passes those with new events, or with an
+  expired timeout, to their DSO.
+
+  When each device is due next is kept on a timer wheel of WHEEL_SLOTS
+  slots, WHEEL_TICK_MS apart.  Arming and cancelling a device's timer
+  is O(1), and all timers expiring since the last wakeup are queued
+  together.  Intervals are jittered, and so is the first timeout, so
+  devices registered together do not all hit the kernel at once.
+
+  The monitor threads do not call the DSOs themselves, as a DSO may
+  take minutes over an event, e.g. running lvconvert.  Devices with
+  events go onto an event queue in their DSO, which an event thread
+  of that DSO works through while it is not empty.  The DSOs serialise
+  their events anyway, so one thread each loses nothing.  A device
+  waiting there stays off the monitor queue until it was processed.
+ */
+#define MONITOR_THREADS  4
+#define MONITOR_INTERVAL_MS 1000
+#define MONITOR_JITTER_MS   100	/* either way */
+
+#define WHEEL_TICK_MS 100
+#define WHEEL_SLOTS   256
+
 int dmeventd_debug = 0;
 static int _systemd_activation = 0;
 static int _foreground = 0;
@@ -132,8 +155,7 @@ struct dso_data {
 	 * fails, update the application metadata etc.
 	 *
 	 * This function gets a dm_task that is a result of
-	 * DM_DEVICE_WAITEVENT ioctl (results equivalent to
-	 * DM_DEVICE_STATUS). It should not destroy it.
+	 * DM_DEVICE_STATUS ioctl. It should not destroy it.
 	 * The caller must dispose of the task.
 	 */
 	void (*process_event)(struct dm_task *dmt, enum dm_event_mask event, void **user);
@@ -158,6 +180,9 @@ struct dso_data {
 	 */
 	int (*unregister_device)(const char *device, const char *uuid,
 				 int major, int minor, void **user);
+
+	struct dm_list event_queue;	/* Devices with events to process. */
+	int event_thread;	/* Set while an event thread works on it. */
 };
 static DM_LIST_INIT(_dso_registry);
 
@@ -178,17 +203,16 @@ struct message_data {
 };
 
 /*
- * Housekeeping of thread+device states.
+ * Housekeeping of monitored device states.
  *
- * One thread per mapped device which can block on it until an event
- * occurs and the event processing function of the DSO gets called.
+ * Each mapped device is queued for the monitor threads at intervals,
+ * and the event processing function of the DSO gets called when an
+ * event occured since the last check.
  */
 struct thread_status {
 	struct dm_list list;
 
-	pthread_t thread;
-
-	struct dso_data *dso_data;	/* DSO this thread accesses. */
+	struct dso_data *dso_data;	/* DSO this device uses. */
 
 	struct {
 		char *uuid;
@@ -196,27 +220,32 @@ struct thread_status {
 		int major, minor;
 	} device;
 	uint32_t event_nr;	/* event number */
-	int processing;		/* Set when event is being processed */
+	int processing;		/* Set while a monitor or event thread has it */
 
-	int status;		/* see DM_THREAD_{RUNNING,SHUTDOWN,DONE}
+	int status;		/* see DM_THREAD_{RUNNING,SHUTDOWN}
 				   constants above */
 	enum dm_event_mask events;	/* bitfield for event filter. */
 	enum dm_event_mask current_events;	/* bitfield for occured events. */
-	struct dm_task *current_task;
-	time_t next_time;
+	uint64_t next_time;	/* when the timeout expires, in ms */
 	uint32_t timeout;
-	struct dm_list timeout_list;
+	uint64_t due_tick;	/* when the timer expires */
+	struct dm_list timer_list;	/* on a _wheel slot */
+	struct dm_list queue_list;	/* on _monitor_queue */
+	struct dm_list event_list;	/* on its DSO's event_queue */
+	struct dm_task *event_task;	/* status to pass with the events */
 	void *dso_private; /* dso per-thread status variable */
 };
 static DM_LIST_INIT(_thread_registry);
 static DM_LIST_INIT(_thread_registry_unused);
 
-static int _timeout_running;
-static DM_LIST_INIT(_timeout_registry);
-static pthread_mutex_t _timeout_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t _timeout_cond = PTHREAD_COND_INITIALIZER;
+/* Monitor thread pool, protected by _global_mutex */
+static int _monitor_running;
+static struct dm_list _wheel[WHEEL_SLOTS];
+static uint64_t _wheel_tick;	/* last tick expired */
+static DM_LIST_INIT(_monitor_queue);	/* devices waiting for a check */
+static pthread_cond_t _monitor_cond;
 
-/* Allocate/free the status structure for a monitoring thread. */
+/* Allocate/free the status structure for a monitored device. */
 static struct thread_status *_alloc_thread_status(struct message_data *data,
 						  struct dso_data *dso_data)
 {
@@ -230,13 +259,14 @@ static struct thread_status *_alloc_thread_status(struct message_data *data,
 		return NULL;
 	}
 
-	ret->current_task = NULL;
 	ret->device.name = NULL;
 	ret->device.major = ret->device.minor = 0;
 	ret->dso_data = dso_data;
 	ret->events = data->events.field;
 	ret->timeout = data->timeout.secs;
-	dm_list_init(&ret->timeout_list);
+	dm_list_init(&ret->timer_list);
+	dm_list_init(&ret->queue_list);
+	dm_list_init(&ret->event_list);
 
 	return ret;
 }
@@ -245,8 +275,6 @@ static void _lib_put(struct dso_data *data);
 static void _free_thread_status(struct thread_status *thread)
 {
 	_lib_put(thread->dso_data);
-	if (thread->current_task)
-		dm_task_destroy(thread->current_task);
 	dm_free(thread->device.uuid);
 	dm_free(thread->device.name);
 	dm_free(thread);
@@ -265,10 +293,12 @@ static struct dso_data *_alloc_dso_data(struct message_data *data)
 		return NULL;
 	}
 
+	dm_list_init(&ret->event_queue);
+
 	return ret;
 }
 
-/* Create a device monitoring thread. */
+/* Create a monitor thread. */
 static int _pthread_create_smallstack(pthread_t *t, void *(*fun)(void *), void *arg)
 {
 	pthread_attr_t attr;
@@ -505,356 +535,433 @@ static void _exit_dm_lib(void)
 	dm_lib_exit();
 }
 
-static void _exit_timeout(void *unused __attribute__((unused)))
+/* Register a device with the DSO. */
+static int _do_register_device(struct thread_status *thread)
 {
-	_timeout_running = 0;
-	pthread_mutex_unlock(&_timeout_mutex);
+	return thread->dso_data->register_device(thread->device.name,
+						 thread->device.uuid,
+						 thread->device.major,
+						 thread->device.minor,
+						 &(thread->dso_private));
 }
 
-/* Wake up monitor threads every so often. */
-static void *_timeout_thread(void *unused __attribute__((unused)))
+/* Unregister a device with the DSO. */
+static int _do_unregister_device(struct thread_status *thread)
 {
-	struct timespec timeout;
-	time_t curr_time;
+	return thread->dso_data->unregister_device(thread->device.name,
+						   thread->device.uuid,
+						   thread->device.major,
+						   thread->device.minor,
+						   &(thread->dso_private));
+}
 
-	timeout.tv_nsec = 0;
-	pthread_cleanup_push(_exit_timeout, NULL);
-	pthread_mutex_lock(&_timeout_mutex);
+/* Process an event in the DSO. */
+static void _do_process_event(struct thread_status *thread, struct dm_task *task)
+{
+	thread->dso_data->process_event(task, thread->current_events, &(thread->dso_private));
+}
 
-	while (!dm_list_empty(&_timeout_registry)) {
-		struct thread_status *thread;
+static int _get_device_info(struct thread_status *ts, struct dm_info *info)
+{
+	struct dm_task *dmt = dm_task_create(DM_DEVICE_INFO);
+	int r = 0;
 
-		timeout.tv_sec = 0;
-		curr_time = time(NULL);
+	if (!dmt)
+		return 0;
 
-		dm_list_iterate_items_gen(thread, &_timeout_registry, timeout_list) {
-			if (thread->next_time <= curr_time) {
-				thread->next_time = curr_time + thread->timeout;
-				pthread_kill(thread->thread, SIGALRM);
-			}
+	if (dm_task_set_uuid(dmt, ts->device.uuid) &&
+	    dm_task_run(dmt) &&
+	    dm_task_get_info(dmt, info))
+		r = 1;
 
-			if (thread->next_time < timeout.tv_sec || !timeout.tv_sec)
-				timeout.tv_sec = thread->next_time;
-		}
+	dm_task_destroy(dmt);
 
-		pthread_cond_timedwait(&_timeout_cond, &_timeout_mutex,
-				       &timeout);
+	return r;
+}
+
+static struct dm_task *_get_device_status(struct thread_status *ts)
+{
+	struct dm_task *dmt = dm_task_create(DM_DEVICE_STATUS);
+
+	if (!dmt)
+		return NULL;
+
+	if (!dm_task_set_uuid(dmt, ts->device.uuid)) {
+		dm_task_destroy(dmt);
+		return NULL;
 	}
 
-	pthread_cleanup_pop(1);
+	if (!dm_task_run(dmt)) {
+		dm_task_destroy(dmt);
+		return NULL;
+	}
 
-	return NULL;
+	return dmt;
 }
 
-static int _register_for_timeout(struct thread_status *thread)
+/*
+ * Timers and the monitor condition use CLOCK_MONOTONIC where available,
+ * so they are not upset by time warps.
+ */
+static uint64_t _now_ms(void)
 {
-	int ret = 0;
+#ifdef HAVE_REALTIME
+	struct timespec ts;
 
-	pthread_mutex_lock(&_timeout_mutex);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	thread->next_time = time(NULL) + thread->timeout;
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+	struct timeval tv;
 
-	if (dm_list_empty(&thread->timeout_list)) {
-		dm_list_add(&_timeout_registry, &thread->timeout_list);
-		if (_timeout_running)
-			pthread_cond_signal(&_timeout_cond);
-	}
+	gettimeofday(&tv, NULL);
 
-	if (!_timeout_running) {
-		pthread_t timeout_id;
+	return (uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
+}
+
+/* Random delay below range_ms.  Mutex must be held. */
+static uint64_t _jitter(uint64_t range_ms)
+{
+	return range_ms ? (uint64_t) random() % range_ms : 0;
+}
 
-		if (!(ret = -_pthread_create_smallstack(&timeout_id, _timeout_thread, NULL)))
-			_timeout_running = 1;
+static void _unlink_list(struct dm_list *l)
+{
+	if (!dm_list_empty(l)) {
+		dm_list_del(l);
+		dm_list_init(l);
 	}
+}
+
+/*
+ * Set the timer for the next check of a device: after about an
+ * interval, or when its timeout expires if that is sooner.
+ *
+ * Mutex must be held when calling this.
+ */
+static void _arm_thread(struct thread_status *thread)
+{
+	uint64_t due = _now_ms() + MONITOR_INTERVAL_MS - MONITOR_JITTER_MS +
+		       _jitter(2 * MONITOR_JITTER_MS);
 
-	pthread_mutex_unlock(&_timeout_mutex);
+	if ((thread->events & DM_EVENT_TIMEOUT) && thread->next_time < due)
+		due = thread->next_time;
 
-	return ret;
+	_unlink_list(&thread->timer_list);
+
+	if ((thread->due_tick = due / WHEEL_TICK_MS) <= _wheel_tick)
+		thread->due_tick = _wheel_tick + 1;
+
+	dm_list_add(&_wheel[thread->due_tick % WHEEL_SLOTS], &thread->timer_list);
 }
 
-static void _unregister_for_timeout(struct thread_status *thread)
+/*
+ * Queue a device for the monitor threads unless one has it already.
+ *
+ * Mutex must be held when calling this.
+ */
+static void _queue_thread(struct thread_status *thread)
 {
-	pthread_mutex_lock(&_timeout_mutex);
-	if (!dm_list_empty(&thread->timeout_list)) {
-		dm_list_del(&thread->timeout_list);
-		dm_list_init(&thread->timeout_list);
-	}
-	pthread_mutex_unlock(&_timeout_mutex);
+	_unlink_list(&thread->timer_list);
+
+	if (thread->status == DM_THREAD_RUNNING && !thread->processing &&
+	    dm_list_empty(&thread->queue_list))
+		dm_list_add(&_monitor_queue, &thread->queue_list);
 }
 
-__attribute__((format(printf, 4, 5)))
-static void _no_intr_log(int level, const char *file, int line,
-			const char *f, ...)
+/*
+ * Queue the devices whose timers expired by tick now.  A slot also
+ * holds timers for later turns of the wheel, which stay.  After a
+ * long stall, one turn is enough to find everything that expired.
+ *
+ * Mutex must be held when calling this.
+ */
+static int _expire_timers(uint64_t now)
 {
-	va_list ap;
+	struct thread_status *thread, *tmp;
+	struct dm_list *slot;
+	unsigned n;
+	int r = 0;
 
-	if (errno == EINTR)
-		return;
-	if (level > _LOG_WARN)
-		return;
+	for (n = 0; _wheel_tick < now && n < WHEEL_SLOTS; n++) {
+		slot = &_wheel[++_wheel_tick % WHEEL_SLOTS];
+		dm_list_iterate_items_gen_safe(thread, tmp, slot, timer_list)
+			if (thread->due_tick <= now) {
+				_queue_thread(thread);
+				r = 1;
+			}
+	}
 
-	va_start(ap, f);
+	if (_wheel_tick < now)
+		_wheel_tick = now;
 
-	if (level < _LOG_WARN)
-		vfprintf(stderr, f, ap);
-	else
-		vprintf(f, ap);
+	return r;
+}
 
-	va_end(ap);
+/*
+ * First tick with any timer in its slot, so idle monitor threads only
+ * wake up when something may be due.
+ *
+ * Mutex must be held when calling this.
+ */
+static uint64_t _next_timer_tick(void)
+{
+	uint64_t tick;
 
-	if (level < _LOG_WARN)
-		fprintf(stderr, "\n");
-	else
-		fprintf(stdout, "\n");
+	for (tick = _wheel_tick + 1; tick < _wheel_tick + WHEEL_SLOTS; tick++)
+		if (!dm_list_empty(&_wheel[tick % WHEEL_SLOTS]))
+			break;
+
+	return tick;
 }
 
-static sigset_t _unblock_sigalrm(void)
+/*
+ * Move a device over to the unused list for _cleanup_unused_threads().
+ *
+ * Mutex must be held when calling this.
+ */
+static void _retire_thread(struct thread_status *thread)
 {
-	sigset_t set, old;
+	thread->status = DM_THREAD_SHUTDOWN;
+	UNLINK_THREAD(thread);
+	LINK(thread, &_thread_registry_unused);
 
-	sigemptyset(&set);
-	sigaddset(&set, SIGALRM);
-	pthread_sigmask(SIG_UNBLOCK, &set, &old);
-	return old;
+	_unlink_list(&thread->timer_list);
+	_unlink_list(&thread->queue_list);
 }
 
-#define DM_WAIT_RETRY 0
-#define DM_WAIT_INTR 1
-#define DM_WAIT_FATAL 2
-
-/* Wait on a device until an event occurs. */
-static int _event_wait(struct thread_status *thread, struct dm_task **task)
+/*
+ * Check a device for events.  Returns the device status to hand to the
+ * DSO with them, or NULL if there are none.
+ */
+static struct dm_task *_monitor_device(struct thread_status *thread)
 {
-	sigset_t set;
-	int ret = DM_WAIT_RETRY;
-	struct dm_task *dmt;
 	struct dm_info info;
+	uint64_t now = _now_ms();
 
-	*task = 0;
-
-	if (!(dmt = dm_task_create(DM_DEVICE_WAITEVENT)))
-		return DM_WAIT_RETRY;
+	thread->current_events = 0;
 
-	thread->current_task = dmt;
+	/* Retried on the next pass */
+	if (!_get_device_info(thread, &info))
+		return NULL;
 
-	if (!dm_task_set_uuid(dmt, thread->device.uuid) ||
-	    !dm_task_set_event_nr(dmt, thread->event_nr))
-		goto out;
+	if (!info.exists) {
+		syslog(LOG_ERR, "%s disappeared, detaching",
+		       thread->device.name);
+		_lock_mutex();
+		if (thread->status == DM_THREAD_RUNNING)
+			_retire_thread(thread);
+		_unlock_mutex();
+		return NULL;
+	}
 
 	/*
-	 * This is so that you can break out of waiting on an event,
-	 * either for a timeout event, or to cancel the thread.
+	 * The event number starts at 0, so a device with past events
+	 * is processed as soon as it is registered, as when waiting.
 	 */
-	set = _unblock_sigalrm();
-	dm_log_init(_no_intr_log);
-	errno = 0;
-	if (dm_task_run(dmt)) {
+	if (info.event_nr != thread->event_nr) {
+		thread->event_nr = info.event_nr;
 		thread->current_events |= DM_EVENT_DEVICE_ERROR;
-		ret = DM_WAIT_INTR;
+	}
 
-		if ((ret = dm_task_get_info(dmt, &info)))
-			thread->event_nr = info.event_nr;
-	} else if (thread->events & DM_EVENT_TIMEOUT && errno == EINTR) {
+	/* Keep the phase given at registration unless far behind */
+	if ((thread->events & DM_EVENT_TIMEOUT) && now >= thread->next_time) {
+		thread->next_time += thread->timeout * 1000ULL;
+		if (thread->next_time <= now)
+			thread->next_time = now + thread->timeout * 1000ULL;
 		thread->current_events |= DM_EVENT_TIMEOUT;
-		ret = DM_WAIT_INTR;
-	} else if (thread->status == DM_THREAD_SHUTDOWN && errno == EINTR) {
-		ret = DM_WAIT_FATAL;
-	} else {
-		syslog(LOG_NOTICE, "dm_task_run failed, errno = %d, %s",
-		       errno, strerror(errno));
-		if (errno == ENXIO) {
-			syslog(LOG_ERR, "%s disappeared, detaching",
-			       thread->device.name);
-			ret = DM_WAIT_FATAL;
-		}
 	}
 
-	pthread_sigmask(SIG_SETMASK, &set, NULL);
-	dm_log_init(NULL);
-
-      out:
-	if (ret == DM_WAIT_FATAL || ret == DM_WAIT_RETRY) {
-		dm_task_destroy(dmt);
-		thread->current_task = NULL;
-	} else
-		*task = dmt;
+	/*
+	 * Check against filter.
+	 *
+	 * If there's current events AND the device got registered for
+	 * those events, they go to the DSO's process_event() handler.
+	 */
+	if (!(thread->events & thread->current_events))
+		return NULL;
 
-	return ret;
+	/* FIXME: syslog fail here ? */
+	return _get_device_status(thread);
 }
 
-/* Register a device with the DSO. */
-static int _do_register_device(struct thread_status *thread)
+/*
+ * Event thread of a DSO.  Exits once its event queue is empty, so it
+ * never touches the DSO after the last device holding it was processed.
+ */
+static void *_event_thread(void *arg)
 {
-	return thread->dso_data->register_device(thread->device.name,
-						 thread->device.uuid,
-						 thread->device.major,
-						 thread->device.minor,
-						 &(thread->dso_private));
-}
+	struct dso_data *dso_data = arg;
+	struct thread_status *thread;
+	struct dm_task *task;
 
-/* Unregister a device with the DSO. */
-static int _do_unregister_device(struct thread_status *thread)
-{
-	return thread->dso_data->unregister_device(thread->device.name,
-						   thread->device.uuid,
-						   thread->device.major,
-						   thread->device.minor,
-						   &(thread->dso_private));
-}
+	_lock_mutex();
 
-/* Process an event in the DSO. */
-static void _do_process_event(struct thread_status *thread, struct dm_task *task)
-{
-	thread->dso_data->process_event(task, thread->current_events, &(thread->dso_private));
-}
+	while (!dm_list_empty(&dso_data->event_queue)) {
+		thread = dm_list_struct_base(dm_list_first(&dso_data->event_queue),
+					     struct thread_status, event_list);
+		dm_list_del(&thread->event_list);
+		dm_list_init(&thread->event_list);
+		task = thread->event_task;
+		thread->event_task = NULL;
 
-/* Thread cleanup handler to unregister device. */
-static void _monitor_unregister(void *arg)
-{
-	struct thread_status *thread = arg, *thread_iter;
+		/* Unregistered meanwhile */
+		if (thread->status == DM_THREAD_RUNNING) {
+			_unlock_mutex();
+			_do_process_event(thread, task);
+			_lock_mutex();
+		}
 
-	if (!_do_unregister_device(thread))
-		syslog(LOG_ERR, "%s: %s unregister failed\n", __func__,
-		       thread->device.name);
-	if (thread->current_task)
-		dm_task_destroy(thread->current_task);
-	thread->current_task = NULL;
+		dm_task_destroy(task);
 
-	_lock_mutex();
-	if (thread->events & DM_EVENT_TIMEOUT) {
-		/* _unregister_for_timeout locks another mutex, we
-		   don't want to deadlock so we release our mutex for
-		   a bit */
-		_unlock_mutex();
-		_unregister_for_timeout(thread);
-		_lock_mutex();
+		thread->processing = 0;
+		if (thread->status == DM_THREAD_RUNNING)
+			_arm_thread(thread);
 	}
-	/* we may have been relinked to unused registry since we were
-	   called, so check that */
-	dm_list_iterate_items(thread_iter, &_thread_registry_unused)
-		if (thread_iter == thread) {
-			thread->status = DM_THREAD_DONE;
-			_unlock_mutex();
-			return;
-		}
-	thread->status = DM_THREAD_DONE;
-	pthread_mutex_lock(&_timeout_mutex);
-	UNLINK_THREAD(thread);
-	LINK(thread, &_thread_registry_unused);
-	pthread_mutex_unlock(&_timeout_mutex);
+
+	dso_data->event_thread = 0;
 	_unlock_mutex();
+
+	return NULL;
 }
 
-static struct dm_task *_get_device_status(struct thread_status *ts)
+/*
+ * Queue a device with events for its DSO, starting an event thread for
+ * that DSO if none is running.  Returns 0 if no thread could be started,
+ * leaving the caller to process the event.
+ *
+ * Mutex must be held when calling this.
+ */
+static int _queue_event(struct thread_status *thread, struct dm_task *task)
 {
-	struct dm_task *dmt = dm_task_create(DM_DEVICE_STATUS);
-
-	if (!dmt)
-		return NULL;
+	struct dso_data *dso_data = thread->dso_data;
+	pthread_t event_thread;
+	int ret;
 
-	if (!dm_task_set_uuid(dmt, ts->device.uuid)) {
-		dm_task_destroy(dmt);
-		return NULL;
+	if (!dso_data->event_thread) {
+		if ((ret = _pthread_create_smallstack(&event_thread, _event_thread,
+						      dso_data))) {
+			syslog(LOG_WARNING, "Failed to start event thread for %s: %s",
+			       dso_data->dso_name, strerror(ret));
+			return 0;
+		}
+		pthread_detach(event_thread);
+		dso_data->event_thread = 1;
 	}
 
-	if (!dm_task_run(dmt)) {
-		dm_task_destroy(dmt);
-		return NULL;
-	}
+	thread->event_task = task;
+	dm_list_add(&dso_data->event_queue, &thread->event_list);
 
-	return dmt;
+	return 1;
 }
 
-/* Device monitoring thread. */
-static void *_monitor_thread(void *arg)
+/*
+ * Monitor thread.
+ *
+ * Whichever thread wakes up first queues the devices with expired
+ * timers; then all threads take devices off the queue until it is
+ * empty, setting their timers again when done with them, or passing
+ * them to their DSO's event thread if they had events.
+ */
+static void *_monitor_thread(void *unused __attribute__((unused)))
 {
-	struct thread_status *thread = arg;
-	int wait_error = 0;
+	struct thread_status *thread;
 	struct dm_task *task;
+	struct timespec timeout;
+	uint64_t wake;
 
-	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
-	pthread_cleanup_push(_monitor_unregister, thread);
-
-	/* Wait for do_process_request() to finish its task. */
 	_lock_mutex();
-	thread->status = DM_THREAD_RUNNING;
-	_unlock_mutex();
 
-	/* Loop forever awaiting/analyzing device events. */
 	while (1) {
-		thread->current_events = 0;
-
-		wait_error = _event_wait(thread, &task);
-		if (wait_error == DM_WAIT_RETRY)
+		if (_expire_timers(_now_ms() / WHEEL_TICK_MS))
+			pthread_cond_broadcast(&_monitor_cond);
+
+		if (dm_list_empty(&_monitor_queue)) {
+			wake = _next_timer_tick() * WHEEL_TICK_MS;
+			timeout.tv_sec = wake / 1000;
+			timeout.tv_nsec = (wake % 1000) * 1000000;
+			pthread_cond_timedwait(&_monitor_cond, &_global_mutex,
+					       &timeout);
 			continue;
-
-		if (wait_error == DM_WAIT_FATAL)
-			break;
-
-		/* Timeout occurred, task is not filled properly.
-		 * We get device status here for processing it in DSO.
-		 */
-		if (wait_error == DM_WAIT_INTR &&
-		    thread->current_events & DM_EVENT_TIMEOUT) {
-			dm_task_destroy(task);
-			task = _get_device_status(thread);
-			/* FIXME: syslog fail here ? */
-			if (!(thread->current_task = task))
-				continue;
 		}
 
-		/*
-		 * We know that wait succeeded and stored a
-		 * pointer to dm_task with device status into task.
-		 */
-
-		/*
-		 * Check against filter.
-		 *
-		 * If there's current events delivered from _event_wait() AND
-		 * the device got registered for those events AND
-		 * those events haven't been processed yet, call
-		 * the DSO's process_event() handler.
-		 */
-		_lock_mutex();
-		if (thread->status == DM_THREAD_SHUTDOWN) {
-			_unlock_mutex();
-			break;
-		}
+		thread = dm_list_struct_base(dm_list_first(&_monitor_queue),
+					     struct thread_status, queue_list);
+		dm_list_del(&thread->queue_list);
+		dm_list_init(&thread->queue_list);
+		thread->processing = 1;
 		_unlock_mutex();
 
-		if (thread->events & thread->current_events) {
-			_lock_mutex();
-			thread->processing = 1;
-			_unlock_mutex();
+		task = _monitor_device(thread);
 
-			_do_process_event(thread, task);
+		_lock_mutex();
+		if (!task)
+			;
+		else if (thread->status != DM_THREAD_RUNNING)
 			dm_task_destroy(task);
-			thread->current_task = NULL;
-
-			_lock_mutex();
-			thread->processing = 0;
+		else if (_queue_event(thread, task))
+			continue;	/* The event thread sets the timer */
+		else {
 			_unlock_mutex();
-		} else {
+			_do_process_event(thread, task);
 			dm_task_destroy(task);
-			thread->current_task = NULL;
+			_lock_mutex();
 		}
-	}
 
-	pthread_cleanup_pop(1);
+		thread->processing = 0;
+		if (thread->status == DM_THREAD_RUNNING)
+			_arm_thread(thread);
+	}
 
 	return NULL;
 }
 
-/* Create a device monitoring thread. */
-static int _create_thread(struct thread_status *thread)
+static void _init_monitor(void)
 {
-	return _pthread_create_smallstack(&thread->thread, _monitor_thread, thread);
+	pthread_condattr_t attr;
+	unsigned i;
+
+	for (i = 0; i < WHEEL_SLOTS; i++)
+		dm_list_init(&_wheel[i]);
+	_wheel_tick = _now_ms() / WHEEL_TICK_MS;
+
+	pthread_condattr_init(&attr);
+#ifdef HAVE_REALTIME
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+	pthread_cond_init(&_monitor_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	srandom((unsigned) (getpid() ^ _now_ms()));
 }
 
-static int _terminate_thread(struct thread_status *thread)
+/*
+ * Start the monitor threads.
+ *
+ * Mutex must be held when calling this.
+ */
+static int _start_monitor_threads(void)
 {
-	return pthread_kill(thread->thread, SIGALRM);
+	pthread_t thread;
+	int i, ret = 0;
+
+	for (i = _monitor_running; i < MONITOR_THREADS; i++) {
+		if ((ret = _pthread_create_smallstack(&thread, _monitor_thread, NULL)))
+			break;
+		pthread_detach(thread);
+		_monitor_running++;
+	}
+
+	/* Carry on with fewer threads */
+	if (_monitor_running) {
+		if (ret)
+			syslog(LOG_WARNING, "Started only %d of %d monitor threads: %s",
+			       _monitor_running, MONITOR_THREADS, strerror(ret));
+		return 0;
+	}
+
+	return ret;
 }
 
 /* DSO reference counting. Call with _global_mutex locked! */
@@ -964,6 +1071,7 @@ static int _register_for_event(struct message_data *message_data)
 	int ret = 0;
 	struct thread_status *thread, *thread_new = NULL;
 	struct dso_data *dso_data;
+	enum dm_event_mask old_events = 0;
 
 	if (!(dso_data = _lookup_dso(message_data)) &&
 	    !(dso_data = _load_dso(message_data))) {
@@ -991,19 +1099,17 @@ static int _register_for_event(struct message_data *message_data)
 
 	_lock_mutex();
 
-	/* If creation of timeout thread fails (as it may), we fail
-	   here completely. The client is responsible for either
-	   retrying later or trying to register without timeout
-	   events. However, if timeout thread cannot be started, it
+	/* If creation of monitor threads fails (as it may), we fail
+	   here completely. The client is responsible for retrying
+	   later. However, if no monitor thread can be started, it
 	   usually means we are so starved on resources that we are
 	   almost as good as dead already... */
-	if (thread_new->events & DM_EVENT_TIMEOUT) {
-		ret = -_register_for_timeout(thread_new);
-		if (ret)
-			goto outth;
-	}
+	if ((ret = -_start_monitor_threads()))
+		goto outth;
 
-	if (!(thread = _lookup_thread_status(message_data))) {
+	if ((thread = _lookup_thread_status(message_data)))
+		old_events = thread->events;
+	else {
 		_unlock_mutex();
 
 		if (!(ret = _do_register_device(thread_new)))
@@ -1012,20 +1118,23 @@ static int _register_for_event(struct message_data *message_data)
 		thread = thread_new;
 		thread_new = NULL;
 
-		/* Try to create the monitoring thread for this device. */
 		_lock_mutex();
-		if ((ret = -_create_thread(thread))) {
-			_unlock_mutex();
-			_do_unregister_device(thread);
-			_free_thread_status(thread);
-			goto out;
-		} else
-			LINK_THREAD(thread);
+		LINK_THREAD(thread);
 	}
 
+	/* Stagger the first timeout across a whole period */
+	if ((message_data->events.field & DM_EVENT_TIMEOUT) &&
+	    !(old_events & DM_EVENT_TIMEOUT))
+		thread->next_time = _now_ms() + thread->timeout * 1000ULL -
+				    _jitter(thread->timeout * 1000ULL);
+
 	/* Or event # into events bitfield. */
 	thread->events |= message_data->events.field;
 
+	/* Check it straight away rather than at the next pass */
+	_queue_thread(thread);
+	pthread_cond_signal(&_monitor_cond);
+
     outth:
 	_unlock_mutex();
 
@@ -1062,27 +1171,14 @@ static int _unregister_for_event(struct message_data *message_data)
 		goto out;
 	}
 
-	if (thread->status == DM_THREAD_DONE) {
-		/* the thread has terminated while we were not
-		   watching */
-		_unlock_mutex();
-		return 0;
-	}
-
 	thread->events &= ~message_data->events.field;
 
-	if (!(thread->events & DM_EVENT_TIMEOUT))
-		_unregister_for_timeout(thread);
 	/*
 	 * In case there's no events to monitor on this device ->
-	 * unlink and terminate its monitoring thread.
+	 * unlink it, to be unregistered with its DSO by the main loop.
 	 */
-	if (!thread->events) {
-		pthread_mutex_lock(&_timeout_mutex);
-		UNLINK_THREAD(thread);
-		LINK(thread, &_thread_registry_unused);
-		pthread_mutex_unlock(&_timeout_mutex);
-	}
+	if (!thread->events)
+		_retire_thread(thread);
 	_unlock_mutex();
 
       out:
@@ -1511,10 +1607,8 @@ static void _process_initial_registrations(void)
 
 static void _cleanup_unused_threads(void)
 {
-	int ret;
 	struct dm_list *l;
 	struct thread_status *thread;
-	int join_ret = 0;
 
 	_lock_mutex();
 	while ((l = dm_list_first(&_thread_registry_unused))) {
@@ -1522,61 +1616,25 @@ static void _cleanup_unused_threads(void)
 		if (thread->processing)
 			break;	/* cleanup on the next round */
 
-		if (thread->status == DM_THREAD_RUNNING) {
-			thread->status = DM_THREAD_SHUTDOWN;
-			break;
-		}
-
-		if (thread->status == DM_THREAD_SHUTDOWN) {
-			if (!thread->events) {
-				/* turn codes negative -- should we be returning this? */
-				ret = _terminate_thread(thread);
-
-				if (ret == ESRCH) {
-					thread->status = DM_THREAD_DONE;
-				} else if (ret) {
-					syslog(LOG_ERR,
-					       "Unable to terminate thread: %s\n",
-					       strerror(-ret));
-					stack;
-				}
-				break;
-			}
-
-			dm_list_del(l);
-			syslog(LOG_ERR,
-			       "thread can't be on unused list unless !thread->events");
-			thread->status = DM_THREAD_RUNNING;
-			LINK_THREAD(thread);
+		dm_list_del(l);
+		_unlock_mutex();
 
-			continue;
-		}
+		if (!_do_unregister_device(thread))
+			syslog(LOG_ERR, "%s: %s unregister failed\n", __func__,
+			       thread->device.name);
 
-		if (thread->status == DM_THREAD_DONE) {
-			dm_list_del(l);
-			join_ret = pthread_join(thread->thread, NULL);
-			_free_thread_status(thread);
-		}
+		_lock_mutex();
+		_free_thread_status(thread);
 	}
 
 	_unlock_mutex();
-
-	if (join_ret)
-		syslog(LOG_ERR, "Failed pthread_join: %s\n", strerror(join_ret));
-}
-
-static void _sig_alarm(int signum __attribute__((unused)))
-{
-	pthread_testcancel();
 }
 
 /* Init thread signal handling. */
 static void _init_thread_signals(void)
 {
 	sigset_t my_sigset;
-	struct sigaction act = { .sa_handler = _sig_alarm };
 
-	sigaction(SIGALRM, &act, NULL);
 	sigfillset(&my_sigset);
 
 	/* These are used for exiting */
@@ -1991,6 +2049,7 @@ int main(int argc, char *argv[])
 		_init_fifos(&fifos);
 
 	pthread_mutex_init(&_global_mutex, NULL);
+	_init_monitor();
 
 	if (!_systemd_activation && !_open_fifos(&fifos))
 		exit(EXIT_FIFO_FAILURE);
@@ -14,6 +14,7 @@
 
 #include "lib.h"
 #include "log.h"
+#include "config.h"
 
 #include "lvm2cmd.h"
 #include "dmeventd_lvm.h"
@@ -37,7 +38,10 @@ static struct dm_pool *_mem_pool = NULL;
 static void *_lvm_handle = NULL;
 
 /*
- * Currently only one event can be processed at a time.
+ * Currently only one event can be processed at a time.  The handle keeps
+ * the device cache between commands, but liblvm2cmd keeps that and its
+ * other caches in globals, so even commands for different VGs cannot run
+ * concurrently.
  */
 static pthread_mutex_t _event_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -141,11 +145,22 @@ struct dm_pool *dmeventd_lvm2_pool(void)
 	return _mem_pool;
 }
 
+/*
+ * FIXME Each action still parses its command line and reads the VG
+ * metadata again: taking the VG lock drops any cached copy, as nothing
+ * tells this process when another one has changed it.
+ */
 int dmeventd_lvm2_run(const char *cmdline)
 {
 	return lvm2_run(_lvm_handle, cmdline);
 }
 
+/* The configuration the next action will run with */
+int dmeventd_lvm2_config_int(const char *path, int fail)
+{
+	return find_config_tree_int((struct cmd_context *) _lvm_handle, path, fail);
+}
+
 int dmeventd_lvm2_command(struct dm_pool *mem, char *buffer, size_t size,
 			  const char *cmd, const char *device)
 {
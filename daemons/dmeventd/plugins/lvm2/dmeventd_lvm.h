@@ -30,6 +30,7 @@
 int dmeventd_lvm2_init(void);
 void dmeventd_lvm2_exit(void);
 int dmeventd_lvm2_run(const char *cmdline);
+int dmeventd_lvm2_config_int(const char *path, int fail);
 
 void dmeventd_lvm2_lock(void);
 void dmeventd_lvm2_unlock(void);
@@ -13,12 +13,14 @@
  */
 
 #include "lib.h"
+#include "defaults.h"
 
 #include "lvm2cmd.h"
 #include "errors.h"
 #include "libdevmapper-event.h"
 #include "dmeventd_lvm.h"
 
+#include <sys/time.h>
 #include <sys/wait.h>
 #include <syslog.h> /* FIXME Replace syslog with multilog */
 /* FIXME Missing openlog? */
@@ -29,6 +31,10 @@
 #define CHECK_STEP 5
 /* Do not bother checking thins less than 50% full. */
 #define CHECK_MINIMUM 50
+/* Extend ahead when the data is predicted to run out within a minute. */
+#define PREDICT_SECONDS 60
+/* And then by enough to hold the next five minutes of writes. */
+#define BATCH_SECONDS 300
 
 #define UMOUNT_COMMAND "/bin/umount"
 
@@ -40,7 +46,12 @@ struct dso_state {
 	int data_percent_check;
 	uint64_t known_metadata_size;
 	uint64_t known_data_size;
+	/* Fill rate of the data, from the usage seen last time */
+	uint64_t last_used_data_blocks;
+	uint64_t last_sample_ms;
+	double data_rate;		/* Blocks per second */
 	char cmd_str[1024];
+	char policy_str[1024];		/* Arguments for a batched extension */
 };
 
 
@@ -189,12 +200,89 @@ out:
 	return r;
 }
 
-static int _extend(struct dso_state *state)
+static uint64_t _now_ms(void)
 {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/*
+ * Follow how fast the data fills up, as a moving average of the rates
+ * seen between samples, so a single burst or discard does not dominate.
+ * Samples less than a second apart are merged with the next one.
+ */
+static void _update_rate(struct dso_state *state,
+			 const struct dm_status_thin_pool *tps)
+{
+	uint64_t now = _now_ms();
+	uint64_t elapsed = now - state->last_sample_ms;
+	double rate;
+
+	if (state->last_sample_ms && now >= state->last_sample_ms &&
+	    elapsed < 1000)
+		return;
+
+	/* Start again after the first sample or the clock jumped */
+	if (!state->last_sample_ms || now < state->last_sample_ms ||
+	    elapsed > 10 * BATCH_SECONDS * 1000) {
+		state->data_rate = 0;
+		goto out;
+	}
+
+	rate = (tps->used_data_blocks > state->last_used_data_blocks) ?
+		(tps->used_data_blocks - state->last_used_data_blocks) * 1000.0 / elapsed : 0;
+	state->data_rate = (state->data_rate + rate) / 2;
+out:
+	state->last_used_data_blocks = tps->used_data_blocks;
+	state->last_sample_ms = now;
+}
+
+/* Seconds until the data is full at the current rate, or -1 if never */
+static int64_t _eta(const struct dso_state *state,
+		    const struct dm_status_thin_pool *tps)
+{
+	if (state->data_rate < 0.01 ||
+	    tps->used_data_blocks >= tps->total_data_blocks)
+		return tps->used_data_blocks >= tps->total_data_blocks ? 0 : -1;
+
+	return (int64_t) ((tps->total_data_blocks - tps->used_data_blocks) /
+			  state->data_rate);
+}
+
+/*
+ * Whether lvextend --use-policies would extend the data now: only
+ * above the threshold, and not at all with a threshold of 100.
+ */
+static int _policy_extends(const struct dm_status_thin_pool *tps)
+{
+	int threshold = dmeventd_lvm2_config_int("activation/thin_pool_autoextend_threshold",
+						 DEFAULT_THIN_POOL_AUTOEXTEND_THRESHOLD);
+
+	return (threshold < 100 &&
+		tps->used_data_blocks * 100 > (uint64_t) threshold * tps->total_data_blocks);
+}
+
+/*
+ * With min_kb set, the extension covers at least that much, however
+ * little the policy would add.
+ */
+static int _extend(struct dso_state *state, uint64_t min_kb)
+{
+	char cmd_str[sizeof(state->cmd_str) + 32];
+
+	if (!min_kb)
+		strcpy(cmd_str, state->cmd_str);
+	else if (dm_snprintf(cmd_str, sizeof(cmd_str), "lvextend -L+%" PRIu64 "k %s",
+			     min_kb, state->policy_str) < 0)
+		return 0;
+
 #if THIN_DEBUG
-	syslog(LOG_INFO, "dmeventd executes: %s.\n", state->cmd_str);
+	syslog(LOG_INFO, "dmeventd executes: %s.\n", cmd_str);
 #endif
-	return (dmeventd_lvm2_run(state->cmd_str) == ECMD_PROCESSED);
+	return (dmeventd_lvm2_run(cmd_str) == ECMD_PROCESSED);
 }
 
 static int _run(const char *cmd, ...)
@@ -301,7 +389,9 @@ void process_event(struct dm_task *dmt,
 		   void **private)
 {
 	const char *device = dm_task_get_name(dmt);
-	int percent;
+	int percent, predicted;
+	int64_t eta;
+	uint64_t min_kb = 0;
 	struct dso_state *state = *private;
 	struct dm_status_thin_pool *tps = NULL;
 	void *next = NULL;
@@ -347,6 +437,9 @@ void process_event(struct dm_task *dmt,
 		state->known_data_size = tps->total_data_blocks;
 	}
 
+	_update_rate(state, tps);
+	eta = _eta(state, tps);
+
 	percent = 100 * tps->used_metadata_blocks / tps->total_metadata_blocks;
 	if (percent >= state->metadata_percent_check) {
 		/*
@@ -360,7 +453,7 @@ void process_event(struct dm_task *dmt,
 			syslog(LOG_WARNING, "Thin metadata %s is now %i%% full.\n",
 			       device, percent);
 		 /* Try to extend the metadata, in accord with user-set policies */
-		if (!_extend(state)) {
+		if (!_extend(state, 0)) {
 			syslog(LOG_ERR, "Failed to extend thin metadata %s.\n",
 			       device);
 			_umount(dmt, device);
@@ -369,17 +462,43 @@ void process_event(struct dm_task *dmt,
 	}
 
 	percent = 100 * tps->used_data_blocks / tps->total_data_blocks;
-	if (percent >= state->data_percent_check) {
+
+	/*
+	 * Filling up too fast to wait for the next step.  Extend ahead,
+	 * once the policy threshold lets lvextend --use-policies extend
+	 * anything.  This is tried again on each event for as long as the
+	 * prediction holds, as an extension that took effect changes it.
+	 */
+	predicted = (eta >= 0 && eta < PREDICT_SECONDS &&
+		     percent >= CHECK_MINIMUM &&
+		     percent < state->data_percent_check &&
+		     _policy_extends(tps));
+
+	if (predicted || percent >= state->data_percent_check) {
 		/*
 		 * Usage has raised more than CHECK_STEP since
 		 * the last time. Run actions.
 		 */
-		state->data_percent_check = (percent / CHECK_STEP) * CHECK_STEP + CHECK_STEP;
+		if (!predicted)
+			state->data_percent_check = (percent / CHECK_STEP) * CHECK_STEP + CHECK_STEP;
+
+		if (percent >= WARNING_THRESH || predicted) { /* Print a warning to syslog. */
+			if (eta >= 0)
+				syslog(LOG_WARNING, "Thin %s is now %i%% full, "
+				       "filling %.1f blocks/s, full in %" PRId64 "s.\n",
+				       device, percent, state->data_rate, eta);
+			else
+				syslog(LOG_WARNING, "Thin %s is now %i%% full.\n",
+				       device, percent);
+		}
+
+		/* Extend by at least what the next BATCH_SECONDS are likely to use */
+		if (eta >= 0 && length && tps->total_data_blocks)
+			min_kb = (uint64_t) (state->data_rate * BATCH_SECONDS *
+					     (length / tps->total_data_blocks)) / 2;
 
-		if (percent >= WARNING_THRESH) /* Print a warning to syslog. */
-			syslog(LOG_WARNING, "Thin %s is now %i%% full.\n", device, percent);
 		/* Try to extend the thin data, in accord with user-set policies */
-		if (!_extend(state)) {
+		if (!_extend(state, min_kb)) {
 			syslog(LOG_ERR, "Failed to extend thin %s.\n", device);
 			state->data_percent_check = 0;
 			_umount(dmt, device);
@@ -410,6 +529,10 @@ int register_device(const char *device,
 	    !dmeventd_lvm2_command(statemem, state->cmd_str,
 				   sizeof(state->cmd_str),
 				   "lvextend --use-policies",
+				   device) ||
+	    !dmeventd_lvm2_command(statemem, state->policy_str,
+				   sizeof(state->policy_str),
+				   "--use-policies",
 				   device)) {
 		if (statemem)
 			dm_pool_destroy(statemem);
@@ -20,18 +20,50 @@
 #include "daemon-server.h"
 #include "daemon-log.h"
 #include "lvm-version.h"
+#include "lib.h"
+#include "crc.h"
+#include "label.h"
+#include "format-text.h"
+#include "layout.h"
+#include "xlate.h"
 
 #include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <unistd.h>
 
+/*
+ * The maps below are guarded by reader/writer locks. Lookups only take them
+ * shared, so readers do not contend with each other, whichever VG they are
+ * after. VG metadata trees are never modified once stored: an update swaps
+ * a new tree in and destroys the old one once no reader can reach it.
+ *
+ * Where several locks are needed, take them in this order: the VG lock (see
+ * lock_vg), pvid_to_vgid, pvid_to_pvmeta, vgid_to_metadata. No thread holds
+ * more than one VG lock: the other VGs an update affects are checked after
+ * its locks are released (see remove_vgs_if_missing).
+ *
+ * Each lock counts how often it was taken and how often that had to wait.
+ */
+struct rwlock {
+	pthread_rwlock_t rw;
+	uint64_t reads, read_waits;
+	uint64_t writes, write_waits;
+};
+
 typedef struct {
 	log_state *log; /* convenience */
 	const char *log_config;
 
 	struct dm_hash_table *pvid_to_pvmeta;
 	struct dm_hash_table *device_to_pvid; /* shares locks with above */
+	struct dm_hash_table *device_unlabelled; /* likewise */
 
 	struct dm_hash_table *vgid_to_metadata;
 	struct dm_hash_table *vgid_to_vgname;
@@ -40,12 +72,26 @@ typedef struct {
 	struct {
 		struct dm_hash_table *vg;
 		pthread_mutex_t vg_lock_map;
-		pthread_mutex_t pvid_to_pvmeta;
-		pthread_mutex_t vgid_to_metadata;
-		pthread_mutex_t pvid_to_vgid;
+		uint64_t vg_locks, vg_waits;
+		struct rwlock pvid_to_pvmeta;
+		struct rwlock vgid_to_metadata;
+		struct rwlock pvid_to_vgid;
 	} lock;
 	char token[128];
 	pthread_mutex_t token_lock;
+	struct {
+		const char *path;	/* NULL if disabled */
+		uint64_t generation;	/* bumped by every update */
+		uint64_t saved;		/* generation last written out */
+		struct dm_config_tree *probe;	/* loaded, still to be checked */
+		char token[128];	/* of the loaded state, set once checked */
+		int probing;		/* requests wait until it is checked */
+		pthread_cond_t probed;
+		int stop;
+		pthread_t thread;
+		pthread_mutex_t lock;
+		pthread_cond_t wake;
+	} snapshot;
 } lvmetad_state;
 
 static void destroy_metadata_hashes(lvmetad_state *s)
@@ -75,6 +121,7 @@ static void destroy_metadata_hashes(lvmetad_state *s)
 	}
 
 	dm_hash_destroy(s->device_to_pvid);
+	dm_hash_destroy(s->device_unlabelled);
 	dm_hash_destroy(s->pvid_to_vgid);
 }
 
@@ -82,26 +129,56 @@ static void create_metadata_hashes(lvmetad_state *s)
 {
 	s->pvid_to_pvmeta = dm_hash_create(32);
 	s->device_to_pvid = dm_hash_create(32);
+	s->device_unlabelled = dm_hash_create(32);
 	s->vgid_to_metadata = dm_hash_create(32);
 	s->vgid_to_vgname = dm_hash_create(32);
 	s->pvid_to_vgid = dm_hash_create(32);
 	s->vgname_to_vgid = dm_hash_create(32);
 }
 
+static void count(uint64_t *counter)
+{
+	__sync_fetch_and_add(counter, 1);
+}
+
+static void read_lock(struct rwlock *l)
+{
+	count(&l->reads);
+	if (pthread_rwlock_tryrdlock(&l->rw)) {
+		count(&l->read_waits);
+		pthread_rwlock_rdlock(&l->rw);
+	}
+}
+
+static void write_lock(struct rwlock *l)
+{
+	count(&l->writes);
+	if (pthread_rwlock_trywrlock(&l->rw)) {
+		count(&l->write_waits);
+		pthread_rwlock_wrlock(&l->rw);
+	}
+}
+
 static void lock_pvid_to_pvmeta(lvmetad_state *s) {
-	pthread_mutex_lock(&s->lock.pvid_to_pvmeta); }
+	write_lock(&s->lock.pvid_to_pvmeta); }
+static void rdlock_pvid_to_pvmeta(lvmetad_state *s) {
+	read_lock(&s->lock.pvid_to_pvmeta); }
 static void unlock_pvid_to_pvmeta(lvmetad_state *s) {
-	pthread_mutex_unlock(&s->lock.pvid_to_pvmeta); }
+	pthread_rwlock_unlock(&s->lock.pvid_to_pvmeta.rw); }
 
 static void lock_vgid_to_metadata(lvmetad_state *s) {
-	pthread_mutex_lock(&s->lock.vgid_to_metadata); }
+	write_lock(&s->lock.vgid_to_metadata); }
+static void rdlock_vgid_to_metadata(lvmetad_state *s) {
+	read_lock(&s->lock.vgid_to_metadata); }
 static void unlock_vgid_to_metadata(lvmetad_state *s) {
-	pthread_mutex_unlock(&s->lock.vgid_to_metadata); }
+	pthread_rwlock_unlock(&s->lock.vgid_to_metadata.rw); }
 
 static void lock_pvid_to_vgid(lvmetad_state *s) {
-	pthread_mutex_lock(&s->lock.pvid_to_vgid); }
+	write_lock(&s->lock.pvid_to_vgid); }
+static void rdlock_pvid_to_vgid(lvmetad_state *s) {
+	read_lock(&s->lock.pvid_to_vgid); }
 static void unlock_pvid_to_vgid(lvmetad_state *s) {
-	pthread_mutex_unlock(&s->lock.pvid_to_vgid); }
+	pthread_rwlock_unlock(&s->lock.pvid_to_vgid.rw); }
 
 static response reply_fail(const char *reason)
 {
@@ -140,10 +217,14 @@ static struct dm_config_tree *lock_vg(lvmetad_state *s, const char *id) {
 	pthread_mutex_unlock(&s->lock.vg_lock_map);
 
 	DEBUGLOG(s, "locking VG %s", id);
-	pthread_mutex_lock(vg);
+	count(&s->lock.vg_locks);
+	if (pthread_mutex_trylock(vg)) {
+		count(&s->lock.vg_waits);
+		pthread_mutex_lock(vg);
+	}
 
 	/* Protect against structure changes of the vgid_to_metadata hash. */
-	lock_vgid_to_metadata(s);
+	rdlock_vgid_to_metadata(s);
 	cft = dm_hash_lookup(s->vgid_to_metadata, id);
 	unlock_vgid_to_metadata(s);
 	return cft;
@@ -204,8 +285,8 @@ static void merge_pvmeta(struct dm_config_node *pv, struct dm_config_node *pvmet
 	pvmeta->parent = pv;
 }
 
-/* Either the "big" vgs lock, or a per-vg lock needs to be held before entering
- * this function. */
+/* Either the vgid_to_metadata lock, or a per-vg lock needs to be held before
+ * entering this function, unless cft is a private copy. */
 static int update_pv_status(lvmetad_state *s,
 			    struct dm_config_tree *cft,
 			    struct dm_config_node *vg, int act)
@@ -215,7 +296,7 @@ static int update_pv_status(lvmetad_state *s,
 	const char *uuid;
 	struct dm_config_tree *pvmeta;
 
-	lock_pvid_to_pvmeta(s);
+	rdlock_pvid_to_pvmeta(s);
 
 	for (pv = pvs(vg); pv; pv = pv->sib) {
 		if (!(uuid = dm_config_find_str(pv->child, "id", NULL)))
@@ -243,6 +324,7 @@ static int update_pv_status(lvmetad_state *s,
 	return complete;
 }
 
+/* The pvid_to_vgid and pvid_to_pvmeta locks need to be held. */
 static struct dm_config_node *make_pv_node(lvmetad_state *s, const char *pvid,
 					   struct dm_config_tree *cft,
 					   struct dm_config_node *parent,
@@ -256,14 +338,19 @@ static struct dm_config_node *make_pv_node(lvmetad_state *s, const char *pvid,
 	if (!pvmeta)
 		return NULL;
 
+	/* The reply outlives the locks: copy the strings it refers to. */
 	if (vgid) {
-		lock_vgid_to_metadata(s); // XXX
-		vgname = dm_hash_lookup(s->vgid_to_vgname, vgid);
+		rdlock_vgid_to_metadata(s);
+		if ((vgname = dm_hash_lookup(s->vgid_to_vgname, vgid)))
+			vgname = dm_pool_strdup(dm_config_memory(cft), vgname);
 		unlock_vgid_to_metadata(s);
+		if (!vgname || !(vgid = dm_pool_strdup(dm_config_memory(cft), vgid)))
+			return 0;
 	}
 
 	/* Nick the pvmeta config tree. */
-	if (!(pv = dm_config_clone_node(cft, pvmeta->root, 0)))
+	if (!(pv = dm_config_clone_node(cft, pvmeta->root, 0)) ||
+	    !(pvid = dm_pool_strdup(dm_config_memory(cft), pvid)))
 		return 0;
 
 	if (pre_sib)
@@ -299,7 +386,8 @@ static response pv_list(lvmetad_state *s, request r)
 	res.cft->root = make_text_node(res.cft, "response", "OK", NULL, NULL);
 	cn_pvs = make_config_node(res.cft, "physical_volumes", NULL, res.cft->root);
 
-	lock_pvid_to_pvmeta(s);
+	rdlock_pvid_to_vgid(s);
+	rdlock_pvid_to_pvmeta(s);
 
 	for (n = dm_hash_get_first(s->pvid_to_pvmeta); n;
 	     n = dm_hash_get_next(s->pvid_to_pvmeta, n)) {
@@ -308,6 +396,7 @@ static response pv_list(lvmetad_state *s, request r)
 	}
 
 	unlock_pvid_to_pvmeta(s);
+	unlock_pvid_to_vgid(s);
 
 	return res;
 }
@@ -330,13 +419,15 @@ static response pv_lookup(lvmetad_state *s, request r)
 	if (!(res.cft->root = make_text_node(res.cft, "response", "OK", NULL, NULL)))
 		return reply_fail("out of memory");
 
-	lock_pvid_to_pvmeta(s);
+	rdlock_pvid_to_vgid(s);
+	rdlock_pvid_to_pvmeta(s);
 	if (!pvid && devt)
 		pvid = dm_hash_lookup_binary(s->device_to_pvid, &devt, sizeof(devt));
 
 	if (!pvid) {
 		WARN(s, "pv_lookup: could not find device %" PRIu64, devt);
 		unlock_pvid_to_pvmeta(s);
+		unlock_pvid_to_vgid(s);
 		dm_config_destroy(res.cft);
 		return reply_unknown("device not found");
 	}
@@ -344,12 +435,14 @@ static response pv_lookup(lvmetad_state *s, request r)
 	pv = make_pv_node(s, pvid, res.cft, NULL, res.cft->root);
 	if (!pv) {
 		unlock_pvid_to_pvmeta(s);
+		unlock_pvid_to_vgid(s);
 		dm_config_destroy(res.cft);
 		return reply_unknown("PV not found");
 	}
 
 	pv->key = "physical_volume";
 	unlock_pvid_to_pvmeta(s);
+	unlock_pvid_to_vgid(s);
 
 	return res;
 }
@@ -364,6 +457,8 @@ static response vg_list(lvmetad_state *s, request r)
 
 	buffer_init( &res.buffer );
 
+	rdlock_vgid_to_metadata(s);
+
 	if (!(res.cft = dm_config_create()))
                 goto bad; /* FIXME: better error reporting */
 
@@ -386,8 +481,6 @@ static response vg_list(lvmetad_state *s, request r)
 	cn->v = NULL;
 	cn->child = NULL;
 
-	lock_vgid_to_metadata(s);
-
 	n = dm_hash_get_first(s->vgid_to_vgname);
 	while (n) {
 		id = dm_hash_get_key(s->vgid_to_vgname, n),
@@ -412,7 +505,8 @@ static response vg_list(lvmetad_state *s, request r)
 			goto bad; /* FIXME */
 
 		cn->child->v->type = DM_CFG_STRING;
-		cn->child->v->v.str = name;
+		if (!(cn->child->v->v.str = dm_pool_strdup(dm_config_memory(res.cft), name)))
+			goto bad; /* FIXME */
 
 		if (!cn_vgs->child)
 			cn_vgs->child = cn;
@@ -421,8 +515,8 @@ static response vg_list(lvmetad_state *s, request r)
 		n = dm_hash_get_next(s->vgid_to_vgname, n);
 	}
 
-	unlock_vgid_to_metadata(s);
 bad:
+	unlock_vgid_to_metadata(s);
 	return res;
 }
 
@@ -439,23 +533,27 @@ static response vg_lookup(lvmetad_state *s, request r)
 
 	DEBUGLOG(s, "vg_lookup: uuid = %s, name = %s", uuid, name);
 
-	if (!uuid || !name) {
-		lock_vgid_to_metadata(s);
-		if (name && !uuid)
-			uuid = dm_hash_lookup(s->vgname_to_vgid, name);
-		if (uuid && !name)
-			name = dm_hash_lookup(s->vgid_to_vgname, uuid);
-		unlock_vgid_to_metadata(s);
-	}
+	/*
+	 * Readers do not take the VG lock: holding vgid_to_metadata shared is
+	 * enough to copy the current tree, which updates never modify.
+	 */
+	rdlock_vgid_to_metadata(s);
+
+	if (name && !uuid)
+		uuid = dm_hash_lookup(s->vgname_to_vgid, name);
+	if (uuid && !name)
+		name = dm_hash_lookup(s->vgid_to_vgname, uuid);
 
 	DEBUGLOG(s, "vg_lookup: updated uuid = %s, name = %s", uuid, name);
 
-	if (!uuid)
+	if (!uuid) {
+		unlock_vgid_to_metadata(s);
 		return reply_unknown("VG not found");
+	}
 
-	cft = lock_vg(s, uuid);
-	if (!cft || !cft->root) {
-		unlock_vg(s, uuid);
+	cft = dm_hash_lookup(s->vgid_to_metadata, uuid);
+	if (!cft || !cft->root || !name) {
+		unlock_vgid_to_metadata(s);
 		return reply_unknown("UUID not found");
 	}
 
@@ -467,7 +565,7 @@ static response vg_lookup(lvmetad_state *s, request r)
 	if (!(res.cft->root = n = dm_config_create_node(res.cft, "response")))
 		goto bad;
 
-	if (!(n->v = dm_config_create_value(cft)))
+	if (!(n->v = dm_config_create_value(res.cft)))
 		goto bad;
 
 	n->parent = res.cft->root;
@@ -482,20 +580,23 @@ static response vg_lookup(lvmetad_state *s, request r)
 
 	n->parent = res.cft->root;
 	n->v->type = DM_CFG_STRING;
-	n->v->v.str = name;
+	if (!(n->v->v.str = dm_pool_strdup(dm_config_memory(res.cft), name)))
+		goto bad;
 
 	/* The metadata section */
 	if (!(n = n->sib = dm_config_clone_node(res.cft, metadata, 1)))
 		goto bad;
 	n->parent = res.cft->root;
 	res.error = 0;
-	unlock_vg(s, uuid);
+	unlock_vgid_to_metadata(s);
 
 	update_pv_status(s, res.cft, n, 1); /* FIXME report errors */
 
 	return res;
 bad:
-	unlock_vg(s, uuid);
+	unlock_vgid_to_metadata(s);
+	if (res.cft)
+		dm_config_destroy(res.cft);
 	return reply_fail("out of memory");
 }
 
@@ -549,80 +650,107 @@ static int compare_config(struct dm_config_node *a, struct dm_config_node *b)
 
 static int vg_remove_if_missing(lvmetad_state *s, const char *vgid);
 
-/* You need to be holding the pvid_to_vgid lock already to call this. */
+/*
+ * You need to be holding the pvid_to_vgid lock already to call this. If
+ * moved_from is given, the VGs the PVs were in before are added to it, to
+ * be checked with remove_vgs_if_missing once the table locks are released.
+ */
 static int update_pvid_to_vgid(lvmetad_state *s, struct dm_config_tree *vg,
-			       const char *vgid, int nuke_empty)
+			       const char *vgid, struct dm_hash_table *moved_from)
 {
 	struct dm_config_node *pv;
-	struct dm_hash_table *to_check;
-	struct dm_hash_node *n;
 	const char *pvid;
 	const char *vgid_old;
-	const char *check_vgid;
-	int r = 0;
 
 	if (!vgid)
 		return 0;
 
-	if (!(to_check = dm_hash_create(32)))
-		return 0;
-
 	for (pv = pvs(vg->root); pv; pv = pv->sib) {
 		if (!(pvid = dm_config_find_str(pv->child, "id", NULL)))
 			continue;
 
-		if (nuke_empty &&
+		if (moved_from &&
 		    (vgid_old = dm_hash_lookup(s->pvid_to_vgid, pvid)) &&
-		    !dm_hash_insert(to_check, vgid_old, (void*) 1))
-			goto out;
+		    !dm_hash_insert(moved_from, vgid_old, (void*) 1))
+			return 0;
 
 		if (!dm_hash_insert(s->pvid_to_vgid, pvid, (void*) vgid))
-			goto out;
+			return 0;
 
 		DEBUGLOG(s, "moving PV %s to VG %s", pvid, vgid);
 	}
 
-	for (n = dm_hash_get_first(to_check); n;
-	     n = dm_hash_get_next(to_check, n)) {
-		check_vgid = dm_hash_get_key(to_check, n);
-		lock_vg(s, check_vgid);
-		vg_remove_if_missing(s, check_vgid);
-		unlock_vg(s, check_vgid);
+	return 1;
+}
+
+static int _compare_vgids(const void *a, const void *b)
+{
+	return strcmp(*(const char * const *) a, *(const char * const *) b);
+}
+
+/*
+ * Drop the VGs in the table that have no PV left. No locks may be held:
+ * each VG is locked in turn, in vgid order, before the table locks.
+ */
+static void remove_vgs_if_missing(lvmetad_state *s, struct dm_hash_table *vgids)
+{
+	struct dm_hash_node *n;
+	const char **sorted;
+	unsigned count = 0, i;
+
+	if (!(sorted = dm_malloc((dm_hash_get_num_entries(vgids) + 1) * sizeof(*sorted)))) {
+		ERROR(s, "Out of memory");
+		return;
 	}
 
-	r = 1;
-    out:
-	dm_hash_destroy(to_check);
+	dm_hash_iterate(n, vgids)
+		sorted[count++] = dm_hash_get_key(vgids, n);
 
-	return r;
+	qsort(sorted, count, sizeof(*sorted), _compare_vgids);
+
+	for (i = 0; i < count; i++) {
+		lock_vg(s, sorted[i]);
+		rdlock_pvid_to_vgid(s);
+		rdlock_pvid_to_pvmeta(s);
+		vg_remove_if_missing(s, sorted[i]);
+		unlock_pvid_to_pvmeta(s);
+		unlock_pvid_to_vgid(s);
+		unlock_vg(s, sorted[i]);
+	}
+
+	dm_free(sorted);
 }
 
-/* A pvid map lock needs to be held if update_pvids = 1. */
+/* The pvid_to_vgid lock needs to be held if update_pvids = 1. */
 static int remove_metadata(lvmetad_state *s, const char *vgid, int update_pvids)
 {
 	struct dm_config_tree *old;
 	const char *oldname;
-	lock_vgid_to_metadata(s);
-	old = dm_hash_lookup(s->vgid_to_metadata, vgid);
-	oldname = dm_hash_lookup(s->vgid_to_vgname, vgid);
-	unlock_vgid_to_metadata(s);
 
-	if (!old)
+	lock_vgid_to_metadata(s);
+	if (!(old = dm_hash_lookup(s->vgid_to_metadata, vgid))) {
+		unlock_vgid_to_metadata(s);
 		return 0;
+	}
+
+	oldname = dm_hash_lookup(s->vgid_to_vgname, vgid);
 	assert(oldname);
 
-	if (update_pvids)
-		/* FIXME: What should happen when update fails */
-		update_pvid_to_vgid(s, old, "#orphan", 0);
 	/* need to update what we have since we found a newer version */
 	dm_hash_remove(s->vgid_to_metadata, vgid);
 	dm_hash_remove(s->vgid_to_vgname, vgid);
 	dm_hash_remove(s->vgname_to_vgid, oldname);
+	unlock_vgid_to_metadata(s);
+
+	/* No reader can reach the old tree any more. */
+	if (update_pvids)
+		/* FIXME: What should happen when update fails */
+		update_pvid_to_vgid(s, old, "#orphan", NULL);
 	dm_config_destroy(old);
 	return 1;
 }
 
-/* The VG must be locked. */
+/* The VG must be locked, and so must pvid_to_pvmeta (shared is enough). */
 static int vg_remove_if_missing(lvmetad_state *s, const char *vgid)
 {
 	struct dm_config_tree *vg;
@@ -634,10 +762,12 @@ static int vg_remove_if_missing(lvmetad_state *s, const char *vgid)
 	if (!vgid)
 		return 0;
 
-	if (!(vg = dm_hash_lookup(s->vgid_to_metadata, vgid)))
+	rdlock_vgid_to_metadata(s);
+	if (!(vg = dm_hash_lookup(s->vgid_to_metadata, vgid))) {
+		unlock_vgid_to_metadata(s);
 		return 1;
+	}
 
-	lock_pvid_to_pvmeta(s);
 	for (pv = pvs(vg->root); pv; pv = pv->sib) {
 		if (!(pvid = dm_config_find_str(pv->child, "id", NULL)))
 			continue;
@@ -647,14 +777,13 @@ static int vg_remove_if_missing(lvmetad_state *s, const char *vgid)
 		    !strcmp(vgid, vgid_check))
 			missing = 0; /* at least one PV is around */
 	}
+	unlock_vgid_to_metadata(s);
 
 	if (missing) {
 		DEBUGLOG(s, "removing empty VG %s", vgid);
 		remove_metadata(s, vgid, 0);
 	}
 
-	unlock_pvid_to_pvmeta(s);
-
 	return 1;
 }
 
@@ -666,6 +795,7 @@ static int update_metadata(lvmetad_state *s, const char *name, const char *_vgid
 {
 	struct dm_config_tree *cft = NULL;
 	struct dm_config_tree *old;
+	struct dm_hash_table *moved_from;
 	int retval = 0;
 	int seq;
 	int haveseq = -1;
@@ -673,24 +803,24 @@ static int update_metadata(lvmetad_state *s, const char *name, const char *_vgid
 	const char *vgid;
 	char *cfgname;
 
-	lock_vgid_to_metadata(s);
-	old = dm_hash_lookup(s->vgid_to_metadata, _vgid);
+	/* The VGs PVs move out of, checked once no lock is held */
+	if (!(moved_from = dm_hash_create(32)))
+		return 0;
+
 	lock_vg(s, _vgid);
-	unlock_vgid_to_metadata(s);
 
 	seq = dm_config_find_int(metadata, "metadata/seqno", -1);
 
-	if (old) {
-		haveseq = dm_config_find_int(old->root, "metadata/seqno", -1);
-		oldname = dm_hash_lookup(s->vgid_to_vgname, _vgid);
-		assert(oldname);
-	}
-
 	if (seq < 0)
 		goto out;
 
 	filter_metadata(metadata); /* sanitize */
 
+	rdlock_vgid_to_metadata(s);
+
+	if ((old = dm_hash_lookup(s->vgid_to_metadata, _vgid)))
+		haveseq = dm_config_find_int(old->root, "metadata/seqno", -1);
+
 	if (oldseq) {
 		if (old)
 			*oldseq = haveseq;
@@ -708,9 +838,13 @@ static int update_metadata(lvmetad_state *s, const char *name, const char *_vgid
 			DEBUGLOG_cft(s, "OLD: ", old->root);
 			DEBUGLOG_cft(s, "NEW: ", metadata);
 		}
-		goto out;
 	}
 
+	unlock_vgid_to_metadata(s);
+
+	if (seq == haveseq)
+		goto out;
+
 	if (seq < haveseq) {
 		DEBUGLOG(s, "Refusing to update metadata for %s (at %d) to %d", _vgid, haveseq, seq);
 		/* TODO: notify the client that their metadata is out of date? */
@@ -733,30 +867,53 @@ static int update_metadata(lvmetad_state *s, const char *name, const char *_vgid
 
 	lock_pvid_to_vgid(s);
 
-	if (haveseq >= 0 && haveseq < seq) {
-		INFO(s, "Updating metadata for %s at %d to %d", _vgid, haveseq, seq);
-		/* temporarily orphan all of our PVs */
-		remove_metadata(s, vgid, 1);
-	}
-
+	/*
+	 * Swap the new tree in under one exclusive hold, so that readers see
+	 * either the old or the new VG, never neither.
+	 */
 	lock_vgid_to_metadata(s);
 	DEBUGLOG(s, "Mapping %s to %s", vgid, name);
 
+	if ((old = dm_hash_lookup(s->vgid_to_metadata, vgid))) {
+		oldname = dm_hash_lookup(s->vgid_to_vgname, vgid);
+		assert(oldname);
+		dm_hash_remove(s->vgname_to_vgid, oldname);
+	}
+
 	retval = ((cfgname = dm_pool_strdup(dm_config_memory(cft), name)) &&
 		  dm_hash_insert(s->vgid_to_metadata, vgid, cft) &&
 		  dm_hash_insert(s->vgid_to_vgname, vgid, cfgname) &&
 		  dm_hash_insert(s->vgname_to_vgid, name, (void*) vgid)) ? 1 : 0;
+
+	if (!retval) {
+		dm_hash_remove(s->vgid_to_metadata, vgid);
+		dm_hash_remove(s->vgid_to_vgname, vgid);
+		dm_hash_remove(s->vgname_to_vgid, name);
+	}
 	unlock_vgid_to_metadata(s);
 
-	if (retval)
+	if (old) {
+		INFO(s, "Updating metadata for %s at %d to %d", _vgid, haveseq, seq);
+		/* orphan all of the old PVs, the new VG claims its own below */
+		update_pvid_to_vgid(s, old, "#orphan", NULL);
+		dm_config_destroy(old);
+	}
+
+	if (retval) {
 		/* FIXME: What should happen when update fails */
-		retval = update_pvid_to_vgid(s, cft, vgid, 1);
+		retval = update_pvid_to_vgid(s, cft, vgid, moved_from);
+		cft = NULL; /* owned by the maps now */
+	}
 
 	unlock_pvid_to_vgid(s);
 out:
 	if (!retval && cft)
 		dm_config_destroy(cft);
 	unlock_vg(s, _vgid);
+
+	remove_vgs_if_missing(s, moved_from);
+	dm_hash_destroy(moved_from);
+
 	return retval;
 }
 
@@ -769,11 +926,19 @@ static response pv_gone(lvmetad_state *s, request r)
 
 	DEBUGLOG(s, "pv_gone: %s / %" PRIu64, pvid, device);
 
+	rdlock_pvid_to_vgid(s);
 	lock_pvid_to_pvmeta(s);
+
+	/* A client looked at the device and found no PV: see _snapshot_probe */
+	if (device > 0)
+		(void) dm_hash_insert_binary(s->device_unlabelled, &device,
+					     sizeof(device), (void *) 1);
+
 	if (!pvid && device > 0)
 		pvid = dm_hash_lookup_binary(s->device_to_pvid, &device, sizeof(device));
 	if (!pvid) {
 		unlock_pvid_to_pvmeta(s);
+		unlock_pvid_to_vgid(s);
 		return reply_unknown("device not in cache");
 	}
 
@@ -785,6 +950,7 @@ static response pv_gone(lvmetad_state *s, request r)
 	dm_hash_remove(s->pvid_to_pvmeta, pvid);
 	vg_remove_if_missing(s, dm_hash_lookup(s->pvid_to_vgid, pvid));
 	unlock_pvid_to_pvmeta(s);
+	unlock_pvid_to_vgid(s);
 
 	if (pvid_old)
 		dm_free(pvid_old);
@@ -800,16 +966,16 @@ static response pv_clear_all(lvmetad_state *s, request r)
 {
 	DEBUGLOG(s, "pv_clear_all");
 
+	lock_pvid_to_vgid(s);
 	lock_pvid_to_pvmeta(s);
 	lock_vgid_to_metadata(s);
-	lock_pvid_to_vgid(s);
 
 	destroy_metadata_hashes(s);
 	create_metadata_hashes(s);
 
-	unlock_pvid_to_vgid(s);
 	unlock_vgid_to_metadata(s);
 	unlock_pvid_to_pvmeta(s);
+	unlock_pvid_to_vgid(s);
 
 	return daemon_reply_simple("OK", NULL);
 }
@@ -843,6 +1009,7 @@ static response pv_found(lvmetad_state *s, request r)
 		dm_hash_remove(s->pvid_to_pvmeta, old);
 	}
 	pvmeta_old_pvid = dm_hash_lookup(s->pvid_to_pvmeta, pvid);
+	dm_hash_remove_binary(s->device_unlabelled, &device, sizeof(device));
 
 	DEBUGLOG(s, "pv_found %s, vgid = %s, device = %" PRIu64 ", old = %s", pvid, vgid, device, old);
 
@@ -879,7 +1046,7 @@ static response pv_found(lvmetad_state *s, request r)
 		if (!update_metadata(s, vgname, vgid, metadata, &seqno_old))
 			return reply_fail("metadata update failed");
 	} else {
-		lock_pvid_to_vgid(s);
+		rdlock_pvid_to_vgid(s);
 		vgid = dm_hash_lookup(s->pvid_to_vgid, pvid);
 		unlock_pvid_to_vgid(s);
 	}
@@ -927,7 +1094,7 @@ static response vg_update(lvmetad_state *s, request r)
 	return daemon_reply_simple("OK", NULL);
 }
 
-static response vg_remove(lvmetad_state *s, request r)
+static response vg_remove_request(lvmetad_state *s, request r)
 {
 	const char *vgid = daemon_request_str(r, "uuid", NULL);
 
@@ -981,6 +1148,42 @@ static void _dump_pairs(struct buffer *buf, struct dm_hash_table *ht, const char
 	buffer_append(buf, "}\n");
 }
 
+static void _dump_lock(struct buffer *buf, const char *name, struct rwlock *l)
+{
+	char *append;
+
+	if (dm_asprintf(&append, "    %s {\n"
+			"        reads = %" PRIu64 "\n"
+			"        read_waits = %" PRIu64 "\n"
+			"        writes = %" PRIu64 "\n"
+			"        write_waits = %" PRIu64 "\n"
+			"    }\n", name, l->reads, l->read_waits,
+			l->writes, l->write_waits) < 0)
+		return;
+
+	buffer_append(buf, append);
+	dm_free(append);
+}
+
+static void _dump_locks(struct buffer *buf, lvmetad_state *s)
+{
+	char *append;
+
+	buffer_append(buf, "locks {\n");
+	_dump_lock(buf, "pvid_to_vgid", &s->lock.pvid_to_vgid);
+	_dump_lock(buf, "pvid_to_pvmeta", &s->lock.pvid_to_pvmeta);
+	_dump_lock(buf, "vgid_to_metadata", &s->lock.vgid_to_metadata);
+
+	if (dm_asprintf(&append, "    vg {\n"
+			"        locks = %" PRIu64 "\n"
+			"        waits = %" PRIu64 "\n"
+			"    }\n", s->lock.vg_locks, s->lock.vg_waits) >= 0) {
+		buffer_append(buf, append);
+		dm_free(append);
+	}
+	buffer_append(buf, "}\n");
+}
+
 static response dump(lvmetad_state *s)
 {
 	response res;
@@ -990,9 +1193,9 @@ static response dump(lvmetad_state *s)
 
 	/* Lock everything so that we get a consistent dump. */
 
-	lock_vgid_to_metadata(s);
-	lock_pvid_to_pvmeta(s);
-	lock_pvid_to_vgid(s);
+	rdlock_pvid_to_vgid(s);
+	rdlock_pvid_to_pvmeta(s);
+	rdlock_vgid_to_metadata(s);
 
 	buffer_append(b, "# VG METADATA\n\n");
 	_dump_cft(b, s->vgid_to_metadata, "metadata/id");
@@ -1012,135 +1215,1071 @@ static response dump(lvmetad_state *s)
 	buffer_append(b, "\n# DEVICE to PVID mapping\n\n");
 	_dump_pairs(b, s->device_to_pvid, "device_to_pvid", 1);
 
-	unlock_pvid_to_vgid(s);
-	unlock_pvid_to_pvmeta(s);
+	buffer_append(b, "\n# LOCK CONTENTION\n\n");
+	_dump_locks(b, s);
+
 	unlock_vgid_to_metadata(s);
+	unlock_pvid_to_pvmeta(s);
+	unlock_pvid_to_vgid(s);
 
 	return res;
 }
 
-static response handler(daemon_state s, client_handle h, request r)
-{
-	lvmetad_state *state = s.private;
-	const char *rq = daemon_request_str(r, "request", "NONE");
-	const char *token = daemon_request_str(r, "token", "NONE");
+/*
+ * Snapshots
+ *
+ * While the cached state keeps changing, it is written out to a file every
+ * SNAPSHOT_INTERVAL seconds, and once more on exit, so that a restarted
+ * lvmetad can answer from a warm cache straight away rather than waiting
+ * for every device to be rescanned. The file uses the binary wire encoding
+ * and is replaced atomically by renaming a complete new copy over it.
+ *
+ * A snapshot is loaded if the set of block devices is the one it was taken
+ * with, which only needs sysfs, and if every field in it is sound. The
+ * snapshot thread then reads the devices in the background to check the
+ * PVs are still there, with their metadata areas holding the VG metadata
+ * versions cached, and that no PV appeared on a device clients had found
+ * empty. Devices no client ever reported on, e.g. ones their filter rejects
+ * such as multipath paths or md legs, are not read.
+ *
+ * Until the check is over the token stays unset and requests from clients
+ * with the saved token, i.e. the same filter, wait. A request with another
+ * token rejects the snapshot. Once the check passes, the saved token is
+ * restored and the waiting clients are served without rescanning. If it
+ * fails, the state is dropped and the token stays unset, so the next client
+ * rescans, as it would have to without a snapshot.
+ */
+#define SNAPSHOT_VERSION	2
+#define SNAPSHOT_INTERVAL	5	/* seconds */
+#define SYSFS_DEV_BLOCK		"/sys/dev/block"
 
-	pthread_mutex_lock(&state->token_lock);
-	if (!strcmp(rq, "token_update")) {
-		strncpy(state->token, token, 128);
-		state->token[127] = 0;
-		pthread_mutex_unlock(&state->token_lock);
-		return daemon_reply_simple("OK", NULL);
-	}
+static response changed(lvmetad_state *s, response res)
+{
+	count(&s->snapshot.generation);
+	return res;
+}
 
-	if (strcmp(token, state->token) && strcmp(rq, "dump")) {
-		pthread_mutex_unlock(&state->token_lock);
-		return daemon_reply_simple("token_mismatch",
-					   "expected = %s", state->token,
-					   "received = %s", token,
-					   "reason = %s", "token mismatch", NULL);
-	}
-	pthread_mutex_unlock(&state->token_lock);
+static int _compare_devices(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
 
-	/*
-	 * TODO Add a stats call, with transaction count/rate, time since last
-	 * update &c.
-	 */
-	if (!strcmp(rq, "pv_found"))
-		return pv_found(state, r);
+	return (x > y) - (x < y);
+}
 
-	if (!strcmp(rq, "pv_gone"))
-		return pv_gone(state, r);
+/*
+ * The sorted device numbers of all block devices, apart from device-mapper
+ * ones, which come and go as LVs are activated, unless with_dm is set.
+ */
+static uint64_t *_block_devices(unsigned *count, int with_dm)
+{
+	char path[PATH_MAX];
+	struct dirent *dirent;
+	uint64_t *devs = NULL, *tmp;
+	unsigned major, minor, size = 0;
+	DIR *d;
 
-	if (!strcmp(rq, "pv_clear_all"))
-		return pv_clear_all(state, r);
+	*count = 0;
 
-	if (!strcmp(rq, "pv_lookup"))
-		return pv_lookup(state, r);
+	if (!(d = opendir(SYSFS_DEV_BLOCK)))
+		return NULL;
 
-	if (!strcmp(rq, "vg_update"))
-		return vg_update(state, r);
+	while ((dirent = readdir(d))) {
+		if (sscanf(dirent->d_name, "%u:%u", &major, &minor) != 2)
+			continue;
 
-	if (!strcmp(rq, "vg_remove"))
-		return vg_remove(state, r);
+		if (dm_snprintf(path, sizeof(path), SYSFS_DEV_BLOCK "/%s/dm",
+				dirent->d_name) < 0 || (!with_dm && !access(path, F_OK)))
+			continue;
 
-	if (!strcmp(rq, "vg_lookup"))
-		return vg_lookup(state, r);
+		if (*count == size) {
+			size = size ? size * 2 : 64;
+			if (!(tmp = dm_realloc(devs, size * sizeof(*devs)))) {
+				dm_free(devs);
+				devs = NULL;
+				*count = 0;
+				break;
+			}
+			devs = tmp;
+		}
 
-	if (!strcmp(rq, "pv_list"))
-		return pv_list(state, r);
+		devs[(*count)++] = (uint64_t) makedev(major, minor);
+	}
 
-	if (!strcmp(rq, "vg_list"))
-		return vg_list(state, r);
+	(void) closedir(d);
 
-	if (!strcmp(rq, "dump"))
-		return dump(state);
+	if (devs)
+		qsort(devs, *count, sizeof(*devs), _compare_devices);
 
-	return reply_fail("request not implemented");
+	return devs;
 }
 
-static int init(daemon_state *s)
+static int _open_device(uint64_t device, char *path, size_t size)
 {
-	pthread_mutexattr_t rec;
-	lvmetad_state *ls = s->private;
-	ls->log = s->log;
-
-	pthread_mutexattr_init(&rec);
-	pthread_mutexattr_settype(&rec, PTHREAD_MUTEX_RECURSIVE_NP);
-	pthread_mutex_init(&ls->lock.pvid_to_pvmeta, &rec);
-	pthread_mutex_init(&ls->lock.vgid_to_metadata, &rec);
-	pthread_mutex_init(&ls->lock.pvid_to_vgid, NULL);
-	pthread_mutex_init(&ls->lock.vg_lock_map, NULL);
-	pthread_mutex_init(&ls->token_lock, NULL);
-	create_metadata_hashes(ls);
-
-	ls->lock.vg = dm_hash_create(32);
-	ls->token[0] = 0;
+	char line[PATH_MAX];
+	FILE *f;
+	int suspended = 0;
+
+	/* Reading a suspended device-mapper device would block */
+	if (dm_snprintf(path, size, SYSFS_DEV_BLOCK "/%u:%u/dm/suspended",
+			major(device), minor(device)) >= 0 &&
+	    (f = fopen(path, "r"))) {
+		if (fscanf(f, "%d", &suspended) != 1)
+			suspended = 1;
+		(void) fclose(f);
+		if (suspended)
+			return -1;
+	}
 
-	/* Set up stderr logging depending on the -l option. */
-	if (!daemon_log_parse(ls->log, DAEMON_LOG_OUTLET_STDERR, ls->log_config, 1))
-		return 0;
+	/* Find the device node through sysfs */
+	if (dm_snprintf(path, size, SYSFS_DEV_BLOCK "/%u:%u/uevent",
+			major(device), minor(device)) < 0 ||
+	    !(f = fopen(path, "r")))
+		return -1;
 
-	DEBUGLOG(s, "initialised state: vgid_to_metadata = %p", ls->vgid_to_metadata);
-	if (!ls->pvid_to_vgid || !ls->vgid_to_metadata)
-		return 0;
+	path[0] = 0;
+	while (fgets(line, sizeof(line), f))
+		if (!strncmp(line, "DEVNAME=", 8)) {
+			line[strcspn(line, "\n")] = 0;
+			if (dm_snprintf(path, size, "/dev/%s", line + 8) < 0)
+				path[0] = 0;
+			break;
+		}
+	(void) fclose(f);
 
-	/* if (ls->initial_registrations)
-	   _process_initial_registrations(ds->initial_registrations); */
+	if (!path[0])
+		return -1;
 
-	return 1;
+	return open(path, O_RDONLY);
 }
 
-static int fini(daemon_state *s)
+/*
+ * Look for an LVM2 label in the first sectors of the device, as label_read
+ * does, and return the UUID of the PV it belongs to.
+ */
+static int _read_pv_label(int fd, struct id *pv_id, int64_t *label_sector)
 {
-	lvmetad_state *ls = s->private;
-	struct dm_hash_node *n;
+	char buf[LABEL_SCAN_SIZE];
+	struct label_header *lh;
+	struct pv_header *pvhdr;
+	uint64_t sector;
 
-	DEBUGLOG(s, "fini");
+	if (pread(fd, buf, sizeof(buf), 0) != sizeof(buf))
+		return 0;
 
-	destroy_metadata_hashes(ls);
+	for (sector = 0; sector < LABEL_SCAN_SECTORS;
+	     sector += LABEL_SIZE >> SECTOR_SHIFT) {
+		lh = (struct label_header *) (buf + (sector << SECTOR_SHIFT));
 
-	/* Destroy the lock hashes now. */
-	n = dm_hash_get_first(ls->lock.vg);
-	while (n) {
-		pthread_mutex_destroy(dm_hash_get_data(ls->lock.vg, n));
+		if (strncmp((char *) lh->id, LABEL_ID, sizeof(lh->id)) ||
+		    xlate64(lh->sector_xl) != sector ||
+		    calc_crc(INITIAL_CRC, (uint8_t *) &lh->offset_xl, LABEL_SIZE -
+			     ((uint8_t *) &lh->offset_xl - (uint8_t *) lh)) !=
+		    xlate32(lh->crc_xl))
+			continue;
+
+		if (strncmp((char *) lh->type, LVM2_LABEL, sizeof(lh->type)) ||
+		    xlate32(lh->offset_xl) > LABEL_SIZE - sizeof(*pvhdr))
+			return 0;
+
+		pvhdr = (struct pv_header *) ((char *) lh + xlate32(lh->offset_xl));
+		memcpy(pv_id->uuid, pvhdr->pv_uuid, sizeof(pv_id->uuid));
+		*label_sector = (int64_t) sector;
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Is pvid the printable form, with dashes, of the UUID?
+ */
+static int _pvid_is(const char *pvid, const struct id *pv_id)
+{
+	unsigned i = 0;
+
+	for (; *pvid; pvid++)
+		if (*pvid != '-' &&
+		    (i == sizeof(pv_id->uuid) || *pvid != pv_id->uuid[i++]))
+			return 0;
+
+	return i == sizeof(pv_id->uuid);
+}
+
+/*
+ * The VG the snapshot has the PV in, and the seqno of its cached metadata.
+ */
+static const char *_snapshot_vg_of_pv(struct dm_config_tree *cft, const char *pvid,
+				      int64_t *seqno)
+{
+	const struct dm_config_node *vg, *pv;
+
+	if (!(vg = dm_config_find_node(cft->root, "volume_groups")))
+		return NULL;
+
+	for (vg = vg->child; vg; vg = vg->sib) {
+		if (!(pv = dm_config_find_node(vg->child, "metadata/physical_volumes")))
+			continue;
+		for (pv = pv->child; pv; pv = pv->sib)
+			if (!strcmp(dm_config_find_str(pv->child, "id", ""), pvid)) {
+				*seqno = dm_config_find_int64(vg->child, "metadata/seqno", -1);
+				return vg->key;
+			}
+	}
+
+	return NULL;
+}
+
+/*
+ * Read the metadata text rlocn points to in the metadata area at start,
+ * which wraps round to just after the mda_header, and check its checksum.
+ */
+static char *_read_metadata_text(int fd, uint64_t start, uint64_t size,
+				 const struct raw_locn *rlocn)
+{
+	uint64_t offset = xlate64(rlocn->offset), len = xlate64(rlocn->size);
+	uint64_t first;
+	char *text;
+
+	if (offset < MDA_HEADER_SIZE || offset >= size ||
+	    !len || len > size - MDA_HEADER_SIZE ||
+	    !(text = dm_malloc(len)))
+		return NULL;
+
+	first = (offset + len > size) ? size - offset : len;
+	if (pread(fd, text, first, start + offset) != (ssize_t) first ||
+	    (first < len &&
+	     pread(fd, text + first, len - first, start + MDA_HEADER_SIZE) !=
+	     (ssize_t) (len - first)) ||
+	    calc_crc(INITIAL_CRC, (uint8_t *) text, len) != xlate32(rlocn->checksum)) {
+		dm_free(text);
+		return NULL;
+	}
+
+	return text;
+}
+
+/*
+ * Does the metadata text hold the given version of the VG?  Every change
+ * to a VG raises its seqno, so the UUID and seqno are enough.
+ */
+static int _metadata_text_matches(const char *text, uint64_t len,
+				  const char *vgid, int64_t seqno)
+{
+	struct dm_config_tree *cft;
+	const struct dm_config_node *vgn;
+	int r = 0;
+
+	if (!(cft = dm_config_create()))
+		return 0;
+
+	if (!dm_config_parse(cft, text, text + len))
+		goto out;
+
+	/* Skip any top-level values, as _read_vg does */
+	for (vgn = cft->root; vgn && vgn->v; vgn = vgn->sib)
+		;
+
+	r = vgn && !strcmp(dm_config_find_str(vgn->child, "id", ""), vgid) &&
+	    dm_config_find_int64(vgn->child, "seqno", -1) == seqno;
+out:
+	dm_config_destroy(cft);
+	return r;
+}
+
+/*
+ * Do the metadata areas on the PV hold the VG metadata the snapshot has
+ * cached for it, or none if it has the PV as an orphan?
+ */
+static int _pv_metadata_matches(struct dm_config_tree *cft, const struct dm_config_node *pv,
+				const char *pvid, int fd)
+{
+	const struct dm_config_node *mda;
+	char buf[MDA_HEADER_SIZE];
+	struct mda_header *mdah = (struct mda_header *) buf;
+	struct raw_locn *rlocn = mdah->raw_locns;
+	const char *vgid;
+	char *text;
+	uint64_t start, size;
+	int64_t seqno = -1;
+	int r;
+
+	vgid = _snapshot_vg_of_pv(cft, pvid, &seqno);
+
+	for (mda = pv->child; mda; mda = mda->sib) {
+		if (strncmp(mda->key, "mda", 3) ||
+		    dm_config_find_int(mda->child, "ignore", 0))
+			continue;
+
+		start = (uint64_t) dm_config_find_int64(mda->child, "start", 0);
+		size = (uint64_t) dm_config_find_int64(mda->child, "size", 0);
+
+		if (size <= MDA_HEADER_SIZE ||
+		    pread(fd, buf, sizeof(buf), start) != sizeof(buf) ||
+		    calc_crc(INITIAL_CRC, (uint8_t *) mdah->magic, MDA_HEADER_SIZE -
+			     sizeof(mdah->checksum_xl)) != xlate32(mdah->checksum_xl) ||
+		    strncmp((char *) mdah->magic, FMTT_MAGIC, sizeof(mdah->magic)) ||
+		    xlate64(mdah->start) != start)
+			return 0;
+
+		if (xlate32(rlocn->flags) & RAW_LOCN_IGNORED)
+			continue;
+
+		if (!rlocn->offset) {
+			if (vgid)
+				return 0;
+			continue;
+		}
+
+		if (!vgid || !(text = _read_metadata_text(fd, start, size, rlocn)))
+			return 0;
+
+		r = _metadata_text_matches(text, xlate64(rlocn->size), vgid, seqno);
+		dm_free(text);
+		if (!r)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Is the device the same as the snapshot has it: no LVM2 label if the
+ * snapshot has no PV on it, or else the same PV, as it was?
+ */
+static int _device_matches(lvmetad_state *s, struct dm_config_tree *cft,
+			   const struct dm_config_node *pv, uint64_t device)
+{
+	char path[PATH_MAX];
+	const char *pvid;
+	struct id pv_id;
+	int64_t label_sector;
+	int fd, r;
+
+	if ((fd = _open_device(device, path, sizeof(path))) < 0)
+		return !pv;
+
+	if (!_read_pv_label(fd, &pv_id, &label_sector))
+		r = !pv;
+	else
+		r = pv &&
+		    (pvid = dm_config_find_str(pv->child, "id", NULL)) &&
+		    _pvid_is(pvid, &pv_id) &&
+		    dm_config_find_int64(pv->child, "label_sector", -1) == label_sector &&
+		    !strcmp(dm_config_find_str(pv->child, "format", ""), "lvm2") &&
+		    _pv_metadata_matches(cft, pv, pvid, fd);
+
+	if (close(fd))
+		DEBUGLOG(s, "close %s failed", path);
+
+	if (!r)
+		INFO(s, "Snapshot %s is stale: %s changed.", s->snapshot.path, path);
+
+	return r;
+}
+
+static struct dm_config_node *_make_device_list(struct dm_config_tree *cft,
+						const char *key, const uint64_t *devs,
+						unsigned count,
+						struct dm_config_node *parent,
+						struct dm_config_node *pre_sib)
+{
+	struct dm_config_node *cn;
+	struct dm_config_value *v, **next;
+	unsigned i;
+
+	if (!(cn = make_config_node(cft, key, parent, pre_sib)))
+		return NULL;
+
+	for (next = &cn->v, i = 0; i < count; i++, next = &v->next) {
+		if (!(v = dm_config_create_value(cft)))
+			return NULL;
+		v->type = DM_CFG_INT;
+		v->v.i = (int64_t) devs[i];
+		*next = v;
+	}
+
+	return cn;
+}
+
+static struct dm_config_node *_snapshot_devices(struct dm_config_tree *cft,
+						struct dm_config_node *parent,
+						struct dm_config_node *pre_sib)
+{
+	struct dm_config_node *cn;
+	uint64_t *devs;
+	unsigned count;
+
+	if (!(devs = _block_devices(&count, 0)))
+		return NULL;
+
+	cn = _make_device_list(cft, "devices", devs, count, parent, pre_sib);
+
+	dm_free(devs);
+	return cn;
+}
+
+/*
+ * The devices clients found no PV on. The caller holds pvid_to_pvmeta.
+ */
+static struct dm_config_node *_snapshot_unlabelled(lvmetad_state *s,
+						   struct dm_config_tree *cft,
+						   struct dm_config_node *parent,
+						   struct dm_config_node *pre_sib)
+{
+	struct dm_config_node *cn;
+	struct dm_hash_node *n;
+	uint64_t *devs;
+	unsigned count = 0;
+
+	if (!(devs = dm_malloc((dm_hash_get_num_entries(s->device_unlabelled) + 1) *
+			       sizeof(*devs))))
+		return NULL;
+
+	dm_hash_iterate(n, s->device_unlabelled)
+		memcpy(&devs[count++], dm_hash_get_key(s->device_unlabelled, n),
+		       sizeof(*devs));
+
+	cn = _make_device_list(cft, "unlabelled", devs, count, parent, pre_sib);
+
+	dm_free(devs);
+	return cn;
+}
+
+/*
+ * Copy the cached state into cft, which becomes the snapshot.
+ */
+static int _snapshot_tree(lvmetad_state *s, struct dm_config_tree *cft)
+{
+	struct dm_config_node *info, *cn, *devices, *pvs, *vgs, *vg, *last = NULL;
+	struct dm_config_tree *tree;
+	struct dm_hash_node *n;
+	const char *name;
+	char *token;
+	int r = 0;
+
+	pthread_mutex_lock(&s->token_lock);
+	token = dm_pool_strdup(dm_config_memory(cft), s->token);
+	pthread_mutex_unlock(&s->token_lock);
+
+	if (!token ||
+	    !(cft->root = info = make_config_node(cft, "snapshot", NULL, NULL)) ||
+	    !(cn = make_int_node(cft, "version", SNAPSHOT_VERSION, info, NULL)) ||
+	    !(cn = make_text_node(cft, "token", token, info, cn)) ||
+	    !(devices = _snapshot_devices(cft, info, cn)) ||
+	    !(pvs = make_config_node(cft, "physical_volumes", NULL, info)) ||
+	    !(vgs = make_config_node(cft, "volume_groups", NULL, pvs)))
+		return 0;
+
+	rdlock_pvid_to_pvmeta(s);
+	rdlock_vgid_to_metadata(s);
+
+	if (!_snapshot_unlabelled(s, cft, info, devices))
+		goto out;
+
+	for (n = dm_hash_get_first(s->pvid_to_pvmeta); n;
+	     n = dm_hash_get_next(s->pvid_to_pvmeta, n)) {
+		tree = dm_hash_get_data(s->pvid_to_pvmeta, n);
+		if (!(cn = dm_config_clone_node(cft, tree->root, 0)) ||
+		    !(cn->key = dm_pool_strdup(dm_config_memory(cft),
+					       dm_hash_get_key(s->pvid_to_pvmeta, n))))
+			goto out;
+		cn->parent = pvs;
+		if (last)
+			last->sib = cn;
+		else
+			pvs->child = cn;
+		last = cn;
+	}
+
+	for (n = dm_hash_get_first(s->vgid_to_metadata), last = NULL; n;
+	     n = dm_hash_get_next(s->vgid_to_metadata, n)) {
+		tree = dm_hash_get_data(s->vgid_to_metadata, n);
+		if (!(name = dm_hash_lookup(s->vgid_to_vgname,
+					    dm_hash_get_key(s->vgid_to_metadata, n))) ||
+		    !(name = dm_pool_strdup(dm_config_memory(cft), name)) ||
+		    !(vg = make_config_node(cft, dm_hash_get_key(s->vgid_to_metadata, n),
+					    vgs, last)) ||
+		    !(cn = make_text_node(cft, "name", name, vg, NULL)) ||
+		    !(cn->sib = dm_config_clone_node(cft, tree->root, 0)))
+			goto out;
+		cn->sib->parent = vg;
+		last = vg;
+	}
+
+	r = 1;
+out:
+	unlock_vgid_to_metadata(s);
+	unlock_pvid_to_pvmeta(s);
+
+	return r;
+}
+
+static int save_snapshot(lvmetad_state *s)
+{
+	struct dm_config_tree *cft;
+	struct buffer buf;
+	uint64_t generation = __sync_fetch_and_add(&s->snapshot.generation, 0);
+	char *tmp = NULL;
+	int fd = -1, r = 0;
+	ssize_t done;
+	size_t pos;
+
+	if (!(cft = dm_config_create()))
+		return 0;
+
+	buffer_init(&buf);
+
+	if (!_snapshot_tree(s, cft) || !config_write_binary(cft->root, &buf) ||
+	    dm_asprintf(&tmp, "%s.tmp", s->snapshot.path) < 0) {
+		ERROR(s, "Failed to prepare snapshot.");
+		tmp = NULL;
+		goto out;
+	}
+
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
+		ERROR(s, "Failed to create snapshot %s: %s", tmp, strerror(errno));
+		goto out;
+	}
+
+	for (pos = 0; pos < (size_t) buf.used; pos += done)
+		if ((done = write(fd, buf.mem + pos, buf.used - pos)) < 0) {
+			if (errno == EINTR) {
+				done = 0;
+				continue;
+			}
+			ERROR(s, "Failed to write snapshot %s: %s", tmp, strerror(errno));
+			goto out;
+		}
+
+	if (fsync(fd) || close(fd)) {
+		ERROR(s, "Failed to write snapshot %s: %s", tmp, strerror(errno));
+		fd = -1;
+		goto out;
+	}
+	fd = -1;
+
+	if (rename(tmp, s->snapshot.path)) {
+		ERROR(s, "Failed to replace snapshot %s: %s", s->snapshot.path, strerror(errno));
+		goto out;
+	}
+
+	s->snapshot.saved = generation;
+	DEBUGLOG(s, "saved snapshot %s (%d bytes)", s->snapshot.path, buf.used);
+	r = 1;
+out:
+	if (fd >= 0)
+		(void) close(fd);
+	if (!r && tmp)
+		(void) unlink(tmp);
+	dm_free(tmp);
+	buffer_destroy(&buf);
+	dm_config_destroy(cft);
+
+	return r;
+}
+
+/*
+ * Can the snapshot be loaded: is it of this version, and taken with the
+ * same block devices? This only reads sysfs: the devices themselves are
+ * checked later, by _snapshot_probe.
+ */
+static int _snapshot_valid(lvmetad_state *s, struct dm_config_tree *cft)
+{
+	const struct dm_config_node *cn;
+	const struct dm_config_value *v;
+	uint64_t *devs;
+	unsigned count, i = 0;
+
+	if (dm_config_find_int(cft->root, "snapshot/version", 0) != SNAPSHOT_VERSION) {
+		INFO(s, "Ignoring snapshot %s: unknown version.", s->snapshot.path);
+		return 0;
+	}
+
+	if (!(cn = dm_config_find_node(cft->root, "snapshot/devices")) ||
+	    !(devs = _block_devices(&count, 0)))
+		return 0;
+
+	for (v = cn->v; v && v->type == DM_CFG_INT && i < count; v = v->next, i++)
+		if ((uint64_t) v->v.i != devs[i])
+			break;
+
+	dm_free(devs);
+
+	if (v || i != count) {
+		INFO(s, "Ignoring snapshot %s: block devices changed.", s->snapshot.path);
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Check the loaded snapshot still describes the disks: each PV as it was,
+ * with no VG metadata changed, and still no LVM2 label on the devices
+ * clients found none on. Other devices are left alone: no client reported
+ * on them, so their filter rejects them, or they are new. Device-mapper
+ * devices are included, as PVs may be on them.
+ * Returns -1 if lvmetad is stopping before the check is done.
+ */
+static int _snapshot_probe(lvmetad_state *s, struct dm_config_tree *cft)
+{
+	const struct dm_config_node *cn, *pv;
+	const struct dm_config_value *v;
+	struct dm_hash_table *pvs, *unlabelled = NULL;
+	uint64_t *devs;
+	int64_t device;
+	unsigned count, i, found = 0, nr_pvs = 0;
+	int r = 0;
+
+	/* The PVs by device number, and the devices found empty */
+	if (!(pvs = dm_hash_create(32)) || !(unlabelled = dm_hash_create(32)))
+		goto out;
+
+	if ((cn = dm_config_find_node(cft->root, "physical_volumes")))
+		for (pv = cn->child; pv; pv = pv->sib) {
+			device = dm_config_find_int64(pv->child, "device", -1);
+			if (device < 0 ||
+			    dm_hash_lookup_binary(pvs, &device, sizeof(device)) ||
+			    !dm_hash_insert_binary(pvs, &device, sizeof(device), (void *) pv)) {
+				INFO(s, "Snapshot %s is stale: bad PV %s.", s->snapshot.path,
+				     dm_config_find_str(pv->child, "id", "without UUID"));
+				goto out;
+			}
+			nr_pvs++;
+		}
+
+	if ((cn = dm_config_find_node(cft->root, "snapshot/unlabelled")))
+		for (v = cn->v; v && v->type == DM_CFG_INT; v = v->next)
+			if (!dm_hash_insert_binary(unlabelled, &v->v.i,
+						   sizeof(v->v.i), (void *) 1))
+				goto out;
+
+	if (!(devs = _block_devices(&count, 1)))
+		goto out;
+
+	for (i = 0; i < count && !s->snapshot.stop; i++) {
+		device = (int64_t) devs[i];
+		if (!(pv = dm_hash_lookup_binary(pvs, &device, sizeof(device))) &&
+		    !dm_hash_lookup_binary(unlabelled, &device, sizeof(device)))
+			continue;
+		if (!_device_matches(s, cft, pv, devs[i]))
+			break;
+		if (pv)
+			found++;
+	}
+
+	dm_free(devs);
+
+	if (s->snapshot.stop) {
+		r = -1;
+		goto out;
+	}
+
+	if (i < count)
+		goto out;
+
+	if (found != nr_pvs) {
+		INFO(s, "Snapshot %s is stale: PV device gone.", s->snapshot.path);
+		goto out;
+	}
+
+	r = 1;
+out:
+	if (unlabelled)
+		dm_hash_destroy(unlabelled);
+	if (pvs)
+		dm_hash_destroy(pvs);
+	return r;
+}
+
+/*
+ * The check of the loaded state is over: passed is 1 if the disks match
+ * the snapshot, 0 if they do not or the snapshot was rejected, and -1 if
+ * lvmetad is stopping before the check was done. Only a passed check
+ * restores the saved token. The caller holds token_lock.
+ */
+static void _snapshot_checked(lvmetad_state *s, int passed)
+{
+	if (!s->snapshot.probing)
+		return;
+
+	if (passed > 0) {
+		strcpy(s->token, s->snapshot.token);
+		INFO(s, "Checked the state loaded from snapshot %s.", s->snapshot.path);
+	} else if (!passed) {
+		lock_pvid_to_vgid(s);
+		lock_pvid_to_pvmeta(s);
+		lock_vgid_to_metadata(s);
+
+		destroy_metadata_hashes(s);
+		create_metadata_hashes(s);
+
+		unlock_vgid_to_metadata(s);
+		unlock_pvid_to_pvmeta(s);
+		unlock_pvid_to_vgid(s);
+
+		count(&s->snapshot.generation);
+		INFO(s, "Dropped the state loaded from snapshot %s.", s->snapshot.path);
+	}
+
+	s->snapshot.probing = 0;
+	pthread_cond_broadcast(&s->snapshot.probed);
+}
+
+static void *snapshot_thread(void *arg)
+{
+	lvmetad_state *s = arg;
+	struct timespec until;
+	struct timeval now;
+	int passed;
+
+	if (s->snapshot.probe) {
+		passed = _snapshot_probe(s, s->snapshot.probe);
+		pthread_mutex_lock(&s->token_lock);
+		_snapshot_checked(s, passed);
+		pthread_mutex_unlock(&s->token_lock);
+		dm_config_destroy(s->snapshot.probe);
+		s->snapshot.probe = NULL;
+	}
+
+	pthread_mutex_lock(&s->snapshot.lock);
+
+	while (!s->snapshot.stop) {
+		gettimeofday(&now, NULL);
+		until.tv_sec = now.tv_sec + SNAPSHOT_INTERVAL;
+		until.tv_nsec = now.tv_usec * 1000;
+		pthread_cond_timedwait(&s->snapshot.wake, &s->snapshot.lock, &until);
+
+		if (!s->snapshot.stop &&
+		    __sync_fetch_and_add(&s->snapshot.generation, 0) != s->snapshot.saved)
+			(void) save_snapshot(s);
+	}
+
+	pthread_mutex_unlock(&s->snapshot.lock);
+
+	return NULL;
+}
+
+static int _snapshot_dir(lvmetad_state *s)
+{
+	char *dir, *slash;
+	int r = 1;
+
+	if (!(dir = dm_strdup(s->snapshot.path)))
+		return 0;
+
+	if ((slash = strrchr(dir, '/')) && slash != dir) {
+		*slash = 0;
+		if (!(r = dm_create_dir(dir)))
+			ERROR(s, "Failed to create %s, not keeping a snapshot.", dir);
+	}
+
+	dm_free(dir);
+	return r;
+}
+
+/*
+ * Fill the empty cache from the snapshot, if there is a valid one, and
+ * leave it for the snapshot thread to check against the disks. A snapshot
+ * with any field missing, of the wrong type or repeated is thrown away.
+ */
+static void load_snapshot(lvmetad_state *s)
+{
+	struct dm_config_tree *cft = NULL, *pvmeta;
+	struct dm_config_node *cn;
+	const struct dm_config_value *v;
+	struct buffer buf;
+	struct stat info;
+	const char *pvid, *name, *token;
+	char *pvid_dup;
+	int64_t device;
+	int fd, pvs = 0, vgs = 0;
+	ssize_t done;
+
+	buffer_init(&buf);
+
+	if ((fd = open(s->snapshot.path, O_RDONLY)) < 0) {
+		if (errno != ENOENT)
+			ERROR(s, "Failed to open snapshot %s: %s", s->snapshot.path, strerror(errno));
+		return;
+	}
+
+	if (fstat(fd, &info) || !info.st_size || info.st_size > INT32_MAX ||
+	    !buffer_realloc(&buf, info.st_size) ||
+	    (done = read(fd, buf.mem, info.st_size)) != info.st_size) {
+		ERROR(s, "Failed to read snapshot %s.", s->snapshot.path);
+		goto out;
+	}
+	buf.used = (int) done;
+
+	if (!buffer_is_binary(&buf) || !(cft = config_read_binary(&buf))) {
+		ERROR(s, "Ignoring damaged snapshot %s.", s->snapshot.path);
+		goto out;
+	}
+
+	if (!_snapshot_valid(s, cft))
+		goto out;
+
+	if (!(token = dm_config_find_str(cft->root, "snapshot/token", NULL)) ||
+	    strlen(token) >= sizeof(s->snapshot.token))
+		goto bad;
+
+	if ((cn = dm_config_find_node(cft->root, "physical_volumes")))
+		for (cn = cn->child; cn; cn = cn->sib) {
+			pvid = dm_config_find_str(cn->child, "id", NULL);
+			device = dm_config_find_int64(cn->child, "device", -1);
+
+			if (!pvid || strcmp(pvid, cn->key) || device < 0 ||
+			    dm_hash_lookup(s->pvid_to_pvmeta, pvid) ||
+			    dm_hash_lookup_binary(s->device_to_pvid, &device, sizeof(device)))
+				goto bad;
+
+			if (!(pvmeta = dm_config_create()))
+				goto bad;
+			if (!(pvmeta->root = dm_config_clone_node(pvmeta, cn, 0)) ||
+			    !dm_hash_insert(s->pvid_to_pvmeta, pvid, pvmeta)) {
+				dm_config_destroy(pvmeta);
+				goto bad;
+			}
+			pvmeta->root->key = "pvmeta";
+			if (!(pvid_dup = dm_strdup(pvid)) ||
+			    !dm_hash_insert_binary(s->device_to_pvid, &device,
+						   sizeof(device), pvid_dup)) {
+				dm_free(pvid_dup);
+				goto bad;
+			}
+			pvs++;
+		}
+
+	if ((cn = dm_config_find_node(cft->root, "snapshot/unlabelled")))
+		for (v = cn->v; v; v = v->next)
+			if (v->type != DM_CFG_INT || v->v.i < 0 ||
+			    dm_hash_lookup_binary(s->device_to_pvid, &v->v.i, sizeof(v->v.i)) ||
+			    !dm_hash_insert_binary(s->device_unlabelled, &v->v.i,
+						   sizeof(v->v.i), (void *) 1))
+				goto bad;
+
+	if ((cn = dm_config_find_node(cft->root, "volume_groups")))
+		for (cn = cn->child; cn; cn = cn->sib) {
+			if (!(name = dm_config_find_str(cn->child, "name", NULL)) ||
+			    !cn->child->sib ||
+			    strcmp(dm_config_find_str(cn->child->sib, "metadata/id", ""), cn->key) ||
+			    dm_hash_lookup(s->vgid_to_metadata, cn->key) ||
+			    dm_hash_lookup(s->vgname_to_vgid, name) ||
+			    !update_metadata(s, name, cn->key, cn->child->sib, NULL))
+				goto bad;
+			vgs++;
+		}
+
+	INFO(s, "Loaded %d PVs and %d VGs from snapshot %s.", pvs, vgs, s->snapshot.path);
+	strcpy(s->snapshot.token, token);
+	s->snapshot.probing = 1;
+	s->snapshot.saved = s->snapshot.generation;
+	s->snapshot.probe = cft;
+	cft = NULL;
+	goto out;
+
+bad:
+	ERROR(s, "Ignoring damaged snapshot %s.", s->snapshot.path);
+	destroy_metadata_hashes(s);
+	create_metadata_hashes(s);
+out:
+	if (close(fd))
+		DEBUGLOG(s, "close %s failed", s->snapshot.path);
+	if (cft)
+		dm_config_destroy(cft);
+	buffer_destroy(&buf);
+}
+
+static response handler(daemon_state s, client_handle h, request r)
+{
+	lvmetad_state *state = s.private;
+	const char *rq = daemon_request_str(r, "request", "NONE");
+	const char *token = daemon_request_str(r, "token", "NONE");
+
+	pthread_mutex_lock(&state->token_lock);
+	if (!strcmp(rq, "token_update")) {
+		/* The client rescans, so the loaded state is not needed */
+		_snapshot_checked(state, 0);
+		strncpy(state->token, token, 128);
+		state->token[127] = 0;
+		pthread_mutex_unlock(&state->token_lock);
+		return changed(state, daemon_reply_simple("OK", NULL));
+	}
+
+	/*
+	 * While the loaded snapshot is checked, hold requests from clients
+	 * with the same filter, and reject it for clients with another one.
+	 */
+	if (strcmp(rq, "dump")) {
+		if (state->snapshot.probing && strcmp(token, state->snapshot.token))
+			_snapshot_checked(state, 0);
+		while (state->snapshot.probing)
+			pthread_cond_wait(&state->snapshot.probed, &state->token_lock);
+	}
+
+	if (strcmp(token, state->token) && strcmp(rq, "dump")) {
+		pthread_mutex_unlock(&state->token_lock);
+		return daemon_reply_simple("token_mismatch",
+					   "expected = %s", state->token,
+					   "received = %s", token,
+					   "reason = %s", "token mismatch", NULL);
+	}
+	pthread_mutex_unlock(&state->token_lock);
+
+	/*
+	 * TODO Add a stats call, with transaction count/rate, time since last
+	 * update &c.
+	 */
+	if (!strcmp(rq, "pv_found"))
+		return changed(state, pv_found(state, r));
+
+	if (!strcmp(rq, "pv_gone"))
+		return changed(state, pv_gone(state, r));
+
+	if (!strcmp(rq, "pv_clear_all"))
+		return changed(state, pv_clear_all(state, r));
+
+	if (!strcmp(rq, "pv_lookup"))
+		return pv_lookup(state, r);
+
+	if (!strcmp(rq, "vg_update"))
+		return changed(state, vg_update(state, r));
+
+	if (!strcmp(rq, "vg_remove"))
+		return changed(state, vg_remove_request(state, r));
+
+	if (!strcmp(rq, "vg_lookup"))
+		return vg_lookup(state, r);
+
+	if (!strcmp(rq, "pv_list"))
+		return pv_list(state, r);
+
+	if (!strcmp(rq, "vg_list"))
+		return vg_list(state, r);
+
+	if (!strcmp(rq, "dump"))
+		return dump(state);
+
+	return reply_fail("request not implemented");
+}
+
+static void init_lock(struct rwlock *l)
+{
+	memset(l, 0, sizeof(*l));
+	pthread_rwlock_init(&l->rw, NULL);
+}
+
+static int init(daemon_state *s)
+{
+	lvmetad_state *ls = s->private;
+	ls->log = s->log;
+
+	init_lock(&ls->lock.pvid_to_pvmeta);
+	init_lock(&ls->lock.vgid_to_metadata);
+	init_lock(&ls->lock.pvid_to_vgid);
+	ls->lock.vg_locks = ls->lock.vg_waits = 0;
+	pthread_mutex_init(&ls->lock.vg_lock_map, NULL);
+	pthread_mutex_init(&ls->token_lock, NULL);
+	create_metadata_hashes(ls);
+
+	ls->lock.vg = dm_hash_create(32);
+	ls->token[0] = 0;
+
+	/* Set up stderr logging depending on the -l option. */
+	if (!daemon_log_parse(ls->log, DAEMON_LOG_OUTLET_STDERR, ls->log_config, 1))
+		return 0;
+
+	DEBUGLOG(s, "initialised state: vgid_to_metadata = %p", ls->vgid_to_metadata);
+	if (!ls->pvid_to_vgid || !ls->vgid_to_metadata)
+		return 0;
+
+	ls->snapshot.generation = ls->snapshot.saved = 0;
+	ls->snapshot.probe = NULL;
+	ls->snapshot.token[0] = 0;
+	ls->snapshot.probing = 0;
+	ls->snapshot.stop = 0;
+	pthread_cond_init(&ls->snapshot.probed, NULL);
+	if (ls->snapshot.path && !_snapshot_dir(ls))
+		ls->snapshot.path = NULL;
+
+	if (ls->snapshot.path) {
+		sigset_t new, old;
+
+		load_snapshot(ls);
+
+		pthread_mutex_init(&ls->snapshot.lock, NULL);
+		pthread_cond_init(&ls->snapshot.wake, NULL);
+
+		/* Leave signals to the main thread. */
+		sigfillset(&new);
+		pthread_sigmask(SIG_SETMASK, &new, &old);
+		if (pthread_create(&ls->snapshot.thread, NULL, snapshot_thread, ls)) {
+			ERROR(s, "Failed to start snapshot thread.");
+			ls->snapshot.path = NULL;
+		}
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+		/* Nothing will check what was loaded */
+		if (!ls->snapshot.path && ls->snapshot.probe) {
+			_snapshot_checked(ls, 0);
+			dm_config_destroy(ls->snapshot.probe);
+			ls->snapshot.probe = NULL;
+		}
+	}
+
+	/* if (ls->initial_registrations)
+	   _process_initial_registrations(ds->initial_registrations); */
+
+	return 1;
+}
+
+static int fini(daemon_state *s)
+{
+	lvmetad_state *ls = s->private;
+	struct dm_hash_node *n;
+
+	DEBUGLOG(s, "fini");
+
+	if (ls->snapshot.path) {
+		pthread_mutex_lock(&ls->snapshot.lock);
+		ls->snapshot.stop = 1;
+		pthread_cond_signal(&ls->snapshot.wake);
+		pthread_mutex_unlock(&ls->snapshot.lock);
+		pthread_join(ls->snapshot.thread, NULL);
+
+		if (ls->snapshot.generation != ls->snapshot.saved)
+			(void) save_snapshot(ls);
+	}
+
+	destroy_metadata_hashes(ls);
+
+	/* Destroy the lock hashes now. */
+	n = dm_hash_get_first(ls->lock.vg);
+	while (n) {
+		pthread_mutex_destroy(dm_hash_get_data(ls->lock.vg, n));
 		free(dm_hash_get_data(ls->lock.vg, n));
 		n = dm_hash_get_next(ls->lock.vg, n);
 	}
 
 	dm_hash_destroy(ls->lock.vg);
+
+	pthread_rwlock_destroy(&ls->lock.pvid_to_pvmeta.rw);
+	pthread_rwlock_destroy(&ls->lock.vgid_to_metadata.rw);
+	pthread_rwlock_destroy(&ls->lock.pvid_to_vgid.rw);
 	return 1;
 }
 
 static void usage(char *prog, FILE *file)
 {
 	fprintf(file, "Usage:\n"
-		"%s [-V] [-h] [-f] [-l {all|wire|debug}] [-s path]\n\n"
+		"%s [-V] [-h] [-f] [-l {all|wire|debug}] [-s path] [-c path]\n\n"
 		"   -V       Show version of lvmetad\n"
 		"   -h       Show this help information\n"
 		"   -f       Don't fork, run in the foreground\n"
 		"   -l       Logging message level (-l {all|wire|debug})\n"
-		"   -s       Set path to the socket to listen on\n\n", prog);
+		"   -s       Set path to the socket to listen on\n"
+		"   -c       Set path to the state snapshot (\"\" for none)\n\n", prog);
 }
 
 int main(int argc, char *argv[])
@@ -1149,6 +2288,7 @@ int main(int argc, char *argv[])
 	daemon_state s = { .private = NULL };
 	lvmetad_state ls;
 	int _socket_override = 1;
+	int _snapshot_override = 0;
 
 	s.name = "lvmetad";
 	s.private = &ls;
@@ -1164,9 +2304,10 @@ int main(int argc, char *argv[])
 	s.protocol = "lvmetad";
 	s.protocol_version = 1;
 	ls.log_config = "";
+	ls.snapshot.path = DEFAULT_SYS_DIR "/" DEFAULT_CACHE_SUBDIR "/lvmetad.cache";
 
 	// use getopt_long
-	while ((opt = getopt(argc, argv, "?fhVl:s:")) != EOF) {
+	while ((opt = getopt(argc, argv, "?fhVl:s:c:")) != EOF) {
 		switch (opt) {
 		case 'h':
 			usage(argv[0], stdout);
@@ -1184,6 +2325,10 @@ int main(int argc, char *argv[])
 			s.socket_path = optarg;
 			_socket_override = 1;
 			break;
+		case 'c': // --snapshot
+			ls.snapshot.path = optarg;
+			_snapshot_override = 1;
+			break;
 		case 'V':
 			printf("lvmetad version: " LVM_VERSION "\n");
 			exit(1);
@@ -1197,8 +2342,14 @@ int main(int argc, char *argv[])
 		} else {
 			s.pidfile = NULL;
 		}
+		/* Like the pidfile, only keep a snapshot if asked to. */
+		if (!_snapshot_override)
+			ls.snapshot.path = NULL;
 	}
 
+	if (ls.snapshot.path && !*ls.snapshot.path)
+		ls.snapshot.path = NULL;
+
 	daemon_start(s);
 	return 0;
 }
@@ -17,6 +17,7 @@
 #include "lvmcache.h"
 #include "toolcontext.h"
 #include "dev-cache.h"
+#include "dev-bcache.h"
 #include "locking.h"
 #include "metadata.h"
 #include "filter.h"
@@ -353,6 +354,33 @@ int lvmcache_verify_lock_order(const char *vgname)
 	return 1;
 }
 
+static void _invalidate_vg_blocks(const char *vgname)
+{
+	struct lvmcache_vginfo *vginfo;
+	struct lvmcache_info *info;
+
+	for (vginfo = lvmcache_vginfo_from_vgname(vgname, NULL); vginfo;
+	     vginfo = vginfo->next)
+		dm_list_iterate_items(info, &vginfo->infos)
+			dev_bcache_invalidate_dev(info->dev);
+}
+
+/*
+ * Drop the cached blocks of the devices the lock covers.  VG_GLOBAL
+ * does not cover a known set of devices, so it drops them all.
+ */
+static void _invalidate_blocks(const char *vgname)
+{
+	if (!strcmp(vgname, VG_GLOBAL))
+		dev_bcache_invalidate();
+	else if (!strcmp(vgname, VG_ORPHANS)) {
+		_invalidate_vg_blocks(FMT_TEXT_ORPHAN_VG_NAME);
+		_invalidate_vg_blocks(FMT_LVM1_ORPHAN_VG_NAME);
+		_invalidate_vg_blocks(FMT_POOL_ORPHAN_VG_NAME);
+	} else
+		_invalidate_vg_blocks(vgname);
+}
+
 void lvmcache_lock_vgname(const char *vgname, int read_only __attribute__((unused)))
 {
 	if (!_lock_hash && !lvmcache_init()) {
@@ -369,6 +397,9 @@ void lvmcache_lock_vgname(const char *vgname, int read_only __attribute__((unuse
 
 	_update_cache_lock_state(vgname, 1);
 
+	/* Blocks read before the lock was held may be stale */
+	_invalidate_blocks(vgname);
+
 	if (strcmp(vgname, VG_GLOBAL))
 		_vgs_locked++;
 }
@@ -409,6 +440,10 @@ static void _vginfo_attach_info(struct lvmcache_vginfo *vginfo,
 
 	info->vginfo = vginfo;
 	dm_list_add(&vginfo->infos, &info->list);
+
+	/* Found to belong to a VG whose lock was taken without it */
+	if (lvmcache_vgname_is_locked(vginfo->vgname))
+		dev_bcache_invalidate_dev(info->dev);
 }
 
 static void _vginfo_detach_info(struct lvmcache_info *info)
@@ -655,15 +690,16 @@ static int _scan_invalid(void)
 
 int lvmcache_label_scan(struct cmd_context *cmd, int full_scan)
 {
-	struct label *label;
 	struct dev_iter *iter;
-	struct device *dev;
 	struct format_type *fmt;
 
 	int r = 0;
 
-	if (lvmetad_active())
+	/* lvmetad keeps the devices up to date, so no rescan is pending */
+	if (lvmetad_active()) {
+		cmd->rescan_devices = 0;
 		return 1;
+	}
 
 	/* Avoid recursion when a PVID can't be found! */
 	if (_scanning_in_progress)
@@ -676,6 +712,12 @@ int lvmcache_label_scan(struct cmd_context *cmd, int full_scan)
 		goto out;
 	}
 
+	/* A long-lived handle saw block devices come or go */
+	if (cmd->rescan_devices) {
+		cmd->rescan_devices = 0;
+		full_scan = 2;
+	}
+
 	if (_has_scanned && !full_scan) {
 		r = _scan_invalid();
 		goto out;
@@ -689,8 +731,10 @@ int lvmcache_label_scan(struct cmd_context *cmd, int full_scan)
 		goto out;
 	}
 
-	while ((dev = dev_iter_get(iter)))
-		(void) label_read(dev, &label, UINT64_C(0));
+	/* Blocks kept since an earlier scan may be stale */
+	dev_bcache_invalidate();
+
+	label_scan(iter, scan_queue_depth());
 
 	dev_iter_destroy(iter);
 
@@ -28,6 +28,7 @@
 #include "filter-sysfs.h"
 #include "label.h"
 #include "lvm-file.h"
+#include "crc.h"
 #include "format-text.h"
 #include "display.h"
 #include "memlock.h"
@@ -36,6 +37,7 @@
 #include "lvmcache.h"
 #include "lvmetad.h"
 #include "dev-cache.h"
+#include "dev-bcache.h"
 #include "archiver.h"
 
 #ifdef HAVE_LIBDL
@@ -670,6 +672,38 @@ static struct dm_config_tree *_destroy_tag_configs(struct cmd_context *cmd)
 	return cft_cmdline;
 }
 
+/*
+ * Compiled device name patterns are kept next to the persistent filter
+ * cache, so only when that is written too.
+ */
+static void _init_dfa_cache_dir(struct cmd_context *cmd)
+{
+	const char *cache_dir = find_config_tree_str(cmd, "devices/cache_dir", NULL);
+
+	cmd->dfa_cache_dir[0] = '\0';
+
+	if (!*cmd->system_dir ||
+	    !find_config_tree_int(cmd, "devices/write_cache_state", 1))
+		return;
+
+	if (dm_snprintf(cmd->dfa_cache_dir, sizeof(cmd->dfa_cache_dir), "%s%s%s",
+			cache_dir ? "" : cmd->system_dir,
+			cache_dir ? "" : "/",
+			cache_dir ? : DEFAULT_CACHE_SUBDIR) < 0 ||
+	    !dir_exists(cmd->dfa_cache_dir))
+		cmd->dfa_cache_dir[0] = '\0';
+}
+
+static const char *_dfa_cache_file(struct cmd_context *cmd, const char *name,
+				   char *buf, size_t size)
+{
+	if (!*cmd->dfa_cache_dir ||
+	    dm_snprintf(buf, size, "%s/%s.dfa", cmd->dfa_cache_dir, name) < 0)
+		return NULL;
+
+	return buf;
+}
+
 static int _init_dev_cache(struct cmd_context *cmd)
 {
 	const struct dm_config_node *cn;
@@ -682,6 +716,12 @@ static int _init_dev_cache(struct cmd_context *cmd)
 		find_config_tree_int(cmd, "devices/disable_after_error_count",
 				     DEFAULT_DISABLE_AFTER_ERROR_COUNT));
 
+	init_scan_queue_depth(
+		find_config_tree_int(cmd, "devices/scan_queue_depth",
+				     DEFAULT_SCAN_QUEUE_DEPTH));
+
+	_init_dfa_cache_dir(cmd);
+
 	if (!dev_cache_init(cmd))
 		return_0;
 
@@ -762,6 +802,7 @@ static struct dev_filter *_init_filter_components(struct cmd_context *cmd)
 	const struct dm_config_node *cn;
 	struct dev_filter *filters[MAX_FILTERS] = { 0 };
 	struct dev_filter *composite;
+	char dfa_file[PATH_MAX];
 
 	/*
 	 * Filters listed in order: top one gets applied first.
@@ -785,7 +826,8 @@ static struct dev_filter *_init_filter_components(struct cmd_context *cmd)
 		log_very_verbose("devices/filter not found in config file: "
 				 "no regex filter installed");
 
-	else if (!(filters[nr_filt] = regex_filter_create(cn->v))) {
+	else if (!(filters[nr_filt] = regex_filter_create(cn->v,
+			_dfa_cache_file(cmd, "filter", dfa_file, sizeof(dfa_file))))) {
 		log_error("Failed to create regex device filter");
 		goto bad;
 	} else
@@ -829,9 +871,46 @@ bad:
 	return NULL;
 }
 
+static int _crc_line(const char *line, void *baton)
+{
+	uint32_t *crc = baton;
+
+	*crc = calc_crc(*crc, (const uint8_t *) line, (uint32_t) strlen(line) + 1);
+
+	return 1;
+}
+
+/*
+ * Hash the settings _init_filter_components() builds the filters from,
+ * so cached verdicts are not used under different ones.
+ */
+static uint32_t _filter_config_hash(struct cmd_context *cmd)
+{
+	static const char *const _settings[] = {
+		"devices/filter",
+		"devices/types",
+		"devices/sysfs_scan",
+		"devices/md_component_detection",
+		"devices/multipath_component_detection",
+		NULL
+	};
+	const char *const *setting;
+	const struct dm_config_node *cn;
+	uint32_t crc = INITIAL_CRC;
+
+	for (setting = _settings; *setting; setting++) {
+		(void) _crc_line(*setting, &crc);
+		if ((cn = find_config_tree_node(cmd, *setting)))
+			(void) dm_config_write_one_node(cn, _crc_line, &crc);
+	}
+
+	return crc;
+}
+
 static int _init_filters(struct cmd_context *cmd, unsigned load_persistent_cache)
 {
 	static char cache_file[PATH_MAX];
+	char dfa_file[PATH_MAX];
 	const char *dev_cache = NULL, *cache_dir, *cache_file_prefix;
 	struct dev_filter *f3 = NULL, *f4 = NULL, *toplevel_components[2] = { 0 };
 	struct stat st;
@@ -873,7 +952,9 @@ static int _init_filters(struct cmd_context *cmd, unsigned load_persistent_cache
 	if (!dev_cache)
 		dev_cache = cache_file;
 
-	if (!(f4 = persistent_filter_create(f3, dev_cache))) {
+	if (!(f4 = persistent_filter_create(f3, dev_cache, cmd->proc_dir,
+					    cmd->sysfs_dir,
+					    _filter_config_hash(cmd)))) {
 		log_verbose("Failed to create persistent device filter.");
 		f3->destroy(f3);
 		return_0;
@@ -893,13 +974,14 @@ static int _init_filters(struct cmd_context *cmd, unsigned load_persistent_cache
 	if (load_persistent_cache && !cmd->is_long_lived &&
 	    !stat(dev_cache, &st) &&
 	    (st.st_ctime > config_file_timestamp(cmd->cft)) &&
-	    !persistent_filter_load(f4, NULL))
+	    !persistent_filter_load(f4))
 		log_verbose("Failed to load existing device cache from %s",
 			    dev_cache);
 
 	if (!(cn = find_config_tree_node(cmd, "devices/global_filter"))) {
 		cmd->filter = f4;
-	} else if (!(cmd->lvmetad_filter = regex_filter_create(cn->v)))
+	} else if (!(cmd->lvmetad_filter = regex_filter_create(cn->v,
+			_dfa_cache_file(cmd, "global_filter", dfa_file, sizeof(dfa_file)))))
 		goto_bad;
 	else {
 		toplevel_components[0] = cmd->lvmetad_filter;
@@ -1643,6 +1725,8 @@ void destroy_toolcontext(struct cmd_context *cmd)
 		cmd->filter->destroy(cmd->filter);
 	if (cmd->mem)
 		dm_pool_destroy(cmd->mem);
+	dev_bcache_reset();
+	dev_io_release_buffers();
 	dev_cache_exit();
 	_destroy_tags(cmd);
 
@@ -87,12 +87,15 @@ struct cmd_context {
 	unsigned si_unit_consistency:1;
 	unsigned metadata_read_only:1;
 	unsigned threaded:1;		/* Set if running within a thread e.g. clvmd */
+	unsigned rescan_devices:1;	/* Next label scan must be a full one */
 
 	unsigned independent_metadata_areas:1;	/* Active formats have MDAs outside PVs */
 
 	struct dev_filter *filter;
 	struct dev_filter *lvmetad_filter;
 	int dump_filter;	/* Dump filter when exiting? */
+	uint64_t uevent_seqnum;	/* Devices unchanged since, for long-lived handles */
+	uint64_t block_devices;	/* Stamp of the block devices at uevent_seqnum */
 
 	struct dm_list config_files;
 	int config_valid;
@@ -112,6 +115,7 @@ struct cmd_context {
 	char dev_dir[PATH_MAX];
 	char proc_dir[PATH_MAX];
 	char sysfs_dir[PATH_MAX]; /* FIXME Use global value instead. */
+	char dfa_cache_dir[PATH_MAX]; /* Empty if compiled patterns are not cached */
 };
 
 /*
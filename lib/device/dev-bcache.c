@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "lib.h"
+#include "dev-bcache.h"
+#include "memlock.h"
+
+#define BCACHE_BLOCK_MASK	((uint64_t) BCACHE_BLOCK_SIZE - 1)
+#define BCACHE_MAX_BLOCKS	2048	/* 8MB */
+
+struct bcache_key {
+	struct device *dev;
+	uint64_t index;
+};
+
+struct bcache_block {
+	struct dm_list lru;		/* Least recently used first */
+	struct dm_list dev_list;	/* Blocks of the same device */
+	struct bcache_key key;
+	char data[BCACHE_BLOCK_SIZE];
+};
+
+static struct dm_hash_table *_blocks = NULL;
+static DM_LIST_INIT(_lru);
+static unsigned _nr_blocks = 0;
+static uint64_t _hits = 0;
+static uint64_t _misses = 0;
+
+static void _set_key(struct bcache_key *key, struct device *dev, uint64_t index)
+{
+	/* Keys are hashed as binary, so padding must be zeroed too */
+	memset(key, 0, sizeof(*key));
+	key->dev = dev;
+	key->index = index;
+}
+
+static struct bcache_block *_lookup(struct device *dev, uint64_t index)
+{
+	struct bcache_key key;
+
+	_set_key(&key, dev, index);
+
+	return dm_hash_lookup_binary(_blocks, &key, sizeof(key));
+}
+
+static void _drop(struct bcache_block *b)
+{
+	dm_hash_remove_binary(_blocks, &b->key, sizeof(b->key));
+	dm_list_del(&b->lru);
+	dm_list_del(&b->dev_list);
+	dm_free(b);
+	_nr_blocks--;
+}
+
+static struct bcache_block *_alloc_block(struct device *dev, uint64_t index)
+{
+	struct bcache_block *b;
+
+	if (_nr_blocks >= BCACHE_MAX_BLOCKS)
+		_drop(dm_list_struct_base(dm_list_first(&_lru),
+					 struct bcache_block, lru));
+
+	if (!(b = dm_malloc(sizeof(*b))))
+		return_NULL;
+
+	_set_key(&b->key, dev, index);
+
+	if (!dm_hash_insert_binary(_blocks, &b->key, sizeof(b->key), b)) {
+		dm_free(b);
+		return_NULL;
+	}
+
+	dm_list_add(&dev->bcache_blocks, &b->dev_list);
+	dm_list_add(&_lru, &b->lru);
+	_nr_blocks++;
+
+	return b;
+}
+
+int dev_bcache_enabled(struct device *dev)
+{
+	/* Regular files hold config, backups and logs: never cache them */
+	return !(dev->flags & DEV_REGULAR) && !critical_section();
+}
+
+int dev_bcache_read(struct device *dev, uint64_t offset, size_t len,
+		    void *buffer)
+{
+	uint64_t index, end = offset + len;
+	struct bcache_block *b;
+	char *out = buffer;
+	size_t skip, n;
+
+	if (!len || !dev_bcache_enabled(dev))
+		return 0;
+
+	if (dm_list_empty(&dev->bcache_blocks))
+		goto miss;
+
+	for (index = offset >> BCACHE_BLOCK_SHIFT;
+	     index <= (end - 1) >> BCACHE_BLOCK_SHIFT; index++)
+		if (!_lookup(dev, index))
+			goto miss;
+
+	while (offset < end) {
+		b = _lookup(dev, offset >> BCACHE_BLOCK_SHIFT);
+		skip = (size_t) (offset & BCACHE_BLOCK_MASK);
+		n = BCACHE_BLOCK_SIZE - skip;
+		if (n > end - offset)
+			n = (size_t) (end - offset);
+
+		memcpy(out, b->data + skip, n);
+		dm_list_move(&_lru, &b->lru);
+
+		out += n;
+		offset += n;
+	}
+
+	_hits++;
+
+	return 1;
+
+miss:
+	_misses++;
+
+	return 0;
+}
+
+void dev_bcache_insert(struct device *dev, uint64_t offset, size_t len,
+		       const void *buffer)
+{
+	uint64_t start = (offset + BCACHE_BLOCK_MASK) & ~BCACHE_BLOCK_MASK;
+	uint64_t end = (offset + len) & ~BCACHE_BLOCK_MASK;
+	const char *in = (const char *) buffer + (start - offset);
+	struct bcache_block *b;
+
+	if (!dev_bcache_enabled(dev))
+		return;
+
+	if (!_blocks && !(_blocks = dm_hash_create(BCACHE_MAX_BLOCKS))) {
+		log_debug("Failed to create block cache.");
+		return;
+	}
+
+	for (; start < end; start += BCACHE_BLOCK_SIZE, in += BCACHE_BLOCK_SIZE) {
+		if ((b = _lookup(dev, start >> BCACHE_BLOCK_SHIFT)))
+			dm_list_move(&_lru, &b->lru);
+		else if (!(b = _alloc_block(dev, start >> BCACHE_BLOCK_SHIFT)))
+			return;
+
+		memcpy(b->data, in, BCACHE_BLOCK_SIZE);
+	}
+}
+
+/*
+ * A NULL buffer drops the blocks instead, e.g. after a failed write.
+ */
+void dev_bcache_write(struct device *dev, uint64_t offset, size_t len,
+		      const void *buffer)
+{
+	uint64_t end = offset + len;
+	const char *in = buffer;
+	struct bcache_block *b;
+	size_t skip, n;
+
+	if (!len || dm_list_empty(&dev->bcache_blocks))
+		return;
+
+	while (offset < end) {
+		skip = (size_t) (offset & BCACHE_BLOCK_MASK);
+		n = BCACHE_BLOCK_SIZE - skip;
+		if (n > end - offset)
+			n = (size_t) (end - offset);
+
+		if ((b = _lookup(dev, offset >> BCACHE_BLOCK_SHIFT))) {
+			if (in)
+				memcpy(b->data + skip, in, n);
+			else
+				_drop(b);
+		}
+
+		if (in)
+			in += n;
+		offset += n;
+	}
+}
+
+void dev_bcache_invalidate_dev(struct device *dev)
+{
+	struct bcache_block *b, *tmp;
+
+	dm_list_iterate_items_gen_safe(b, tmp, &dev->bcache_blocks, dev_list)
+		_drop(b);
+}
+
+void dev_bcache_invalidate(void)
+{
+	struct bcache_block *b, *tmp;
+
+	dm_list_iterate_items_gen_safe(b, tmp, &_lru, lru)
+		_drop(b);
+}
+
+void dev_bcache_reset(void)
+{
+	if (_hits || _misses)
+		log_debug("Block cache: %" PRIu64 " hits, %" PRIu64 " misses.",
+			  _hits, _misses);
+
+	dev_bcache_invalidate();
+
+	if (_blocks) {
+		dm_hash_destroy(_blocks);
+		_blocks = NULL;
+	}
+
+	_hits = _misses = 0;
+}
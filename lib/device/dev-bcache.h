@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _LVM_DEV_BCACHE_H
+#define _LVM_DEV_BCACHE_H
+
+#include "device.h"
+
+/*
+ * Cache of device blocks sitting underneath dev_read() and dev_write().
+ * Blocks outlive closing their device, so a label_read() following a
+ * label scan, or a second look at an mda_header, is served from memory.
+ * Taking a VG lock drops the blocks of the devices lvmcache has in that
+ * VG, and of any found to be in it while the lock is held, so the VG
+ * metadata read once the lock is held always comes from disk.  The
+ * global lock, each full label scan and the end of each command drop
+ * the whole cache.
+ *
+ * The cache lives in unlocked static variables: only call these
+ * functions from the command's own thread.
+ */
+#define BCACHE_BLOCK_SHIFT	12
+#define BCACHE_BLOCK_SIZE	(1 << BCACHE_BLOCK_SHIFT)
+
+/* Does the cache accept blocks from this device at the moment? */
+int dev_bcache_enabled(struct device *dev);
+
+/* Returns 1 only if the whole region was copied out of the cache */
+int dev_bcache_read(struct device *dev, uint64_t offset, size_t len,
+		    void *buffer);
+
+/* Region must be block-aligned; blocks already cached are replaced */
+void dev_bcache_insert(struct device *dev, uint64_t offset, size_t len,
+		       const void *buffer);
+
+/* Write-through: refresh any cached blocks overlapping the region */
+void dev_bcache_write(struct device *dev, uint64_t offset, size_t len,
+		      const void *buffer);
+
+void dev_bcache_invalidate_dev(struct device *dev);
+void dev_bcache_invalidate(void);
+
+/* Log hit and miss counters, then drop everything */
+void dev_bcache_reset(void);
+
+#endif
@@ -15,14 +15,18 @@
 
 #include "lib.h"
 #include "dev-cache.h"
+#include "dev-sysfs.h"
+#include "dev-bcache.h"
 #include "lvm-types.h"
 #include "btree.h"
 #include "filter.h"
+#include "lvm-regex.h"
 #include "toolcontext.h"
 
 #include <unistd.h>
 #include <sys/param.h>
 #include <dirent.h>
+#include <fcntl.h>
 
 struct dev_iter {
 	struct btree_iter *current;
@@ -37,6 +41,7 @@ struct dir_list {
 static struct {
 	struct dm_pool *mem;
 	struct dm_hash_table *names;
+	struct dm_hash_table *links;	/* Symlink or not, during a scan */
 	struct btree *devices;
 	struct dm_regex *preferred_names_matcher;
 	const char *dev_dir;
@@ -63,6 +68,7 @@ static void _dev_init(struct device *dev, int max_error_count)
 
 	dm_list_init(&dev->aliases);
 	dm_list_init(&dev->open_list);
+	dm_list_init(&dev->bcache_blocks);
 }
 
 struct device *dev_create_file(const char *filename, struct device *dev,
@@ -207,6 +213,39 @@ static int _apply_builtin_path_preference_rules(const char *path0, const char *p
 	return -1;
 }
 
+#define LINK_NO		((void *) 1)
+#define LINK_YES	((void *) 2)
+
+static void _remember_link(const char *path, int is_link)
+{
+	if (_cache.links &&
+	    !dm_hash_insert(_cache.links, path, is_link ? LINK_YES : LINK_NO))
+		log_debug("%s: Failed to remember file type", path);
+}
+
+/*
+ * Returns 1 for a symlink, 0 for anything else or -1 if lstat fails.
+ * A scan compares each new alias with the preferred one, and most of them
+ * share the same few directories, so the answers are kept until it ends.
+ */
+static int _is_link(const char *path)
+{
+	struct stat info;
+	void *known;
+
+	if (_cache.links && (known = dm_hash_lookup(_cache.links, path)))
+		return known == LINK_YES;
+
+	if (lstat(path, &info)) {
+		log_sys_very_verbose("lstat", path);
+		return -1;
+	}
+
+	_remember_link(path, S_ISLNK(info.st_mode));
+
+	return S_ISLNK(info.st_mode) ? 1 : 0;
+}
+
 /* Return 1 if we prefer path1 else return 0 */
 static int _compare_paths(const char *path0, const char *path1)
 {
@@ -215,7 +254,7 @@ static int _compare_paths(const char *path0, const char *path1)
 	const char *p;
 	char p0[PATH_MAX], p1[PATH_MAX];
 	char *s0, *s1;
-	struct stat stat0, stat1;
+	int link0, link1;
 	int r;
 
 	/*
@@ -277,17 +316,13 @@ static int _compare_paths(const char *path0, const char *path1)
 			*s0 = '\0';
 			*s1 = '\0';
 		}
-		if (lstat(p0, &stat0)) {
-			log_sys_very_verbose("lstat", p0);
+		if ((link0 = _is_link(p0)) < 0)
 			return 1;
-		}
-		if (lstat(p1, &stat1)) {
-			log_sys_very_verbose("lstat", p1);
+		if ((link1 = _is_link(p1)) < 0)
 			return 0;
-		}
-		if (S_ISLNK(stat0.st_mode) && !S_ISLNK(stat1.st_mode))
+		if (link0 && !link1)
 			return 0;
-		if (!S_ISLNK(stat0.st_mode) && S_ISLNK(stat1.st_mode))
+		if (!link0 && link1)
 			return 1;
 		if (s0) {
 			*s0++ = '/';
@@ -393,16 +428,6 @@ static int _insert_dev(const char *path, dev_t d)
 	return 1;
 }
 
-static char *_join(const char *dir, const char *name)
-{
-	size_t len = strlen(dir) + strlen(name) + 2;
-	char *r = dm_malloc(len);
-	if (r)
-		snprintf(r, len, "%s/%s", dir, name);
-
-	return r;
-}
-
 /*
  * Get rid of extra slashes in the path string.
  */
@@ -425,32 +450,190 @@ static void _collapse_slashes(char *str)
 	*str = *ptr;
 }
 
-static int _insert_dir(const char *dir)
+struct dir_entry {
+	unsigned char type;	/* d_type, which may be DT_UNKNOWN */
+	char name[0];
+};
+
+/* Same order as scandir with alphasort */
+static int _compare_entries(const void *a, const void *b)
 {
-	int n, dirent_count, r = 1;
-	struct dirent **dirent;
-	char *path;
-
-	dirent_count = scandir(dir, &dirent, NULL, alphasort);
-	if (dirent_count > 0) {
-		for (n = 0; n < dirent_count; n++) {
-			if (dirent[n]->d_name[0] == '.') {
-				free(dirent[n]);
-				continue;
+	return strcoll((*(struct dir_entry * const *) a)->name,
+		       (*(struct dir_entry * const *) b)->name);
+}
+
+static int _insert_dir_fd(struct dm_pool *mem, int fd, char *path, size_t len);
+
+/*
+ * path holds the name of the entry, which lives in directory dfd.
+ * The type of most entries is known from the directory itself, so only
+ * block devices and symlinks need a stat, and only entries of unknown type
+ * need an lstat as well.
+ */
+static int _insert_dir_entry(struct dm_pool *mem, int dfd, char *path,
+			     size_t len, const struct dir_entry *e)
+{
+	unsigned char type = e->type;
+	struct stat info;
+	int fd;
+
+	if (type == DT_UNKNOWN) {
+		if (fstatat(dfd, e->name, &info, AT_SYMLINK_NOFOLLOW) < 0) {
+			log_sys_very_verbose("lstat", path);
+			return 0;
+		}
+		type = IFTODT(info.st_mode);
+	}
+
+	if (type == DT_DIR) {
+		if ((fd = openat(dfd, e->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW)) < 0) {
+			log_sys_very_verbose("open", path);
+			return 0;
+		}
+
+		_remember_link(path, 0);
+
+		return _insert_dir_fd(mem, fd, path, len);
+	}
+
+	if (type != DT_BLK && type != DT_LNK) {
+		log_debug("%s: Not a block device", path);
+		return 0;
+	}
+
+	if (fstatat(dfd, e->name, &info, 0) < 0) {
+		log_sys_very_verbose("stat", path);
+		return 0;
+	}
+
+	if (S_ISDIR(info.st_mode)) {
+		log_debug("%s: Symbolic link to directory", path);
+		return 0;
+	}
+
+	if (!S_ISBLK(info.st_mode)) {
+		log_debug("%s: Not a block device", path);
+		return 0;
+	}
+
+	_remember_link(path, type == DT_LNK);
+
+	if (!_insert_dev(path, info.st_rdev))
+		return_0;
+
+	return 1;
+}
+
+/*
+ * Read a whole directory through the open fd (which is closed here) before
+ * inserting its entries in sorted order, so names can be looked up relative
+ * to it instead of walking the full path again for each one.
+ */
+static int _insert_dir_fd(struct dm_pool *mem, int fd, char *path, size_t len)
+{
+	struct dir_entry **entries = NULL, **tmp, *e, *first = NULL;
+	unsigned n, count = 0, size = 0;
+	struct dirent *dirent;
+	size_t dir_len = len, name_len;
+	DIR *d;
+	int r = 1;
+
+	if (!(d = fdopendir(fd))) {
+		log_sys_very_verbose("fdopendir", path);
+		if (close(fd))
+			log_sys_debug("close", path);
+		return 1;
+	}
+
+	while ((dirent = readdir(d))) {
+		if (dirent->d_name[0] == '.')
+			continue;
+
+		if (count == size) {
+			size = size ? size * 2 : 64;
+			if (!(tmp = dm_realloc(entries, size * sizeof(*entries)))) {
+				log_error("Failed to allocate directory entries.");
+				r = 0;
+				goto out;
 			}
+			entries = tmp;
+		}
 
-			if (!(path = _join(dir, dirent[n]->d_name)))
-				return_0;
+		name_len = strlen(dirent->d_name) + 1;
+		if (!(e = dm_pool_alloc(mem, sizeof(*e) + name_len))) {
+			log_error("Failed to allocate directory entry.");
+			r = 0;
+			goto out;
+		}
 
-			_collapse_slashes(path);
-			r &= _insert(path, 1, 0);
-			dm_free(path);
+		if (!first)
+			first = e;
+
+		e->type = dirent->d_type;
+		memcpy(e->name, dirent->d_name, name_len);
+		entries[count++] = e;
+	}
 
-			free(dirent[n]);
+	qsort(entries, count, sizeof(*entries), _compare_entries);
+
+	if (path[dir_len - 1] != '/')
+		path[dir_len++] = '/';
+
+	for (n = 0; n < count; n++) {
+		name_len = strlen(entries[n]->name);
+		if (dir_len + name_len >= PATH_MAX) {
+			path[dir_len] = '\0';
+			log_debug("%s: Path name too long for %s", path, entries[n]->name);
+			r = 0;
+			continue;
 		}
-		free(dirent);
+
+		memcpy(path + dir_len, entries[n]->name, name_len + 1);
+		r &= _insert_dir_entry(mem, dirfd(d), path, dir_len + name_len, entries[n]);
+	}
+
+out:
+	path[len] = '\0';
+	if (first)
+		dm_pool_free(mem, first);
+	dm_free(entries);
+	if (closedir(d))
+		log_sys_debug("closedir", path);
+
+	return r;
+}
+
+static int _insert_dir(const char *dir)
+{
+	char path[PATH_MAX];
+	struct dm_pool *mem;
+	size_t len;
+	int fd, r;
+
+	if (!dm_strncpy(path, dir, sizeof(path))) {
+		log_debug("%s: Path name too long", dir);
+		return 0;
+	}
+
+	_collapse_slashes(path);
+	if ((len = strlen(path)) > 1 && path[len - 1] == '/')
+		path[--len] = '\0';
+
+	if ((fd = open(path, O_RDONLY | O_DIRECTORY)) < 0) {
+		log_sys_very_verbose("open", path);
+		return 1;
 	}
 
+	if (!(mem = dm_pool_create("dev scan", 16 * 1024))) {
+		if (close(fd))
+			log_sys_debug("close", path);
+		return_0;
+	}
+
+	r = _insert_dir_fd(mem, fd, path, len);
+
+	dm_pool_destroy(mem);
+
 	return r;
 }
 
@@ -642,11 +825,22 @@ static void _full_scan(int dev_scan)
 	if (_cache.has_scanned && !dev_scan)
 		return;
 
+	/* Devices found now may be newer than the sysfs snapshot */
+	dev_sysfs_reset();
+
+	if (!(_cache.links = dm_hash_create(1024)))
+		log_debug("Failed to create file type cache.");
+
 	_insert_dirs(&_cache.dirs);
 
 	dm_list_iterate_items(dl, &_cache.files)
 		_insert_file(dl->dir);
 
+	if (_cache.links) {
+		dm_hash_destroy(_cache.links);
+		_cache.links = NULL;
+	}
+
 	_cache.has_scanned = 1;
 	init_full_scan_done(1);
 }
@@ -670,6 +864,8 @@ static int _init_preferred_names(struct cmd_context *cmd)
 	const struct dm_config_value *v;
 	struct dm_pool *scratch = NULL;
 	const char **regex;
+	char dfa_file[PATH_MAX];
+	const char *file = NULL;
 	unsigned count = 0;
 	int i, r = 0;
 
@@ -708,8 +904,13 @@ static int _init_preferred_names(struct cmd_context *cmd)
 		}
 	}
 
+	if (*cmd->dfa_cache_dir &&
+	    dm_snprintf(dfa_file, sizeof(dfa_file), "%s/preferred_names.dfa",
+			cmd->dfa_cache_dir) >= 0)
+		file = dfa_file;
+
 	if (!(_cache.preferred_names_matcher =
-		dm_regex_create(_cache.mem, regex, count))) {
+		regex_create_cached(_cache.mem, regex, count, file))) {
 		log_error("Preferred device name pattern matcher creation failed.");
 		goto out;
 	}
@@ -775,6 +976,9 @@ void dev_cache_exit(void)
 	if (_cache.names)
 		_check_for_open_devices();
 
+	dev_sysfs_reset();
+	dev_bcache_invalidate();
+
 	if (_cache.preferred_names_matcher)
 		_cache.preferred_names_matcher = NULL;
 
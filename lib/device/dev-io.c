@@ -16,6 +16,7 @@
 #include "lib.h"
 #include "lvm-types.h"
 #include "device.h"
+#include "dev-bcache.h"
 #include "metadata.h"
 #include "lvmcache.h"
 #include "memlock.h"
@@ -26,6 +27,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/syscall.h>
 
 #ifdef linux
 #  define u64 uint64_t		/* Missing without __KERNEL__ */
@@ -54,6 +56,12 @@
 #  endif
 #endif
 
+/* Native kernel aio is used directly, so no libaio is required */
+#if defined(linux) && defined(__NR_io_setup)
+#  include <linux/aio_abi.h>
+#  define AIO_SUPPORT
+#endif
+
 static DM_LIST_INIT(_open_devices);
 
 /*-----------------------------------------------------------------
@@ -164,13 +172,215 @@ static void _widen_region(unsigned int block_size, struct device_area *region,
 		result->size += block_size - delta;
 }
 
+/*
+ * Page-aligned buffers are kept for reuse rather than allocating a
+ * fresh bounce buffer for every io.  Callers can also obtain one with
+ * dev_io_buffer_get() and fill it directly: the space around their
+ * data is then used in place and nothing needs to be copied.
+ */
+#define IO_BUFFERS_MAX 8	/* Idle buffers kept for reuse */
+
+struct io_buffer {
+	struct dm_list list;
+	char *mem;		/* As allocated */
+	char *start;		/* Page-aligned */
+	size_t size;
+	unsigned in_use;
+};
+
+static DM_LIST_INIT(_io_buffers);
+static unsigned _io_buffer_allocs = 0;
+static uint64_t _io_bytes_copied = 0;
+
+static void _io_buffer_destroy(struct io_buffer *iob)
+{
+	dm_list_del(&iob->list);
+	dm_free(iob->mem);
+	dm_free(iob);
+}
+
+static struct io_buffer *_io_buffer_get(size_t size)
+{
+	uintptr_t mask = lvm_getpagesize() - 1;
+	struct io_buffer *iob, *best = NULL;
+
+	/* Smallest idle buffer that is big enough */
+	dm_list_iterate_items(iob, &_io_buffers)
+		if (!iob->in_use && iob->size >= size &&
+		    (!best || iob->size < best->size))
+			best = iob;
+
+	if (best) {
+		best->in_use = 1;
+		return best;
+	}
+
+	if (!(iob = dm_zalloc(sizeof(*iob)))) {
+		log_error("Io buffer allocation failed");
+		return NULL;
+	}
+
+	if (!(iob->mem = dm_malloc(size + mask))) {
+		log_error("Io buffer malloc failed");
+		dm_free(iob);
+		return NULL;
+	}
+
+	iob->start = (char *) ((((uintptr_t) iob->mem) + mask) & ~mask);
+	iob->size = size;
+	iob->in_use = 1;
+	dm_list_add(&_io_buffers, &iob->list);
+	_io_buffer_allocs++;
+
+	return iob;
+}
+
+static void _io_buffer_put(struct io_buffer *iob)
+{
+	struct io_buffer *idle;
+	unsigned nr_idle = 0;
+
+	iob->in_use = 0;
+
+	dm_list_iterate_items(idle, &_io_buffers)
+		if (!idle->in_use)
+			nr_idle++;
+
+	if (nr_idle > IO_BUFFERS_MAX)
+		_io_buffer_destroy(iob);
+}
+
+/*
+ * Find the buffer in use that holds the whole region [buf, buf + len).
+ */
+static struct io_buffer *_io_buffer_find(const char *buf, size_t len)
+{
+	struct io_buffer *iob;
+
+	dm_list_iterate_items(iob, &_io_buffers)
+		if (iob->in_use && buf >= iob->start &&
+		    buf + len <= iob->start + iob->size)
+			return iob;
+
+	return NULL;
+}
+
+static void _io_copy(void *dest, const void *src, size_t n)
+{
+	memcpy(dest, src, n);
+	_io_bytes_copied += n;
+}
+
+void *dev_io_buffer_get(uint64_t offset, size_t len)
+{
+	size_t pagesize = (size_t) lvm_getpagesize();
+	size_t head = (size_t) (offset & (pagesize - 1));
+	struct io_buffer *iob;
+
+	/* Cover the io widened to whole pages, which contain whole blocks */
+	if (!(iob = _io_buffer_get((head + len + pagesize - 1) & ~(pagesize - 1))))
+		return_NULL;
+
+	return iob->start + head;
+}
+
+void dev_io_buffer_put(void *buf)
+{
+	struct io_buffer *iob;
+
+	if (!buf)
+		return;
+
+	if (!(iob = _io_buffer_find(buf, 0))) {
+		log_error(INTERNAL_ERROR "Attempt to release unknown io buffer.");
+		return;
+	}
+
+	_io_buffer_put(iob);
+}
+
+void dev_io_release_buffers(void)
+{
+	struct io_buffer *iob, *tmp;
+
+	if (_io_buffer_allocs || _io_bytes_copied)
+		log_debug("Io buffers: %u allocated, %" PRIu64 " bytes copied.",
+			  _io_buffer_allocs, _io_bytes_copied);
+
+	dm_list_iterate_items_safe(iob, tmp, &_io_buffers)
+		if (!iob->in_use)
+			_io_buffer_destroy(iob);
+
+	_io_buffer_allocs = 0;
+	_io_bytes_copied = 0;
+}
+
+/*
+ * Before writing the widened region from bounce, fill the parts of its
+ * first and last blocks that lie outside the caller's data with what
+ * is already on disk.  Only those partial blocks are read, and the
+ * caller's data inside bounce is left untouched.
+ */
+static int _read_partial_blocks(struct device_area *where,
+				struct device_area *widened, char *bounce,
+				unsigned int block_size)
+{
+	size_t head = (size_t) (where->start - widened->start);
+	size_t tail = (size_t) (widened->start + widened->size -
+				where->start - where->size);
+	struct device_area block;
+	struct io_buffer *iob;
+
+	if (!head && !tail)
+		return 1;
+
+	if (!(iob = _io_buffer_get(block_size)))
+		return_0;
+
+	block.dev = where->dev;
+	block.size = block_size;
+
+	if (head) {
+		block.start = widened->start;
+		if (!dev_bcache_read(block.dev, block.start, block_size, iob->start) &&
+		    !_io(&block, iob->start, 0))
+			/* FIXME pre-extend the file */
+			memset(iob->start, '\n', block_size);
+
+		_io_copy(bounce, iob->start, head);
+
+		/* Both ends in the same block? */
+		if (tail && widened->size == block_size) {
+			_io_copy(bounce + block_size - tail,
+				 iob->start + block_size - tail, tail);
+			tail = 0;
+		}
+	}
+
+	if (tail) {
+		block.start = widened->start + widened->size - block_size;
+		if (!dev_bcache_read(block.dev, block.start, block_size, iob->start) &&
+		    !_io(&block, iob->start, 0))
+			memset(iob->start, '\n', block_size);
+
+		_io_copy(bounce + widened->size - tail,
+			 iob->start + block_size - tail, tail);
+	}
+
+	_io_buffer_put(iob);
+
+	return 1;
+}
+
 static int _aligned_io(struct device_area *where, char *buffer,
 		       int should_write)
 {
-	char *bounce, *bounce_buf;
+	struct io_buffer *iob = NULL;
+	char *bounce;
 	unsigned int block_size = 0;
 	uintptr_t mask;
 	struct device_area widened;
+	size_t delta;
 	int r = 0;
 
 	if (!(where->dev->flags & DEV_REGULAR) &&
@@ -188,44 +398,41 @@ static int _aligned_io(struct device_area *where, char *buffer,
 	    !((uintptr_t) buffer & mask))
 		return _io(where, buffer, should_write);
 
-	/* Allocate a bounce buffer with an extra block */
-	if (!(bounce_buf = bounce = dm_malloc((size_t) widened.size + block_size))) {
-		log_error("Bounce buffer malloc failed");
-		return 0;
+	/* Can the io buffer holding the data be used in place? */
+	delta = (size_t) (where->start - widened.start);
+	bounce = buffer - delta;
+	if (((uintptr_t) bounce & mask) ||
+	    !_io_buffer_find(bounce, (size_t) widened.size)) {
+		if (!(iob = _io_buffer_get((size_t) widened.size)))
+			return_0;
+		bounce = iob->start;
 	}
 
-	/*
-	 * Realign start of bounce buffer (using the extra sector)
-	 */
-	if (((uintptr_t) bounce) & mask)
-		bounce = (char *) ((((uintptr_t) bounce) + mask) & ~mask);
-
-	/* channel the io through the bounce buffer */
-	if (!_io(&widened, bounce, 0)) {
-		if (!should_write)
+	if (!should_write) {
+		if (!_io(&widened, bounce, 0))
 			goto_out;
-		/* FIXME pre-extend the file */
-		memset(bounce, '\n', widened.size);
-	}
 
-	if (should_write) {
-		memcpy(bounce + (where->start - widened.start), buffer,
-		       (size_t) where->size);
+		if (iob)
+			_io_copy(buffer, bounce + delta, (size_t) where->size);
 
-		/* ... then we write */
-		if (!(r = _io(&widened, bounce, 1)))
-			stack;
-			
+		r = 1;
 		goto out;
 	}
 
-	memcpy(buffer, bounce + (where->start - widened.start),
-	       (size_t) where->size);
+	if (!_read_partial_blocks(where, &widened, bounce, block_size))
+		goto_out;
 
-	r = 1;
+	if (iob)
+		_io_copy(bounce + delta, buffer, (size_t) where->size);
+
+	/* ... then we write */
+	if (!(r = _io(&widened, bounce, 1)))
+		stack;
 
 out:
-	dm_free(bounce_buf);
+	if (iob)
+		_io_buffer_put(iob);
+
 	return r;
 }
 
@@ -577,6 +784,7 @@ static void _close(struct device *dev)
 	log_debug("Closed %s", dev_name(dev));
 
 	if (dev->flags & DEV_ALLOCED) {
+		dev_bcache_invalidate_dev(dev);
 		dm_free((void *) dm_list_item(dev->aliases.n, struct str_list)->
 			 str);
 		dm_free(dev->aliases.n);
@@ -649,6 +857,36 @@ static void _dev_inc_error_count(struct device *dev)
 			 dev->max_error_count, dev_name(dev));
 }
 
+/*
+ * Read whole cache blocks around the region, keep them in the block
+ * cache and copy out the part requested.  Fails without side effects
+ * if the widened read is impossible, e.g. at the end of the device,
+ * so the caller can retry the exact region.
+ */
+static int _bcache_fill(struct device_area *where, char *buffer)
+{
+	struct device_area widened;
+	struct io_buffer *iob;
+	int r = 0;
+
+	_widen_region(BCACHE_BLOCK_SIZE, where, &widened);
+
+	if (!(iob = _io_buffer_get((size_t) widened.size)))
+		return 0;
+
+	if (_aligned_io(&widened, iob->start, 0)) {
+		dev_bcache_insert(where->dev, widened.start,
+				  (size_t) widened.size, iob->start);
+		_io_copy(buffer, iob->start + (where->start - widened.start),
+			 (size_t) where->size);
+		r = 1;
+	}
+
+	_io_buffer_put(iob);
+
+	return r;
+}
+
 int dev_read(struct device *dev, uint64_t offset, size_t len, void *buffer)
 {
 	struct device_area where;
@@ -660,12 +898,18 @@ int dev_read(struct device *dev, uint64_t offset, size_t len, void *buffer)
 	if (!_dev_is_valid(dev))
 		return 0;
 
+	if (dev_bcache_read(dev, offset, len, buffer))
+		return 1;
+
 	where.dev = dev;
 	where.start = offset;
 	where.size = len;
 
 	// fprintf(stderr, "READ: %s, %lld, %d\n", dev_name(dev), offset, len);
 
+	if (dev_bcache_enabled(dev) && _bcache_fill(&where, buffer))
+		return 1;
+
 	ret = _aligned_io(&where, buffer, 0);
 	if (!ret)
 		_dev_inc_error_count(dev);
@@ -744,6 +988,9 @@ int dev_write(struct device *dev, uint64_t offset, size_t len, void *buffer)
 	if (!ret)
 		_dev_inc_error_count(dev);
 
+	/* Writes are skipped in test mode so cached blocks must go */
+	dev_bcache_write(dev, offset, len, (ret && !test_mode()) ? buffer : NULL);
+
 	return ret;
 }
 
@@ -783,3 +1030,393 @@ int dev_set(struct device *dev, uint64_t offset, size_t len, int value)
 
 	return (len == 0);
 }
+
+/*-----------------------------------------------------------------
+ * Asynchronous io.
+ *
+ * Up to 'depth' reads or writes are kept in flight at once so that
+ * the latency of many devices overlaps.  Completed ios are handed
+ * back strictly in submission order, so callers see the same
+ * sequence of results as they would with dev_read() and
+ * dev_write().  If the kernel interface is unavailable, each io is
+ * performed synchronously instead.
+ *---------------------------------------------------------------*/
+#define AIO_MAX_EVENTS 64
+
+struct dev_aio_slot {
+	struct device *dev;
+	dev_aio_fn fn;
+	void *context;
+
+	struct device_area widened;
+	uint64_t delta;		/* Offset of the caller's data within buf */
+	int64_t result;		/* Bytes transferred or -errno */
+	unsigned done;
+	unsigned write;
+
+	char *buf;		/* Aligned within buf_alloc */
+	char *buf_alloc;
+	size_t buf_size;
+#ifdef AIO_SUPPORT
+	struct iocb cb;
+#endif
+};
+
+struct dev_aio {
+	unsigned depth;
+	unsigned head;		/* Oldest slot in use */
+	unsigned count;		/* Slots in use */
+#ifdef AIO_SUPPORT
+	aio_context_t ctx;
+#endif
+	struct dev_aio_slot slots[0];
+};
+
+#ifdef AIO_SUPPORT
+static int _io_setup(unsigned nr_events, aio_context_t *ctx)
+{
+	return syscall(__NR_io_setup, nr_events, ctx);
+}
+
+static int _io_destroy(aio_context_t ctx)
+{
+	return syscall(__NR_io_destroy, ctx);
+}
+
+static int _io_submit(aio_context_t ctx, long nr, struct iocb **iocbs)
+{
+	return syscall(__NR_io_submit, ctx, nr, iocbs);
+}
+
+static int _io_getevents(aio_context_t ctx, long min_nr, long nr,
+			 struct io_event *events)
+{
+	return syscall(__NR_io_getevents, ctx, min_nr, nr, events, NULL);
+}
+#endif
+
+struct dev_aio *dev_aio_create(unsigned depth)
+{
+	struct dev_aio *aio;
+
+	if (!depth)
+		depth = 1;
+
+	if (!(aio = dm_zalloc(sizeof(*aio) + depth * sizeof(aio->slots[0])))) {
+		log_error("Failed to allocate asynchronous io context.");
+		return NULL;
+	}
+
+	aio->depth = depth;
+
+#ifdef AIO_SUPPORT
+	if (_io_setup(depth, &aio->ctx) < 0) {
+		log_debug("Asynchronous io unavailable: %s. "
+			  "Using synchronous io.", strerror(errno));
+		aio->ctx = 0;
+	}
+#endif
+
+	return aio;
+}
+
+void dev_aio_destroy(struct dev_aio *aio)
+{
+	unsigned i;
+
+#ifdef AIO_SUPPORT
+	/* Waits for anything still in flight before buffers are freed */
+	if (aio->ctx && _io_destroy(aio->ctx) < 0)
+		log_sys_error("io_destroy", "");
+#endif
+
+	for (i = 0; i < aio->depth; i++)
+		dm_free(aio->slots[i].buf_alloc);
+
+	dm_free(aio);
+}
+
+static int _aio_slot_buffer(struct dev_aio_slot *slot, size_t size,
+			    unsigned int block_size)
+{
+	uintptr_t mask = lvm_getpagesize() - 1;
+
+	if (block_size > mask + 1)
+		mask = block_size - 1;
+
+	if (slot->buf_alloc && slot->buf_size >= size &&
+	    !((uintptr_t) slot->buf & mask))
+		return 1;
+
+	dm_free(slot->buf_alloc);
+	slot->buf_size = 0;
+
+	if (!(slot->buf_alloc = dm_malloc(size + mask))) {
+		log_error("Asynchronous io buffer allocation failed.");
+		return 0;
+	}
+
+	slot->buf = (char *) ((((uintptr_t) slot->buf_alloc) + mask) & ~mask);
+	slot->buf_size = size;
+
+	return 1;
+}
+
+#ifdef AIO_SUPPORT
+/*
+ * If completions cannot be collected, tear down the context, which waits
+ * for whatever is still in flight, and redo every unfinished io
+ * synchronously.  Later ios are synchronous too.  Each io still ends up
+ * with one result, so failures are counted once when it is completed.
+ */
+static void _aio_fall_back_to_sync(struct dev_aio *aio)
+{
+	struct dev_aio_slot *s;
+	unsigned i;
+
+	if (_io_destroy(aio->ctx) < 0)
+		log_sys_error("io_destroy", "");
+
+	aio->ctx = 0;
+
+	for (i = 0; i < aio->count; i++) {
+		s = &aio->slots[(aio->head + i) % aio->depth];
+		if (s->done)
+			continue;
+		s->result = _io(&s->widened, s->buf, s->write) ?
+			    (int64_t) s->widened.size : 0;
+		s->done = 1;
+	}
+}
+#endif
+
+/*
+ * Collect completion events until the given slot has finished.
+ */
+static void _aio_wait_slot(struct dev_aio *aio, struct dev_aio_slot *slot)
+{
+#ifdef AIO_SUPPORT
+	struct io_event events[AIO_MAX_EVENTS];
+	struct dev_aio_slot *s;
+	int i, n;
+
+	while (!slot->done) {
+		if ((n = _io_getevents(aio->ctx, 1, AIO_MAX_EVENTS, events)) < 0) {
+			if (errno == EINTR)
+				continue;
+			log_sys_error("io_getevents", dev_name(slot->dev));
+			_aio_fall_back_to_sync(aio);
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			s = (struct dev_aio_slot *) (uintptr_t) events[i].data;
+			s->result = events[i].res;
+			s->done = 1;
+		}
+	}
+#endif
+}
+
+/*
+ * Hand the oldest io back to its caller and release its slot.
+ */
+static void _aio_complete_oldest(struct dev_aio *aio)
+{
+	struct dev_aio_slot *slot = &aio->slots[aio->head];
+	void *buf = NULL;
+
+	_aio_wait_slot(aio, slot);
+
+	aio->head = (aio->head + 1) % aio->depth;
+	aio->count--;
+
+	if (slot->result == (int64_t) slot->widened.size) {
+		if (!slot->write)
+			dev_bcache_insert(slot->dev, slot->widened.start,
+					  (size_t) slot->widened.size, slot->buf);
+		buf = slot->buf + slot->delta;
+	} else {
+		if (slot->write) {
+			log_error("%s: write failed at %" PRIu64 ": %s",
+				  dev_name(slot->dev),
+				  (uint64_t) slot->widened.start,
+				  slot->result < 0 ?
+				  strerror((int) -slot->result) : "short write");
+			/* The cache was updated at submission */
+			dev_bcache_write(slot->dev, slot->widened.start,
+					 (size_t) slot->widened.size, NULL);
+		} else if (slot->result < 0)
+			log_error_once("%s: read failed at %" PRIu64 ": %s",
+				       dev_name(slot->dev),
+				       (uint64_t) slot->widened.start,
+				       strerror((int) -slot->result));
+		_dev_inc_error_count(slot->dev);
+	}
+
+	if (slot->fn)
+		slot->fn(slot->dev, buf, slot->context);
+}
+
+/*
+ * Does an io still in flight touch any block within 'where'?
+ */
+static int _aio_in_flight(struct dev_aio *aio, struct device_area *where)
+{
+	struct dev_aio_slot *slot;
+	unsigned i;
+
+	for (i = 0; i < aio->count; i++) {
+		slot = &aio->slots[(aio->head + i) % aio->depth];
+		if (slot->dev == where->dev &&
+		    slot->widened.start < where->start + where->size &&
+		    where->start < slot->widened.start + slot->widened.size)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * A NULL buffer requests a read; otherwise len bytes of buffer are
+ * copied and written out.
+ */
+static int _aio_submit(struct dev_aio *aio, struct device *dev, uint64_t offset,
+		       size_t len, const void *buffer, dev_aio_fn fn,
+		       void *context)
+{
+	struct dev_aio_slot *slot;
+	struct device_area where, widened;
+	unsigned int block_size = 0;
+	int should_write = buffer ? 1 : 0;
+#ifdef AIO_SUPPORT
+	struct iocb *cbs[1];
+#endif
+
+	if (!dev->open_count)
+		return_0;
+
+	if (!_dev_is_valid(dev))
+		return 0;
+
+	if (!(dev->flags & DEV_REGULAR) &&
+	    !_get_block_size(dev, &block_size))
+		return_0;
+
+	if (!block_size)
+		block_size = lvm_getpagesize();
+
+	/* Read whole blocks so that the data can seed the block cache */
+	if (!should_write && dev_bcache_enabled(dev) &&
+	    block_size < BCACHE_BLOCK_SIZE)
+		block_size = BCACHE_BLOCK_SIZE;
+
+	where.dev = dev;
+	where.start = offset;
+	where.size = len;
+
+	/*
+	 * Partial blocks around a write are filled from disk, so any
+	 * earlier io still in flight to those blocks must land first.
+	 */
+	if (should_write) {
+		_widen_region(block_size, &where, &widened);
+		if (_aio_in_flight(aio, &widened) &&
+		    !dev_aio_wait(aio))
+			return_0;
+	}
+
+	/* Make room by completing the oldest io if the queue is full */
+	if (aio->count == aio->depth)
+		_aio_complete_oldest(aio);
+
+	slot = &aio->slots[(aio->head + aio->count) % aio->depth];
+
+	_widen_region(block_size, &where, &slot->widened);
+
+	if (!_aio_slot_buffer(slot, (size_t) slot->widened.size, block_size))
+		return_0;
+
+	slot->dev = dev;
+	slot->fn = fn;
+	slot->context = context;
+	slot->delta = offset - slot->widened.start;
+	slot->write = should_write;
+	slot->done = 0;
+
+	if (should_write) {
+		if (!_read_partial_blocks(&where, &slot->widened, slot->buf,
+					  block_size))
+			return_0;
+
+		_io_copy(slot->buf + slot->delta, buffer, len);
+
+		dev->flags |= DEV_ACCESSED_W;
+
+		/* Writes are skipped in test mode so cached blocks must go */
+		dev_bcache_write(dev, offset, len, test_mode() ? NULL : buffer);
+
+		if (test_mode()) {
+			slot->result = (int64_t) slot->widened.size;
+			slot->done = 1;
+			aio->count++;
+			return 1;
+		}
+	}
+
+	aio->count++;
+
+#ifdef AIO_SUPPORT
+	if (aio->ctx) {
+		memset(&slot->cb, 0, sizeof(slot->cb));
+		slot->cb.aio_data = (uintptr_t) slot;
+		slot->cb.aio_lio_opcode = should_write ? IOCB_CMD_PWRITE :
+							 IOCB_CMD_PREAD;
+		slot->cb.aio_fildes = dev_fd(dev);
+		slot->cb.aio_buf = (uintptr_t) slot->buf;
+		slot->cb.aio_nbytes = slot->widened.size;
+		slot->cb.aio_offset = slot->widened.start;
+		cbs[0] = &slot->cb;
+
+		if (_io_submit(aio->ctx, 1, cbs) == 1)
+			return 1;
+
+		log_debug("%s: Asynchronous %s submission failed: %s",
+			  dev_name(dev), should_write ? "write" : "read",
+			  strerror(errno));
+	}
+#endif
+
+	slot->result = _io(&slot->widened, slot->buf, should_write) ?
+		       (int64_t) slot->widened.size : 0;
+	slot->done = 1;
+
+	return 1;
+}
+
+int dev_aio_read(struct dev_aio *aio, struct device *dev, uint64_t offset,
+		 size_t len, dev_aio_fn fn, void *context)
+{
+	return _aio_submit(aio, dev, offset, len, NULL, fn, context);
+}
+
+/*
+ * The data is copied before returning, so buffer may be reused at
+ * once.  fn, if set, receives a NULL buffer if the write failed.
+ */
+int dev_aio_write(struct dev_aio *aio, struct device *dev, uint64_t offset,
+		  size_t len, const void *buffer, dev_aio_fn fn, void *context)
+{
+	if (!len)
+		return 1;
+
+	return _aio_submit(aio, dev, offset, len, buffer, fn, context);
+}
+
+int dev_aio_wait(struct dev_aio *aio)
+{
+	while (aio->count)
+		_aio_complete_oldest(aio);
+
+	return 1;
+}
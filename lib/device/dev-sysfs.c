@@ -0,0 +1,698 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "lib.h"
+#include "dev-sysfs.h"
+
+#ifdef linux
+
+#include <dirent.h>
+#include <fcntl.h>
+
+struct sysfs_dev {
+	dev_t dev;
+	dev_t primary;		/* Whole device of a partition */
+	const char *name;	/* Kernel name */
+	const char *parent;	/* Kernel name of the primary, while reading */
+	const char *path;	/* Directory holding the attributes */
+	unsigned nr_partitions;
+	unsigned is_partition:1;
+	unsigned holders_read:1;
+	unsigned dm_uuid_read:1;
+	int nr_holders;
+	dev_t *holders;
+	const char *dm_uuid;
+};
+
+static struct {
+	struct dm_pool *mem;
+	char *sysfs_dir;
+	int valid;		/* Zero if sysfs could not be read */
+	struct sysfs_dev *devs;	/* Sorted by dev */
+	unsigned nr_devs;
+	unsigned alloc_devs;
+	struct dm_hash_table *names;
+} _snapshot;
+
+static struct sysfs_dev *_add_dev(dev_t dev, const char *name, const char *path)
+{
+	struct sysfs_dev *sd;
+	unsigned alloc;
+
+	if (_snapshot.nr_devs == _snapshot.alloc_devs) {
+		alloc = _snapshot.alloc_devs ? _snapshot.alloc_devs * 2 : 256;
+		if (!(sd = dm_realloc(_snapshot.devs, alloc * sizeof(*sd)))) {
+			log_error("Failed to allocate sysfs device list.");
+			return NULL;
+		}
+		_snapshot.devs = sd;
+		_snapshot.alloc_devs = alloc;
+	}
+
+	sd = _snapshot.devs + _snapshot.nr_devs;
+	memset(sd, 0, sizeof(*sd));
+	sd->dev = dev;
+
+	if (!(sd->name = dm_pool_strdup(_snapshot.mem, name)) ||
+	    !(sd->path = dm_pool_strdup(_snapshot.mem, path))) {
+		log_error("Failed to allocate sysfs device name.");
+		return NULL;
+	}
+
+	_snapshot.nr_devs++;
+
+	return sd;
+}
+
+/*
+ * Each entry of /sys/dev/block is named after the device number and links
+ * to the device's directory.  Partition directories sit inside the
+ * directory of their whole device, which sits in a "block" directory:
+ *
+ * /sys/dev/block
+ * |-- 8:0 -> ../../devices/pci0000:00/0000:00:1f.2/host0/target0:0:0/0:0:0:0/block/sda
+ * |-- 8:1 -> ../../devices/pci0000:00/0000:00:1f.2/host0/target0:0:0/0:0:0:0/block/sda/sda1
+ *  `-- 253:0 -> ../../devices/virtual/block/dm-0
+ *
+ * So a single readlink per device is enough to find its name and primary.
+ */
+static int _read_dev_block(const char *dir)
+{
+	char path[PATH_MAX], link[PATH_MAX];
+	char *name, *parent;
+	struct sysfs_dev *sd;
+	struct dirent *d;
+	unsigned major, minor;
+	ssize_t len;
+	DIR *dr;
+	int r = 0;
+
+	if (!(dr = opendir(dir))) {
+		log_sys_error("opendir", dir);
+		return 0;
+	}
+
+	while ((d = readdir(dr))) {
+		if (sscanf(d->d_name, "%u:%u", &major, &minor) != 2)
+			continue;
+
+		if ((len = readlinkat(dirfd(dr), d->d_name, link, sizeof(link) - 1)) < 0) {
+			log_sys_debug("readlinkat", d->d_name);
+			continue;
+		}
+		link[len] = '\0';
+
+		if (!(name = strrchr(link, '/')) || name == link)
+			continue;
+		*name++ = '\0';
+
+		parent = strrchr(link, '/');
+		parent = parent ? parent + 1 : link;
+
+		if (dm_snprintf(path, sizeof(path), "%s/%s", dir, d->d_name) < 0) {
+			log_error("sysfs path name too long: %s in %s",
+				  d->d_name, dir);
+			continue;
+		}
+
+		if (!(sd = _add_dev(makedev(major, minor), name, path)))
+			goto_out;
+
+		if (strcmp(parent, "block")) {
+			sd->is_partition = 1;
+			if (!(sd->parent = dm_pool_strdup(_snapshot.mem, parent)))
+				goto_out;
+		}
+	}
+
+	r = 1;
+out:
+	if (closedir(dr))
+		log_sys_error("closedir", dir);
+
+	return r;
+}
+
+/*
+ * Kernels without /sys/dev/block have one of these instead.
+ */
+static int _locate_sysfs_blocks(const char *sysfs_dir, char *path, size_t len,
+				unsigned *sysfs_depth)
+{
+	struct stat info;
+
+	/*
+	 * unified classification directory for all kernel subsystems
+	 *
+	 * /sys/subsystem/block/devices
+	 * |-- sda -> ../../../devices/pci0000:00/0000:00:1f.2/host0/target0:0:0/0:0:0:0/block/sda
+	 * |-- sda1 -> ../../../devices/pci0000:00/0000:00:1f.2/host0/target0:0:0/0:0:0:0/block/sda/sda1
+	 *  `-- sr0 -> ../../../devices/pci0000:00/0000:00:1f.2/host1/target1:0:0/1:0:0:0/block/sr0
+	 *
+	 */
+	if (dm_snprintf(path, len, "%s/%s", sysfs_dir,
+			"subsystem/block/devices") >= 0) {
+		if (!stat(path, &info)) {
+			*sysfs_depth = 0;
+			return 1;
+		}
+	}
+
+	/*
+	 * block subsystem as a class
+	 *
+	 * /sys/class/block
+	 * |-- sda -> ../../devices/pci0000:00/0000:00:1f.2/host0/target0:0:0/0:0:0:0/block/sda
+	 * |-- sda1 -> ../../devices/pci0000:00/0000:00:1f.2/host0/target0:0:0/0:0:0:0/block/sda/sda1
+	 *  `-- sr0 -> ../../devices/pci0000:00/0000:00:1f.2/host1/target1:0:0/1:0:0:0/block/sr0
+	 *
+	 */
+	if (dm_snprintf(path, len, "%s/%s", sysfs_dir, "class/block") >= 0) {
+		if (!stat(path, &info)) {
+			*sysfs_depth = 0;
+			return 1;
+		}
+	}
+
+	/*
+	 * old block subsystem layout with nested directories
+	 *
+	 * /sys/block/
+	 * |-- sda
+	 * |   |-- capability
+	 * |   |-- dev
+	 * ...
+	 * |   |-- sda1
+	 * |   |   |-- dev
+	 * ...
+	 * |
+	 * `-- sr0
+	 *     |-- capability
+	 *     |-- dev
+	 * ...
+	 *
+	 */
+	if (dm_snprintf(path, len, "%s/%s", sysfs_dir, "block") >= 0) {
+		if (!stat(path, &info)) {
+			*sysfs_depth = 1;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int _read_dev(const char *file, dev_t *result)
+{
+	unsigned major, minor;
+	char buffer[64];
+	int r = 0;
+	FILE *fp;
+
+	if (!(fp = fopen(file, "r"))) {
+		log_sys_error("fopen", file);
+		return 0;
+	}
+
+	if (!fgets(buffer, sizeof(buffer), fp))
+		log_error("Empty sysfs device file: %s", file);
+	else if (sscanf(buffer, "%u:%u", &major, &minor) != 2)
+		log_info("sysfs device file not correct format");
+	else {
+		*result = makedev(major, minor);
+		r = 1;
+	}
+
+	if (fclose(fp))
+		log_sys_error("fclose", file);
+
+	return r;
+}
+
+/*
+ * Recurse through sysfs directories, adding any devs found.
+ */
+static int _read_devs(const char *dir, const char *parent, unsigned sysfs_depth)
+{
+	struct dirent *d;
+	DIR *dr;
+	struct stat info;
+	struct sysfs_dev *sd;
+	char path[PATH_MAX];
+	char file[PATH_MAX];
+	dev_t dev = { 0 };
+	int r = 1;
+
+	if (!(dr = opendir(dir))) {
+		log_sys_error("opendir", dir);
+		return 0;
+	}
+
+	while ((d = readdir(dr))) {
+		if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+			continue;
+
+		if (dm_snprintf(path, sizeof(path), "%s/%s", dir,
+				 d->d_name) < 0) {
+			log_error("sysfs path name too long: %s in %s",
+				  d->d_name, dir);
+			continue;
+		}
+
+		/* devices have a "dev" file */
+		if (dm_snprintf(file, sizeof(file), "%s/dev", path) < 0) {
+			log_error("sysfs path name too long: %s in %s",
+				  d->d_name, dir);
+			continue;
+		}
+
+		if (stat(file, &info) || !_read_dev(file, &dev))
+			continue;
+
+		if (!(sd = _add_dev(dev, d->d_name, path))) {
+			r = 0;
+			break;
+		}
+
+		if (parent) {
+			sd->is_partition = 1;
+			sd->parent = parent;
+		}
+
+		/* recurse if we found a device and expect subdirs */
+		if (sysfs_depth && !_read_devs(path, sd->name, sysfs_depth - 1)) {
+			r = 0;
+			break;
+		}
+	}
+
+	if (closedir(dr))
+		log_sys_error("closedir", dir);
+
+	return r;
+}
+
+static int _compare_devs(const void *a, const void *b)
+{
+	const struct sysfs_dev *sa = a, *sb = b;
+
+	return (sa->dev > sb->dev) - (sa->dev < sb->dev);
+}
+
+static int _index_devs(void)
+{
+	struct sysfs_dev *sd, *primary;
+	unsigned i;
+
+	qsort(_snapshot.devs, _snapshot.nr_devs, sizeof(*_snapshot.devs),
+	      _compare_devs);
+
+	if (!(_snapshot.names = dm_hash_create(_snapshot.nr_devs * 2 + 16))) {
+		log_error("Failed to create sysfs device name index.");
+		return 0;
+	}
+
+	for (i = 0; i < _snapshot.nr_devs; i++)
+		if (!dm_hash_insert(_snapshot.names, _snapshot.devs[i].name,
+				    _snapshot.devs + i)) {
+			log_error("Failed to index sysfs device %s.",
+				  _snapshot.devs[i].name);
+			return 0;
+		}
+
+	for (i = 0; i < _snapshot.nr_devs; i++) {
+		sd = _snapshot.devs + i;
+		sd->primary = sd->dev;
+		if (!sd->is_partition)
+			continue;
+
+		if (!(primary = dm_hash_lookup(_snapshot.names, sd->parent))) {
+			log_debug("%s: primary device %s not in sysfs.",
+				  sd->name, sd->parent);
+			sd->is_partition = 0;
+			continue;
+		}
+
+		sd->primary = primary->dev;
+		primary->nr_partitions++;
+	}
+
+	return 1;
+}
+
+static int _take_snapshot(const char *sysfs_dir)
+{
+	char path[PATH_MAX];
+	unsigned sysfs_depth;
+	struct stat info;
+	int r;
+
+	if (!(_snapshot.mem = dm_pool_create("sysfs snapshot", 4096)) ||
+	    !(_snapshot.sysfs_dir = dm_pool_strdup(_snapshot.mem, sysfs_dir))) {
+		log_error("Failed to allocate sysfs snapshot.");
+		return 0;
+	}
+
+	if (dm_snprintf(path, sizeof(path), "%s/dev/block", sysfs_dir) < 0) {
+		log_error("sysfs path name too long: %s", sysfs_dir);
+		return 0;
+	}
+
+	if (!stat(path, &info))
+		r = _read_dev_block(path);
+	else if (_locate_sysfs_blocks(sysfs_dir, path, sizeof(path), &sysfs_depth))
+		r = _read_devs(path, NULL, sysfs_depth);
+	else {
+		log_debug("No block devices found in %s.", sysfs_dir);
+		return 0;
+	}
+
+	if (!r || !_index_devs())
+		return_0;
+
+	log_debug("Read %u block devices from %s.", _snapshot.nr_devs, path);
+
+	return 1;
+}
+
+/*
+ * Returns 1 and sets sd if the device is in the snapshot, 0 if it is not,
+ * and -1 if there is no snapshot to look in.
+ */
+static int _lookup(const char *sysfs_dir, dev_t dev, struct sysfs_dev **sd)
+{
+	struct sysfs_dev key = { .dev = dev };
+
+	if (!sysfs_dir || !*sysfs_dir)
+		return -1;
+
+	if (_snapshot.sysfs_dir && strcmp(_snapshot.sysfs_dir, sysfs_dir))
+		dev_sysfs_reset();
+
+	if (!_snapshot.mem)
+		_snapshot.valid = _take_snapshot(sysfs_dir);
+
+	if (!_snapshot.valid)
+		return -1;
+
+	if (!(*sd = bsearch(&key, _snapshot.devs, _snapshot.nr_devs,
+			    sizeof(*_snapshot.devs), _compare_devs)))
+		return 0;
+
+	return 1;
+}
+
+int dev_sysfs_present(const char *sysfs_dir, dev_t dev)
+{
+	struct sysfs_dev *sd;
+
+	return _lookup(sysfs_dir, dev, &sd);
+}
+
+int dev_sysfs_primary(const char *sysfs_dir, dev_t dev, dev_t *primary)
+{
+	struct sysfs_dev *sd;
+	int r;
+
+	if ((r = _lookup(sysfs_dir, dev, &sd)) <= 0)
+		return r;
+
+	if (!sd->is_partition)
+		return 0;
+
+	*primary = sd->primary;
+
+	return 1;
+}
+
+int dev_sysfs_partitioned(const char *sysfs_dir, dev_t dev)
+{
+	struct sysfs_dev *sd;
+	int r;
+
+	if ((r = _lookup(sysfs_dir, dev, &sd)) <= 0)
+		return r;
+
+	return sd->nr_partitions ? 1 : 0;
+}
+
+static int _read_holders(struct sysfs_dev *sd)
+{
+	char path[PATH_MAX];
+	struct sysfs_dev *holder;
+	struct dirent *d;
+	dev_t *holders;
+	DIR *dr;
+	int r = 0;
+
+	if (dm_snprintf(path, sizeof(path), "%s/holders", sd->path) < 0) {
+		log_error("sysfs path name too long: %s", sd->path);
+		return 0;
+	}
+
+	/* Partitions have no holders directory on older kernels */
+	if (!(dr = opendir(path))) {
+		if (errno != ENOENT)
+			log_sys_debug("opendir", path);
+		return 1;
+	}
+
+	while ((d = readdir(dr))) {
+		if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+			continue;
+
+		if (!(holders = dm_pool_alloc(_snapshot.mem, (sd->nr_holders + 1) *
+					      sizeof(*holders)))) {
+			log_error("Failed to allocate sysfs holders list.");
+			goto out;
+		}
+
+		if (sd->nr_holders)
+			memcpy(holders, sd->holders, sd->nr_holders * sizeof(*holders));
+
+		holder = dm_hash_lookup(_snapshot.names, d->d_name);
+		holders[sd->nr_holders++] = holder ? holder->dev : 0;
+		sd->holders = holders;
+	}
+
+	r = 1;
+out:
+	if (closedir(dr))
+		log_sys_debug("closedir", path);
+
+	return r;
+}
+
+int dev_sysfs_holders(const char *sysfs_dir, dev_t dev, const dev_t **holders)
+{
+	struct sysfs_dev *sd;
+	int r;
+
+	if ((r = _lookup(sysfs_dir, dev, &sd)) <= 0) {
+		*holders = NULL;
+		return r;
+	}
+
+	if (!sd->holders_read) {
+		if (!_read_holders(sd))
+			return -1;
+		sd->holders_read = 1;
+	}
+
+	*holders = sd->holders;
+
+	return sd->nr_holders;
+}
+
+static void _read_dm_uuid(struct sysfs_dev *sd)
+{
+	char path[PATH_MAX], buffer[256];
+	FILE *fp;
+
+	if (dm_snprintf(path, sizeof(path), "%s/dm/uuid", sd->path) < 0) {
+		log_error("sysfs path name too long: %s", sd->path);
+		return;
+	}
+
+	/* Not there before 2.6.29 */
+	if (!(fp = fopen(path, "r"))) {
+		if (errno != ENOENT)
+			log_sys_debug("fopen", path);
+		return;
+	}
+
+	if (!fgets(buffer, sizeof(buffer), fp))
+		buffer[0] = '\0';
+	else
+		buffer[strcspn(buffer, "\n")] = '\0';
+
+	if (!(sd->dm_uuid = dm_pool_strdup(_snapshot.mem, buffer)))
+		log_error("Failed to allocate sysfs dm uuid.");
+
+	if (fclose(fp))
+		log_sys_debug("fclose", path);
+}
+
+int dev_sysfs_dm_uuid_prefix(const char *sysfs_dir, dev_t dev, const char *prefix)
+{
+	struct sysfs_dev *sd;
+
+	/* Not in the snapshot: let the caller ask the kernel */
+	if (_lookup(sysfs_dir, dev, &sd) <= 0)
+		return -1;
+
+	if (!sd->dm_uuid_read) {
+		_read_dm_uuid(sd);
+		sd->dm_uuid_read = 1;
+	}
+
+	if (!sd->dm_uuid)
+		return -1;
+
+	return strncasecmp(sd->dm_uuid, prefix, strlen(prefix)) ? 0 : 1;
+}
+
+void dev_sysfs_reset(void)
+{
+	if (_snapshot.names)
+		dm_hash_destroy(_snapshot.names);
+
+	if (_snapshot.mem)
+		dm_pool_destroy(_snapshot.mem);
+
+	dm_free(_snapshot.devs);
+
+	memset(&_snapshot, 0, sizeof(_snapshot));
+}
+
+int dev_sysfs_uevent_seqnum(const char *sysfs_dir, uint64_t *seqnum)
+{
+	char path[PATH_MAX], buffer[64];
+	ssize_t len;
+	int fd, r = 0;
+
+	if (!*sysfs_dir ||
+	    dm_snprintf(path, sizeof(path), "%s/kernel/uevent_seqnum", sysfs_dir) < 0)
+		return 0;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		log_sys_debug("open", path);
+		return 0;
+	}
+
+	if ((len = read(fd, buffer, sizeof(buffer) - 1)) < 0)
+		log_sys_debug("read", path);
+	else if (len) {
+		buffer[len] = '\0';
+		r = (sscanf(buffer, "%" PRIu64, seqnum) == 1);
+	}
+
+	if (close(fd))
+		log_sys_debug("close", path);
+
+	return r;
+}
+
+int dev_sysfs_block_devices_stamp(const char *sysfs_dir, uint64_t *stamp)
+{
+	char path[PATH_MAX];
+	struct dirent *d;
+	unsigned major, minor, count = 0;
+	uint64_t sum = 0, x;
+	DIR *dr;
+
+	if (!*sysfs_dir ||
+	    dm_snprintf(path, sizeof(path), "%s/dev/block", sysfs_dir) < 0)
+		return 0;
+
+	if (!(dr = opendir(path))) {
+		log_sys_debug("opendir", path);
+		return 0;
+	}
+
+	/*
+	 * Summed, so the order of the entries does not matter.  The inode
+	 * of an entry differs when a device gets a number used before.
+	 */
+	while ((d = readdir(dr))) {
+		if (sscanf(d->d_name, "%u:%u", &major, &minor) != 2)
+			continue;
+
+		x = ((uint64_t) major << 44) ^ ((uint64_t) minor << 24) ^ (uint64_t) d->d_ino;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+		sum += x ^ (x >> 31);
+		count++;
+	}
+
+	if (closedir(dr))
+		log_sys_debug("closedir", path);
+
+	*stamp = sum + count;
+
+	return 1;
+}
+
+#else
+
+int dev_sysfs_present(const char *sysfs_dir __attribute__((unused)),
+		      dev_t dev __attribute__((unused)))
+{
+	return -1;
+}
+
+int dev_sysfs_primary(const char *sysfs_dir __attribute__((unused)),
+		      dev_t dev __attribute__((unused)),
+		      dev_t *primary __attribute__((unused)))
+{
+	return -1;
+}
+
+int dev_sysfs_partitioned(const char *sysfs_dir __attribute__((unused)),
+			  dev_t dev __attribute__((unused)))
+{
+	return -1;
+}
+
+int dev_sysfs_holders(const char *sysfs_dir __attribute__((unused)),
+		      dev_t dev __attribute__((unused)),
+		      const dev_t **holders __attribute__((unused)))
+{
+	return -1;
+}
+
+int dev_sysfs_dm_uuid_prefix(const char *sysfs_dir __attribute__((unused)),
+			     dev_t dev __attribute__((unused)),
+			     const char *prefix __attribute__((unused)))
+{
+	return -1;
+}
+
+void dev_sysfs_reset(void)
+{
+}
+
+int dev_sysfs_uevent_seqnum(const char *sysfs_dir __attribute__((unused)),
+			    uint64_t *seqnum __attribute__((unused)))
+{
+	return 0;
+}
+
+int dev_sysfs_block_devices_stamp(const char *sysfs_dir __attribute__((unused)),
+				  uint64_t *stamp __attribute__((unused)))
+{
+	return 0;
+}
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _LVM_DEV_SYSFS_H
+#define _LVM_DEV_SYSFS_H
+
+/*
+ * Snapshot of the block device topology in sysfs, shared by the device
+ * filters.  It is read in a single pass the first time it is needed and
+ * kept until the next full device scan.  Holders and dm uuids are only
+ * read for the devices they are asked about, but then also kept.
+ *
+ * Functions return -1 if no snapshot could be taken of sysfs_dir, so
+ * callers can fall back to probing the device themselves.  A device that
+ * is not in the snapshot is not in sysfs: it is not a partition, has no
+ * partitions and no holders.
+ */
+
+/* Is the device present in sysfs? */
+int dev_sysfs_present(const char *sysfs_dir, dev_t dev);
+
+/* Returns 1 and sets primary if the device is a partition */
+int dev_sysfs_primary(const char *sysfs_dir, dev_t dev, dev_t *primary);
+
+/* Does the kernel know of any partitions on the device? */
+int dev_sysfs_partitioned(const char *sysfs_dir, dev_t dev);
+
+/*
+ * Returns the number of holders and points holders at their devices.
+ * Holders that were not in the snapshot are given as 0.
+ */
+int dev_sysfs_holders(const char *sysfs_dir, dev_t dev, const dev_t **holders);
+
+/* Returns 1 if the device is a dm device with a uuid starting with prefix */
+int dev_sysfs_dm_uuid_prefix(const char *sysfs_dir, dev_t dev, const char *prefix);
+
+/* Drop the snapshot so the next query reads sysfs again */
+void dev_sysfs_reset(void);
+
+/*
+ * Reads the sequence number of the last uevent, which changes whenever
+ * a device appears, goes or changes.  Returns 0 if it is not available.
+ */
+int dev_sysfs_uevent_seqnum(const char *sysfs_dir, uint64_t *seqnum);
+
+/*
+ * Reads a stamp of the set of block devices, which changes only when a
+ * device appears or goes.  Returns 0 if it is not available.
+ */
+int dev_sysfs_block_devices_stamp(const char *sysfs_dir, uint64_t *stamp);
+
+#endif
@@ -19,6 +19,7 @@
 #include "metadata.h"
 #include "filter.h"
 #include "xlate.h"
+#include "dev-sysfs.h"
 
 #include <libgen.h> /* dirname, basename */
 
@@ -92,6 +93,10 @@ int is_partitioned_dev(struct device *dev)
 	if (!_is_partitionable(dev))
 		return 0;
 
+	/* No need to read the table if the kernel already found partitions */
+	if (dev_sysfs_partitioned(sysfs_dir_path(), dev->dev) == 1)
+		return 1;
+
 	return _has_partition_table(dev);
 }
 
@@ -46,6 +46,7 @@ struct device {
 	uint32_t flags;
 	uint64_t end;
 	struct dm_list open_list;
+	struct dm_list bcache_blocks;	/* Cached blocks, see dev-bcache.h */
 
 	char pvid[ID_LEN + 1];
 	char _padding[7];
@@ -93,6 +94,31 @@ int dev_append(struct device *dev, size_t len, char *buffer);
 int dev_set(struct device *dev, uint64_t offset, size_t len, int value);
 void dev_flush(struct device *dev);
 
+/*
+ * Buffers for io of len bytes at offset that dev_read() and dev_write()
+ * can use in place, avoiding a bounce buffer and copy for O_DIRECT.
+ * dev_io_release_buffers() frees any that are idle.
+ */
+void *dev_io_buffer_get(uint64_t offset, size_t len);
+void dev_io_buffer_put(void *buf);
+void dev_io_release_buffers(void);
+
+/*
+ * Asynchronous reads.  The callback receives a pointer to the data
+ * read, or NULL on failure, and is called in submission order.
+ * The device must stay open until its callback has run.
+ */
+struct dev_aio;
+typedef void (*dev_aio_fn) (struct device *dev, void *buf, void *context);
+
+struct dev_aio *dev_aio_create(unsigned depth);
+void dev_aio_destroy(struct dev_aio *aio);
+int dev_aio_read(struct dev_aio *aio, struct device *dev, uint64_t offset,
+		 size_t len, dev_aio_fn fn, void *context);
+int dev_aio_write(struct dev_aio *aio, struct device *dev, uint64_t offset,
+		  size_t len, const void *buffer, dev_aio_fn fn, void *context);
+int dev_aio_wait(struct dev_aio *aio);
+
 struct device *dev_create_file(const char *filename, struct device *dev,
 			       struct str_list *alias, int use_malloc);
 
@@ -15,9 +15,29 @@
 
 #include "lib.h"
 #include "filter-md.h"
+#include "filter.h"
+#include "dev-sysfs.h"
 
 #ifdef linux
 
+/*
+ * Members of a running array are held by it, whether or not they
+ * carry a superblock, so no need to read them.
+ */
+static int _held_by_md(struct device *dev)
+{
+	const dev_t *holders;
+	int i, nr_holders;
+
+	nr_holders = dev_sysfs_holders(sysfs_dir_path(), dev->dev, &holders);
+
+	for (i = 0; i < nr_holders; i++)
+		if (holders[i] && (int) MAJOR(holders[i]) == md_major())
+			return 1;
+
+	return 0;
+}
+
 static int _ignore_md(struct dev_filter *f __attribute__((unused)),
 		      struct device *dev)
 {
@@ -26,7 +46,7 @@ static int _ignore_md(struct dev_filter *f __attribute__((unused)),
 	if (!md_filtering())
 		return 1;
 	
-	ret = dev_is_md(dev, NULL);
+	ret = _held_by_md(dev) ? 1 : dev_is_md(dev, NULL);
 
 	if (ret == 1) {
 		log_debug("%s: Skipping md component device", dev_name(dev));
@@ -19,6 +19,7 @@
 
 #ifdef linux
 #include <dirent.h>
+#include "dev-sysfs.h"
 
 #define MPATH_PREFIX "mpath-"
 
@@ -113,19 +114,15 @@ static int get_parent_mpath(const char *dir, char *name, int max_size)
 	return r;
 }
 
-static int dev_is_mpath(struct dev_filter *f, struct device *dev)
+/* Without the sysfs snapshot, look the device up in sysfs directly */
+static int _probe_mpath(const char *sysfs_dir, struct device *dev)
 {
 	const char *name;
 	char path[PATH_MAX+1];
 	char parent_name[PATH_MAX+1];
 	struct stat info;
-	const char *sysfs_dir = f->private;
 	int major, minor;
 
-	/* Limit this filter only to SCSI devices */
-	if (!major_is_scsi_device(MAJOR(dev->dev)))
-		return 0;
-
 	if (!(name = get_sysfs_name(dev)))
 		return_0;
 
@@ -157,6 +154,46 @@ static int dev_is_mpath(struct dev_filter *f, struct device *dev)
 	return lvm_dm_prefix_check(major, minor, MPATH_PREFIX);
 }
 
+static int dev_is_mpath(struct dev_filter *f, struct device *dev)
+{
+	const char *sysfs_dir = f->private;
+	const dev_t *holders;
+	dev_t primary;
+	int r;
+
+	/* Limit this filter only to SCSI devices */
+	if (!major_is_scsi_device(MAJOR(dev->dev)))
+		return 0;
+
+	/* also filters out partitions */
+	if ((r = dev_sysfs_primary(sysfs_dir, dev->dev, &primary)) < 0)
+		return _probe_mpath(sysfs_dir, dev);
+	if (r)
+		return 0;
+
+	/* There should be only one holder if it is multipath */
+	if ((r = dev_sysfs_holders(sysfs_dir, dev->dev, &holders)) < 0)
+		return _probe_mpath(sysfs_dir, dev);
+	if (r != 1)
+		return 0;
+
+	/* Held by a device that appeared after the snapshot was taken */
+	if (!holders[0])
+		return _probe_mpath(sysfs_dir, dev);
+
+	if (MAJOR(holders[0]) != dm_major()) {
+		log_debug("mpath major %d is not dm major %d.",
+			  (int) MAJOR(holders[0]), dm_major());
+		return 0;
+	}
+
+	/* Ask the kernel only if sysfs has no dm uuid for it */
+	if ((r = dev_sysfs_dm_uuid_prefix(sysfs_dir, holders[0], MPATH_PREFIX)) >= 0)
+		return r;
+
+	return lvm_dm_prefix_check(MAJOR(holders[0]), MINOR(holders[0]), MPATH_PREFIX);
+}
+
 static int _ignore_mpath(struct dev_filter *f, struct device *dev)
 {
 	if (dev_is_mpath(f, dev) == 1) {
@@ -16,29 +16,89 @@
 #include "lib.h"
 #include "config.h"
 #include "dev-cache.h"
+#include "dev-sysfs.h"
 #include "filter.h"
 #include "filter-persistent.h"
 #include "lvm-file.h"
 #include "lvm-string.h"
 #include "activate.h"
+#include "crc.h"
 
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 
+/*
+ * What the kernel says about the state of the devices: the boot and the
+ * number of uevents so far.  Any device appearing, disappearing, changing
+ * size or having its partitions or signatures rewritten generates a uevent,
+ * so verdicts reached under the same stamp still hold.
+ */
+struct pf_stamp {
+	uint64_t uevent_seqnum;
+	char boot_id[40];
+};
+
 struct pfilter {
 	char *file;
 	struct dm_hash_table *devices;
+	struct dm_pool *mem;
 	struct dev_filter *real;
 	time_t ctime;
+	char *proc_dir;
+	char *sysfs_dir;
+	struct pf_stamp stamp;
+	uint32_t config_hash;
+	int have_stamp;
+	int md_filtering;
+	int dirty;
 };
 
 /*
- * The hash table holds one of these two states
- * against each entry.
+ * The hash table holds one of these against each name.
  */
-#define PF_BAD_DEVICE ((void *) 1)
-#define PF_GOOD_DEVICE ((void *) 2)
+struct pf_device {
+	dev_t dev;
+	int good;
+};
+
+/*
+ * The cache file is read through mmap, so it holds fixed size records in
+ * host byte order: the header, then the devices, then their names.
+ * The whole file belongs to the filter configuration it was written with.
+ * Rejections only hold under the stamp they were reached with, as a
+ * rejected device has no size to check, while devices that passed are
+ * kept across uevents for as long as their size is unchanged.
+ */
+#define PF_MAGIC 0x4c504633	/* "LPF3" */
+
+struct pf_header {
+	uint32_t magic;
+	uint32_t checksum;	/* Of everything after the header */
+	uint32_t nr_devices;
+	uint32_t names_size;
+	uint32_t config_hash;
+	uint32_t padding;
+	struct pf_stamp stamp;
+};
+
+struct pf_disk_device {
+	uint64_t dev;
+	uint64_t size;		/* In kB, as /proc/partitions gives it */
+	uint32_t name;		/* Offset into the names */
+	uint32_t good;
+};
+
+struct pf_partition {
+	dev_t dev;
+	uint64_t size;
+};
+
+struct pf_partitions {
+	struct pf_partition *table;
+	unsigned count;
+};
 
 static int _init_hash(struct pfilter *pf)
 {
@@ -51,55 +111,265 @@ static int _init_hash(struct pfilter *pf)
 	return 1;
 }
 
+static int _read_file(const char *dir, const char *name, char *buf, size_t size)
+{
+	char path[PATH_MAX];
+	ssize_t len;
+	int fd;
+
+	if (!*dir || dm_snprintf(path, sizeof(path), "%s/%s", dir, name) < 0)
+		return 0;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		log_sys_debug("open", path);
+		return 0;
+	}
+
+	if ((len = read(fd, buf, size - 1)) < 0)
+		log_sys_debug("read", path);
+	else
+		buf[len] = '\0';
+
+	if (close(fd))
+		log_sys_debug("close", path);
+
+	return len > 0;
+}
+
+static int _read_stamp(struct pfilter *pf, struct pf_stamp *stamp)
+{
+	char buf[64];
+
+	memset(stamp, 0, sizeof(*stamp));
+
+	if (!dev_sysfs_uevent_seqnum(pf->sysfs_dir, &stamp->uevent_seqnum))
+		return 0;
+
+	if (!_read_file(pf->proc_dir, "sys/kernel/random/boot_id", buf, sizeof(buf)) ||
+	    sscanf(buf, "%39s", stamp->boot_id) != 1)
+		return 0;
+
+	return 1;
+}
+
+static int _same_stamp(const struct pf_stamp *stamp0, const struct pf_stamp *stamp1)
+{
+	return stamp0->uevent_seqnum == stamp1->uevent_seqnum &&
+	       !strncmp(stamp0->boot_id, stamp1->boot_id, sizeof(stamp0->boot_id));
+}
+
+static int _compare_partitions(const void *a, const void *b)
+{
+	const struct pf_partition *p0 = a, *p1 = b;
+
+	return (p0->dev > p1->dev) - (p0->dev < p1->dev);
+}
+
+/*
+ * Device sizes from /proc/partitions, which is one read for all of them
+ * rather than an open and ioctl per device.
+ */
+static int _read_partitions(struct pfilter *pf, struct pf_partitions *parts)
+{
+	char path[PATH_MAX], line[256];
+	unsigned major, minor, size = 0;
+	unsigned long long kb;
+	struct pf_partition *tmp;
+	FILE *fp;
+
+	parts->table = NULL;
+	parts->count = 0;
+
+	if (!*pf->proc_dir ||
+	    dm_snprintf(path, sizeof(path), "%s/partitions", pf->proc_dir) < 0)
+		return 0;
+
+	if (!(fp = fopen(path, "r"))) {
+		log_sys_debug("fopen", path);
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%u %u %llu", &major, &minor, &kb) != 3)
+			continue;
+
+		if (parts->count == size) {
+			size = size ? size * 2 : 64;
+			if (!(tmp = dm_realloc(parts->table, size * sizeof(*tmp)))) {
+				log_error("Failed to allocate partition table.");
+				dm_free(parts->table);
+				parts->table = NULL;
+				parts->count = 0;
+				break;
+			}
+			parts->table = tmp;
+		}
+
+		parts->table[parts->count].dev = MKDEV((dev_t) major, (dev_t) minor);
+		parts->table[parts->count++].size = kb;
+	}
+
+	if (fclose(fp))
+		log_sys_debug("fclose", path);
+
+	qsort(parts->table, parts->count, sizeof(*parts->table),
+	      _compare_partitions);
+
+	return parts->table ? 1 : 0;
+}
+
+static uint64_t _partition_size(const struct pf_partitions *parts, dev_t dev)
+{
+	struct pf_partition key = { .dev = dev }, *p;
+
+	if (!parts->count ||
+	    !(p = bsearch(&key, parts->table, parts->count,
+			  sizeof(*parts->table), _compare_partitions)))
+		return 0;
+
+	return p->size;
+}
+
+static struct pf_device *_add_device(struct pfilter *pf, const char *name,
+				     dev_t dev, int good)
+{
+	struct pf_device *pd;
+
+	if (!(pd = dm_pool_alloc(pf->mem, sizeof(*pd))))
+		return_NULL;
+
+	pd->dev = dev;
+	pd->good = good;
+
+	if (!dm_hash_insert(pf->devices, name, pd))
+		return_NULL;
+
+	return pd;
+}
+
 static void _persistent_filter_wipe(struct dev_filter *f)
 {
 	struct pfilter *pf = (struct pfilter *) f->private;
+	struct pf_stamp stamp;
+	int have_stamp = _read_stamp(pf, &stamp);
 
-	log_verbose("Wiping cache of LVM-capable devices");
-	dm_hash_wipe(pf->devices);
+	if (have_stamp && pf->have_stamp && _same_stamp(&stamp, &pf->stamp))
+		log_verbose("Keeping cache of LVM-capable devices: "
+			    "no device changed since it was built");
+	else {
+		log_verbose("Wiping cache of LVM-capable devices");
+		dm_hash_wipe(pf->devices);
+		dm_pool_empty(pf->mem);
+		pf->stamp = stamp;
+		pf->have_stamp = have_stamp;
+		pf->dirty = 1;
+	}
 
 	/* Trigger complete device scan */
 	dev_cache_scan(1);
 }
 
-static int _read_array(struct pfilter *pf, struct dm_config_tree *cft,
-		       const char *path, void *data)
+/*
+ * Add the devices cached in the file open on fd that we know nothing about
+ * yet.  If any device changed since the file was written, only devices
+ * that passed and are still the same size are kept.
+ * Returns the number of devices added.
+ */
+static int _load_cache(struct pfilter *pf, int fd)
 {
-	const struct dm_config_node *cn;
-	const struct dm_config_value *cv;
+	const struct pf_header *hdr;
+	const struct pf_disk_device *dd;
+	const char *names, *name;
+	struct pf_partitions parts = { 0 };
+	struct stat info;
+	struct device *dev;
+	void *map;
+	size_t size;
+	uint32_t n;
+	int trusted, added = 0;
+
+	if (fstat(fd, &info)) {
+		log_sys_error("fstat", pf->file);
+		return 0;
+	}
 
-	if (!(cn = dm_config_find_node(cft->root, path))) {
-		log_very_verbose("Couldn't find %s array in '%s'",
-				 path, pf->file);
+	/* Empty when just created by fcntl_lock_file */
+	if ((size_t) info.st_size < sizeof(*hdr)) {
+		log_very_verbose("%s: No devices cached", pf->file);
 		return 0;
 	}
 
-	/*
-	 * iterate through the array, adding
-	 * devices as we go.
-	 */
-	for (cv = cn->v; cv; cv = cv->next) {
-		if (cv->type != DM_CFG_STRING) {
-			log_verbose("Devices array contains a value "
-				    "which is not a string ... ignoring");
+	size = (size_t) info.st_size;
+	if ((map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		log_sys_error("mmap", pf->file);
+		return 0;
+	}
+
+	hdr = map;
+	dd = (const struct pf_disk_device *) (hdr + 1);
+	names = (const char *) (dd + hdr->nr_devices);
+
+	if (hdr->magic != PF_MAGIC ||
+	    hdr->nr_devices > (size - sizeof(*hdr)) / sizeof(*dd) ||
+	    size != sizeof(*hdr) + hdr->nr_devices * sizeof(*dd) + hdr->names_size ||
+	    (hdr->names_size && names[hdr->names_size - 1]) ||
+	    hdr->checksum != calc_crc(INITIAL_CRC, (const uint8_t *) (hdr + 1),
+				      (uint32_t) (size - sizeof(*hdr)))) {
+		log_verbose("%s: Ignoring invalid device cache", pf->file);
+		goto out;
+	}
+
+	if (hdr->config_hash != pf->config_hash) {
+		log_verbose("%s: Ignoring device cache for different filters",
+			    pf->file);
+		goto out;
+	}
+
+	if (!(trusted = pf->have_stamp && _same_stamp(&hdr->stamp, &pf->stamp)))
+		(void) _read_partitions(pf, &parts);
+
+	for (n = 0; n < hdr->nr_devices; n++, dd++) {
+		if (dd->name >= hdr->names_size)
+			break;
+
+		name = names + dd->name;
+		if (dm_hash_lookup(pf->devices, name))
+			continue;
+
+		if (!trusted && (!dd->good ||
+				 dd->size != _partition_size(&parts, (dev_t) dd->dev))) {
+			log_debug("%s: Dropping cached verdict", name);
+			pf->dirty = 1;
 			continue;
 		}
 
-		if (!dm_hash_insert(pf->devices, cv->v.str, data))
-			log_verbose("Couldn't add '%s' to filter ... ignoring",
-				    cv->v.str);
 		/* Populate dev_cache ourselves */
-		dev_cache_get(cv->v.str, NULL);
+		if (!(dev = dev_cache_get(name, NULL)) || dev->dev != (dev_t) dd->dev) {
+			pf->dirty = 1;
+			continue;
+		}
+
+		if (!_add_device(pf, name, (dev_t) dd->dev, dd->good ? 1 : 0)) {
+			log_verbose("Couldn't add '%s' to filter ... ignoring", name);
+			continue;
+		}
+
+		added++;
 	}
-	return 1;
+
+	dm_free(parts.table);
+out:
+	if (munmap(map, size))
+		log_sys_debug("munmap", pf->file);
+
+	return added;
 }
 
-int persistent_filter_load(struct dev_filter *f, struct dm_config_tree **cft_out)
+int persistent_filter_load(struct dev_filter *f)
 {
 	struct pfilter *pf = (struct pfilter *) f->private;
-	struct dm_config_tree *cft;
 	struct stat info;
-	int r = 0;
+	int fd, r = 0;
 
 	if (obtain_device_list_from_udev()) {
 		if (!stat(pf->file, &info)) {
@@ -112,71 +382,97 @@ int persistent_filter_load(struct dev_filter *f, struct dm_config_tree **cft_out
 		return 1;
 	}
 
-	if (!stat(pf->file, &info))
-		pf->ctime = info.st_ctime;
-	else {
-		log_very_verbose("%s: stat failed: %s", pf->file,
+	if ((fd = open(pf->file, O_RDONLY)) < 0) {
+		log_very_verbose("%s: open failed: %s", pf->file,
 				 strerror(errno));
-		return_0;
+		return 0;
 	}
 
-	if (!(cft = config_file_open(pf->file, 1)))
-		return_0;
-
-	if (!config_file_read(cft))
-		goto_out;
+	if (!fstat(fd, &info))
+		pf->ctime = info.st_ctime;
 
-	_read_array(pf, cft, "persistent_filter_cache/valid_devices",
-		    PF_GOOD_DEVICE);
-	/* We don't gain anything by holding invalid devices */
-	/* _read_array(pf, cft, "persistent_filter_cache/invalid_devices",
-	   PF_BAD_DEVICE); */
+	/* Unless something was dropped, there is no need to write it back */
+	pf->dirty = 0;
 
 	/* Did we find anything? */
-	if (dm_hash_get_num_entries(pf->devices)) {
+	if (_load_cache(pf, fd)) {
 		/* We populated dev_cache ourselves */
 		dev_cache_scan(0);
 		r = 1;
-	}
+	} else
+		pf->dirty = 1;
+
+	if (close(fd))
+		log_sys_debug("close", pf->file);
 
 	log_very_verbose("Loaded persistent filter cache from %s", pf->file);
 
-      out:
-	if (r && cft_out)
-		*cft_out = cft;
-	else
-		config_file_destroy(cft);
 	return r;
 }
 
-static void _write_array(struct pfilter *pf, FILE *fp, const char *path,
-			 void *data)
+static int _write_cache(struct pfilter *pf, FILE *fp, const char *file)
 {
-	void *d;
-	int first = 1;
-	char buf[2 * PATH_MAX];
+	struct pf_partitions parts;
+	struct pf_header *hdr;
+	struct pf_disk_device *dd;
 	struct dm_hash_node *n;
+	struct pf_device *pd;
+	const char *name;
+	char *buf, *names;
+	uint32_t nr_devices = 0, names_size = 0;
+	size_t size;
+	int r = 0;
 
 	for (n = dm_hash_get_first(pf->devices); n;
 	     n = dm_hash_get_next(pf->devices, n)) {
-		d = dm_hash_get_data(pf->devices, n);
+		nr_devices++;
+		names_size += strlen(dm_hash_get_key(pf->devices, n)) + 1;
+	}
 
-		if (d != data)
-			continue;
+	size = sizeof(*hdr) + nr_devices * sizeof(*dd) + names_size;
+	if (!(buf = dm_zalloc(size))) {
+		log_error("Failed to allocate persistent device cache.");
+		return 0;
+	}
 
-		if (!first)
-			fprintf(fp, ",\n");
-		else {
-			fprintf(fp, "\t%s=[\n", path);
-			first = 0;
-		}
+	(void) _read_partitions(pf, &parts);
+
+	hdr = (struct pf_header *) buf;
+	dd = (struct pf_disk_device *) (hdr + 1);
+	names = (char *) (dd + nr_devices);
 
-		dm_escape_double_quotes(buf, dm_hash_get_key(pf->devices, n));
-		fprintf(fp, "\t\t\"%s\"", buf);
+	for (n = dm_hash_get_first(pf->devices); n;
+	     n = dm_hash_get_next(pf->devices, n)) {
+		pd = dm_hash_get_data(pf->devices, n);
+		name = dm_hash_get_key(pf->devices, n);
+
+		dd->dev = pd->dev;
+		dd->size = _partition_size(&parts, pd->dev);
+		dd->name = hdr->names_size;
+		dd->good = pd->good;
+		dd++;
+
+		strcpy(names + hdr->names_size, name);
+		hdr->names_size += strlen(name) + 1;
 	}
 
-	if (!first)
-		fprintf(fp, "\n\t]\n");
+	hdr->magic = PF_MAGIC;
+	hdr->nr_devices = nr_devices;
+	hdr->config_hash = pf->config_hash;
+	if (pf->have_stamp)
+		hdr->stamp = pf->stamp;
+	hdr->checksum = calc_crc(INITIAL_CRC, (const uint8_t *) (hdr + 1),
+				 (uint32_t) (size - sizeof(*hdr)));
+
+	if (fwrite(buf, size, 1, fp) != 1)
+		log_sys_error("fwrite", file);
+	else
+		r = 1;
+
+	dm_free(parts.table);
+	dm_free(buf);
+
+	return r;
 }
 
 int persistent_filter_dump(struct dev_filter *f, int merge_existing)
@@ -184,7 +480,6 @@ int persistent_filter_dump(struct dev_filter *f, int merge_existing)
 	struct pfilter *pf;
 	char *tmp_file;
 	struct stat info, info2;
-	struct dm_config_tree *cft = NULL;
 	FILE *fp;
 	int lockfd;
 	int r = 0;
@@ -206,6 +501,11 @@ int persistent_filter_dump(struct dev_filter *f, int merge_existing)
 				 "to %s", pf->file);
 		return 0;
 	}
+	if (!pf->dirty) {
+		log_very_verbose("Persistent device cache %s unchanged "
+				 "- not writing it", pf->file);
+		return 1;
+	}
 
 	log_very_verbose("Dumping persistent device cache to %s", pf->file);
 
@@ -232,11 +532,12 @@ int persistent_filter_dump(struct dev_filter *f, int merge_existing)
 	}
 
 	/*
-	 * If file contents changed since we loaded it, merge new contents
+	 * If file contents changed since we loaded it, merge new contents.
+	 * The mapping is read through lockfd, as closing any other
+	 * descriptor of the file would lose the lock.
 	 */
 	if (merge_existing && info.st_ctime != pf->ctime)
-		/* Keep cft open to avoid losing lock */
-		persistent_filter_load(f, &cft);
+		(void) _load_cache(pf, lockfd);
 
 	tmp_file = alloca(strlen(pf->file) + 5);
 	sprintf(tmp_file, "%s.tmp", pf->file);
@@ -248,14 +549,11 @@ int persistent_filter_dump(struct dev_filter *f, int merge_existing)
 		goto out;
 	}
 
-	fprintf(fp, "# This file is automatically maintained by lvm.\n\n");
-	fprintf(fp, "persistent_filter_cache {\n");
-
-	_write_array(pf, fp, "valid_devices", PF_GOOD_DEVICE);
-	/* We don't gain anything by remembering invalid devices */
-	/* _write_array(pf, fp, "invalid_devices", PF_BAD_DEVICE); */
+	if (!_write_cache(pf, fp, tmp_file)) {
+		(void) lvm_fclose(fp, tmp_file);
+		goto_out;
+	}
 
-	fprintf(fp, "}\n");
 	if (lvm_fclose(fp, tmp_file))
 		goto_out;
 
@@ -263,37 +561,62 @@ int persistent_filter_dump(struct dev_filter *f, int merge_existing)
 		log_error("%s: rename to %s failed: %s", tmp_file, pf->file,
 			  strerror(errno));
 
+	pf->dirty = 0;
 	r = 1;
 
 out:
 	fcntl_unlock_file(lockfd);
 
-	if (cft)
-		config_file_destroy(cft);
-
 	return r;
 }
 
+static int _add_aliases(struct pfilter *pf, struct device *dev, int good)
+{
+	struct str_list *sl;
+	struct pf_device *pd = NULL;
+
+	dm_list_iterate_items(sl, &dev->aliases) {
+		if (pd) {
+			if (!dm_hash_insert(pf->devices, sl->str, pd))
+				return_0;
+		} else if (!(pd = _add_device(pf, sl->str, dev->dev, good)))
+			return_0;
+	}
+
+	pf->dirty = 1;
+
+	return 1;
+}
+
 static int _lookup_p(struct dev_filter *f, struct device *dev)
 {
 	struct pfilter *pf = (struct pfilter *) f->private;
-	void *l = dm_hash_lookup(pf->devices, dev_name(dev));
-	struct str_list *sl;
+	struct pf_device *pd = dm_hash_lookup(pf->devices, dev_name(dev));
+	int good;
+
+	/* Overridden md filtering, as by pvcreate: neither use nor keep verdicts */
+	if (md_filtering() != pf->md_filtering)
+		return pf->real->passes_filter(pf->real, dev);
+
+	/* A different device now has this name */
+	if (pd && pd->dev != dev->dev) {
+		log_debug("%s: Cached verdict is for device %d:%d", dev_name(dev),
+			  (int) MAJOR(pd->dev), (int) MINOR(pd->dev));
+		pd = NULL;
+	}
 
 	/* Cached BAD? */
-	if (l == PF_BAD_DEVICE) {
+	if (pd && !pd->good) {
 		log_debug("%s: Skipping (cached)", dev_name(dev));
 		return 0;
 	}
 
 	/* Test dm devices every time, so cache them as GOOD. */
 	if (MAJOR(dev->dev) == dm_major()) {
-		if (!l)
-			dm_list_iterate_items(sl, &dev->aliases)
-				if (!dm_hash_insert(pf->devices, sl->str, PF_GOOD_DEVICE)) {
-					log_error("Failed to hash device to filter.");
-					return 0;
-				}
+		if (!pd && !_add_aliases(pf, dev, 1)) {
+			log_error("Failed to hash device to filter.");
+			return 0;
+		}
 		if (!device_is_usable(dev)) {
 			log_debug("%s: Skipping unusable device", dev_name(dev));
 			return 0;
@@ -302,17 +625,18 @@ static int _lookup_p(struct dev_filter *f, struct device *dev)
 	}
 
 	/* Uncached */
-	if (!l) {
-		l = pf->real->passes_filter(pf->real, dev) ?  PF_GOOD_DEVICE : PF_BAD_DEVICE;
+	if (!pd) {
+		good = pf->real->passes_filter(pf->real, dev) ? 1 : 0;
 
-		dm_list_iterate_items(sl, &dev->aliases)
-			if (!dm_hash_insert(pf->devices, sl->str, l)) {
-				log_error("Failed to hash alias to filter.");
-				return 0;
-			}
+		if (!_add_aliases(pf, dev, good)) {
+			log_error("Failed to hash alias to filter.");
+			return 0;
+		}
+
+		return good;
 	}
 
-	return (l == PF_BAD_DEVICE) ? 0 : 1;
+	return 1;
 }
 
 static void _persistent_destroy(struct dev_filter *f)
@@ -323,14 +647,20 @@ static void _persistent_destroy(struct dev_filter *f)
 		log_error(INTERNAL_ERROR "Destroying persistent filter while in use %u times.", f->use_count);
 
 	dm_hash_destroy(pf->devices);
+	dm_pool_destroy(pf->mem);
 	dm_free(pf->file);
+	dm_free(pf->proc_dir);
+	dm_free(pf->sysfs_dir);
 	pf->real->destroy(pf->real);
 	dm_free(pf);
 	dm_free(f);
 }
 
 struct dev_filter *persistent_filter_create(struct dev_filter *real,
-					    const char *file)
+					    const char *file,
+					    const char *proc_dir,
+					    const char *sysfs_dir,
+					    uint32_t config_hash)
 {
 	struct pfilter *pf;
 	struct dev_filter *f = NULL;
@@ -341,12 +671,21 @@ struct dev_filter *persistent_filter_create(struct dev_filter *real,
 		return NULL;
 	}
 
-	if (!(pf->file = dm_strdup(file))) {
+	if (!(pf->file = dm_strdup(file)) ||
+	    !(pf->proc_dir = dm_strdup(proc_dir)) ||
+	    !(pf->sysfs_dir = dm_strdup(sysfs_dir))) {
 		log_error("Filename duplication for persistent filter failed.");
 		goto bad;
 	}
 
 	pf->real = real;
+	pf->config_hash = config_hash;
+	pf->md_filtering = md_filtering();
+
+	if (!(pf->mem = dm_pool_create("persistent filter", 1024))) {
+		log_error("Couldn't create pool for persistent filter.");
+		goto bad;
+	}
 
 	if (!(_init_hash(pf))) {
 		log_error("Couldn't create hash table for persistent filter.");
@@ -362,6 +701,12 @@ struct dev_filter *persistent_filter_create(struct dev_filter *real,
 	if (!stat(pf->file, &info))
 		pf->ctime = info.st_ctime;
 
+	/* Before any verdicts, so changes while they are reached show up */
+	pf->have_stamp = _read_stamp(pf, &pf->stamp);
+
+	/* Written out unless loaded unchanged */
+	pf->dirty = 1;
+
 	f->passes_filter = _lookup_p;
 	f->destroy = _persistent_destroy;
 	f->use_count = 0;
@@ -372,6 +717,10 @@ struct dev_filter *persistent_filter_create(struct dev_filter *real,
 
       bad:
 	dm_free(pf->file);
+	dm_free(pf->proc_dir);
+	dm_free(pf->sysfs_dir);
+	if (pf->mem)
+		dm_pool_destroy(pf->mem);
 	if (pf->devices)
 		dm_hash_destroy(pf->devices);
 	dm_free(pf);
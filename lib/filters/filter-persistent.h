@@ -18,10 +18,18 @@
 
 #include "dev-cache.h"
 
+/*
+ * proc_dir and sysfs_dir are used to tell whether any device changed
+ * since the verdicts cached in file were reached.  config_hash identifies
+ * the configuration of f: verdicts cached under another one are ignored.
+ */
 struct dev_filter *persistent_filter_create(struct dev_filter *f,
-					    const char *file);
+					    const char *file,
+					    const char *proc_dir,
+					    const char *sysfs_dir,
+					    uint32_t config_hash);
 
-int persistent_filter_load(struct dev_filter *f, struct dm_config_tree **cft_out);
+int persistent_filter_load(struct dev_filter *f);
 int persistent_filter_dump(struct dev_filter *f, int merge_existing);
 
 #endif
@@ -16,6 +16,7 @@
 #include "lib.h"
 #include "filter-regex.h"
 #include "device.h"
+#include "lvm-regex.h"
 
 struct rfilter {
 	struct dm_pool *mem;
@@ -87,7 +88,8 @@ static int _extract_pattern(struct dm_pool *mem, const char *pat,
 	return 1;
 }
 
-static int _build_matcher(struct rfilter *rf, const struct dm_config_value *val)
+static int _build_matcher(struct rfilter *rf, const struct dm_config_value *val,
+			  const char *dfa_file)
 {
 	struct dm_pool *scratch;
 	const struct dm_config_value *v;
@@ -136,8 +138,8 @@ static int _build_matcher(struct rfilter *rf, const struct dm_config_value *val)
 	/*
 	 * build the matcher.
 	 */
-	if (!(rf->engine = dm_regex_create(rf->mem, (const char * const*) regex,
-					   count)))
+	if (!(rf->engine = regex_create_cached(rf->mem, (const char * const*) regex,
+					       count, dfa_file)))
 		goto_out;
 	r = 1;
 
@@ -189,7 +191,8 @@ static void _regex_destroy(struct dev_filter *f)
 	dm_pool_destroy(rf->mem);
 }
 
-struct dev_filter *regex_filter_create(const struct dm_config_value *patterns)
+struct dev_filter *regex_filter_create(const struct dm_config_value *patterns,
+				      const char *dfa_file)
 {
 	struct dm_pool *mem = dm_pool_create("filter regex", 10 * 1024);
 	struct rfilter *rf;
@@ -203,7 +206,7 @@ struct dev_filter *regex_filter_create(const struct dm_config_value *patterns)
 
 	rf->mem = mem;
 
-	if (!_build_matcher(rf, patterns))
+	if (!_build_matcher(rf, patterns, dfa_file))
 		goto_bad;
 
 	if (!(f = dm_pool_zalloc(mem, sizeof(*f))))
@@ -25,8 +25,12 @@
  * r/cdrom/          - reject cdroms
  * a|loop/[0-4]|     - accept loops 0 to 4
  * r|.*|             - reject everything else
+ *
+ * If dfa_file is set, the compiled patterns are loaded from it, or saved
+ * there for the next command when it holds none for these patterns.
  */
 
-struct dev_filter *regex_filter_create(const struct dm_config_value *patterns);
+struct dev_filter *regex_filter_create(const struct dm_config_value *patterns,
+				      const char *dfa_file);
 
 #endif
@@ -20,6 +20,7 @@
 #include "config.h"
 #include "metadata.h"
 #include "activate.h"
+#include "dev-sysfs.h"
 
 #include <dirent.h>
 #include <unistd.h>
@@ -61,6 +62,7 @@ int blkext_major(void)
 int dev_subsystem_part_major(const struct device *dev)
 {
 	dev_t primary_dev;
+	int r;
 
 	if (MAJOR(dev->dev) == _md_major)
 		return 1;
@@ -71,10 +73,12 @@ int dev_subsystem_part_major(const struct device *dev)
 	if (MAJOR(dev->dev) == _emcpower_major)
 		return 1;
 
-	if ((MAJOR(dev->dev) == _blkext_major) &&
-	    (get_primary_dev(sysfs_dir_path(), dev, &primary_dev)) &&
-	    (MAJOR(primary_dev) == _md_major))
-		return 1;
+	if (MAJOR(dev->dev) == _blkext_major) {
+		if ((r = dev_sysfs_primary(sysfs_dir_path(), dev->dev, &primary_dev)) < 0)
+			r = get_primary_dev(sysfs_dir_path(), dev, &primary_dev);
+		if (r && (MAJOR(primary_dev) == _md_major))
+			return 1;
+	}
 
 	return 0;
 }
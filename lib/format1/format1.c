@@ -384,9 +384,13 @@ static int _format1_pv_setup(const struct format_type *fmt,
 static int _format1_lv_setup(struct format_instance *fid, struct logical_volume *lv)
 {
 	uint64_t max_size = UINT_MAX;
+	union lvid lvid;
 
-	if (!*lv->lvid.s)
-		lvid_from_lvnum(&lv->lvid, &lv->vg->id, find_free_lvnum(lv));
+	if (!*lv->lvid.s) {
+		lvid_from_lvnum(&lvid, &lv->vg->id, find_free_lvnum(lv));
+		if (!lv_set_lvid(lv, &lvid))
+			return_0;
+	}
 
 	if (lv->le_count > MAX_LE_TOTAL) {
 		log_error("logical volumes cannot contain more than "
@@ -51,6 +51,8 @@ typedef int (*nl_fn) (struct formatter * f);
 struct formatter {
 	struct dm_pool *mem;	/* pv names allocated from here */
 	struct dm_hash_table *pv_names;	/* dev_name -> pv_name (eg, pv1) */
+	struct dm_hash_table *pv_refs;	/* pv -> pv_name, for the cache keys */
+	struct export_cache *cache;	/* Raw exports of VGs being written */
 
 	union {
 		FILE *fp;	/* where we're writing to */
@@ -442,58 +444,399 @@ static const char *_get_pv_name(struct formatter *f, struct physical_volume *pv)
 	return _get_pv_name_from_uuid(f, uuid);
 }
 
-static int _print_pvs(struct formatter *f, struct volume_group *vg)
+/*
+ * Raw exports of a VG being written keep the text of each PV and LV in
+ * the VG's export cache, together with a key holding everything that
+ * text is printed from: the fields of the PV or LV and its segments,
+ * the names of the PVs and LVs they refer to and the extent size.
+ * While the key is unchanged the kept text is copied instead of being
+ * printed again, so the cost of an export follows what changed since
+ * the previous one.
+ *
+ * Anything that _print_pv(), _print_lv() or the text_export method of
+ * a segment type prints must be added to the keys below.
+ */
+struct export_fragment {
+	char *key;		/* Text follows the key in the same block */
+	size_t key_size;
+	char *text;
+	size_t text_size;
+};
+
+struct export_cache {
+	struct dm_hash_table *fragments;	/* PV or LV id -> fragment */
+	char *key;		/* Key being built */
+	size_t key_size;
+	size_t key_used;
+	int key_error;
+};
+
+static void _key_start(struct formatter *f)
+{
+	f->cache->key_used = 0;
+	f->cache->key_error = 0;
+}
+
+static void _key_add(struct formatter *f, const void *data, size_t size)
+{
+	struct export_cache *cache = f->cache;
+	size_t new_size = cache->key_size ? : 1024;
+	char *key;
+
+	if (cache->key_error)
+		return;
+
+	if (cache->key_used + size > cache->key_size) {
+		while (cache->key_used + size > new_size)
+			new_size *= 2;
+
+		if (!(key = dm_realloc(cache->key, new_size))) {
+			cache->key_error = 1;
+			return;
+		}
+
+		cache->key = key;
+		cache->key_size = new_size;
+	}
+
+	memcpy(cache->key + cache->key_used, data, size);
+	cache->key_used += size;
+}
+
+#define _key_val(f, val) _key_add((f), &(val), sizeof(val))
+
+static void _key_str(struct formatter *f, const char *str)
+{
+	if (!str)
+		str = "";
+
+	_key_add(f, str, strlen(str) + 1);
+}
+
+/* Names are never empty, so an empty one stands for no LV */
+static void _key_lv(struct formatter *f, const struct logical_volume *lv)
+{
+	_key_str(f, lv ? lv->name : NULL);
+}
+
+/* Tags are never empty either, so an empty one ends the list */
+static void _key_tags(struct formatter *f, const struct dm_list *tags)
+{
+	const struct str_list *sl;
+
+	dm_list_iterate_items(sl, tags)
+		_key_str(f, sl->str);
+	_key_str(f, NULL);
+}
+
+static int _key_pv_ref(struct formatter *f, const struct physical_volume *pv)
 {
-	struct pv_list *pvl;
-	struct physical_volume *pv;
-	char buffer[4096];
-	char *buf;
 	const char *name;
 
-	outf(f, "physical_volumes {");
-	_inc_indent(f);
+	if (!(name = dm_hash_lookup_binary(f->pv_refs, &pv, sizeof(pv))))
+		return 0;
 
-	dm_list_iterate_items(pvl, &vg->pvs) {
-		pv = pvl->pv;
+	_key_str(f, name);
 
-		if (!id_write_format(&pv->id, buffer, sizeof(buffer)))
-			return_0;
+	return 1;
+}
 
-		if (!(name = _get_pv_name_from_uuid(f, buffer)))
-			return_0;
+static int _key_seg(struct formatter *f, const struct lv_segment *seg)
+{
+	const struct lv_thin_message *tmsg;
+	uint32_t count = dm_list_size(&seg->thin_messages);
+	uint32_t s;
 
-		outnl(f);
-		outf(f, "%s {", name);
-		_inc_indent(f);
+	/* Replicator and unknown segments print state not covered here */
+	if (seg->segtype_private || seg->replicator || seg->rlog_lv)
+		return 0;
 
-		outf(f, "id = \"%s\"", buffer);
+	_key_val(f, seg->segtype);
+	_key_val(f, seg->le);
+	_key_val(f, seg->len);
+	_key_val(f, seg->status);
+	_key_val(f, seg->stripe_size);
+	_key_val(f, seg->area_count);
+	_key_val(f, seg->chunk_size);
+	_key_val(f, seg->region_size);
+	_key_val(f, seg->extents_copied);
+	_key_val(f, seg->transaction_id);
+	_key_val(f, seg->low_water_mark);
+	_key_val(f, seg->zero_new_blocks);
+	_key_val(f, seg->discards);
+	_key_val(f, seg->device_id);
+	_key_lv(f, seg->origin);
+	_key_lv(f, seg->cow);
+	_key_lv(f, seg->log_lv);
+	_key_lv(f, seg->metadata_lv);
+	_key_lv(f, seg->pool_lv);
+	_key_tags(f, &seg->tags);
+
+	_key_val(f, count);
+	dm_list_iterate_items(tmsg, &seg->thin_messages) {
+		_key_val(f, tmsg->type);
+		if (tmsg->type == DM_THIN_MESSAGE_DELETE)
+			_key_val(f, tmsg->u.delete_id);
+		else
+			_key_lv(f, tmsg->u.lv);
+	}
 
-		if (!(buf = alloca(dm_escaped_len(pv_dev_name(pv))))) {
-			log_error("temporary stack allocation for device name"
-				  "string failed");
+	for (s = 0; s < seg->area_count; s++) {
+		_key_val(f, seg_type(seg, s));
+		switch (seg_type(seg, s)) {
+		case AREA_PV:
+			if (!_key_pv_ref(f, seg_pv(seg, s)))
+				return 0;
+			_key_val(f, seg_pe(seg, s));
+			break;
+		case AREA_LV:
+			_key_lv(f, seg_lv(seg, s));
+			_key_val(f, seg_le(seg, s));
+			if (seg->meta_areas && seg_metatype(seg, s) == AREA_LV)
+				_key_lv(f, seg_metalv(seg, s));
+			break;
+		case AREA_UNASSIGNED:
 			return 0;
 		}
+	}
 
-		outhint(f, "device = \"%s\"",
-			dm_escape_double_quotes(buf, pv_dev_name(pv)));
-		outnl(f);
+	return 1;
+}
 
-		if (!_print_flag_config(f, pv->status, PV_FLAGS))
-			return_0;
+/*
+ * Returns 0 if the LV cannot be cached.
+ */
+static int _key_lv_text(struct formatter *f, const struct logical_volume *lv)
+{
+	const struct lv_segment *seg;
+
+	if (lv->rdevice || !dm_list_empty(&lv->rsites))
+		return 0;
+
+	_key_start(f);
+	_key_val(f, lv->vg->extent_size);
+	_key_str(f, lv->name);
+	_key_val(f, lv->lvid.id[1]);
+	_key_val(f, lv->status);
+	_key_tags(f, &lv->tags);
+	_key_val(f, lv->timestamp);
+	_key_str(f, lv->hostname);
+	_key_val(f, lv->alloc);
+	_key_val(f, lv->read_ahead);
+	_key_val(f, lv->major);
+	_key_val(f, lv->minor);
+
+	dm_list_iterate_items(seg, &lv->segments)
+		if (!_key_seg(f, seg))
+			return 0;
+
+	return !f->cache->key_error;
+}
+
+static int _key_pv_text(struct formatter *f, const struct volume_group *vg,
+			const struct physical_volume *pv)
+{
+	_key_start(f);
+	_key_val(f, vg->extent_size);
+	if (!_key_pv_ref(f, pv))
+		return 0;
+	_key_val(f, pv->id);
+	_key_str(f, pv_dev_name(pv));
+	_key_val(f, pv->status);
+	_key_tags(f, &pv->tags);
+	_key_val(f, pv->size);
+	_key_val(f, pv->pe_start);
+	_key_val(f, pv->pe_count);
+
+	return !f->cache->key_error;
+}
+
+/*
+ * The fragment kept for a PV or LV id, added if there is none yet.
+ */
+static struct export_fragment *_get_fragment(struct formatter *f,
+					     const struct id *id)
+{
+	struct export_fragment *frag;
 
-		if (!_out_tags(f, &pv->tags))
+	if ((frag = dm_hash_lookup_binary(f->cache->fragments, id, sizeof(*id))))
+		return frag;
+
+	if (!(frag = dm_zalloc(sizeof(*frag))))
+		return_NULL;
+
+	if (!dm_hash_insert_binary(f->cache->fragments, id, sizeof(*id), frag)) {
+		dm_free(frag);
+		return_NULL;
+	}
+
+	return frag;
+}
+
+static int _fragment_is_current(struct formatter *f,
+				const struct export_fragment *frag)
+{
+	return frag->key && frag->key_size == f->cache->key_used &&
+		!memcmp(frag->key, f->cache->key, frag->key_size);
+}
+
+static int _splice_fragment(struct formatter *f,
+			    const struct export_fragment *frag)
+{
+	while (f->data.buf.used + frag->text_size + 1 > f->data.buf.size)
+		if (!_extend_buffer(f))
 			return_0;
 
-		outsize(f, pv->size, "dev_size = %" PRIu64, pv->size);
+	memcpy(f->data.buf.start + f->data.buf.used, frag->text, frag->text_size);
+	f->data.buf.used += frag->text_size;
+	f->data.buf.start[f->data.buf.used] = '\0';
 
-		outf(f, "pe_start = %" PRIu64, pv->pe_start);
-		outsize(f, vg->extent_size * (uint64_t) pv->pe_count,
-			"pe_count = %u", pv->pe_count);
+	return 1;
+}
+
+/*
+ * Keep the text printed from start with the key just built.
+ * Failing to keep it does not fail the export.
+ */
+static void _keep_fragment(struct formatter *f, struct export_fragment *frag,
+			   uint32_t start)
+{
+	size_t text_size = f->data.buf.used - start;
+
+	dm_free(frag->key);
+	frag->key = frag->text = NULL;
 
-		_dec_indent(f);
-		outf(f, "}");
+	if (!(frag->key = dm_malloc(f->cache->key_used + text_size))) {
+		stack;
+		return;
 	}
 
+	frag->key_size = f->cache->key_used;
+	memcpy(frag->key, f->cache->key, frag->key_size);
+	frag->text = frag->key + frag->key_size;
+	frag->text_size = text_size;
+	memcpy(frag->text, f->data.buf.start + start, text_size);
+}
+
+static int _init_export_cache(struct volume_group *vg)
+{
+	struct export_cache *cache;
+
+	if (vg->export_cache)
+		return 1;
+
+	if (!(cache = dm_zalloc(sizeof(*cache))))
+		return_0;
+
+	if (!(cache->fragments = dm_hash_create(1024))) {
+		dm_free(cache);
+		return_0;
+	}
+
+	vg->export_cache = cache;
+
+	return 1;
+}
+
+void destroy_vg_export_cache(struct volume_group *vg)
+{
+	struct dm_hash_node *n;
+	struct export_fragment *frag;
+
+	if (!vg->export_cache)
+		return;
+
+	dm_hash_iterate(n, vg->export_cache->fragments) {
+		frag = dm_hash_get_data(vg->export_cache->fragments, n);
+		dm_free(frag->key);
+		dm_free(frag);
+	}
+
+	dm_hash_destroy(vg->export_cache->fragments);
+	dm_free(vg->export_cache->key);
+	dm_free(vg->export_cache);
+	vg->export_cache = NULL;
+}
+
+static int _print_pv(struct formatter *f, struct volume_group *vg,
+		     struct physical_volume *pv)
+{
+	char buffer[4096];
+	char *buf;
+	const char *name;
+
+	if (!id_write_format(&pv->id, buffer, sizeof(buffer)))
+		return_0;
+
+	if (!(name = _get_pv_name_from_uuid(f, buffer)))
+		return_0;
+
+	outnl(f);
+	outf(f, "%s {", name);
+	_inc_indent(f);
+
+	outf(f, "id = \"%s\"", buffer);
+
+	if (!(buf = alloca(dm_escaped_len(pv_dev_name(pv))))) {
+		log_error("temporary stack allocation for device name"
+			  "string failed");
+		return 0;
+	}
+
+	outhint(f, "device = \"%s\"",
+		dm_escape_double_quotes(buf, pv_dev_name(pv)));
+	outnl(f);
+
+	if (!_print_flag_config(f, pv->status, PV_FLAGS))
+		return_0;
+
+	if (!_out_tags(f, &pv->tags))
+		return_0;
+
+	outsize(f, pv->size, "dev_size = %" PRIu64, pv->size);
+
+	outf(f, "pe_start = %" PRIu64, pv->pe_start);
+	outsize(f, vg->extent_size * (uint64_t) pv->pe_count,
+		"pe_count = %u", pv->pe_count);
+
+	_dec_indent(f);
+	outf(f, "}");
+
+	return 1;
+}
+
+static int _print_cached_pv(struct formatter *f, struct volume_group *vg,
+			    struct physical_volume *pv)
+{
+	struct export_fragment *frag;
+	uint32_t start = f->data.buf.used;
+
+	if (!f->cache || !_key_pv_text(f, vg, pv) ||
+	    !(frag = _get_fragment(f, &pv->id)))
+		return _print_pv(f, vg, pv);
+
+	if (_fragment_is_current(f, frag))
+		return _splice_fragment(f, frag);
+
+	if (!_print_pv(f, vg, pv))
+		return_0;
+
+	_keep_fragment(f, frag, start);
+
+	return 1;
+}
+
+static int _print_pvs(struct formatter *f, struct volume_group *vg)
+{
+	struct pv_list *pvl;
+
+	outf(f, "physical_volumes {");
+	_inc_indent(f);
+
+	dm_list_iterate_items(pvl, &vg->pvs)
+		if (!_print_cached_pv(f, vg, pvl->pv))
+			return_0;
+
 	_dec_indent(f);
 	outf(f, "}");
 	return 1;
@@ -648,6 +991,26 @@ static int _print_lv(struct formatter *f, struct logical_volume *lv)
 	return 1;
 }
 
+static int _print_cached_lv(struct formatter *f, struct logical_volume *lv)
+{
+	struct export_fragment *frag;
+	uint32_t start = f->data.buf.used;
+
+	if (!f->cache || !_key_lv_text(f, lv) ||
+	    !(frag = _get_fragment(f, &lv->lvid.id[1])))
+		return _print_lv(f, lv);
+
+	if (_fragment_is_current(f, frag))
+		return _splice_fragment(f, frag);
+
+	if (!_print_lv(f, lv))
+		return_0;
+
+	_keep_fragment(f, frag, start);
+
+	return 1;
+}
+
 static int _print_lvs(struct formatter *f, struct volume_group *vg)
 {
 	struct lv_list *lvl;
@@ -667,14 +1030,14 @@ static int _print_lvs(struct formatter *f, struct volume_group *vg)
 	dm_list_iterate_items(lvl, &vg->lvs) {
 		if (!(lv_is_visible(lvl->lv)))
 			continue;
-		if (!_print_lv(f, lvl->lv))
+		if (!_print_cached_lv(f, lvl->lv))
 			return_0;
 	}
 
 	dm_list_iterate_items(lvl, &vg->lvs) {
 		if ((lv_is_visible(lvl->lv)))
 			continue;
-		if (!_print_lv(f, lvl->lv))
+		if (!_print_cached_lv(f, lvl->lv))
 			return_0;
 	}
 
@@ -702,6 +1065,9 @@ static int _build_pv_names(struct formatter *f, struct volume_group *vg)
 	if (!(f->pv_names = dm_hash_create(128)))
 		return_0;
 
+	if (f->cache && !(f->pv_refs = dm_hash_create(128)))
+		return_0;
+
 	dm_list_iterate_items(pvl, &vg->pvs) {
 		pv = pvl->pv;
 
@@ -718,6 +1084,10 @@ static int _build_pv_names(struct formatter *f, struct volume_group *vg)
 
 		if (!dm_hash_insert(f->pv_names, uuid, name))
 			return_0;
+
+		if (f->pv_refs &&
+		    !dm_hash_insert_binary(f->pv_refs, &pv, sizeof(pv), name))
+			return_0;
 	}
 
 	return 1;
@@ -770,6 +1140,11 @@ static int _text_vg_export(struct formatter *f,
 		f->pv_names = NULL;
 	}
 
+	if (f->pv_refs) {
+		dm_hash_destroy(f->pv_refs);
+		f->pv_refs = NULL;
+	}
+
 	return r;
 }
 
@@ -796,12 +1171,49 @@ int text_vg_export_file(struct volume_group *vg, const char *desc, FILE *fp)
 	return r;
 }
 
+/*
+ * Between vg_write() and vg_commit() or vg_revert() the VG cannot change
+ * but is exported again for lvmetad and the metadata cache, so the
+ * export is kept and copied rather than generated each time.
+ */
+void keep_vg_export(struct volume_group *vg)
+{
+	vg->keep_export = 1;
+}
+
+void drop_vg_export(struct volume_group *vg)
+{
+	dm_free(vg->export_buf);
+	vg->export_buf = NULL;
+	vg->export_size = 0;
+	vg->keep_export = 0;
+}
+
+static size_t _copy_export(const char *export_buf, size_t export_size, char **buf)
+{
+	if (!(*buf = dm_malloc(export_size))) {
+		log_error("text_export buffer allocation failed");
+		return 0;
+	}
+
+	memcpy(*buf, export_buf, export_size);
+
+	return export_size;
+}
+
 /* Returns amount of buffer used incl. terminating NUL */
 size_t text_vg_export_raw(struct volume_group *vg, const char *desc, char **buf)
 {
 	struct formatter *f;
 	size_t r = 0;
 
+	/* The kept export has an empty description */
+	if (vg->keep_export && !*desc && vg->export_buf) {
+		log_debug("Reusing %" PRIsize_t " bytes of %s metadata.",
+			  vg->export_size, vg->name);
+		return _copy_export(vg->export_buf, vg->export_size, buf);
+	}
+
 	_init();
 
 	if (!(f = dm_zalloc(sizeof(*f))))
@@ -818,6 +1230,14 @@ size_t text_vg_export_raw(struct volume_group *vg, const char *desc, char **buf)
 	f->out_with_comment = &_out_with_comment_raw;
 	f->nl = &_nl_raw;
 
+	/* VGs being written are likely to be written again */
+	if (vg->keep_export || vg->export_cache) {
+		if (_init_export_cache(vg))
+			f->cache = vg->export_cache;
+		else
+			stack;
+	}
+
 	if (!_text_vg_export(f, vg, desc)) {
 		dm_free(f->data.buf.start);
 		goto_out;
@@ -826,6 +1246,10 @@ size_t text_vg_export_raw(struct volume_group *vg, const char *desc, char **buf)
 	r = f->data.buf.used + 1;
 	*buf = f->data.buf.start;
 
+	if (vg->keep_export && !*desc &&
+	    !(vg->export_size = _copy_export(*buf, r, &vg->export_buf)))
+		stack;
+
       out:
 	dm_free(f);
 	return r;
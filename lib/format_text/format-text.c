@@ -29,6 +29,7 @@
 #include "label.h"
 #include "lvmcache.h"
 #include "lvmetad.h"
+#include "defaults.h"
 
 #include <unistd.h>
 #include <sys/param.h>
@@ -42,6 +43,8 @@ static struct format_instance *_text_create_text_instance(const struct format_ty
 struct text_fid_context {
 	char *raw_metadata_buf;
 	uint32_t raw_metadata_buf_size;
+	struct dev_aio *aio;		/* Metadata writes in flight */
+	int aio_failed;
 };
 
 struct dir_list {
@@ -278,6 +281,8 @@ static int _pv_analyze_mda_raw (const struct format_type * fmt,
 static int _text_lv_setup(struct format_instance *fid __attribute__((unused)),
 			  struct logical_volume *lv)
 {
+	union lvid lvid;
+
 /******** FIXME Any LV size restriction?
 	uint64_t max_size = UINT_MAX;
 
@@ -289,10 +294,14 @@ static int _text_lv_setup(struct format_instance *fid __attribute__((unused)),
 	}
 */
 
-	if (!*lv->lvid.s && !lvid_create(&lv->lvid, &lv->vg->id)) {
-		log_error("Random lvid creation failed for %s/%s.",
-			  lv->vg->name, lv->name);
-		return 0;
+	if (!*lv->lvid.s) {
+		if (!lvid_create(&lvid, &lv->vg->id)) {
+			log_error("Random lvid creation failed for %s/%s.",
+				  lv->vg->name, lv->name);
+			return 0;
+		}
+		if (!lv_set_lvid(lv, &lvid))
+			return_0;
 	}
 
 	return 1;
@@ -565,6 +574,63 @@ static struct volume_group *_vg_read_precommit_raw(struct format_instance *fid,
 	return vg;
 }
 
+static void _metadata_written(struct device *dev, void *buf, void *context)
+{
+	struct text_fid_context *fidtc = context;
+
+	if (!buf)
+		fidtc->aio_failed = 1;
+}
+
+/*
+ * Wait for the metadata writes queued by _vg_write_raw.  A failure
+ * is reported once, to the first caller after it happened.
+ */
+static int _wait_metadata_writes(struct text_fid_context *fidtc)
+{
+	int r = 1;
+
+	if (fidtc->aio) {
+		if (!dev_aio_wait(fidtc->aio))
+			fidtc->aio_failed = 1;
+		dev_aio_destroy(fidtc->aio);
+		fidtc->aio = NULL;
+	}
+
+	if (fidtc->aio_failed) {
+		log_error("Failed to write metadata.");
+		fidtc->aio_failed = 0;
+		r = 0;
+	}
+
+	return r;
+}
+
+/*
+ * With metadata/write_queue_depth set, the text is queued to all the
+ * metadata areas at once and awaited before the first header update.
+ */
+static int _write_metadata_text(struct format_instance *fid,
+				struct device *dev, uint64_t offset,
+				size_t len, char *buf)
+{
+	struct text_fid_context *fidtc = (struct text_fid_context *) fid->private;
+	int depth;
+
+	if (!fidtc->aio &&
+	    (depth = find_config_tree_int(fid->fmt->cmd,
+					  "metadata/write_queue_depth",
+					  DEFAULT_METADATA_WRITE_QUEUE_DEPTH)) > 0 &&
+	    !(fidtc->aio = dev_aio_create((unsigned) depth)))
+		return_0;
+
+	if (!fidtc->aio)
+		return dev_write(dev, offset, len, buf);
+
+	return dev_aio_write(fidtc->aio, dev, offset, len, buf,
+			     _metadata_written, fidtc);
+}
+
 static int _vg_write_raw(struct format_instance *fid, struct volume_group *vg,
 			 struct metadata_area *mda)
 {
@@ -630,9 +696,10 @@ static int _vg_write_raw(struct format_instance *fid, struct volume_group *vg,
 		  mdac->rlocn.offset, mdac->rlocn.size - new_wrap);
 
 	/* Write text out, circularly */
-	if (!dev_write(mdac->area.dev, mdac->area.start + mdac->rlocn.offset,
-		       (size_t) (mdac->rlocn.size - new_wrap),
-		       fidtc->raw_metadata_buf))
+	if (!_write_metadata_text(fid, mdac->area.dev,
+				  mdac->area.start + mdac->rlocn.offset,
+				  (size_t) (mdac->rlocn.size - new_wrap),
+				  fidtc->raw_metadata_buf))
 		goto_out;
 
 	if (new_wrap) {
@@ -640,11 +707,11 @@ static int _vg_write_raw(struct format_instance *fid, struct volume_group *vg,
 			  dev_name(mdac->area.dev), mdac->area.start +
 			  MDA_HEADER_SIZE, new_wrap);
 
-		if (!dev_write(mdac->area.dev,
-			       mdac->area.start + MDA_HEADER_SIZE,
-			       (size_t) new_wrap,
-			       fidtc->raw_metadata_buf +
-			       mdac->rlocn.size - new_wrap))
+		if (!_write_metadata_text(fid, mdac->area.dev,
+					  mdac->area.start + MDA_HEADER_SIZE,
+					  (size_t) new_wrap,
+					  fidtc->raw_metadata_buf +
+					  mdac->rlocn.size - new_wrap))
 			goto_out;
 	}
 
@@ -661,6 +728,10 @@ static int _vg_write_raw(struct format_instance *fid, struct volume_group *vg,
 
       out:
 	if (!r) {
+		/* Let queued writes land before the device is closed */
+		if (fidtc->aio && !dev_aio_wait(fidtc->aio))
+			stack;
+
 		if (!dev_close(mdac->area.dev))
 			stack;
 
@@ -698,6 +769,10 @@ static int _vg_commit_raw_rlocn(struct format_instance *fid,
 	if (!found)
 		return 1;
 
+	/* All metadata text must be on disk before any header points at it */
+	if (!_wait_metadata_writes(fidtc) && mdac->rlocn.size)
+		goto_out;
+
 	if (!(mdah = raw_read_mda_header(fid->fmt, &mdac->area)))
 		goto_out;
 
@@ -1528,7 +1603,11 @@ static int _text_pv_initialise(const struct format_type *fmt,
 
 static void _text_destroy_instance(struct format_instance *fid)
 {
+	struct text_fid_context *fidtc = (struct text_fid_context *) fid->private;
+
 	if (--fid->ref_count <= 1) {
+		if (fidtc && fidtc->aio)
+			(void) _wait_metadata_writes(fidtc);
 		if (fid->metadata_areas_index)
 			dm_hash_destroy(fid->metadata_areas_index);
 		dm_pool_destroy(fid->mem);
@@ -51,6 +51,16 @@ struct text_context {
 };
 struct format_type *create_text_format(struct cmd_context *cmd);
 
+/*
+ * Metadata read-ahead
+ */
+int text_prefetch_vgs(struct cmd_context *cmd, struct dm_list *vgnames,
+		      unsigned threads);
+int text_read_prefetched(struct dm_config_tree *cft, struct device *dev,
+			 off_t offset, uint32_t size,
+			 off_t offset2, uint32_t size2, uint32_t checksum);
+void text_prefetch_destroy(void);
+
 struct labeller *text_labeller_create(const struct format_type *fmt);
 
 int pvhdr_read(struct device *dev, char *buf);
@@ -16,6 +16,7 @@
 #include "lib.h"
 #include "metadata.h"
 #include "import-export.h"
+#include "format-text.h"
 
 /* FIXME Use tidier inclusion method */
 static struct text_vg_version_ops *(_text_vsn_list[2]);
@@ -96,8 +97,10 @@ struct volume_group *text_vg_import_fd(struct format_instance *fid,
 		return_NULL;
 
 	if ((!dev && !config_file_read(cft)) ||
-	    (dev && !config_file_read_fd(cft, dev, offset, size,
-					 offset2, size2, checksum_fn, checksum))) {
+	    (dev && !text_read_prefetched(cft, dev, offset, size,
+					  offset2, size2, checksum) &&
+	     !config_file_read_fd(cft, dev, offset, size,
+				  offset2, size2, checksum_fn, checksum))) {
 		log_error("Couldn't read volume group metadata.");
 		goto out;
 	}
@@ -518,6 +518,15 @@ static int _read_lvnames(struct format_instance *fid __attribute__((unused)),
 		return 0;
 	}
 
+	/* Read before link_lv_to_vg() indexes it.  FIXME: read full lvid */
+	if (!_read_id(&lv->lvid.id[1], lvn, "id")) {
+		log_error("Couldn't read uuid for logical volume %s.",
+			  lv->name);
+		return 0;
+	}
+
+	memcpy(&lv->lvid.id[0], &vg->id, sizeof(lv->lvid.id[0]));
+
 	if (!_read_flag_config(lvn, &lv->status, LV_FLAGS)) {
 		log_error("Couldn't read status flags for logical volume %s.",
 			  lv->name);
@@ -606,15 +615,6 @@ static int _read_lvsegs(struct format_instance *fid __attribute__((unused)),
 		return 0;
 	}
 
-	/* FIXME: read full lvid */
-	if (!_read_id(&lv->lvid.id[1], lvn, "id")) {
-		log_error("Couldn't read uuid for logical volume %s.",
-			  lv->name);
-		return 0;
-	}
-
-	memcpy(&lv->lvid.id[0], &lv->vg->id, sizeof(lv->lvid.id[0]));
-
 	if (!_read_segments(lv, lvn, pv_hash))
 		return_0;
 
@@ -0,0 +1,359 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Metadata read-ahead for commands that process many VGs.
+ *
+ * Nothing else in the library is thread-safe, so the worker threads
+ * here only open devices by name, read the metadata area header and
+ * the metadata text it points at, and leave the result in their job.
+ * They use neither the device cache, nor lvmcache, nor the logging
+ * functions, nor dm_malloc.
+ *
+ * The VGs are still locked, read and processed one at a time, in order,
+ * by the command itself.  Under the VG lock the metadata area header is
+ * always read again from the disk, and the text read ahead is used only
+ * if it sits at the same place and matches the checksum in that header,
+ * so nothing read before the lock was taken is ever trusted.
+ */
+
+#include "lib.h"
+#include "format-text.h"
+#include "layout.h"
+#include "crc.h"
+#include "xlate.h"
+#include "lvmcache.h"
+#include "metadata.h"
+#include "toolcontext.h"
+
+#include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define PREFETCH_ALIGN 4096
+
+struct prefetch_job {
+	struct device *dev;
+	char *path;
+	uint64_t start;		/* Of the metadata area header */
+
+	/* Filled in by the worker */
+	char *buf;
+	off_t offset;
+	uint32_t size;
+	off_t offset2;
+	uint32_t size2;
+	uint32_t checksum;
+};
+
+struct prefetch_key {
+	struct device *dev;
+	uint64_t offset;
+};
+
+struct prefetch_jobs {
+	struct cmd_context *cmd;
+	struct prefetch_job *job;
+	unsigned count;
+	unsigned max;
+	unsigned next;
+	pthread_mutex_t lock;
+};
+
+static struct dm_hash_table *_prefetched = NULL;
+static struct prefetch_job *_prefetch_jobs = NULL;
+static unsigned _prefetch_count = 0;
+
+static void _key(struct prefetch_key *key, struct device *dev, uint64_t offset)
+{
+	memset(key, 0, sizeof(*key));
+	key->dev = dev;
+	key->offset = offset;
+}
+
+/*
+ * Reads len bytes at offset through an aligned bounce buffer,
+ * as the device may have been opened with O_DIRECT.
+ */
+static int _read_at(int fd, uint64_t offset, size_t len, char *out)
+{
+	uint64_t start = offset & ~((uint64_t) PREFETCH_ALIGN - 1);
+	size_t span = (offset - start + len + PREFETCH_ALIGN - 1) & ~((size_t) PREFETCH_ALIGN - 1);
+	size_t done = 0;
+	ssize_t n;
+	void *bounce;
+
+	if (posix_memalign(&bounce, PREFETCH_ALIGN, span))
+		return 0;
+
+	while (done < span) {
+		n = pread(fd, (char *) bounce + done, span - done, (off_t) (start + done));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += (size_t) n;
+	}
+
+	if (done >= offset - start + len)
+		memcpy(out, (char *) bounce + (offset - start), len);
+	else
+		done = 0;
+
+	free(bounce);
+
+	return done ? 1 : 0;
+}
+
+/*
+ * Mirrors raw_read_mda_header() and _vg_read_raw_area() for the
+ * committed metadata, quietly giving up on anything unexpected:
+ * the command's own read will report it.
+ */
+static void _prefetch_one(struct prefetch_job *job)
+{
+	char hdr[MDA_HEADER_SIZE] __attribute__((aligned(8)));
+	struct mda_header *mdah = (struct mda_header *) hdr;
+	struct raw_locn *rlocn = mdah->raw_locns;
+	uint64_t size, offset, wrap = 0;
+	char *buf;
+	int fd, flags = O_RDONLY;
+
+#ifdef O_DIRECT_SUPPORT
+	flags |= O_DIRECT;
+#endif
+	if ((fd = open(job->path, flags)) < 0 &&
+	    (flags == O_RDONLY || (fd = open(job->path, O_RDONLY)) < 0))
+		return;
+
+	if (!_read_at(fd, job->start, MDA_HEADER_SIZE, hdr) ||
+	    mdah->checksum_xl != xlate32(calc_crc(INITIAL_CRC, (uint8_t *) mdah->magic,
+						  MDA_HEADER_SIZE - sizeof(mdah->checksum_xl))) ||
+	    strncmp((char *) mdah->magic, FMTT_MAGIC, sizeof(mdah->magic)) ||
+	    xlate32(mdah->version) != FMTT_VERSION ||
+	    xlate64(mdah->start) != job->start ||
+	    !(offset = xlate64(rlocn->offset)))
+		goto out;
+
+	size = xlate64(rlocn->size);
+	if (offset + size > xlate64(mdah->size))
+		wrap = offset + size - xlate64(mdah->size);
+
+	if (wrap > offset || !size || size > UINT32_MAX)
+		goto out;
+
+	if (!(buf = malloc((size_t) size)))
+		goto out;
+
+	if (!_read_at(fd, job->start + offset, (size_t) (size - wrap), buf) ||
+	    (wrap && !_read_at(fd, job->start + MDA_HEADER_SIZE, (size_t) wrap,
+			       buf + size - wrap))) {
+		free(buf);
+		goto out;
+	}
+
+	job->offset = (off_t) (job->start + offset);
+	job->size = (uint32_t) (size - wrap);
+	job->offset2 = (off_t) (job->start + MDA_HEADER_SIZE);
+	job->size2 = (uint32_t) wrap;
+	job->checksum = calc_crc(calc_crc(INITIAL_CRC, (uint8_t *) buf, job->size),
+				 (uint8_t *) buf + job->size, job->size2);
+	job->buf = buf;
+out:
+	(void) close(fd);
+}
+
+static void *_prefetch_thread(void *arg)
+{
+	struct prefetch_jobs *jobs = arg;
+	unsigned i;
+
+	for (;;) {
+		pthread_mutex_lock(&jobs->lock);
+		i = jobs->next++;
+		pthread_mutex_unlock(&jobs->lock);
+
+		if (i >= jobs->count)
+			break;
+
+		_prefetch_one(&jobs->job[i]);
+	}
+
+	return NULL;
+}
+
+static int _add_mda_job(struct metadata_area *mda, void *baton)
+{
+	struct prefetch_jobs *jobs = baton;
+	struct mda_context *mdac = (struct mda_context *) mda->metadata_locn;
+	struct prefetch_job *job;
+
+	if (mda_is_ignored(mda))
+		return 1;
+
+	if (jobs->count == jobs->max) {
+		jobs->max = jobs->max ? jobs->max * 2 : 64;
+		if (!(job = dm_realloc(jobs->job, sizeof(*job) * jobs->max))) {
+			log_error("Failed to allocate metadata read-ahead jobs.");
+			return 0;
+		}
+		jobs->job = job;
+	}
+
+	job = &jobs->job[jobs->count];
+	memset(job, 0, sizeof(*job));
+	job->dev = mdac->area.dev;
+	job->start = mdac->area.start;
+	if (!(job->path = dm_pool_strdup(jobs->cmd->mem, dev_name(job->dev))))
+		return_0;
+	jobs->count++;
+
+	return 1;
+}
+
+static int _add_pv_jobs(struct lvmcache_info *info, void *baton)
+{
+	if (strcmp(lvmcache_fmt(info)->name, FMT_TEXT_NAME))
+		return 1;
+
+	return lvmcache_foreach_mda(info, _add_mda_job, baton);
+}
+
+void text_prefetch_destroy(void)
+{
+	unsigned i;
+
+	for (i = 0; i < _prefetch_count; i++)
+		free(_prefetch_jobs[i].buf);
+
+	dm_free(_prefetch_jobs);
+	_prefetch_jobs = NULL;
+	_prefetch_count = 0;
+
+	if (_prefetched) {
+		dm_hash_destroy(_prefetched);
+		_prefetched = NULL;
+	}
+}
+
+int text_prefetch_vgs(struct cmd_context *cmd, struct dm_list *vgnames,
+		      unsigned threads)
+{
+	struct prefetch_jobs jobs = { .cmd = cmd };
+	struct lvmcache_vginfo *vginfo;
+	struct prefetch_job *job;
+	struct prefetch_key key;
+	struct str_list *sl;
+	pthread_t *tids = NULL;
+	unsigned i, started = 0, found = 0;
+	int r = 0;
+
+	text_prefetch_destroy();
+
+	dm_list_iterate_items(sl, vgnames)
+		if ((vginfo = lvmcache_vginfo_from_vgname(sl->str, NULL)) &&
+		    !lvmcache_foreach_pv(vginfo, _add_pv_jobs, &jobs))
+			goto_out;
+
+	/* The jobs hold the buffers from now on */
+	_prefetch_jobs = jobs.job;
+	_prefetch_count = jobs.count;
+
+	/* Not worth a thread for a single area */
+	if (jobs.count < 2)
+		return 1;
+
+	if (!(_prefetched = dm_hash_create(jobs.count))) {
+		log_error("Failed to create metadata read-ahead hash.");
+		goto out;
+	}
+
+	if (threads > jobs.count)
+		threads = jobs.count;
+
+	if (!(tids = dm_malloc(sizeof(*tids) * threads))) {
+		log_error("Failed to allocate metadata read-ahead threads.");
+		goto out;
+	}
+
+	if (pthread_mutex_init(&jobs.lock, NULL)) {
+		log_sys_error("pthread_mutex_init", "metadata read-ahead");
+		goto out;
+	}
+
+	/* The calling thread counts as one of them */
+	for (; started + 1 < threads; started++)
+		if (pthread_create(&tids[started], NULL, _prefetch_thread, &jobs)) {
+			log_sys_debug("pthread_create", "metadata read-ahead");
+			break;
+		}
+
+	(void) _prefetch_thread(&jobs);
+
+	for (i = 0; i < started; i++)
+		(void) pthread_join(tids[i], NULL);
+
+	(void) pthread_mutex_destroy(&jobs.lock);
+
+	for (i = 0; i < jobs.count; i++) {
+		job = &jobs.job[i];
+		if (!job->buf)
+			continue;
+		_key(&key, job->dev, (uint64_t) job->offset);
+		if (!dm_hash_insert_binary(_prefetched, &key, sizeof(key), job)) {
+			log_error("Failed to store metadata read ahead.");
+			goto out;
+		}
+		found++;
+	}
+
+	log_debug("Read ahead metadata from %u of %u areas with %u threads.",
+		  found, jobs.count, started + 1);
+	r = 1;
+out:
+	dm_free(tids);
+	if (!r) {
+		_prefetch_jobs = jobs.job;
+		_prefetch_count = jobs.count;
+		text_prefetch_destroy();
+	}
+
+	return r;
+}
+
+int text_read_prefetched(struct dm_config_tree *cft, struct device *dev,
+			 off_t offset, uint32_t size,
+			 off_t offset2, uint32_t size2, uint32_t checksum)
+{
+	struct prefetch_job *job;
+	struct prefetch_key key;
+
+	if (!_prefetched)
+		return 0;
+
+	_key(&key, dev, (uint64_t) offset);
+	if (!(job = dm_hash_lookup_binary(_prefetched, &key, sizeof(key))) ||
+	    job->size != size || job->size2 != size2 ||
+	    (size2 && job->offset2 != offset2) || job->checksum != checksum)
+		return 0;
+
+	if (!dm_config_parse(cft, job->buf, job->buf + size + size2))
+		return_0;
+
+	log_debug("Using metadata read ahead from %s at %" PRIu64 ".",
+		  dev_name(dev), (uint64_t) offset);
+
+	return 1;
+}
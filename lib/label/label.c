@@ -20,6 +20,7 @@
 #include "lvmcache.h"
 #include "lvmetad.h"
 #include "metadata.h"
+#include "dev-cache.h"
 
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -98,23 +99,33 @@ struct labeller *label_get_handler(const char *name)
 	return NULL;
 }
 
-static struct labeller *_find_labeller(struct device *dev, char *buf,
-				       uint64_t *label_sector,
-				       uint64_t scan_sector)
+static void _update_lvmcache_orphan(struct device *dev)
+{
+	struct lvmcache_info *info;
+
+	if ((info = lvmcache_info_from_pvid(dev->pvid, 0)))
+		lvmcache_update_vgname_and_id(info, lvmcache_fmt(info)->orphan_vg_name,
+					      lvmcache_fmt(info)->orphan_vg_name,
+					      0, NULL);
+}
+
+/*
+ * Look for a label in the LABEL_SCAN_SIZE bytes already read into
+ * readbuf.  A NULL readbuf means the read failed.
+ */
+static struct labeller *_find_labeller_in_buf(struct device *dev,
+					      char *readbuf, char *buf,
+					      uint64_t *label_sector,
+					      uint64_t scan_sector)
 {
 	struct labeller_i *li;
 	struct labeller *r = NULL;
 	struct label_header *lh;
-	struct lvmcache_info *info;
 	uint64_t sector;
 	int found = 0;
-	char readbuf[LABEL_SCAN_SIZE] __attribute__((aligned(8)));
 
-	if (!dev_read(dev, scan_sector << SECTOR_SHIFT,
-		      LABEL_SCAN_SIZE, readbuf)) {
-		log_debug("%s: Failed to read label area", dev_name(dev));
+	if (!readbuf)
 		goto out;
-	}
 
 	/* Scan a few sectors for a valid label */
 	for (sector = 0; sector < LABEL_SCAN_SECTORS;
@@ -173,16 +184,30 @@ static struct labeller *_find_labeller(struct device *dev, char *buf,
 
       out:
 	if (!found) {
-		if ((info = lvmcache_info_from_pvid(dev->pvid, 0)))
-			lvmcache_update_vgname_and_id(info, lvmcache_fmt(info)->orphan_vg_name,
-						      lvmcache_fmt(info)->orphan_vg_name,
-						      0, NULL);
+		_update_lvmcache_orphan(dev);
 		log_very_verbose("%s: No label detected", dev_name(dev));
 	}
 
 	return r;
 }
 
+static struct labeller *_find_labeller(struct device *dev, char *buf,
+				       uint64_t *label_sector,
+				       uint64_t scan_sector)
+{
+	char readbuf[LABEL_SCAN_SIZE] __attribute__((aligned(8)));
+
+	if (!dev_read(dev, scan_sector << SECTOR_SHIFT,
+		      LABEL_SCAN_SIZE, readbuf)) {
+		log_debug("%s: Failed to read label area", dev_name(dev));
+		return _find_labeller_in_buf(dev, NULL, buf, label_sector,
+					     scan_sector);
+	}
+
+	return _find_labeller_in_buf(dev, readbuf, buf, label_sector,
+				     scan_sector);
+}
+
 /* FIXME Also wipe associated metadata area headers? */
 int label_remove(struct device *dev)
 {
@@ -270,12 +295,7 @@ int label_read(struct device *dev, struct label **result,
 
 	if (!dev_open_readonly(dev)) {
 		stack;
-
-		if ((info = lvmcache_info_from_pvid(dev->pvid, 0)))
-			lvmcache_update_vgname_and_id(info, lvmcache_fmt(info)->orphan_vg_name,
-						      lvmcache_fmt(info)->orphan_vg_name,
-						      0, NULL);
-
+		_update_lvmcache_orphan(dev);
 		return r;
 	}
 
@@ -292,11 +312,73 @@ int label_read(struct device *dev, struct label **result,
 	return r;
 }
 
+static void _label_scan_read(struct device *dev, void *readbuf,
+			     void *context __attribute__((unused)))
+{
+	char buf[LABEL_SIZE] __attribute__((aligned(8)));
+	struct labeller *l;
+	struct label *label;
+	uint64_t sector;
+
+	if (!readbuf)
+		log_debug("%s: Failed to read label area", dev_name(dev));
+
+	if ((l = _find_labeller_in_buf(dev, readbuf, buf, &sector, UINT64_C(0))) &&
+	    (l->ops->read)(l, dev, buf, &label) && label)
+		label->sector = sector;
+
+	if (!dev_close(dev))
+		stack;
+}
+
+/*
+ * Read the labels on all devices returned by iter.  With a queue_depth
+ * above 1, the label areas of that many devices are read concurrently
+ * and each is passed to the labellers as it completes.
+ */
+void label_scan(struct dev_iter *iter, unsigned queue_depth)
+{
+	struct dev_aio *aio = NULL;
+	struct label *label;
+	struct device *dev;
+
+	if (queue_depth > 1 && !(aio = dev_aio_create(queue_depth)))
+		stack;
+
+	while ((dev = dev_iter_get(iter))) {
+		if (!aio) {
+			(void) label_read(dev, &label, UINT64_C(0));
+			continue;
+		}
+
+		if (lvmcache_info_from_pvid(dev->pvid, 1)) {
+			log_debug("Using cached label for %s", dev_name(dev));
+			continue;
+		}
+
+		if (!dev_open_readonly(dev)) {
+			stack;
+			_update_lvmcache_orphan(dev);
+			continue;
+		}
+
+		if (!dev_aio_read(aio, dev, UINT64_C(0), LABEL_SCAN_SIZE,
+				  _label_scan_read, NULL))
+			_label_scan_read(dev, NULL, NULL);
+	}
+
+	if (aio) {
+		if (!dev_aio_wait(aio))
+			stack;
+		dev_aio_destroy(aio);
+	}
+}
+
 /* Caller may need to use label_get_handler to create label struct! */
 int label_write(struct device *dev, struct label *label)
 {
-	char buf[LABEL_SIZE] __attribute__((aligned(8)));
-	struct label_header *lh = (struct label_header *) buf;
+	char *buf;
+	struct label_header *lh;
 	int r = 1;
 
 	if (!label->labeller->ops->write) {
@@ -310,20 +392,29 @@ int label_write(struct device *dev, struct label *label)
 		return 0;
 	}
 
+	/* Build the label where dev_write can use it without copying */
+	if (!(buf = dev_io_buffer_get(label->sector << SECTOR_SHIFT, LABEL_SIZE)))
+		return_0;
+
+	lh = (struct label_header *) buf;
 	memset(buf, 0, LABEL_SIZE);
 
 	strncpy((char *)lh->id, LABEL_ID, sizeof(lh->id));
 	lh->sector_xl = xlate64(label->sector);
 	lh->offset_xl = xlate32(sizeof(*lh));
 
-	if (!(label->labeller->ops->write)(label, buf))
-		return_0;
+	if (!(label->labeller->ops->write)(label, buf)) {
+		r = 0;
+		goto_out;
+	}
 
 	lh->crc_xl = xlate32(calc_crc(INITIAL_CRC, (uint8_t *)&lh->offset_xl, LABEL_SIZE -
 				      ((uint8_t *) &lh->offset_xl - (uint8_t *) lh)));
 
-	if (!dev_open(dev))
-		return_0;
+	if (!dev_open(dev)) {
+		r = 0;
+		goto_out;
+	}
 
 	log_info("%s: Writing label to sector %" PRIu64 " with stored offset %"
 		 PRIu32 ".", dev_name(dev), label->sector,
@@ -336,6 +427,9 @@ int label_write(struct device *dev, struct label *label)
 	if (!dev_close(dev))
 		stack;
 
+      out:
+	dev_io_buffer_put(buf);
+
 	return r;
 }
 
@@ -345,15 +439,10 @@ int label_verify(struct device *dev)
 	struct labeller *l;
 	char buf[LABEL_SIZE] __attribute__((aligned(8)));
 	uint64_t sector;
-	struct lvmcache_info *info;
 	int r = 0;
 
 	if (!dev_open_readonly(dev)) {
-		if ((info = lvmcache_info_from_pvid(dev->pvid, 0)))
-			lvmcache_update_vgname_and_id(info, lvmcache_fmt(info)->orphan_vg_name,
-						      lvmcache_fmt(info)->orphan_vg_name,
-						      0, NULL);
-
+		_update_lvmcache_orphan(dev);
 		return_0;
 	}
 
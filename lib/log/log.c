@@ -52,6 +52,11 @@ void init_log_fn(lvm2_log_fn_t log_fn)
 		_lvm2_log_fn = NULL;
 }
 
+int log_fn_is_set(void)
+{
+	return _lvm2_log_fn ? 1 : 0;
+}
+
 void init_log_file(const char *log_file, int append)
 {
 	const char *open_mode = append ? "a" : "w";
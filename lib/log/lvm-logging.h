@@ -32,6 +32,7 @@ typedef void (*lvm2_log_fn_t) (int level, const char *file, int line,
 			       int dm_errno, const char *message);
 
 void init_log_fn(lvm2_log_fn_t log_fn);
+int log_fn_is_set(void);
 
 void init_indent(int indent);
 void init_msg_prefix(const char *prefix);
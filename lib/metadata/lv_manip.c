@@ -1544,7 +1544,7 @@ static area_use_t _check_pva(struct alloc_handle *ah, struct pv_area *pva, uint3
 {
 	unsigned s;
 
-	/* Skip fully-reserved areas (which are not currently removed from the list). */
+	/* Skip fully-reserved areas. */
 	if (!pva->unreserved)
 		return NEXT_AREA;
 
@@ -1623,13 +1623,10 @@ static uint32_t _calc_required_extents(struct alloc_handle *ah, struct pv_area *
 	} else if (required < ah->log_len)
 		required = ah->log_len;
 
-	if (required >= pva->unreserved) {
+	if (required >= pva->unreserved)
 		required = pva->unreserved;
-		pva->unreserved = 0;
-	} else {
-		pva->unreserved -= required;
-		reinsert_changed_pv_area(pva);
-	}
+
+	reserve_pv_area(pva, required);
 
 	return required;
 }
@@ -1665,19 +1662,6 @@ static void _clear_areas(struct alloc_state *alloc_state)
 		alloc_state->areas[s].pva = NULL;
 }
 
-static void _reset_unreserved(struct dm_list *pvms)
-{
-	struct pv_map *pvm;
-	struct pv_area *pva;
-
-	dm_list_iterate_items(pvm, pvms)
-		dm_list_iterate_items(pva, &pvm->areas)
-			if (pva->unreserved != pva->count) {
-				pva->unreserved = pva->count;
-				reinsert_changed_pv_area(pva);
-			}
-}
-
 static void _report_needed_allocation_space(struct alloc_handle *ah,
 					    struct alloc_state *alloc_state)
 {
@@ -1707,6 +1691,50 @@ static void _report_needed_allocation_space(struct alloc_handle *ah,
 	log_debug("  %" PRIu32 " %ss of %" PRIu32 " extents each",
 		  metadata_count, metadata_type, metadata_size);
 }
+/*
+ * Where on each PV an area must start to be contiguous to prev_lvseg.
+ */
+struct contiguous_end {
+	struct dm_list list;
+	struct physical_volume *pv;
+	uint32_t pe;
+};
+
+struct contiguous_ends {
+	struct dm_pool *mem;
+	struct dm_list ends;
+};
+
+static int _add_contiguous_end(struct cmd_context *cmd __attribute__((unused)),
+			       struct pv_segment *pvseg,
+			       uint32_t s __attribute__((unused)),
+			       void *data)
+{
+	struct contiguous_ends *ce = data;
+	struct contiguous_end *end;
+
+	if (!(end = dm_pool_alloc(ce->mem, sizeof(*end))))
+		return_0;
+
+	end->pv = pvseg->pv;
+	end->pe = pvseg->pe + pvseg->len;
+	dm_list_add(&ce->ends, &end->list);
+
+	return 1;
+}
+
+static int _find_contiguous_ends(struct alloc_handle *ah, struct lv_segment *prev_lvseg,
+				 struct contiguous_ends *ce)
+{
+	ce->mem = ah->mem;
+	dm_list_init(&ce->ends);
+
+	/* The same LEs that _check_contiguous() looks at */
+	return _for_each_pv(ah->cmd, prev_lvseg->lv,
+			    prev_lvseg->le + prev_lvseg->len - 1, 1, NULL, NULL,
+			    0, 0, -1, 1, _add_contiguous_end, ce);
+}
+
 /*
  * Returns 1 regardless of whether any space was found, except on error.
  */
@@ -1726,8 +1754,12 @@ static int _find_some_parallel_space(struct alloc_handle *ah, const struct alloc
 	unsigned iteration_count = 0; /* cling_to_alloced may need 2 iterations */
 	unsigned log_iteration_count = 0; /* extra iteration for logs on data devices */
 	struct alloced_area *aa;
+	struct contiguous_ends ce;
+	struct contiguous_end *end;
+	struct pv_area *fit;
 	uint32_t s;
 	uint32_t devices_needed = ah->area_count + ah->parity_count;
+	uint32_t min_unreserved = (max_to_allocate + ah->area_multiple - 1) / (ah->area_multiple ? : 1);
 
 	/* ix_offset holds the number of parallel allocations that must be contiguous/cling */
 	/* At most one of A_CONTIGUOUS_TO_LVSEG, A_CLING_TO_LVSEG or A_CLING_TO_ALLOCED may be set */
@@ -1741,8 +1773,12 @@ static int _find_some_parallel_space(struct alloc_handle *ah, const struct alloc
 		log_debug("Cling_to_allocated is %sset",
 			  alloc_parms->flags & A_CLING_TO_ALLOCED ? "" : "not ");
 
+	if ((alloc_parms->flags & A_CONTIGUOUS_TO_LVSEG) &&
+	    !_find_contiguous_ends(ah, alloc_parms->prev_lvseg, &ce))
+		return_0;
+
 	_clear_areas(alloc_state);
-	_reset_unreserved(pvms);
+	unreserve_pv_maps(pvms);
 
 	_report_needed_allocation_space(ah, alloc_state);
 
@@ -1802,6 +1838,23 @@ static int _find_some_parallel_space(struct alloc_handle *ah, const struct alloc
 							goto next_pv;
 			}
 
+			/*
+			 * Rather than checking every area for contiguity, look
+			 * up the ones starting where prev_lvseg ends on this PV.
+			 */
+			if ((alloc_parms->flags & A_CONTIGUOUS_TO_LVSEG) &&
+			    !iteration_count && !log_iteration_count) {
+				dm_list_iterate_items(end, &ce.ends)
+					if (end->pv == pvm->pv &&
+					    (pva = find_pv_area_at(pvm, end->pe)) &&
+					    _check_pva(ah, pva, max_to_allocate, alloc_parms,
+						       alloc_state, 0, 0, 0) == PREFERRED) {
+						preferred_count++;
+						break;
+					}
+				goto next_pv;
+			}
+
 			already_found_one = 0;
 			/* First area in each list is the largest */
 			dm_list_iterate_items(pva, &pvm->areas) {
@@ -1838,6 +1891,23 @@ static int _find_some_parallel_space(struct alloc_handle *ah, const struct alloc
 					if (!_reserve_required_area(ah, max_to_allocate, ix + ix_offset,
 								    pva, alloc_state, alloc_parms->alloc))
 						return_0;
+
+					/*
+					 * Each smaller area that is still big enough would
+					 * replace this one in turn, so go straight to the
+					 * smallest of them.
+					 */
+					if (alloc_parms->alloc != ALLOC_ANYWHERE &&
+					    !iteration_count && !log_iteration_count &&
+					    !alloc_state->log_area_count_still_needed &&
+					    (fit = find_pv_area_fit(pvm, min_unreserved)) && fit != pva &&
+					    _check_pva(ah, fit, max_to_allocate, alloc_parms, alloc_state,
+						       already_found_one, 0, 0) == USE_AREA) {
+						if (!_reserve_required_area(ah, max_to_allocate, ix + ix_offset,
+									    fit, alloc_state, alloc_parms->alloc))
+							return_0;
+						goto next_pv;
+					}
 				}
 
 			}
@@ -3027,9 +3097,21 @@ char *generate_lv_name(struct volume_group *vg, const char *format,
 {
 	struct lv_list *lvl;
 	int high = -1, i;
+	const char *num = strchr(format, '%');
+	size_t prefix_len = num ? (size_t) (num - format) : 0;
+	int plain_number = num && (num[1] == 'd');
+	char *end;
 
 	dm_list_iterate_items(lvl, &vg->lvs) {
-		if (sscanf(lvl->lv->name, format, &i) != 1)
+		if (plain_number) {
+			/* Cheaper than sscanf for the usual "<prefix>%d" */
+			if (strncmp(lvl->lv->name, format, prefix_len))
+				continue;
+
+			i = (int) strtol(lvl->lv->name + prefix_len, &end, 10);
+			if (end == lvl->lv->name + prefix_len)
+				continue;
+		} else if (sscanf(lvl->lv->name, format, &i) != 1)
 			continue;
 
 		if (i > high)
@@ -3218,6 +3300,38 @@ struct dm_list *build_parallel_areas_from_lv(struct logical_volume *lv,
 	return parallel_areas;
 }
 
+/*
+ * vg->lvids is keyed on lvid.id[1], so an LV whose uuid is not set yet
+ * is left out until lv_set_lvid() gives it one.
+ */
+static int _index_lv(struct volume_group *vg, struct lv_list *lvl)
+{
+	struct logical_volume *lv = lvl->lv;
+
+	/* Earlier LVs keep their entries, as for a search of the list */
+	if (lv->name && !dm_hash_lookup(vg->lv_names, lv->name) &&
+	    !dm_hash_insert(vg->lv_names, lv->name, lvl))
+		return_0;
+
+	if (lv->lvid.id[1].uuid[0] &&
+	    !dm_hash_lookup_binary(vg->lvids, &lv->lvid.id[1], ID_LEN) &&
+	    !dm_hash_insert_binary(vg->lvids, &lv->lvid.id[1], ID_LEN, lvl))
+		return_0;
+
+	return 1;
+}
+
+static void _unindex_lv(struct volume_group *vg, struct lv_list *lvl)
+{
+	struct logical_volume *lv = lvl->lv;
+
+	if (lv->name && dm_hash_lookup(vg->lv_names, lv->name) == lvl)
+		dm_hash_remove(vg->lv_names, lv->name);
+
+	if (dm_hash_lookup_binary(vg->lvids, &lv->lvid.id[1], ID_LEN) == lvl)
+		dm_hash_remove_binary(vg->lvids, &lv->lvid.id[1], ID_LEN);
+}
+
 int link_lv_to_vg(struct volume_group *vg, struct logical_volume *lv)
 {
 	struct lv_list *lvl;
@@ -3232,7 +3346,7 @@ int link_lv_to_vg(struct volume_group *vg, struct logical_volume *lv)
 	lv->vg = vg;
 	dm_list_add(&vg->lvs, &lvl->list);
 
-	return 1;
+	return _index_lv(vg, lvl);
 }
 
 int unlink_lv_from_vg(struct logical_volume *lv)
@@ -3243,6 +3357,43 @@ int unlink_lv_from_vg(struct logical_volume *lv)
 		return_0;
 
 	dm_list_del(&lvl->list);
+	_unindex_lv(lv->vg, lvl);
+
+	return 1;
+}
+
+/*
+ * Move an LV between VGs, as vgsplit and vgmerge do.
+ */
+int move_lv_to_vg(struct volume_group *vg_to, struct lv_list *lvl)
+{
+	_unindex_lv(lvl->lv->vg, lvl);
+
+	dm_list_move(&vg_to->lvs, &lvl->list);
+	lvl->lv->vg = vg_to;
+
+	return _index_lv(vg_to, lvl);
+}
+
+/*
+ * Change the lvid of an LV that is linked into its VG.
+ */
+int lv_set_lvid(struct logical_volume *lv, const union lvid *lvid)
+{
+	struct volume_group *vg = lv->vg;
+	struct lv_list *lvl;
+
+	if (!(lvl = find_lv_in_vg(vg, lv->name)))
+		return_0;
+
+	if (dm_hash_lookup_binary(vg->lvids, &lv->lvid.id[1], ID_LEN) == lvl)
+		dm_hash_remove_binary(vg->lvids, &lv->lvid.id[1], ID_LEN);
+
+	lv->lvid = *lvid;
+
+	if (!dm_hash_lookup_binary(vg->lvids, &lv->lvid.id[1], ID_LEN) &&
+	    !dm_hash_insert_binary(vg->lvids, &lv->lvid.id[1], ID_LEN, lvl))
+		return_0;
 
 	return 1;
 }
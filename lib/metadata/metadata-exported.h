@@ -432,6 +432,8 @@ struct dm_list *get_pvs(struct cmd_context *cmd);
  */
 int link_lv_to_vg(struct volume_group *vg, struct logical_volume *lv);
 int unlink_lv_from_vg(struct logical_volume *lv);
+int move_lv_to_vg(struct volume_group *vg_to, struct lv_list *lvl);
+int lv_set_lvid(struct logical_volume *lv, const union lvid *lvid);
 void lv_set_visible(struct logical_volume *lv);
 void lv_set_hidden(struct logical_volume *lv);
 
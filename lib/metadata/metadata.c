@@ -166,6 +166,11 @@ void add_pvl_to_vgs(struct volume_group *vg, struct pv_list *pvl)
 	vg->pv_count++;
 	pvl->pv->vg = vg;
 	pv_set_fid(pvl->pv, vg->fid);
+
+	/* Without an entry lookups just scan the list */
+	if (!dm_hash_lookup_binary(vg->pvids, &pvl->pv->id, ID_LEN) &&
+	    !dm_hash_insert_binary(vg->pvids, &pvl->pv->id, ID_LEN, pvl))
+		stack;
 }
 
 void del_pvl_from_vgs(struct volume_group *vg, struct pv_list *pvl)
@@ -175,6 +180,9 @@ void del_pvl_from_vgs(struct volume_group *vg, struct pv_list *pvl)
 	vg->pv_count--;
 	dm_list_del(&pvl->list);
 
+	if (dm_hash_lookup_binary(vg->pvids, &pvl->pv->id, ID_LEN) == pvl)
+		dm_hash_remove_binary(vg->pvids, &pvl->pv->id, ID_LEN);
+
 	pvl->pv->vg = vg->fid->fmt->orphan_vg; /* orphan */
 	if ((info = lvmcache_info_from_pvid((const char *) &pvl->pv->id, 0)))
 		lvmcache_fid_add_mdas(info, vg->fid->fmt->orphan_vg->fid,
@@ -1712,9 +1720,10 @@ static struct pv_list *_find_pv_in_vg(const struct volume_group *vg,
 				      const char *pv_name)
 {
 	struct pv_list *pvl;
+	struct device *dev = dev_cache_get(pv_name, vg->cmd->filter);
 
 	dm_list_iterate_items(pvl, &vg->pvs)
-		if (pvl->pv->dev == dev_cache_get(pv_name, vg->cmd->filter))
+		if (pvl->pv->dev == dev)
 			return pvl;
 
 	return NULL;
@@ -1736,6 +1745,10 @@ int pv_is_in_vg(struct volume_group *vg, struct physical_volume *pv)
 {
 	struct pv_list *pvl;
 
+	if ((pvl = dm_hash_lookup_binary(vg->pvids, &pv->id, ID_LEN)) &&
+	    (pvl->pv == pv) && (pv->vg == vg))
+		return 1;
+
 	dm_list_iterate_items(pvl, &vg->pvs)
 		if (pv == pvl->pv)
 			 return 1;
@@ -1743,14 +1756,27 @@ int pv_is_in_vg(struct volume_group *vg, struct physical_volume *pv)
 	return 0;
 }
 
+/*
+ * The vg->pvids and lv_names indexes are kept as PVs and LVs are added
+ * to and removed from the VG, but PV uuids and LV names can change in
+ * place.  So an entry is only used if it still matches, and a miss
+ * searches the list and puts right the entry for what it finds.
+ */
 static struct pv_list *_find_pv_in_vg_by_uuid(const struct volume_group *vg,
 					      const struct id *id)
 {
 	struct pv_list *pvl;
 
+	if ((pvl = dm_hash_lookup_binary(vg->pvids, id, ID_LEN)) &&
+	    (pvl->pv->vg == vg) && id_equal(&pvl->pv->id, id))
+		return pvl;
+
 	dm_list_iterate_items(pvl, &vg->pvs)
-		if (id_equal(&pvl->pv->id, id))
+		if (id_equal(&pvl->pv->id, id)) {
+			if (!dm_hash_insert_binary(vg->pvids, id, ID_LEN, pvl))
+				stack;
 			return pvl;
+		}
 
 	return NULL;
 }
@@ -1785,9 +1811,16 @@ struct lv_list *find_lv_in_vg(const struct volume_group *vg,
 	else
 		ptr = lv_name;
 
+	if ((lvl = dm_hash_lookup(vg->lv_names, ptr)) &&
+	    (lvl->lv->vg == vg) && !strcmp(lvl->lv->name, ptr))
+		return lvl;
+
 	dm_list_iterate_items(lvl, &vg->lvs)
-		if (!strcmp(lvl->lv->name, ptr))
+		if (!strcmp(lvl->lv->name, ptr)) {
+			if (!dm_hash_insert(vg->lv_names, ptr, lvl))
+				stack;
 			return lvl;
+		}
 
 	return NULL;
 }
@@ -1809,9 +1842,10 @@ struct lv_list *find_lv_in_vg_by_lvid(struct volume_group *vg,
 {
 	struct lv_list *lvl;
 
-	dm_list_iterate_items(lvl, &vg->lvs)
-		if (!strncmp(lvl->lv->lvid.s, lvid->s, sizeof(*lvid)))
-			return lvl;
+	/* lv_set_lvid() and move_lv_to_vg() keep vg->lvids complete */
+	if ((lvl = dm_hash_lookup_binary(vg->lvids, &lvid->id[1], ID_LEN)) &&
+	    (lvl->lv->vg == vg) && !strncmp(lvl->lv->lvid.s, lvid->s, sizeof(*lvid)))
+		return lvl;
 
 	return NULL;
 }
@@ -2609,9 +2643,13 @@ int vg_write(struct volume_group *vg)
 	memlock_unlock(vg->cmd);
 	vg->seqno++;
 
+	/* The VG must not change until vg_commit() or vg_revert() */
+	drop_vg_export(vg);
+	keep_vg_export(vg);
+
         dm_list_iterate_items(pv_to_create, &vg->pvs_to_create) {
 		if (!_pvcreate_write(vg->cmd, pv_to_create))
-			return 0;
+			goto_bad;
 		pv_to_create->pv->status &= ~UNLABELLED_PV;
         }
 
@@ -2629,7 +2667,7 @@ int vg_write(struct volume_group *vg)
 					stack;
 				}
 			}
-			return 0;
+			goto bad;
 		}
 		if (!mda->ops->vg_write(vg->fid, vg, mda)) {
 			stack;
@@ -2642,7 +2680,7 @@ int vg_write(struct volume_group *vg)
 					stack;
 				}
 			}
-			return 0;
+			goto bad;
 		}
 	}
 
@@ -2658,11 +2696,15 @@ int vg_write(struct volume_group *vg)
 					stack;
 				}
 			}
-			return 0;
+			goto bad;
 		}
 	}
 
 	return 1;
+
+bad:
+	drop_vg_export(vg);
+	return 0;
 }
 
 static int _vg_commit_mdas(struct volume_group *vg)
@@ -2710,10 +2752,13 @@ int vg_commit(struct volume_group *vg)
 		return cache_updated;
 	}
 
-	if (!lvmetad_vg_update(vg))
+	if (!lvmetad_vg_update(vg)) {
+		drop_vg_export(vg);
 		return 0;
+	}
 
 	cache_updated = _vg_commit_mdas(vg);
+	drop_vg_export(vg);
 
 	if (cache_updated) {
 		/* Instruct remote nodes to upgrade cached metadata. */
@@ -2747,6 +2792,8 @@ void vg_revert(struct volume_group *vg)
 		}
 	}
 
+	drop_vg_export(vg);
+
 	if (!drop_cached_metadata(vg))
 		log_error("Attempt to drop cached metadata failed "
 			  "after reverted update for VG %s.", vg->name);
@@ -2806,6 +2853,7 @@ static struct volume_group *_vg_read_orphans(struct cmd_context *cmd,
 	dm_list_iterate_items(pvl, &vg->pvs)
 		pv_set_fid(pvl->pv, NULL);
 	dm_list_init(&vg->pvs);
+	dm_hash_wipe(vg->pvids);
 	vg->pv_count = 0;
 
 	baton.warnings = warnings;
@@ -440,6 +440,9 @@ void lv_calculate_readahead(const struct logical_volume *lv, uint32_t *read_ahea
  * For internal metadata caching.
  */
 size_t export_vg_to_buffer(struct volume_group *vg, char **buf);
+void keep_vg_export(struct volume_group *vg);
+void drop_vg_export(struct volume_group *vg);
+void destroy_vg_export_cache(struct volume_group *vg);
 int export_vg_to_config_tree(struct volume_group *vg, struct dm_config_tree **cft);
 struct volume_group *import_vg_from_buffer(const char *buf,
 					   struct format_instance *fid);
@@ -19,27 +19,162 @@
 #include <assert.h>
 
 /*
- * Areas are maintained in size order, largest first.
+ * Each pv_map indexes its areas in two treaps: by_size orders the
+ * areas that still have extents unreserved by that number, largest
+ * first, and by_start orders all the areas by their first extent.
+ * Node priorities come from the order of insertion, so the shape of
+ * the trees - and so every allocation - is reproducible.
  *
  * FIXME Cope with overlap.
  */
-static void _insert_area(struct dm_list *head, struct pv_area *a, unsigned reduced)
+typedef int (*pv_area_order_fn)(const struct pv_area_node *a,
+				const struct pv_area_node *b);
+
+static int _size_before(const struct pv_area_node *a,
+			const struct pv_area_node *b)
 {
-	struct pv_area *pva;
-	uint32_t count = reduced ? a->unreserved : a->count;
-		
-	dm_list_iterate_items(pva, head)
-		if (count > pva->count)
-			break;
+	const struct pv_area *pa = dm_list_struct_base(a, struct pv_area, by_size);
+	const struct pv_area *pb = dm_list_struct_base(b, struct pv_area, by_size);
+
+	/* Equal sizes stay in the order they were inserted */
+	if (pa->size != pb->size)
+		return pa->size > pb->size;
+
+	return pa->seq < pb->seq;
+}
+
+static int _start_before(const struct pv_area_node *a,
+			 const struct pv_area_node *b)
+{
+	const struct pv_area *pa = dm_list_struct_base(a, struct pv_area, by_start);
+	const struct pv_area *pb = dm_list_struct_base(b, struct pv_area, by_start);
+
+	if (pa->start != pb->start)
+		return pa->start < pb->start;
+
+	return pa < pb;
+}
+
+static uint32_t _priority(uint32_t seq)
+{
+	seq *= UINT32_C(2654435761);
+
+	return seq ^ (seq >> 16);
+}
+
+static struct pv_area_node *_merge(struct pv_area_node *l, struct pv_area_node *r)
+{
+	if (!l)
+		return r;
+
+	if (!r)
+		return l;
+
+	if (l->priority > r->priority) {
+		l->r = _merge(l->r, r);
+		return l;
+	}
+
+	r->l = _merge(l, r->l);
+
+	return r;
+}
+
+/*
+ * Split tree t into the nodes that come before n and the rest.
+ */
+static void _split(struct pv_area_node *t, const struct pv_area_node *n,
+		   pv_area_order_fn before,
+		   struct pv_area_node **l, struct pv_area_node **r)
+{
+	if (!t) {
+		*l = *r = NULL;
+		return;
+	}
+
+	if (before(t, n)) {
+		_split(t->r, n, before, &t->r, r);
+		*l = t;
+	} else {
+		_split(t->l, n, before, l, &t->l);
+		*r = t;
+	}
+}
+
+static void _tree_insert(struct pv_area_node **root, struct pv_area_node *n,
+			 uint32_t priority, pv_area_order_fn before)
+{
+	struct pv_area_node *l, *r;
+
+	n->l = n->r = NULL;
+	n->priority = priority;
+
+	_split(*root, n, before, &l, &r);
+	*root = _merge(_merge(l, n), r);
+}
+
+static void _tree_remove(struct pv_area_node **root, struct pv_area_node *n,
+			 pv_area_order_fn before)
+{
+	struct pv_area_node **t = root;
+
+	while (*t && *t != n)
+		t = before(n, *t) ? &(*t)->l : &(*t)->r;
+
+	assert(*t);
+	*t = _merge(n->l, n->r);
+}
+
+/*
+ * The node that follows n, which is in tree t.
+ */
+static struct pv_area_node *_tree_next(struct pv_area_node *t,
+				       const struct pv_area_node *n,
+				       pv_area_order_fn before)
+{
+	struct pv_area_node *next = NULL;
+
+	while (t) {
+		if (before(n, t)) {
+			next = t;
+			t = t->l;
+		} else
+			t = t->r;
+	}
 
-	dm_list_add(&pva->list, &a->list);
-	a->map->pe_count += a->count;
+	return next;
+}
+
+/*
+ * Areas with extents unreserved are kept in size order, largest first,
+ * both in the by_size tree and in the areas list that the allocator walks.
+ */
+static void _insert_area(struct pv_area *a)
+{
+	struct pv_map *pvm = a->map;
+	struct pv_area_node *next;
+
+	if (!(a->size = a->unreserved))
+		return;
+
+	a->seq = pvm->seq++;
+	_tree_insert(&pvm->by_size, &a->by_size, _priority(a->seq), _size_before);
+
+	if ((next = _tree_next(pvm->by_size, &a->by_size, _size_before)))
+		dm_list_add(&dm_list_struct_base(next, struct pv_area, by_size)->list,
+			    &a->list);
+	else
+		dm_list_add(&pvm->areas, &a->list);
 }
 
 static void _remove_area(struct pv_area *a)
 {
+	if (!a->size)
+		return;
+
+	_tree_remove(&a->map->by_size, &a->by_size, _size_before);
 	dm_list_del(&a->list);
-	a->map->pe_count -= a->count;
+	a->size = 0;
 }
 
 static int _create_single_area(struct dm_pool *mem, struct pv_map *pvm,
@@ -56,7 +191,10 @@ static int _create_single_area(struct dm_pool *mem, struct pv_map *pvm,
 	pva->start = start;
 	pva->count = length;
 	pva->unreserved = pva->count;
-	_insert_area(&pvm->areas, pva, 0);
+	pvm->pe_count += length;
+	_insert_area(pva);
+	_tree_insert(&pvm->by_start, &pva->by_start, _priority(pvm->seq++),
+		     _start_before);
 
 	return 1;
 }
@@ -129,8 +267,14 @@ static int _create_all_areas_for_pv(struct dm_pool *mem, struct pv_map *pvm,
 
 static int _create_maps(struct dm_pool *mem, struct dm_list *pvs, struct dm_list *pvms)
 {
-	struct pv_map *pvm, *pvm2;
+	struct dm_hash_table *maps;
+	struct pv_map *pvm;
 	struct pv_list *pvl;
+	int r = 0;
+
+	/* The same PV may be listed more than once, with different ranges */
+	if (!(maps = dm_hash_create(dm_list_size(pvs) * 2 + 1)))
+		return_0;
 
 	dm_list_iterate_items(pvl, pvs) {
 		if (!(pvl->pv->status & ALLOCATABLE_PV))
@@ -139,28 +283,30 @@ static int _create_maps(struct dm_pool *mem, struct dm_list *pvs, struct dm_list
 			continue;
 		assert(pvl->pv->dev);
 
-		pvm = NULL;
-
-		dm_list_iterate_items(pvm2, pvms)
-			if (pvm2->pv->dev == pvl->pv->dev) {
-				pvm = pvm2;
-				break;
-			}
-
-		if (!pvm) {
+		if (!(pvm = dm_hash_lookup_binary(maps, &pvl->pv->dev,
+						  sizeof(pvl->pv->dev)))) {
 			if (!(pvm = dm_pool_zalloc(mem, sizeof(*pvm))))
-				return_0;
+				goto_out;
 
 			pvm->pv = pvl->pv;
 			dm_list_init(&pvm->areas);
+			dm_list_init(&pvm->reserved);
 			dm_list_add(pvms, &pvm->list);
+
+			if (!dm_hash_insert_binary(maps, &pvl->pv->dev,
+						   sizeof(pvl->pv->dev), pvm))
+				goto_out;
 		}
 
 		if (!_create_all_areas_for_pv(mem, pvm, pvl->pe_ranges))
-			return_0;
+			goto_out;
 	}
 
-	return 1;
+	r = 1;
+out:
+	dm_hash_destroy(maps);
+
+	return r;
 }
 
 /*
@@ -190,27 +336,95 @@ struct dm_list *create_pv_maps(struct dm_pool *mem, struct volume_group *vg,
 
 void consume_pv_area(struct pv_area *pva, uint32_t to_go)
 {
+	struct pv_map *pvm = pva->map;
+
 	_remove_area(pva);
+	_tree_remove(&pvm->by_start, &pva->by_start, _start_before);
+	if (pva->unreserved != pva->count)
+		dm_list_del(&pva->reserved_list);
 
 	assert(to_go <= pva->count);
+	pvm->pe_count -= to_go;
 
 	if (to_go < pva->count) {
 		/* split the area */
 		pva->start += to_go;
 		pva->count -= to_go;
 		pva->unreserved = pva->count;
-		_insert_area(&pva->map->areas, pva, 0);
+		_insert_area(pva);
+		_tree_insert(&pvm->by_start, &pva->by_start,
+			     _priority(pvm->seq++), _start_before);
 	}
 }
 
 /*
- * Remove an area from list and reinsert it based on its new size
- * after a provisional allocation (or reverting one).
+ * Set aside extents of an area during an allocation attempt, moving it
+ * to its new place in size order.  An area left with nothing unreserved
+ * is dropped from the areas list until unreserve_pv_maps().
  */
-void reinsert_changed_pv_area(struct pv_area *pva)
+void reserve_pv_area(struct pv_area *pva, uint32_t required)
 {
+	assert(required <= pva->unreserved);
+
+	if (!required)
+		return;
+
+	if (pva->unreserved == pva->count)
+		dm_list_add(&pva->map->reserved, &pva->reserved_list);
+
 	_remove_area(pva);
-	_insert_area(&pva->map->areas, pva, 1);
+	pva->unreserved -= required;
+	_insert_area(pva);
+}
+
+/*
+ * Revert all the provisional allocations made by reserve_pv_area().
+ */
+void unreserve_pv_maps(struct dm_list *pvms)
+{
+	struct pv_map *pvm;
+	struct pv_area *pva, *tmp;
+
+	dm_list_iterate_items(pvm, pvms)
+		dm_list_iterate_items_gen_safe(pva, tmp, &pvm->reserved, reserved_list) {
+			dm_list_del(&pva->reserved_list);
+			_remove_area(pva);
+			pva->unreserved = pva->count;
+			_insert_area(pva);
+		}
+}
+
+struct pv_area *find_pv_area_fit(struct pv_map *pvm, uint32_t min_unreserved)
+{
+	struct pv_area_node *t = pvm->by_size, *fit = NULL;
+	struct pv_area *pva;
+
+	/* Smaller areas are to the right */
+	while (t) {
+		pva = dm_list_struct_base(t, struct pv_area, by_size);
+		if (pva->size >= min_unreserved) {
+			fit = t;
+			t = t->r;
+		} else
+			t = t->l;
+	}
+
+	return fit ? dm_list_struct_base(fit, struct pv_area, by_size) : NULL;
+}
+
+struct pv_area *find_pv_area_at(struct pv_map *pvm, uint32_t pe)
+{
+	struct pv_area_node *t = pvm->by_start;
+	struct pv_area *pva;
+
+	while (t) {
+		pva = dm_list_struct_base(t, struct pv_area, by_start);
+		if (pva->start == pe)
+			return pva;
+		t = (pe < pva->start) ? t->l : t->r;
+	}
+
+	return NULL;
 }
 
 uint32_t pv_maps_size(struct dm_list *pvms)
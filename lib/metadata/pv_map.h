@@ -26,6 +26,14 @@
  * mapping available.
  */
 
+/*
+ * Node in one of the search trees of a pv_map.
+ */
+struct pv_area_node {
+	struct pv_area_node *l, *r;
+	uint32_t priority;
+};
+
 struct pv_area {
 	struct pv_map *map;
 	uint32_t start;
@@ -35,6 +43,12 @@ struct pv_area {
 	uint32_t unreserved;
 
 	struct dm_list list;		/* pv_map.areas */
+
+	uint32_t size;			/* Key in pv_map.by_size, 0 if absent */
+	uint32_t seq;			/* Orders areas of equal size or start */
+	struct pv_area_node by_size;	/* pv_map.by_size */
+	struct pv_area_node by_start;	/* pv_map.by_start */
+	struct dm_list reserved_list;	/* pv_map.reserved */
 };
 
 /*
@@ -51,22 +65,50 @@ struct pv_area_used {
 	uint32_t used;
 };
 
+/*
+ * The areas list holds just the areas in the by_size tree, in its order,
+ * largest first.  An area with nothing left unreserved leaves both until
+ * unreserve_pv_maps() puts it back, but stays in by_start.
+ */
 struct pv_map {
 	struct physical_volume *pv;
 	struct dm_list areas;		/* struct pv_areas */
 	uint32_t pe_count;		/* Total number of PEs */
 
+	struct pv_area_node *by_size;	/* Areas with unreserved extents */
+	struct pv_area_node *by_start;	/* All areas */
+	struct dm_list reserved;	/* Areas with unreserved < count */
+	uint32_t seq;
+
 	struct dm_list list;
 };
 
 /*
- * Find intersection between available_pvs and free space in VG
+ * Find intersection between available_pvs and free space in VG.
+ * The maps are built again for every allocation, walking every PV
+ * segment, so the trees only make the searches within one allocation
+ * cheaper.
  */
 struct dm_list *create_pv_maps(struct dm_pool *mem, struct volume_group *vg,
 			    struct dm_list *allocatable_pvs);
 
 void consume_pv_area(struct pv_area *area, uint32_t to_go);
-void reinsert_changed_pv_area(struct pv_area *pva);
+
+/*
+ * Provisional allocation during a single allocation pass.
+ */
+void reserve_pv_area(struct pv_area *pva, uint32_t required);
+void unreserve_pv_maps(struct dm_list *pvms);
+
+/*
+ * Smallest area with at least min_unreserved extents unreserved.
+ */
+struct pv_area *find_pv_area_fit(struct pv_map *pvm, uint32_t min_unreserved);
+
+/*
+ * Area starting at extent pe.
+ */
+struct pv_area *find_pv_area_at(struct pv_map *pvm, uint32_t pe);
 
 uint32_t pv_maps_size(struct dm_list *pvms);
 
@@ -20,6 +20,16 @@
 #include "toolcontext.h"
 #include "lvmcache.h"
 
+static void _destroy_indexes(struct volume_group *vg)
+{
+	if (vg->lv_names)
+		dm_hash_destroy(vg->lv_names);
+	if (vg->lvids)
+		dm_hash_destroy(vg->lvids);
+	if (vg->pvids)
+		dm_hash_destroy(vg->pvids);
+}
+
 struct volume_group *alloc_vg(const char *pool_name, struct cmd_context *cmd,
 			      const char *vg_name)
 {
@@ -50,6 +60,16 @@ struct volume_group *alloc_vg(const char *pool_name, struct cmd_context *cmd,
 		return NULL;
 	}
 
+	if (!(vg->lv_names = dm_hash_create(64)) ||
+	    !(vg->lvids = dm_hash_create(64)) ||
+	    !(vg->pvids = dm_hash_create(16))) {
+		log_error("Failed to allocate VG lookup hashtables.");
+		_destroy_indexes(vg);
+		dm_hash_destroy(vg->hostnames);
+		dm_pool_destroy(vgmem);
+		return NULL;
+	}
+
 	dm_list_init(&vg->pvs);
 	dm_list_init(&vg->pvs_to_create);
 	dm_list_init(&vg->lvs);
@@ -73,7 +93,10 @@ static void _free_vg(struct volume_group *vg)
 
 	log_debug("Freeing VG %s at %p.", vg->name, vg);
 
+	drop_vg_export(vg);
+	destroy_vg_export_cache(vg);
 	dm_hash_destroy(vg->hostnames);
+	_destroy_indexes(vg);
 	dm_pool_destroy(vg->vgmem);
 }
 
@@ -20,6 +20,7 @@ struct dm_pool;
 struct format_instance;
 struct dm_list;
 struct id;
+struct export_cache;
 
 typedef enum {
 	ALLOC_INVALID,
@@ -111,6 +112,25 @@ struct volume_group {
 	uint32_t mda_copies; /* target number of mdas for this VG */
 
 	struct dm_hash_table *hostnames; /* map of creation hostnames */
+
+	/*
+	 * Indexes into lvs and pvs for the find_*_in_vg() functions.
+	 * Entries are checked on use: a miss falls back to the lists.
+	 */
+	struct dm_hash_table *lv_names;	/* lv->name -> lv_list */
+	struct dm_hash_table *lvids;	/* lv->lvid.id[1] -> lv_list */
+	struct dm_hash_table *pvids;	/* pv->id -> pv_list */
+
+	/*
+	 * Text export made for vg_write(), reused by lvmetad and the
+	 * metadata cache until vg_commit() or vg_revert().
+	 */
+	unsigned keep_export;
+	char *export_buf;
+	size_t export_size;
+
+	/* PV and LV text kept by raw exports, see export.c */
+	struct export_cache *export_cache;
 };
 
 struct volume_group *alloc_vg(const char *pool_name, struct cmd_context *cmd,
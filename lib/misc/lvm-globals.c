@@ -46,6 +46,7 @@ static int _retry_deactivation = DEFAULT_RETRY_DEACTIVATION;
 static int _activation_checks = 0;
 static char _sysfs_dir_path[PATH_MAX] = "";
 static int _dev_disable_after_error_count = DEFAULT_DISABLE_AFTER_ERROR_COUNT;
+static unsigned _scan_queue_depth = DEFAULT_SCAN_QUEUE_DEPTH;
 static uint64_t _pv_min_size = (DEFAULT_PV_MIN_SIZE_KB * 1024L >> SECTOR_SHIFT);
 static int _detect_internal_vg_cache_corruption =
 	DEFAULT_DETECT_INTERNAL_VG_CACHE_CORRUPTION;
@@ -158,6 +159,11 @@ void init_dev_disable_after_error_count(int value)
 	_dev_disable_after_error_count = value;
 }
 
+void init_scan_queue_depth(unsigned depth)
+{
+	_scan_queue_depth = depth;
+}
+
 void init_pv_min_size(uint64_t sectors)
 {
 	_pv_min_size = sectors;
@@ -308,6 +314,11 @@ int dev_disable_after_error_count(void)
 	return _dev_disable_after_error_count;
 }
 
+unsigned scan_queue_depth(void)
+{
+	return _scan_queue_depth;
+}
+
 uint64_t pv_min_size(void)
 {
 	return _pv_min_size;
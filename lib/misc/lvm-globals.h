@@ -41,6 +41,7 @@ void init_error_message_produced(int produced);
 void init_is_static(unsigned value);
 void init_udev_checking(int checking);
 void init_dev_disable_after_error_count(int value);
+void init_scan_queue_depth(unsigned depth);
 void init_pv_min_size(uint64_t sectors);
 void init_activation_checks(int checks);
 void init_detect_internal_vg_cache_corruption(int detect);
@@ -79,4 +80,6 @@ int dmeventd_monitor_mode(void);
 #define NO_DEV_ERROR_COUNT_LIMIT 0
 int dev_disable_after_error_count(void);
 
+unsigned scan_queue_depth(void);
+
 #endif
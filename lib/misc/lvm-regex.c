@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "lib.h"
+#include "lvm-regex.h"
+#include "lvm-file.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define MAX_DFA_FILE_SIZE (8 * 1024 * 1024)
+
+static struct dm_regex *_load_dfa(struct dm_pool *mem, const char * const *patterns,
+				  unsigned num_patterns, const char *file)
+{
+	struct dm_regex *regex = NULL;
+	struct stat info;
+	void *data = NULL;
+	int fd;
+
+	if ((fd = open(file, O_RDONLY)) < 0)
+		return NULL;
+
+	if (fstat(fd, &info) || !info.st_size || info.st_size > MAX_DFA_FILE_SIZE ||
+	    !(data = dm_malloc(info.st_size)))
+		goto out;
+
+	if (read(fd, data, info.st_size) != info.st_size) {
+		log_sys_debug("read", file);
+		goto out;
+	}
+
+	if ((regex = dm_regex_import(mem, patterns, num_patterns, data, info.st_size)))
+		log_debug("Loaded regex dfa from %s", file);
+out:
+	dm_free(data);
+	if (close(fd))
+		log_sys_debug("close", file);
+
+	return regex;
+}
+
+/*
+ * Only a cache: a read-only or missing directory is fine, but is worth
+ * finding out about before calculating every state of the dfa.
+ */
+static int _dir_writable(const char *file)
+{
+	const char *slash = strrchr(file, '/');
+	char dir[PATH_MAX];
+	size_t len = slash ? (size_t) (slash - file) : 0;
+
+	if (len >= sizeof(dir))
+		return 0;
+
+	if (len) {
+		memcpy(dir, file, len);
+		dir[len] = '\0';
+	} else
+		strcpy(dir, slash ? "/" : ".");
+
+	if (access(dir, W_OK)) {
+		log_sys_debug("access", dir);
+		return 0;
+	}
+
+	return 1;
+}
+
+static void _save_dfa(struct dm_regex *regex, const char *file)
+{
+	struct dm_pool *mem;
+	char tmp_file[PATH_MAX];
+	void *data;
+	size_t size;
+	FILE *fp;
+
+	if (!_dir_writable(file))
+		return;
+
+	if (!(mem = dm_pool_create("regex dfa", 1024)))
+		return;
+
+	/* Not an error: the dfa may be too large to be worth saving */
+	if (!(size = dm_regex_export(regex, mem, &data)))
+		goto out;
+
+	/* Other commands may be saving the same file */
+	if (dm_snprintf(tmp_file, sizeof(tmp_file), "%s.%d.tmp", file, getpid()) < 0)
+		goto_out;
+
+	if (!(fp = fopen(tmp_file, "w"))) {
+		log_sys_debug("fopen", tmp_file);
+		goto out;
+	}
+
+	if (fwrite(data, size, 1, fp) != 1) {
+		log_sys_debug("fwrite", tmp_file);
+		if (fclose(fp))
+			log_sys_debug("fclose", tmp_file);
+	} else if (!lvm_fclose(fp, tmp_file)) {
+		if (!rename(tmp_file, file)) {
+			log_debug("Saved regex dfa to %s", file);
+			goto out;
+		}
+		log_sys_debug("rename", tmp_file);
+	}
+
+	if (unlink(tmp_file))
+		log_sys_debug("unlink", tmp_file);
+out:
+	dm_pool_destroy(mem);
+}
+
+struct dm_regex *regex_create_cached(struct dm_pool *mem, const char * const *patterns,
+				     unsigned num_patterns, const char *file)
+{
+	struct dm_regex *regex;
+
+	if (file && (regex = _load_dfa(mem, patterns, num_patterns, file)))
+		return regex;
+
+	if (!(regex = dm_regex_create(mem, patterns, num_patterns)))
+		return_NULL;
+
+	if (file)
+		_save_dfa(regex, file);
+
+	return regex;
+}
@@ -0,0 +1,24 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU Lesser General Public License v.2.1.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _LVM_REGEX_H
+#define _LVM_REGEX_H
+
+/*
+ * dm_regex_create() with the dfa cached in file, which may be NULL.
+ */
+struct dm_regex *regex_create_cached(struct dm_pool *mem, const char * const *patterns,
+				     unsigned num_patterns, const char *file);
+
+#endif
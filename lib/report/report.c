@@ -1156,11 +1156,27 @@ static const struct dm_report_field_type _fields[] = {
 void *report_init(struct cmd_context *cmd, const char *format, const char *keys,
 		  report_type_t *report_type, const char *separator,
 		  int aligned, int buffered, int headings, int field_prefixes,
-		  int quoted, int columns_as_rows)
+		  int quoted, int columns_as_rows, const char *output_format)
 {
 	uint32_t report_flags = 0;
 	void *rh;
 
+	if (!strcmp(output_format, "json"))
+		report_flags |= DM_REPORT_OUTPUT_JSON;
+	else if (!strcmp(output_format, "nul")) {
+		/* The rows would bypass the log function */
+		if (log_fn_is_set()) {
+			log_error("NUL-delimited reports cannot be passed to "
+				  "a log function.");
+			return NULL;
+		}
+		report_flags |= DM_REPORT_OUTPUT_NUL_DELIMITED;
+	} else if (strcmp(output_format, "basic")) {
+		log_error("Unknown report format %s: use basic, json or nul.",
+			  output_format);
+		return NULL;
+	}
+
 	if (aligned)
 		report_flags |= DM_REPORT_OUTPUT_ALIGNED;
 
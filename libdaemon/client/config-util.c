@@ -215,7 +215,8 @@ struct dm_config_node *config_make_nodes_v(struct dm_config_tree *cft,
 	const char *next;
 	struct dm_config_node *first = NULL;
 	struct dm_config_node *cn;
-	const char *fmt, *key;
+	const char *fmt;
+	char *key, *end;
 
 	while ((next = va_arg(ap, char *))) {
 		cn = NULL;
@@ -227,8 +228,13 @@ struct dm_config_node *config_make_nodes_v(struct dm_config_tree *cft,
 		}
 		fmt += 2;
 
-		key = dm_pool_strdup(cft->mem, next);
-		*strchr(key, '=') = 0;
+		if (!(key = dm_pool_strdup(cft->mem, next)))
+			return_NULL;
+
+		/* "key = %s": the text parser would drop the blank too */
+		for (end = strchr(key, '='); end > key && end[-1] == ' '; end--)
+			;
+		*end = 0;
 
 		if (!strcmp(fmt, "%d") || !strcmp(fmt, "%" PRId64)) {
 			int64_t value = va_arg(ap, int64_t);
@@ -327,3 +333,275 @@ void buffer_init(struct buffer *buf)
 	buf->allocated = buf->used = 0;
 	buf->mem = 0;
 }
+
+/*
+ * Binary wire encoding of config trees. The payload following the header is
+ * a list of nodes, each a NODE tag, the key, a value count, the values and
+ * then the list of children. Every list of nodes ends with an END tag. Values
+ * are a type byte followed by an integer, 32-bit float bits or a string.
+ * Strings are a length and the bytes, without a terminating NUL. Lengths,
+ * counts and integers are variable length: 7 bits per byte, least significant
+ * first, with the top bit set on all but the last byte. Integers are zigzag
+ * encoded first so that small negative numbers stay short.
+ */
+enum {
+	BINARY_END = 0,
+	BINARY_NODE = 1
+};
+
+static int _buffer_add(struct buffer *buf, const void *data, int len)
+{
+	if ((buf->allocated - buf->used <= len) &&
+	    !buffer_realloc(buf, len + 1))
+		return 0;
+
+	memcpy(buf->mem + buf->used, data, len);
+	buf->used += len;
+
+	return 1;
+}
+
+static int _add_uint(struct buffer *buf, uint64_t value, int bytes)
+{
+	unsigned char le[8];
+	int i;
+
+	for (i = 0; i < bytes; i++, value >>= 8)
+		le[i] = value & 0xff;
+
+	return _buffer_add(buf, le, bytes);
+}
+
+static int _add_varint(struct buffer *buf, uint64_t value)
+{
+	unsigned char bytes[10];
+	int i = 0;
+
+	while (value > 0x7f) {
+		bytes[i++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	bytes[i++] = value;
+
+	return _buffer_add(buf, bytes, i);
+}
+
+static int _add_str(struct buffer *buf, const char *str)
+{
+	uint32_t len = str ? strlen(str) : 0;
+
+	return _add_varint(buf, len) && _buffer_add(buf, str, len);
+}
+
+static int _add_nodes(struct buffer *buf, const struct dm_config_node *cn)
+{
+	const struct dm_config_value *v;
+	uint32_t count, bits;
+	unsigned char tag;
+
+	for (; cn; cn = cn->sib) {
+		for (count = 0, v = cn->v; v; v = v->next)
+			count++;
+
+		tag = BINARY_NODE;
+		if (!_buffer_add(buf, &tag, 1) ||
+		    !_add_str(buf, cn->key) ||
+		    !_add_varint(buf, count))
+			return 0;
+
+		for (v = cn->v; v; v = v->next) {
+			tag = v->type;
+			if (!_buffer_add(buf, &tag, 1))
+				return 0;
+
+			switch (v->type) {
+			case DM_CFG_INT:
+				if (!_add_varint(buf, ((uint64_t) v->v.i << 1) ^
+							       (uint64_t) (v->v.i >> 63)))
+					return 0;
+				break;
+			case DM_CFG_FLOAT:
+				memcpy(&bits, &v->v.f, sizeof(bits));
+				if (!_add_uint(buf, bits, 4))
+					return 0;
+				break;
+			case DM_CFG_STRING:
+				if (!_add_str(buf, v->v.str))
+					return 0;
+				break;
+			case DM_CFG_EMPTY_ARRAY:
+				break;
+			}
+		}
+
+		if (!_add_nodes(buf, cn->child))
+			return 0;
+	}
+
+	tag = BINARY_END;
+	return _buffer_add(buf, &tag, 1);
+}
+
+int buffer_is_binary(const struct buffer *buf)
+{
+	return buf->used >= BINARY_HEADER_SIZE && !buf->mem[0];
+}
+
+int config_write_binary(const struct dm_config_node *cn, struct buffer *buf)
+{
+	int start = buf->used;
+	uint32_t len;
+
+	if (!_add_uint(buf, 0, 1) || !_add_uint(buf, 0, 4) ||
+	    !_add_nodes(buf, cn))
+		return 0;
+
+	/* Fill in the payload length */
+	len = buf->used - start - BINARY_HEADER_SIZE;
+	buf->used = start + 1;
+	(void) _add_uint(buf, len, 4);
+	buf->used = start + BINARY_HEADER_SIZE + len;
+
+	return 1;
+}
+
+struct binary_reader {
+	const unsigned char *pos;
+	const unsigned char *end;
+	struct dm_pool *mem;
+};
+
+static int _get_uint(struct binary_reader *r, uint64_t *value, int bytes)
+{
+	int i;
+
+	if (r->end - r->pos < bytes)
+		return 0;
+
+	for (*value = 0, i = bytes - 1; i >= 0; i--)
+		*value = (*value << 8) | r->pos[i];
+
+	r->pos += bytes;
+
+	return 1;
+}
+
+static int _get_varint(struct binary_reader *r, uint64_t *value)
+{
+	int shift;
+
+	for (*value = 0, shift = 0; r->pos < r->end && shift < 64; shift += 7) {
+		*value |= (uint64_t) (*r->pos & 0x7f) << shift;
+		if (!(*r->pos++ & 0x80))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int _get_str(struct binary_reader *r, const char **str)
+{
+	uint64_t len;
+
+	if (!_get_varint(r, &len) || (uint64_t) (r->end - r->pos) < len ||
+	    !(*str = dm_pool_strndup(r->mem, (const char *) r->pos, (size_t) len)))
+		return 0;
+
+	r->pos += len;
+
+	return 1;
+}
+
+static int _get_nodes(struct binary_reader *r, struct dm_config_node *parent,
+		      struct dm_config_node **first)
+{
+	struct dm_config_node *cn, *last = NULL;
+	struct dm_config_value *v, **vp;
+	uint64_t tag, count, value;
+	uint32_t bits;
+
+	*first = NULL;
+
+	while (1) {
+		if (!_get_uint(r, &tag, 1))
+			return 0;
+		if (tag == BINARY_END)
+			return 1;
+		if (tag != BINARY_NODE ||
+		    !(cn = dm_pool_zalloc(r->mem, sizeof(*cn))) ||
+		    !_get_str(r, &cn->key) ||
+		    !_get_varint(r, &count))
+			return 0;
+
+		cn->parent = parent;
+		if (last)
+			last->sib = cn;
+		else
+			*first = cn;
+		last = cn;
+
+		for (vp = &cn->v; count; count--, vp = &v->next) {
+			if (!(v = dm_pool_zalloc(r->mem, sizeof(*v))) ||
+			    !_get_uint(r, &tag, 1))
+				return 0;
+
+			v->type = (dm_config_value_type_t) tag;
+			switch (tag) {
+			case DM_CFG_INT:
+				if (!_get_varint(r, &value))
+					return 0;
+				v->v.i = (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+				break;
+			case DM_CFG_FLOAT:
+				if (!_get_uint(r, &value, 4))
+					return 0;
+				bits = (uint32_t) value;
+				memcpy(&v->v.f, &bits, sizeof(bits));
+				break;
+			case DM_CFG_STRING:
+				if (!_get_str(r, &v->v.str))
+					return 0;
+				break;
+			case DM_CFG_EMPTY_ARRAY:
+				break;
+			default:
+				return 0;
+			}
+			*vp = v;
+		}
+
+		if (!_get_nodes(r, cn, &cn->child))
+			return 0;
+	}
+}
+
+struct dm_config_tree *config_read_binary(const struct buffer *buf)
+{
+	struct dm_config_tree *cft;
+	struct binary_reader r;
+	uint64_t len;
+
+	if (!buffer_is_binary(buf) || !(cft = dm_config_create()))
+		return NULL;
+
+	r.pos = (const unsigned char *) buf->mem + 1;
+	r.end = (const unsigned char *) buf->mem + buf->used;
+	r.mem = dm_config_memory(cft);
+
+	if (!_get_uint(&r, &len, 4) || len != (uint64_t) (r.end - r.pos) ||
+	    !_get_nodes(&r, NULL, &cft->root) || r.pos != r.end) {
+		log_error("Malformed binary message.");
+		dm_config_destroy(cft);
+		return NULL;
+	}
+
+	return cft;
+}
+
+struct dm_config_tree *config_from_buffer(const struct buffer *buf)
+{
+	if (buffer_is_binary(buf))
+		return config_read_binary(buf);
+
+	return dm_config_from_string(buf->mem);
+}
@@ -35,6 +35,21 @@ int buffer_realloc(struct buffer *buf, int required);
 
 int buffer_line(const char *line, void *baton);
 
+/*
+ * Config trees may also be sent in a compact binary form, when both ends
+ * support it (see daemon_open). A binary message starts with a NUL byte,
+ * which never starts a text message, followed by the 32-bit little endian
+ * length of the encoded nodes. It needs no terminator.
+ */
+#define BINARY_HEADER_SIZE 5
+
+int buffer_is_binary(const struct buffer *buf);
+int config_write_binary(const struct dm_config_node *cn, struct buffer *buf);
+struct dm_config_tree *config_read_binary(const struct buffer *buf);
+
+/* Parse a message in either form. */
+struct dm_config_tree *config_from_buffer(const struct buffer *buf);
+
 int set_flag(struct dm_config_tree *cft, struct dm_config_node *parent,
 	     const char *field, const char *flag, int want);
 
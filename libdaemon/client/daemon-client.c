@@ -41,10 +41,13 @@ daemon_handle daemon_open(daemon_info i) {
 	if (connect(h.socket_fd,(struct sockaddr *) &sockaddr, sizeof(sockaddr)))
 		goto error;
 
-	r = daemon_send_simple(h, "hello", NULL);
+	r = daemon_send_simple(h, "hello", "wire = %s", "binary", NULL);
 	if (r.error || strcmp(daemon_reply_str(r, "response", "unknown"), "OK"))
 		goto error;
 
+	/* Older daemons ignore the offer and keep to text */
+	h.binary = !strcmp(daemon_reply_str(r, "wire", "text"), "binary");
+
 	h.protocol = daemon_reply_str(r, "protocol", NULL);
 	if (h.protocol)
 		h.protocol = dm_strdup(h.protocol); /* keep around */
@@ -76,7 +79,13 @@ daemon_reply daemon_send(daemon_handle h, daemon_request rq)
 	assert(h.socket_fd >= 0);
 	buffer = rq.buffer;
 
-	if (!buffer.mem)
+	if (!buffer.mem && h.binary) {
+		if (!config_write_binary(rq.cft->root, &buffer)) {
+			buffer_destroy(&buffer);
+			reply.error = ENOMEM;
+			return reply;
+		}
+	} else if (!buffer.mem)
 		dm_config_write_node(rq.cft->root, buffer_line, &buffer);
 
 	assert(buffer.mem);
@@ -84,7 +93,7 @@ daemon_reply daemon_send(daemon_handle h, daemon_request rq)
 		reply.error = errno;
 
 	if (buffer_read(h.socket_fd, &reply.buffer)) {
-		reply.cft = dm_config_from_string(reply.buffer.mem);
+		reply.cft = config_from_buffer(&reply.buffer);
 		if (!reply.cft)
 			reply.error = EPROTO;
 	} else
@@ -22,6 +22,7 @@ typedef struct {
 	int socket_fd; /* the fd we use to talk to the daemon */
 	const char *protocol;
 	int protocol_version;  /* version of the protocol the daemon uses */
+	int binary;  /* the daemon accepts binary messages */
 	int error;
 } daemon_handle;
 
@@ -13,6 +13,8 @@
  */
 
 #include <errno.h>
+#include <limits.h>
+#include <poll.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -21,72 +23,158 @@
 #include "libdevmapper.h"
 
 /*
- * Read a single message from a (socket) filedescriptor. Messages are delimited
- * by blank lines. This call will block until all of a message is received. The
- * memory will be allocated from heap. Upon error, all memory is freed and the
- * buffer pointer is set to NULL.
- *
- * See also write_buffer about blocking (read_buffer has identical behaviour).
+ * Wait until fd is ready for the given poll events.
  */
-int buffer_read(int fd, struct buffer *buffer) {
-	if (!buffer_realloc(buffer, 32)) /* ensure we have some space */
-		goto fail;
+static int _wait_fd(int fd, short events)
+{
+	struct pollfd pfd = { .fd = fd, .events = events };
+
+	while (poll(&pfd, 1, -1) < 0)
+		if (errno != EINTR)
+			return 0;
+
+	return 1;
+}
+
+/*
+ * The total size of a binary message, once its header has arrived, or -1
+ * if it is over DAEMON_MAX_MESSAGE.
+ */
+static int _binary_size(const struct buffer *buffer)
+{
+	const unsigned char *le = (const unsigned char *) buffer->mem + 1;
+	uint32_t len;
+
+	if (buffer->used < BINARY_HEADER_SIZE)
+		return 0;
+
+	len = le[0] | (le[1] << 8) | (le[2] << 16) | ((uint32_t) le[3] << 24);
+	if (len > DAEMON_MAX_MESSAGE - BINARY_HEADER_SIZE)
+		return -1;
+
+	return BINARY_HEADER_SIZE + (int) len;
+}
+
+/*
+ * Read whatever part of a message is available on fd without waiting for
+ * more. Returns 0 on error or end of file, or once the message is over
+ * DAEMON_MAX_MESSAGE. Otherwise, *complete is set once the whole message
+ * is in the buffer; the terminator of a text message is then stripped off
+ * as in buffer_read. The buffer only grows as data arrives, whatever size
+ * a binary message advertises.
+ */
+int buffer_read_some(int fd, struct buffer *buffer, int *complete) {
+	int result, size;
+
+	*complete = 0;
 
 	while (1) {
-		int result = read(fd, buffer->mem + buffer->used, buffer->allocated - buffer->used);
+		if (buffer->allocated - buffer->used < 32 &&
+		    !buffer_realloc(buffer, 1024))
+			return 0;
+
+		result = read(fd, buffer->mem + buffer->used, buffer->allocated - buffer->used);
 		if (result > 0) {
 			buffer->used += result;
-			if (!strncmp((buffer->mem) + buffer->used - 4, "\n##\n", 4)) {
+			if (!buffer->mem[0]) {
+				/* Binary: complete once the advertised length is in */
+				if (!(size = _binary_size(buffer)))
+					continue;
+				if (size < 0) {
+					errno = EMSGSIZE;
+					return 0;
+				}
+				if (buffer->used >= size) {
+					*complete = 1;
+					return 1;
+				}
+				continue;
+			}
+			if (buffer->used >= 4 &&
+			    !strncmp((buffer->mem) + buffer->used - 4, "\n##\n", 4)) {
 				*(buffer->mem + buffer->used - 4) = 0;
 				buffer->used -= 4;
-				break; /* success, we have the full message now */
+				*complete = 1;
+				return 1;
+			}
+			if (buffer->used > DAEMON_MAX_MESSAGE) {
+				errno = EMSGSIZE;
+				return 0;
 			}
-			if (buffer->used - buffer->allocated < 32)
-				if (!buffer_realloc(buffer, 1024))
-					goto fail;
 			continue;
 		}
 		if (result == 0) {
 			errno = ECONNRESET;
-			goto fail; /* we should never encounter EOF here */
+			return 0; /* we should never encounter EOF here */
 		}
-		if (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
-			goto fail;
-		/* TODO call select here if we encountered EAGAIN/EWOULDBLOCK/EINTR */
+		if (errno == EINTR)
+			continue;
+		return (errno == EAGAIN || errno == EWOULDBLOCK);
 	}
+}
+
+/*
+ * Write as much of buffer, from *written on, as fd accepts without waiting.
+ * Returns 0 on error. All of it went through once *written == buffer->used.
+ */
+int buffer_write_some(int fd, const struct buffer *buffer, int *written) {
+	int result;
+
+	while (*written < buffer->used) {
+		result = write(fd, buffer->mem + *written, buffer->used - *written);
+		if (result > 0) {
+			*written += result;
+			continue;
+		}
+		if (result < 0 && errno == EINTR)
+			continue;
+		return (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+	}
+
 	return 1;
-fail:
-	return 0;
 }
 
 /*
- * Write a buffer to a filedescriptor. Keep trying. Blocks (even on
- * SOCK_NONBLOCK) until all of the write went through.
+ * Read a single message from a (socket) filedescriptor. Messages are delimited
+ * by blank lines. This call will block until all of a message is received. The
+ * memory will be allocated from heap.
  *
- * TODO use select on EWOULDBLOCK/EAGAIN/EINTR to avoid useless spinning
+ * On a non-blocking fd, this waits in poll() for more data to arrive.
+ */
+int buffer_read(int fd, struct buffer *buffer) {
+	int complete;
+
+	while (buffer_read_some(fd, buffer, &complete)) {
+		if (complete)
+			return 1;
+		if (!_wait_fd(fd, POLLIN))
+			return 0;
+	}
+
+	return 0;
+}
+
+/*
+ * Write a buffer to a filedescriptor, followed by the message terminator
+ * unless it holds a binary message. Blocks (even on SOCK_NONBLOCK, using
+ * poll()) until all of the write went through.
  */
 int buffer_write(int fd, struct buffer *buffer) {
 	struct buffer terminate = { .mem = (char *) "\n##\n", .used = 4 };
-	int done = 0;
-	int written = 0;
 	struct buffer *use = buffer;
-write:
-	while (1) {
-		int result = write(fd, use->mem + written, use->used - written);
-		if (result > 0)
-			written += result;
-		if (result < 0 && errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR)
-			return 0; /* too bad */
-		if (written == use->used) {
-			if (done)
-				return 1;
-			else
-				break; /* done */
+	int written = 0;
+
+	while (buffer_write_some(fd, use, &written)) {
+		if (written < use->used) {
+			if (!_wait_fd(fd, POLLOUT))
+				return 0;
+			continue;
 		}
+		if (use == &terminate || buffer_is_binary(buffer))
+			return 1;
+		use = &terminate;
+		written = 0;
 	}
 
-	use = &terminate;
-	written = 0;
-	done = 1;
-	goto write;
+	return 0; /* too bad */
 }
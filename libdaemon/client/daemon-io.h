@@ -25,7 +25,14 @@
 
 /* TODO function names */
 
+/* The largest message, text or binary, either side accepts. */
+#define DAEMON_MAX_MESSAGE	(64 * 1024 * 1024)
+
 int buffer_read(int fd, struct buffer *buffer);
 int buffer_write(int fd, struct buffer *buffer);
 
+/* Non-blocking variants for event-driven servers. */
+int buffer_read_some(int fd, struct buffer *buffer, int *complete);
+int buffer_write_some(int fd, const struct buffer *buffer, int *written);
+
 #endif /* _LVM_DAEMON_SHARED_H */
@@ -18,6 +18,7 @@
 #include <dlfcn.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sys/epoll.h>
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -30,19 +31,11 @@
 
 #include <syslog.h> /* FIXME. For the global closelog(). */
 
-#if 0
-/* Create a device monitoring thread. */
-static int _pthread_create(pthread_t *t, void *(*fun)(void *), void *arg, int stacksize)
-{
-	pthread_attr_t attr;
-	pthread_attr_init(&attr);
-	/*
-	 * We use a smaller stack since it gets preallocated in its entirety
-	 */
-	pthread_attr_setstacksize(&attr, stacksize);
-	return pthread_create(t, &attr, fun, arg);
-}
-#endif
+#define DAEMON_WORKER_THREADS	8
+#define DAEMON_MAX_QUEUED	64
+#define DAEMON_MAX_CLIENTS	4096
+#define DAEMON_MAX_EVENTS	64
+#define DAEMON_LISTEN_BACKLOG	128
 
 static volatile sig_atomic_t _shutdown_requested = 0;
 static int _systemd_activation = 0;
@@ -190,9 +183,15 @@ static int _systemd_handover(struct daemon_state *ds)
 		goto out;
 
 	/* Check and handle the socket passed in */
-	if ((r = _handle_preloaded_socket(SD_FD_SOCKET_SERVER, ds->socket_path)))
+	if ((r = _handle_preloaded_socket(SD_FD_SOCKET_SERVER, ds->socket_path))) {
 		ds->socket_fd = SD_FD_SOCKET_SERVER;
 
+		/* Systemd passes it blocking unless NonBlocking= is set */
+		if (fcntl(ds->socket_fd, F_SETFL, fcntl(ds->socket_fd, F_GETFL, 0) | O_NONBLOCK))
+			fprintf(stderr, "setting O_NONBLOCK on socket fd %d failed: %s\n",
+				ds->socket_fd, strerror(errno));
+	}
+
 out:
 	unsetenv(SD_ACTIVATION_ENV_VAR_NAME);
 	unsetenv(SD_LISTEN_PID_ENV_VAR_NAME);
@@ -234,7 +233,7 @@ static int _open_socket(daemon_state s)
 		perror("can't bind local socket.");
 		goto error;
 	}
-	if (listen(fd, 1) != 0) {
+	if (listen(fd, DAEMON_LISTEN_BACKLOG) != 0) {
 		perror("listen local");
 		goto error;
 	}
@@ -348,9 +347,49 @@ end:
 	return res;
 }
 
-struct thread_baton {
-	daemon_state s;
+/*
+ * Clients are served by a single event loop thread, which does all of the
+ * socket io without blocking, and a fixed pool of worker threads, which parse
+ * complete requests and run the handler. Each connection carries at most one
+ * request at a time: while it is queued or being handled, the connection is
+ * not polled. When more than DAEMON_MAX_QUEUED requests wait for a worker, no
+ * more are read, and beyond DAEMON_MAX_CLIENTS connections, no more are
+ * accepted, leaving the clients to wait in the kernel instead.
+ */
+struct connection {
+	struct dm_list list;	/* work, done or stalled queue */
+	struct dm_list clients;	/* all connections */
 	client_handle client;
+	struct buffer in;
+	struct buffer out;
+	int written;
+	unsigned polled:1;	/* registered with epoll */
+	unsigned failed:1;	/* drop after the current request */
+	unsigned closed:1;	/* freed after the current batch of events */
+};
+
+struct server {
+	daemon_state *s;
+	int epoll_fd;
+	int wake_fd[2];		/* workers signal the event loop */
+	unsigned accepting:1;
+
+	/* Owned by the event loop */
+	struct dm_list clients;
+	struct dm_list stalled;
+	struct dm_list closed;
+	unsigned nr_clients;
+	unsigned nr_queued;	/* handed to the workers, not yet collected */
+
+	/* Shared with the workers */
+	pthread_mutex_t lock;
+	pthread_cond_t work_ready;
+	struct dm_list work;
+	struct dm_list done;
+	int stopping;
+
+	pthread_t workers[DAEMON_WORKER_THREADS];
+	unsigned nr_workers;
 };
 
 static response builtin_handler(daemon_state s, client_handle h, request r)
@@ -359,6 +398,11 @@ static response builtin_handler(daemon_state s, client_handle h, request r)
 	response res = { .error = EPROTO };
 
 	if (!strcmp(rq, "hello")) {
+		/* Offer binary messages to clients that ask for them */
+		if (!strcmp(daemon_request_str(r, "wire", "text"), "binary"))
+			return daemon_reply_simple("OK", "protocol = %s", s.protocol ?: "default",
+						   "version = %" PRId64, (int64_t) s.protocol_version,
+						   "wire = %s", "binary", NULL);
 		return daemon_reply_simple("OK", "protocol = %s", s.protocol ?: "default",
 					   "version = %" PRId64, (int64_t) s.protocol_version, NULL);
 	}
@@ -367,84 +411,433 @@ static response builtin_handler(daemon_state s, client_handle h, request r)
 	return res;
 }
 
-static void *client_thread(void *baton)
+/*
+ * Run in a worker thread. Turns conn->in into a response in conn->out.
+ */
+static void _handle_request(daemon_state *s, struct connection *conn)
 {
-	struct thread_baton *b = baton;
-	request req;
+	request req = { .buffer = conn->in };
 	response res;
+	int binary = buffer_is_binary(&req.buffer);
 
-	buffer_init(&req.buffer);
+	buffer_init(&conn->in);
+	conn->client.thread_id = pthread_self();
 
-	while (1) {
-		if (!buffer_read(b->client.socket_fd, &req.buffer))
-			goto fail;
+	req.cft = config_from_buffer(&req.buffer);
 
-		req.cft = dm_config_from_string(req.buffer.mem);
+	if (!req.cft)
+		fprintf(stderr, "error parsing request:\n %s\n",
+			binary ? "(binary)" : req.buffer.mem);
+	else
+		daemon_log_cft(s->log, DAEMON_LOG_WIRE, "<- ", req.cft->root);
+
+	res = builtin_handler(*s, conn->client, req);
+
+	if (res.error == EPROTO) /* Not a builtin, delegate to the custom handler. */
+		res = s->handler(*s, conn->client, req);
+
+	/* Binary requests get binary replies, unless already formatted */
+	if (!res.buffer.mem && binary) {
+		daemon_log_cft(s->log, DAEMON_LOG_WIRE, "-> ", res.cft->root);
+		if (!config_write_binary(res.cft->root, &res.buffer))
+			conn->failed = 1;
+		dm_config_destroy(res.cft);
+	} else if (!res.buffer.mem) {
+		dm_config_write_node(res.cft->root, buffer_line, &res.buffer);
+		if (!buffer_append(&res.buffer, "\n\n"))
+			conn->failed = 1;
+		dm_config_destroy(res.cft);
+	}
 
-		if (!req.cft)
-			fprintf(stderr, "error parsing request:\n %s\n", req.buffer.mem);
-		else
-			daemon_log_cft(b->s.log, DAEMON_LOG_WIRE, "<- ", req.cft->root);
+	if (req.cft)
+		dm_config_destroy(req.cft);
+	buffer_destroy(&req.buffer);
 
-		res = builtin_handler(b->s, b->client, req);
+	if (!conn->failed && !buffer_is_binary(&res.buffer)) {
+		daemon_log_multi(s->log, DAEMON_LOG_WIRE, "-> ", res.buffer.mem);
+		if (!buffer_append(&res.buffer, "\n##\n"))
+			conn->failed = 1;
+	}
 
-		if (res.error == EPROTO) /* Not a builtin, delegate to the custom handler. */
-			res = b->s.handler(b->s, b->client, req);
+	conn->out = res.buffer;
+	conn->written = 0;
+}
 
-		if (!res.buffer.mem) {
-			dm_config_write_node(res.cft->root, buffer_line, &res.buffer);
-			if (!buffer_append(&res.buffer, "\n\n"))
-				goto fail;
-			dm_config_destroy(res.cft);
+static void *_worker_thread(void *arg)
+{
+	struct server *srv = arg;
+	struct connection *conn;
+
+	while (1) {
+		pthread_mutex_lock(&srv->lock);
+		while (!srv->stopping && dm_list_empty(&srv->work))
+			pthread_cond_wait(&srv->work_ready, &srv->lock);
+		if (dm_list_empty(&srv->work)) {
+			pthread_mutex_unlock(&srv->lock);
+			break;
 		}
+		conn = dm_list_item(dm_list_first(&srv->work), struct connection);
+		dm_list_del(&conn->list);
+		pthread_mutex_unlock(&srv->lock);
 
-		if (req.cft)
-			dm_config_destroy(req.cft);
-		buffer_destroy(&req.buffer);
+		_handle_request(srv->s, conn);
 
-		daemon_log_multi(b->s.log, DAEMON_LOG_WIRE, "-> ", res.buffer.mem);
-		buffer_write(b->client.socket_fd, &res.buffer);
+		pthread_mutex_lock(&srv->lock);
+		dm_list_add(&srv->done, &conn->list);
+		pthread_mutex_unlock(&srv->lock);
 
-		buffer_destroy(&res.buffer);
+		/* A full pipe already holds a wakeup */
+		if (write(srv->wake_fd[1], "", 1) < 0 && errno != EAGAIN)
+			perror("wakeup write");
 	}
-fail:
-	/* TODO what should we really do here? */
-	if (close(b->client.socket_fd))
-		perror("close");
-	buffer_destroy(&req.buffer);
-	dm_free(baton);
+
 	return NULL;
 }
 
-static int handle_connect(daemon_state s)
+static int _poll(struct server *srv, struct connection *conn, uint32_t events)
 {
-	struct thread_baton *baton;
+	struct epoll_event ev = { .events = events, .data.ptr = conn };
+	int fd = conn ? conn->client.socket_fd : srv->s->socket_fd;
+	int op = EPOLL_CTL_DEL;
+	int polled = conn ? conn->polled : srv->accepting;
+
+	if (events)
+		op = polled ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	else if (!polled)
+		return 1;
+
+	if (epoll_ctl(srv->epoll_fd, op, fd, &ev)) {
+		perror("epoll_ctl");
+		return 0;
+	}
+
+	if (conn)
+		conn->polled = events ? 1 : 0;
+	else
+		srv->accepting = events ? 1 : 0;
+
+	return 1;
+}
+
+static void _close_connection(struct server *srv, struct connection *conn)
+{
+	(void) _poll(srv, conn, 0);
+
+	if (close(conn->client.socket_fd))
+		perror("close");
+
+	buffer_destroy(&conn->in);
+	buffer_destroy(&conn->out);
+
+	/* Events for it may still follow in the current batch */
+	conn->closed = 1;
+	dm_list_move(&srv->closed, &conn->clients);
+
+	/* Resume accepting once below the limit */
+	if (--srv->nr_clients < DAEMON_MAX_CLIENTS && !srv->accepting &&
+	    !srv->stopping)
+		(void) _poll(srv, NULL, EPOLLIN);
+}
+
+static void _free_closed(struct server *srv)
+{
+	struct connection *conn, *tmp;
+
+	dm_list_iterate_items_gen_safe(conn, tmp, &srv->closed, clients) {
+		dm_list_del(&conn->clients);
+		dm_free(conn);
+	}
+}
+
+static void _accept_clients(struct server *srv)
+{
+	struct connection *conn;
 	struct sockaddr_un sockaddr;
-	client_handle client = { .thread_id = 0 };
-	socklen_t sl = sizeof(sockaddr);
+	socklen_t sl;
+	int fd;
+
+	while (srv->nr_clients < DAEMON_MAX_CLIENTS) {
+		sl = sizeof(sockaddr);
+		if ((fd = accept(srv->s->socket_fd, (struct sockaddr *) &sockaddr, &sl)) < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				ERROR(srv->s, "Failed to accept a client connection: %s",
+				      strerror(errno));
+			return;
+		}
+
+		if (fcntl(fd, F_SETFD, FD_CLOEXEC) ||
+		    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) ||
+		    !(conn = dm_zalloc(sizeof(*conn)))) {
+			ERROR(srv->s, "Failed to handle a client connection.");
+			if (close(fd))
+				perror("close");
+			continue;
+		}
+
+		conn->client.socket_fd = fd;
+		dm_list_add(&srv->clients, &conn->clients);
+		srv->nr_clients++;
+
+		if (!_poll(srv, conn, EPOLLIN))
+			_close_connection(srv, conn);
+	}
+
+	/* Leave further clients in the listen backlog */
+	(void) _poll(srv, NULL, 0);
+}
+
+static void _read_request(struct server *srv, struct connection *conn)
+{
+	int complete;
+
+	if (srv->nr_queued >= DAEMON_MAX_QUEUED) {
+		/* Stop reading until the workers catch up */
+		if (_poll(srv, conn, 0))
+			dm_list_add(&srv->stalled, &conn->list);
+		else
+			_close_connection(srv, conn);
+		return;
+	}
+
+	if (!buffer_read_some(conn->client.socket_fd, &conn->in, &complete)) {
+		_close_connection(srv, conn);
+		return;
+	}
+
+	if (!complete)
+		return;
+
+	if (!_poll(srv, conn, 0)) {
+		_close_connection(srv, conn);
+		return;
+	}
+
+	srv->nr_queued++;
 
-	client.socket_fd = accept(s.socket_fd, (struct sockaddr *) &sockaddr, &sl);
-	if (client.socket_fd < 0)
+	pthread_mutex_lock(&srv->lock);
+	dm_list_add(&srv->work, &conn->list);
+	pthread_cond_signal(&srv->work_ready);
+	pthread_mutex_unlock(&srv->lock);
+}
+
+static void _write_response(struct server *srv, struct connection *conn)
+{
+	if (conn->failed ||
+	    !buffer_write_some(conn->client.socket_fd, &conn->out, &conn->written)) {
+		_close_connection(srv, conn);
+		return;
+	}
+
+	if (conn->written < conn->out.used) {
+		if (!conn->polled && !_poll(srv, conn, EPOLLOUT))
+			_close_connection(srv, conn);
+		return;
+	}
+
+	/* The whole response went out: wait for the next request */
+	buffer_destroy(&conn->out);
+	if (!_poll(srv, conn, EPOLLIN))
+		_close_connection(srv, conn);
+}
+
+/*
+ * Write out the responses the workers have finished, then let stalled
+ * connections read again while there is room in the queue.
+ */
+static void _collect_responses(struct server *srv)
+{
+	struct dm_list done;
+	struct connection *conn, *tmp;
+	char drain[64];
+
+	while (read(srv->wake_fd[0], drain, sizeof(drain)) > 0)
+		;
+
+	dm_list_init(&done);
+
+	pthread_mutex_lock(&srv->lock);
+	dm_list_splice(&done, &srv->done);
+	pthread_mutex_unlock(&srv->lock);
+
+	dm_list_iterate_items_safe(conn, tmp, &done) {
+		dm_list_del(&conn->list);
+		srv->nr_queued--;
+		_write_response(srv, conn);
+	}
+
+	dm_list_iterate_items_safe(conn, tmp, &srv->stalled) {
+		if (srv->nr_queued >= DAEMON_MAX_QUEUED)
+			break;
+		dm_list_del(&conn->list);
+		if (!_poll(srv, conn, EPOLLIN))
+			_close_connection(srv, conn);
+	}
+}
+
+static int _pthread_create(pthread_t *t, void *(*fun)(void *), void *arg, int stacksize)
+{
+	pthread_attr_t attr;
+	int r;
+
+	if (pthread_attr_init(&attr))
 		return 0;
 
-	if (!(baton = malloc(sizeof(struct thread_baton))))
+	/*
+	 * We use a smaller stack since it gets preallocated in its entirety
+	 */
+	if (stacksize)
+		pthread_attr_setstacksize(&attr, stacksize);
+
+	r = pthread_create(t, &attr, fun, arg);
+	pthread_attr_destroy(&attr);
+
+	return r ? 0 : 1;
+}
+
+static int _server_init(struct server *srv, daemon_state *s)
+{
+	sigset_t all, old;
+	unsigned i;
+
+	srv->s = s;
+	srv->wake_fd[0] = srv->wake_fd[1] = -1;
+	dm_list_init(&srv->clients);
+	dm_list_init(&srv->stalled);
+	dm_list_init(&srv->closed);
+	dm_list_init(&srv->work);
+	dm_list_init(&srv->done);
+	pthread_mutex_init(&srv->lock, NULL);
+	pthread_cond_init(&srv->work_ready, NULL);
+
+	if ((srv->epoll_fd = epoll_create(DAEMON_MAX_EVENTS)) < 0) {
+		perror("epoll_create");
 		return 0;
+	}
 
-	baton->s = s;
-	baton->client = client;
+	if (pipe(srv->wake_fd)) {
+		perror("pipe");
+		return 0;
+	}
 
-	if (pthread_create(&baton->client.thread_id, NULL, client_thread, baton))
+	for (i = 0; i < 2; i++)
+		if (fcntl(srv->wake_fd[i], F_SETFD, FD_CLOEXEC) ||
+		    fcntl(srv->wake_fd[i], F_SETFL, O_NONBLOCK)) {
+			perror("fcntl");
+			return 0;
+		}
+
+	/* A blocking accept() would stall the whole event loop */
+	if (fcntl(s->socket_fd, F_SETFL, fcntl(s->socket_fd, F_GETFL, 0) | O_NONBLOCK)) {
+		perror("fcntl");
 		return 0;
+	}
+
+	{
+		struct epoll_event ev = { .events = EPOLLIN, .data.ptr = srv };
+		if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, srv->wake_fd[0], &ev)) {
+			perror("epoll_ctl");
+			return 0;
+		}
+	}
+
+	if (!_poll(srv, NULL, EPOLLIN))
+		return 0;
+
+	/* Signals (shutdown requests) must interrupt the event loop instead */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+
+	for (i = 0; i < DAEMON_WORKER_THREADS; i++) {
+		if (!_pthread_create(&srv->workers[i], _worker_thread, srv,
+				     s->thread_stack_size))
+			break;
+		srv->nr_workers++;
+	}
 
-	pthread_detach(baton->client.thread_id);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (!srv->nr_workers) {
+		ERROR(s, "Failed to create worker threads.");
+		return 0;
+	}
 
 	return 1;
 }
 
+static void _server_run(struct server *srv)
+{
+	struct epoll_event events[DAEMON_MAX_EVENTS];
+	struct connection *conn;
+	int i, n;
+
+	while (!_shutdown_requested) {
+		if ((n = epoll_wait(srv->epoll_fd, events, DAEMON_MAX_EVENTS, -1)) < 0) {
+			if (errno != EINTR)
+				perror("epoll_wait error");
+			continue;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (_shutdown_requested)
+				break;
+
+			if (!events[i].data.ptr)
+				_accept_clients(srv);
+			else if (events[i].data.ptr == srv)
+				_collect_responses(srv);
+			else {
+				conn = events[i].data.ptr;
+				/* Closed or handed on earlier in this batch? */
+				if (conn->closed || !conn->polled)
+					continue;
+				if (conn->out.mem)
+					_write_response(srv, conn);
+				else
+					_read_request(srv, conn);
+			}
+		}
+
+		_free_closed(srv);
+	}
+}
+
+static void _server_fini(struct server *srv)
+{
+	struct connection *conn, *tmp;
+	unsigned i;
+
+	if (!srv->s)
+		return;
+
+	pthread_mutex_lock(&srv->lock);
+	srv->stopping = 1;
+	pthread_cond_broadcast(&srv->work_ready);
+	pthread_mutex_unlock(&srv->lock);
+
+	/* Requests already queued are finished, but not answered */
+	for (i = 0; i < srv->nr_workers; i++)
+		pthread_join(srv->workers[i], NULL);
+
+	dm_list_iterate_items_gen_safe(conn, tmp, &srv->clients, clients)
+		_close_connection(srv, conn);
+	_free_closed(srv);
+
+	for (i = 0; i < 2; i++)
+		if (srv->wake_fd[i] >= 0 && close(srv->wake_fd[i]))
+			perror("close");
+
+	if (srv->epoll_fd >= 0 && close(srv->epoll_fd))
+		perror("close");
+
+	pthread_cond_destroy(&srv->work_ready);
+	pthread_mutex_destroy(&srv->lock);
+}
+
 void daemon_start(daemon_state s)
 {
 	int failed = 0;
 	log_state _log = { { 0 } };
+	struct server srv = { .epoll_fd = -1 };
 
 	/*
 	 * Switch to C locale to avoid reading large locale-archive file used by
@@ -509,16 +902,13 @@ void daemon_start(daemon_state s)
 		if (!s.daemon_init(&s))
 			failed = 1;
 
-	while (!_shutdown_requested && !failed) {
-		fd_set in;
-		FD_ZERO(&in);
-		FD_SET(s.socket_fd, &in);
-		if (select(FD_SETSIZE, &in, NULL, NULL, NULL) < 0 && errno != EINTR)
-			perror("select error");
-		if (FD_ISSET(s.socket_fd, &in))
-			if (!_shutdown_requested && !handle_connect(s))
-				ERROR(&s, "Failed to handle a client connection.");
-	}
+	if (!failed && !_server_init(&srv, &s))
+		failed = 1;
+
+	if (!failed)
+		_server_run(&srv);
+
+	_server_fini(&srv);
 
 	/* If activated by systemd, do not unlink the socket - systemd takes care of that! */
 	if (!_systemd_activation && s.socket_fd >= 0)
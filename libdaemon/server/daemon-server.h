@@ -19,7 +19,7 @@
 
 typedef struct {
 	int socket_fd; /* the fd we use to talk to the client */
-	pthread_t thread_id;
+	pthread_t thread_id; /* the worker handling the current request */
 	char *read_buf;
 	void *private; /* this holds per-client state */
 } client_handle;
@@ -56,11 +56,12 @@ static inline const char *daemon_request_str(request r, const char *path, const
 }
 
 /*
- * The callback. Called once per request issued, in the respective client's
- * thread. It is presented by a parsed request (in the form of a config tree).
- * The output is a new config tree that is serialised and sent back to the
- * client. The client blocks until the request processing is done and reply is
- * sent.
+ * The callback. Called once per request issued, in one of a fixed pool of
+ * worker threads, so requests from different clients may be handled
+ * concurrently. It is presented by a parsed request (in the form of a config
+ * tree). The output is a new config tree that is serialised and sent back to
+ * the client. The client blocks until the request processing is done and reply
+ * is sent.
  */
 typedef response (*handle_request)(struct daemon_state s, client_handle h, request r);
 
@@ -103,3 +103,86 @@ int dm_bit_get_first(dm_bitset_t bs)
 {
 	return dm_bit_get_next(bs, -1);
 }
+
+int dm_bit_get_next_clear(dm_bitset_t bs, int last_bit)
+{
+	int word, bit, nr_words = ((int) bs[0] + DM_BITS_PER_INT - 1) >> INT_SHIFT;
+	uint32_t test;
+
+	last_bit++;		/* otherwise we'll return the same bit again */
+
+	if (last_bit >= (int) bs[0])
+		return -1;
+
+	/* Whole words of set bits are skipped with a single test */
+	word = last_bit >> INT_SHIFT;
+	test = ~bs[word + 1] & (~UINT32_C(0) << (last_bit & (DM_BITS_PER_INT - 1)));
+
+	while (!test) {
+		if (++word >= nr_words)
+			return -1;
+		test = ~bs[word + 1];
+	}
+
+	bit = (word * DM_BITS_PER_INT) + ffs(test) - 1;
+
+	return (bit < (int) bs[0]) ? bit : -1;
+}
+
+static void _bit_range(dm_bitset_t bs, unsigned start, unsigned count, int set)
+{
+	unsigned end = start + count;
+	uint32_t mask;
+
+	while (start < end) {
+		mask = ~UINT32_C(0) << (start & (DM_BITS_PER_INT - 1));
+
+		/* Does the range end within this word? */
+		if (end - (start & ~(DM_BITS_PER_INT - 1)) < DM_BITS_PER_INT)
+			mask &= ~(~UINT32_C(0) << (end & (DM_BITS_PER_INT - 1)));
+
+		if (set)
+			bs[(start >> INT_SHIFT) + 1] |= mask;
+		else
+			bs[(start >> INT_SHIFT) + 1] &= ~mask;
+
+		start = (start | (DM_BITS_PER_INT - 1)) + 1;
+	}
+}
+
+void dm_bit_set_range(dm_bitset_t bs, unsigned start, unsigned count)
+{
+	_bit_range(bs, start, count, 1);
+}
+
+void dm_bit_clear_range(dm_bitset_t bs, unsigned start, unsigned count)
+{
+	_bit_range(bs, start, count, 0);
+}
+
+static unsigned _popcount(uint32_t word)
+{
+#ifdef __GNUC__
+	return (unsigned) __builtin_popcount(word);
+#else
+	return hweight32(word);
+#endif
+}
+
+/*
+ * Bits beyond bs[0] are not counted, although dm_bit_set_all()
+ * sets them.
+ */
+unsigned dm_bit_count(dm_bitset_t bs)
+{
+	unsigned i, count = 0, full_words = bs[0] >> INT_SHIFT;
+
+	for (i = 1; i <= full_words; i++)
+		count += _popcount(bs[i]);
+
+	if (bs[0] & (DM_BITS_PER_INT - 1))
+		count += _popcount(bs[full_words + 1] &
+				   ~(~UINT32_C(0) << (bs[0] & (DM_BITS_PER_INT - 1))));
+
+	return count;
+}
@@ -18,42 +18,29 @@
 struct dm_hash_node {
 	struct dm_hash_node *next;
 	void *data;
+	uint32_t hash;
 	unsigned keylen;
 	char key[0];
 };
 
+/*
+ * The table doubles once it holds more than one entry per slot on average.
+ * Rather than moving every entry at once, each insertion then moves the
+ * chains of a few more slots of the previous table across. Until they are
+ * all gone, an entry lives in its old slot if that has not been moved yet.
+ */
+#define HASH_MAX_LOAD		1
+#define HASH_MOVE_SLOTS		4	/* per insertion while growing */
+
 struct dm_hash_table {
 	unsigned num_nodes;
 	unsigned num_slots;
 	struct dm_hash_node **slots;
-};
 
-/* Permutation of the Integers 0 through 255 */
-static unsigned char _nums[] = {
-	1, 14, 110, 25, 97, 174, 132, 119, 138, 170, 125, 118, 27, 233, 140, 51,
-	87, 197, 177, 107, 234, 169, 56, 68, 30, 7, 173, 73, 188, 40, 36, 65,
-	49, 213, 104, 190, 57, 211, 148, 223, 48, 115, 15, 2, 67, 186, 210, 28,
-	12, 181, 103, 70, 22, 58, 75, 78, 183, 167, 238, 157, 124, 147, 172,
-	144,
-	176, 161, 141, 86, 60, 66, 128, 83, 156, 241, 79, 46, 168, 198, 41, 254,
-	178, 85, 253, 237, 250, 154, 133, 88, 35, 206, 95, 116, 252, 192, 54,
-	221,
-	102, 218, 255, 240, 82, 106, 158, 201, 61, 3, 89, 9, 42, 155, 159, 93,
-	166, 80, 50, 34, 175, 195, 100, 99, 26, 150, 16, 145, 4, 33, 8, 189,
-	121, 64, 77, 72, 208, 245, 130, 122, 143, 55, 105, 134, 29, 164, 185,
-	194,
-	193, 239, 101, 242, 5, 171, 126, 11, 74, 59, 137, 228, 108, 191, 232,
-	139,
-	6, 24, 81, 20, 127, 17, 91, 92, 251, 151, 225, 207, 21, 98, 113, 112,
-	84, 226, 18, 214, 199, 187, 13, 32, 94, 220, 224, 212, 247, 204, 196,
-	43,
-	249, 236, 45, 244, 111, 182, 153, 136, 129, 90, 217, 202, 19, 165, 231,
-	71,
-	230, 142, 96, 227, 62, 179, 246, 114, 162, 53, 160, 215, 205, 180, 47,
-	109,
-	44, 38, 31, 149, 135, 0, 216, 52, 63, 23, 37, 69, 39, 117, 146, 184,
-	163, 200, 222, 235, 248, 243, 219, 10, 152, 131, 123, 229, 203, 76, 120,
-	209
+	/* The previous table, from slot 'moved' on, while growing */
+	unsigned num_old_slots;
+	unsigned moved;
+	struct dm_hash_node **old_slots;
 };
 
 static struct dm_hash_node *_create_node(const char *str, unsigned len)
@@ -68,27 +55,70 @@ static struct dm_hash_node *_create_node(const char *str, unsigned len)
 	return n;
 }
 
-static unsigned long _hash(const char *str, unsigned len)
+static uint32_t _rotl(uint32_t x, unsigned r)
 {
-	unsigned long h = 0, g;
+	return (x << r) | (x >> (32 - r));
+}
+
+/*
+ * MurmurHash3 (x86, 32-bit), by Austin Appleby, placed in the public domain.
+ * Consumes the key four bytes at a time.
+ */
+static uint32_t _hash(const void *key, unsigned len)
+{
+	const unsigned char *p = key;
+	uint32_t h = len, k;
 	unsigned i;
 
-	for (i = 0; i < len; i++) {
-		h <<= 4;
-		h += _nums[(unsigned char) *str++];
-		g = h & ((unsigned long) 0xf << 16u);
-		if (g) {
-			h ^= g >> 16u;
-			h ^= g >> 5u;
-		}
+	for (i = len >> 2; i; i--, p += 4) {
+		memcpy(&k, p, sizeof(k));
+		k *= 0xcc9e2d51;
+		k = _rotl(k, 15);
+		k *= 0x1b873593;
+		h ^= k;
+		h = _rotl(h, 13);
+		h = h * 5 + 0xe6546b64;
+	}
+
+	k = 0;
+	switch (len & 3) {
+	case 3:
+		k ^= (uint32_t) p[2] << 16;
+		/* Fall through */
+	case 2:
+		k ^= (uint32_t) p[1] << 8;
+		/* Fall through */
+	case 1:
+		k ^= p[0];
+		k *= 0xcc9e2d51;
+		k = _rotl(k, 15);
+		k *= 0x1b873593;
+		h ^= k;
 	}
 
+	h ^= len;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
 	return h;
 }
 
+static struct dm_hash_node **_alloc_slots(unsigned num_slots)
+{
+	size_t len = sizeof(struct dm_hash_node *) * num_slots;
+	struct dm_hash_node **slots;
+
+	if ((slots = dm_malloc(len)))
+		memset(slots, 0, len);
+
+	return slots;
+}
+
 struct dm_hash_table *dm_hash_create(unsigned size_hint)
 {
-	size_t len;
 	unsigned new_size = 16u;
 	struct dm_hash_table *hc = dm_zalloc(sizeof(*hc));
 
@@ -100,12 +130,10 @@ struct dm_hash_table *dm_hash_create(unsigned size_hint)
 		new_size = new_size << 1;
 
 	hc->num_slots = new_size;
-	len = sizeof(*(hc->slots)) * new_size;
-	if (!(hc->slots = dm_malloc(len))) {
+	if (!(hc->slots = _alloc_slots(new_size))) {
 		stack;
 		goto bad;
 	}
-	memset(hc->slots, 0, len);
 	return hc;
 
       bad:
@@ -114,18 +142,82 @@ struct dm_hash_table *dm_hash_create(unsigned size_hint)
 	return 0;
 }
 
-static void _free_nodes(struct dm_hash_table *t)
+/*
+ * The slot holding the chain an entry with the given hash belongs to.
+ */
+static struct dm_hash_node **_slot(struct dm_hash_table *t, uint32_t hash)
+{
+	unsigned old;
+
+	if (t->old_slots && (old = hash & (t->num_old_slots - 1)) >= t->moved)
+		return &t->old_slots[old];
+
+	return &t->slots[hash & (t->num_slots - 1)];
+}
+
+static void _move_slots(struct dm_hash_table *t, unsigned count)
+{
+	struct dm_hash_node *c, *n, **slot;
+
+	for (; count && t->moved < t->num_old_slots; count--, t->moved++)
+		for (c = t->old_slots[t->moved]; c; c = n) {
+			n = c->next;
+			slot = &t->slots[c->hash & (t->num_slots - 1)];
+			c->next = *slot;
+			*slot = c;
+		}
+
+	if (t->moved == t->num_old_slots) {
+		dm_free(t->old_slots);
+		t->old_slots = NULL;
+		t->num_old_slots = 0;
+	}
+}
+
+static void _grow(struct dm_hash_table *t)
+{
+	struct dm_hash_node **slots;
+
+	/* Finish any previous growth first */
+	if (t->old_slots)
+		_move_slots(t, t->num_old_slots);
+
+	/* Without memory, carry on with longer chains */
+	if (!(slots = _alloc_slots(t->num_slots << 1)))
+		return;
+
+	t->old_slots = t->slots;
+	t->num_old_slots = t->num_slots;
+	t->moved = 0;
+	t->slots = slots;
+	t->num_slots <<= 1;
+}
+
+static void _free_chains(struct dm_hash_node **slots, unsigned first,
+			 unsigned num_slots)
 {
 	struct dm_hash_node *c, *n;
 	unsigned i;
 
-	for (i = 0; i < t->num_slots; i++)
-		for (c = t->slots[i]; c; c = n) {
+	for (i = first; i < num_slots; i++)
+		for (c = slots[i]; c; c = n) {
 			n = c->next;
 			dm_free(c);
 		}
 }
 
+static void _free_nodes(struct dm_hash_table *t)
+{
+	_free_chains(t->slots, 0, t->num_slots);
+
+	if (t->old_slots) {
+		_free_chains(t->old_slots, t->moved, t->num_old_slots);
+		dm_free(t->old_slots);
+		t->old_slots = NULL;
+		t->num_old_slots = 0;
+	}
+}
+
 void dm_hash_destroy(struct dm_hash_table *t)
 {
 	_free_nodes(t);
@@ -134,13 +226,12 @@ void dm_hash_destroy(struct dm_hash_table *t)
 }
 
 static struct dm_hash_node **_find(struct dm_hash_table *t, const void *key,
-				   uint32_t len)
+				   uint32_t len, uint32_t hash)
 {
-	unsigned h = _hash(key, len) & (t->num_slots - 1);
 	struct dm_hash_node **c;
 
-	for (c = &t->slots[h]; *c; c = &((*c)->next)) {
-		if ((*c)->keylen != len)
+	for (c = _slot(t, hash); *c; c = &((*c)->next)) {
+		if ((*c)->hash != hash || (*c)->keylen != len)
 			continue;
 
 		if (!memcmp(key, (*c)->key, len))
@@ -153,7 +244,7 @@ static struct dm_hash_node **_find(struct dm_hash_table *t, const void *key,
 void *dm_hash_lookup_binary(struct dm_hash_table *t, const void *key,
 			    uint32_t len)
 {
-	struct dm_hash_node **c = _find(t, key, len);
+	struct dm_hash_node **c = _find(t, key, len, _hash(key, len));
 
 	return *c ? (*c)->data : 0;
 }
@@ -161,7 +252,8 @@ void *dm_hash_lookup_binary(struct dm_hash_table *t, const void *key,
 int dm_hash_insert_binary(struct dm_hash_table *t, const void *key,
 			  uint32_t len, void *data)
 {
-	struct dm_hash_node **c = _find(t, key, len);
+	uint32_t hash = _hash(key, len);
+	struct dm_hash_node **c = _find(t, key, len, hash);
 
 	if (*c)
 		(*c)->data = data;
@@ -172,9 +264,16 @@ int dm_hash_insert_binary(struct dm_hash_table *t, const void *key,
 			return 0;
 
 		n->data = data;
+		n->hash = hash;
 		n->next = 0;
 		*c = n;
 		t->num_nodes++;
+
+		if (t->old_slots)
+			_move_slots(t, HASH_MOVE_SLOTS);
+
+		if (t->num_nodes > t->num_slots * HASH_MAX_LOAD)
+			_grow(t);
 	}
 
 	return 1;
@@ -183,7 +282,7 @@ int dm_hash_insert_binary(struct dm_hash_table *t, const void *key,
 void dm_hash_remove_binary(struct dm_hash_table *t, const void *key,
 			uint32_t len)
 {
-	struct dm_hash_node **c = _find(t, key, len);
+	struct dm_hash_node **c = _find(t, key, len, _hash(key, len));
 
 	if (*c) {
 		struct dm_hash_node *old = *c;
@@ -216,13 +315,11 @@ unsigned dm_hash_get_num_entries(struct dm_hash_table *t)
 void dm_hash_iter(struct dm_hash_table *t, dm_hash_iterate_fn f)
 {
 	struct dm_hash_node *c, *n;
-	unsigned i;
 
-	for (i = 0; i < t->num_slots; i++)
-		for (c = t->slots[i]; c; c = n) {
-			n = c->next;
-			f(c->data);
-		}
+	for (c = dm_hash_get_first(t); c; c = n) {
+		n = dm_hash_get_next(t, c);
+		f(c->data);
+	}
 }
 
 void dm_hash_wipe(struct dm_hash_table *t)
@@ -244,6 +341,10 @@ void *dm_hash_get_data(struct dm_hash_table *t __attribute__((unused)),
 	return n->data;
 }
 
+/*
+ * Iteration visits the current table, then what remains of the previous one.
+ * Slot numbers from num_slots on stand for the previous table.
+ */
 static struct dm_hash_node *_next_slot(struct dm_hash_table *t, unsigned s)
 {
 	struct dm_hash_node *c = NULL;
@@ -252,6 +353,13 @@ static struct dm_hash_node *_next_slot(struct dm_hash_table *t, unsigned s)
 	for (i = s; i < t->num_slots && !c; i++)
 		c = t->slots[i];
 
+	if (c || !t->old_slots)
+		return c;
+
+	for (i = (s > t->num_slots ? s - t->num_slots : 0); i < t->num_old_slots && !c; i++)
+		if (i >= t->moved)
+			c = t->old_slots[i];
+
 	return c;
 }
 
@@ -262,7 +370,13 @@ struct dm_hash_node *dm_hash_get_first(struct dm_hash_table *t)
 
 struct dm_hash_node *dm_hash_get_next(struct dm_hash_table *t, struct dm_hash_node *n)
 {
-	unsigned h = _hash(n->key, n->keylen) & (t->num_slots - 1);
+	unsigned old;
+
+	if (n->next)
+		return n->next;
+
+	if (t->old_slots && (old = n->hash & (t->num_old_slots - 1)) >= t->moved)
+		return _next_slot(t, t->num_slots + old + 1);
 
-	return n->next ? n->next : _next_slot(t, h + 1);
+	return _next_slot(t, (n->hash & (t->num_slots - 1)) + 1);
 }
@@ -918,6 +918,16 @@ void dm_bit_union(dm_bitset_t out, dm_bitset_t in1, dm_bitset_t in2);
 int dm_bit_get_first(dm_bitset_t bs);
 int dm_bit_get_next(dm_bitset_t bs, int last_bit);
 
+/* Returns the first clear bit after last_bit, or -1 if there is none */
+int dm_bit_get_next_clear(dm_bitset_t bs, int last_bit);
+
+/* Sets or clears count bits from bit start onwards */
+void dm_bit_set_range(dm_bitset_t bs, unsigned start, unsigned count);
+void dm_bit_clear_range(dm_bitset_t bs, unsigned start, unsigned count);
+
+/* Returns number of set bits */
+unsigned dm_bit_count(dm_bitset_t bs);
+
 #define DM_BITS_PER_INT (sizeof(int) * CHAR_BIT)
 
 #define dm_bit(bs, i) \
@@ -1349,6 +1359,22 @@ int dm_regex_match(struct dm_regex *regex, const char *s);
  */
 uint32_t dm_regex_fingerprint(struct dm_regex *regex);
 
+/*
+ * Save the complete dfa, so that a later process can load it with
+ * dm_regex_import() instead of parsing the patterns again.
+ * Returns the size of the data allocated from mem, or 0 if the dfa
+ * is too large to save or on failure.
+ */
+size_t dm_regex_export(struct dm_regex *regex, struct dm_pool *mem, void **data);
+
+/*
+ * Load a dfa saved by dm_regex_export().  Returns NULL if the data was
+ * not saved from exactly the same patterns, when dm_regex_create() must
+ * be used instead.
+ */
+struct dm_regex *dm_regex_import(struct dm_pool *mem, const char * const *patterns,
+				 unsigned num_patterns, const void *data, size_t size);
+
 /*********************
  * reporting functions
  *********************/
@@ -1402,6 +1428,19 @@ struct dm_report_field_type {
 #define DM_REPORT_OUTPUT_FIELD_NAME_PREFIX	0x00000008
 #define DM_REPORT_OUTPUT_FIELD_UNQUOTED		0x00000010
 #define DM_REPORT_OUTPUT_COLUMNS_AS_ROWS	0x00000020
+#define DM_REPORT_OUTPUT_JSON			0x00000040
+#define DM_REPORT_OUTPUT_NUL_DELIMITED		0x00000080
+
+/*
+ * With DM_REPORT_OUTPUT_JSON or DM_REPORT_OUTPUT_NUL_DELIMITED each row is
+ * output as soon as it is reported, without allocating anything per field
+ * and without aligning.  JSON rows are objects keyed by field id, one per
+ * line, logged like the rows of other reports.  NUL-delimited rows have
+ * their fields separated by NUL bytes and end with a newline: as no log
+ * function can take them, they are written straight to stdout.  If the
+ * output is also buffered, the rows are sorted in runs of bounded size,
+ * spilled to a temporary file and merged by dm_report_output().
+ */
 
 struct dm_report *dm_report_init(uint32_t *report_types,
 				 const struct dm_report_object_type *types,
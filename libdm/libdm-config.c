@@ -44,6 +44,7 @@ struct parser {
 
 	int t;			/* token limits and type */
 	const char *tb, *te;
+	int escaped;		/* TOK_STRING_ESCAPED holds a backslash */
 
 	int line;		/* line number we are on */
 
@@ -66,6 +67,7 @@ static int _match_aux(struct parser *p, int t);
 static struct dm_config_value *_create_value(struct dm_pool *mem);
 static struct dm_config_node *_create_node(struct dm_pool *mem);
 static char *_dup_tok(struct parser *p);
+static const char *_dup_tok_interned(struct parser *p);
 
 static const int sep = '/';
 
@@ -89,6 +91,69 @@ static int _tok_match(const char *str, const char *b, const char *e)
 	return !(*str || (b != e));
 }
 
+/*
+ * Keys and string values that appear over and over again in metadata.
+ * Tokens matching one of these share its copy instead of taking their
+ * own from the pool.  Keep sorted.
+ */
+#define INTERNED_LEN 20
+
+static const char _interned[][INTERNED_LEN] = {
+	"ALLOCATABLE", "CLUSTERED", "EXPORTED", "FIXED_MINOR",
+	"LOCKED", "MIRRORED", "MIRROR_IMAGE", "MIRROR_LOG", "PVMOVE",
+	"READ", "RESIZEABLE", "VISIBLE", "WRITE", "allocation_policy",
+	"chunk_size", "cow_store", "creation_host", "creation_time",
+	"data", "dev_size", "device", "device_id", "discards", "error",
+	"extent_count", "extent_size", "flags", "format", "id",
+	"logical_volumes", "lvm2", "max_lv", "max_pv", "metadata",
+	"metadata_copies", "mirror", "mirror_count", "mirror_log",
+	"mirrors", "origin", "pe_count", "pe_start",
+	"physical_volumes", "pool", "raid1", "raid10", "raid5",
+	"raid6", "read_ahead", "region_size", "segment_count", "seqno",
+	"snapshot", "start_extent", "status", "stripe_count",
+	"stripe_size", "striped", "stripes", "tags", "thin",
+	"thin-pool", "transaction_id", "type", "zero",
+	"zero_new_blocks"
+};
+
+#define NR_INTERNED (sizeof(_interned) / sizeof(*_interned))
+
+/*
+ * Returns the interned copy of the token from b to e, or NULL.
+ */
+static const char *_intern(const char *b, const char *e)
+{
+	unsigned lo = 0, hi = NR_INTERNED, mid;
+	const unsigned char *str, *t;
+
+	if (b == e || (e - b) >= INTERNED_LEN)
+		return NULL;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		str = (const unsigned char *) _interned[mid];
+
+		for (t = (const unsigned char *) b;
+		     (t != (const unsigned char *) e) && (*str == *t); str++, t++)
+			;
+
+		if (t == (const unsigned char *) e) {
+			if (!*str)
+				return _interned[mid];
+			hi = mid;	/* token is a prefix of this one */
+		} else if (*str < *t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return NULL;
+}
+
+/* The same characters isspace() accepts in the C locale */
+#define _is_space(c) ((c) == ' ' || (c) == '\n' || (c) == '\t' || \
+		      (c) == '\r' || (c) == '\v' || (c) == '\f')
+
 struct dm_config_tree *dm_config_create(void)
 {
 	struct dm_config_tree *cft;
@@ -386,7 +451,7 @@ static struct dm_config_node *_section(struct parser *p)
 		return NULL;
 	}
 
-	if (!(root->key = _dup_tok(p)))
+	if (!(root->key = _dup_tok_interned(p)))
 		return_NULL;
 
 	match(TOK_IDENTIFIER);
@@ -481,7 +546,7 @@ static struct dm_config_value *_type(struct parser *p)
 		v->type = DM_CFG_STRING;
 
 		p->tb++, p->te--;	/* strip "'s */
-		if (!(v->v.str = _dup_tok(p)))
+		if (!(v->v.str = _dup_tok_interned(p)))
 			return_NULL;
 		p->te++;
 		match(TOK_STRING);
@@ -491,10 +556,16 @@ static struct dm_config_value *_type(struct parser *p)
 		v->type = DM_CFG_STRING;
 
 		p->tb++, p->te--;	/* strip "'s */
-		if (!(str = _dup_tok(p)))
-			return_NULL;
-		dm_unescape_double_quotes(str);
-		v->v.str = str;
+		if (!p->escaped) {
+			/* Nothing to unescape */
+			if (!(v->v.str = _dup_tok_interned(p)))
+				return_NULL;
+		} else {
+			if (!(str = _dup_tok(p)))
+				return_NULL;
+			dm_unescape_double_quotes(str);
+			v->v.str = str;
+		}
 		p->te++;
 		match(TOK_STRING_ESCAPED);
 		break;
@@ -574,11 +645,14 @@ static void _get_token(struct parser *p, int tok_prev)
 
 	case '"':
 		p->t = TOK_STRING_ESCAPED;
+		p->escaped = 0;
 		te++;
 		while ((te != p->fe) && (*te) && (*te != '"')) {
 			if ((*te == '\\') && (te + 1 != p->fe) &&
-			    *(te + 1))
+			    *(te + 1)) {
+				p->escaped = 1;
 				te++;
+			}
 			te++;
 		}
 
@@ -629,7 +703,7 @@ static void _get_token(struct parser *p, int tok_prev)
 
 	default:
 		p->t = TOK_IDENTIFIER;
-		while ((te != p->fe) && (*te) && !isspace(*te) &&
+		while ((te != p->fe) && (*te) && !_is_space(*te) &&
 		       (*te != '#') && (*te != '=') &&
 		       (*te != SECTION_B_CHAR) &&
 		       (*te != SECTION_E_CHAR))
@@ -647,10 +721,10 @@ static void _eat_space(struct parser *p)
 			while ((p->te != p->fe) && (*p->te != '\n') && (*p->te))
 				++p->te;
 
-		else if (!isspace(*p->te))
+		else if (!_is_space(*p->te))
 			break;
 
-		while ((p->te != p->fe) && isspace(*p->te)) {
+		while ((p->te != p->fe) && _is_space(*p->te)) {
 			if (*p->te == '\n')
 				++p->line;
 			++p->te;
@@ -686,6 +760,16 @@ static char *_dup_tok(struct parser *p)
 	return str;
 }
 
+static const char *_dup_tok_interned(struct parser *p)
+{
+	const char *str;
+
+	if ((str = _intern(p->tb, p->te)))
+		return str;
+
+	return _dup_tok(p);
+}
+
 /*
  * Utility functions
  */
@@ -715,10 +799,10 @@ static const struct dm_config_node *_find_config_node(const void *start,
 		/* find the end of this segment */
 		for (e = path; *e && (*e != sep); e++) ;
 
-		/* hunt for the node */
+		/* hunt for the node - the first character rules most out */
 		cn_found = NULL;
 		while (cn) {
-			if (_tok_match(cn->key, path, e)) {
+			if ((*cn->key == *path) && _tok_match(cn->key, path, e)) {
 				/* Inefficient */
 				if (!cn_found)
 					cn_found = cn;
@@ -16,12 +16,17 @@
 #include "dmlib.h"
 
 #include <ctype.h>
+#include <unistd.h>
 
 /*
  * Internal flags
  */
 #define RH_SORT_REQUIRED	0x00000100
 #define RH_HEADINGS_PRINTED	0x00000200
+#define RH_STREAM		0x00000400
+
+/* Sorted streaming output spills to a file in runs of about this size */
+#define RH_RUN_SIZE		(4 * 1024 * 1024)
 
 struct dm_report {
 	struct dm_pool *mem;
@@ -48,6 +53,21 @@ struct dm_report {
 
 	/* To store caller private data */
 	void *private;
+
+	/* Streaming output reuses one field per column and one line buffer */
+	struct dm_report_field *stream_fields;
+	struct dm_report_field **stream_keys;	/* Fields in sort order */
+	char *line;
+	size_t line_size;
+	size_t line_len;
+
+	/* Records of sorted streaming output, spilled to a file when full */
+	char *run;
+	size_t run_size;
+	size_t run_len;
+	FILE *spill;
+	off_t *spill_ends;			/* Where each sorted run ends */
+	unsigned spill_count;
 };
 
 /*
@@ -561,6 +581,29 @@ static int _parse_keys(struct dm_report *rh, const char *keys,
 	return 1;
 }
 
+static int _init_stream(struct dm_report *rh)
+{
+	struct field_properties *fp;
+	unsigned i = 0;
+
+	if (!(rh->stream_fields = dm_pool_zalloc(rh->mem, sizeof(*rh->stream_fields) *
+						 dm_list_size(&rh->field_props))) ||
+	    !(rh->stream_keys = dm_pool_zalloc(rh->mem, sizeof(*rh->stream_keys) *
+					       (rh->keys_count + 1)))) {
+		log_error("dm_report: stream field allocation failed");
+		return 0;
+	}
+
+	dm_list_iterate_items(fp, &rh->field_props) {
+		rh->stream_fields[i].props = fp;
+		if (fp->flags & FLD_SORT_KEY)
+			rh->stream_keys[fp->sort_posn] = &rh->stream_fields[i];
+		i++;
+	}
+
+	return 1;
+}
+
 struct dm_report *dm_report_init(uint32_t *report_types,
 				 const struct dm_report_object_type *types,
 				 const struct dm_report_field_type *fields,
@@ -593,6 +636,22 @@ struct dm_report *dm_report_init(uint32_t *report_types,
 
 	rh->flags |= output_flags & DM_REPORT_OUTPUT_MASK;
 
+	/* Streaming output is neither aligned nor turned into columns. */
+	if (output_flags & (DM_REPORT_OUTPUT_JSON | DM_REPORT_OUTPUT_NUL_DELIMITED)) {
+		if ((output_flags & DM_REPORT_OUTPUT_JSON) &&
+		    (output_flags & DM_REPORT_OUTPUT_NUL_DELIMITED)) {
+			log_error("dm_report_init: JSON and NUL-delimited "
+				  "output cannot be combined");
+			dm_free(rh);
+			return NULL;
+		}
+		rh->flags |= RH_STREAM;
+		rh->flags &= ~(DM_REPORT_OUTPUT_ALIGNED |
+			       DM_REPORT_OUTPUT_COLUMNS_AS_ROWS |
+			       DM_REPORT_OUTPUT_FIELD_NAME_PREFIX);
+		output_flags &= ~DM_REPORT_OUTPUT_COLUMNS_AS_ROWS;
+	}
+
 	/* With columns_as_rows we must buffer and not align. */
 	if (output_flags & DM_REPORT_OUTPUT_COLUMNS_AS_ROWS) {
 		if (!(output_flags & DM_REPORT_OUTPUT_BUFFERED))
@@ -636,6 +695,11 @@ struct dm_report *dm_report_init(uint32_t *report_types,
 		return NULL;
 	}
 
+	if ((rh->flags & RH_STREAM) && !_init_stream(rh)) {
+		dm_report_free(rh);
+		return NULL;
+	}
+
 	/* Return updated types value for further compatility check by caller */
 	if (report_types)
 		*report_types = rh->report_types;
@@ -645,6 +709,12 @@ struct dm_report *dm_report_init(uint32_t *report_types,
 
 void dm_report_free(struct dm_report *rh)
 {
+	if (rh->spill && fclose(rh->spill))
+		log_sys_error("fclose", "report spill file");
+
+	dm_free(rh->spill_ends);
+	dm_free(rh->run);
+	dm_free(rh->line);
 	dm_pool_destroy(rh->mem);
 	dm_free(rh);
 }
@@ -688,6 +758,526 @@ static void *_report_get_field_data(struct dm_report *rh,
 	return (void *)(ret + rh->fields[fp->field_num].offset);
 }
 
+/*
+ * Streaming output
+ */
+static int _grow_buffer(char **buf, size_t *size, size_t needed)
+{
+	size_t new_size = *size ? : 4096;
+	char *new_buf;
+
+	while (new_size < needed)
+		new_size *= 2;
+
+	if (new_size == *size)
+		return 1;
+
+	if (!(new_buf = dm_realloc(*buf, new_size))) {
+		log_error("dm_report: output buffer allocation failed");
+		return 0;
+	}
+
+	*buf = new_buf;
+	*size = new_size;
+
+	return 1;
+}
+
+static int _line_add(struct dm_report *rh, const char *str, size_t len)
+{
+	if ((rh->line_len + len > rh->line_size) &&
+	    !_grow_buffer(&rh->line, &rh->line_size, rh->line_len + len))
+		return_0;
+
+	memcpy(rh->line + rh->line_len, str, len);
+	rh->line_len += len;
+
+	return 1;
+}
+
+static int _line_add_json_string(struct dm_report *rh, const char *str)
+{
+	const char *plain;
+	char esc[8];
+
+	if (!_line_add(rh, "\"", 1))
+		return_0;
+
+	while (*str) {
+		for (plain = str; *str && *str != '"' && *str != '\\' &&
+		     (unsigned char) *str >= 0x20; str++)
+			;
+
+		if ((str > plain) && !_line_add(rh, plain, (size_t) (str - plain)))
+			return_0;
+
+		if (!*str)
+			break;
+
+		if (*str == '"' || *str == '\\') {
+			esc[0] = '\\';
+			esc[1] = *str;
+			esc[2] = '\0';
+		} else
+			sprintf(esc, "\\u%04x", (unsigned char) *str);
+
+		if (!_line_add(rh, esc, strlen(esc)))
+			return_0;
+		str++;
+	}
+
+	return _line_add(rh, "\"", 1);
+}
+
+static int _line_add_field(struct dm_report *rh, unsigned first,
+			   const char *id, const char *value)
+{
+	if (!(rh->flags & DM_REPORT_OUTPUT_JSON))
+		return (first || _line_add(rh, "", 1)) &&
+			_line_add(rh, value, strlen(value));
+
+	return _line_add(rh, first ? "{" : ",", 1) &&
+		_line_add_json_string(rh, id) &&
+		_line_add(rh, ":", 1) &&
+		_line_add_json_string(rh, value);
+}
+
+static int _line_end(struct dm_report *rh)
+{
+	if ((rh->flags & DM_REPORT_OUTPUT_JSON) && !_line_add(rh, "}", 1))
+		return_0;
+
+	return _line_add(rh, "\n", 1);
+}
+
+/*
+ * Rows go through log_print like those of the other formats, so they
+ * reach any log function the caller set up.  NUL-delimited rows cannot
+ * pass through a string, so they are written straight to stdout.
+ */
+static int _write_output(const struct dm_report *rh, const char *buf, size_t len)
+{
+	if (!(rh->flags & DM_REPORT_OUTPUT_NUL_DELIMITED)) {
+		/* Without the newline */
+		log_print("%.*s", (int) len - 1, buf);
+		return 1;
+	}
+
+	if (fwrite(buf, 1, len, stdout) != len) {
+		log_sys_error("fwrite", "report output");
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Headings go out in NUL-delimited output only, as JSON names each value.
+ */
+static int _stream_headings(struct dm_report *rh)
+{
+	struct field_properties *fp;
+	unsigned first = 1;
+
+	if (rh->flags & RH_HEADINGS_PRINTED)
+		return 1;
+
+	rh->flags |= RH_HEADINGS_PRINTED;
+
+	if (!(rh->flags & DM_REPORT_OUTPUT_HEADINGS) ||
+	    (rh->flags & DM_REPORT_OUTPUT_JSON))
+		return 1;
+
+	rh->line_len = 0;
+
+	dm_list_iterate_items(fp, &rh->field_props) {
+		if (fp->flags & FLD_HIDDEN)
+			continue;
+		if (!_line_add_field(rh, first, rh->fields[fp->field_num].id,
+				     rh->fields[fp->field_num].heading))
+			return_0;
+		first = 0;
+	}
+
+	return _line_end(rh) && _write_output(rh, rh->line, rh->line_len);
+}
+
+/*
+ * A record of sorted output is its length, the length of its sort keys,
+ * the sort keys and then the line to print.  Numeric keys are stored as
+ * raw uint64_t, strings with their terminating NUL.
+ */
+static int _run_add_record(struct dm_report *rh)
+{
+	struct dm_report_field *field;
+	uint32_t len, keys_len = 0, cnt;
+	char *rec;
+
+	for (cnt = 0; cnt < rh->keys_count; cnt++) {
+		field = rh->stream_keys[cnt];
+		keys_len += (field->props->flags & DM_REPORT_FIELD_TYPE_NUMBER) ?
+			sizeof(uint64_t) : strlen(field->sort_value) + 1;
+	}
+
+	len = 2 * sizeof(uint32_t) + keys_len + rh->line_len;
+
+	if ((rh->run_len + len > rh->run_size) &&
+	    !_grow_buffer(&rh->run, &rh->run_size, rh->run_len + len))
+		return_0;
+
+	rec = rh->run + rh->run_len;
+	rh->run_len += len;
+
+	memcpy(rec, &len, sizeof(len));
+	memcpy(rec + sizeof(len), &keys_len, sizeof(keys_len));
+	rec += 2 * sizeof(uint32_t);
+
+	for (cnt = 0; cnt < rh->keys_count; cnt++) {
+		field = rh->stream_keys[cnt];
+		if (field->props->flags & DM_REPORT_FIELD_TYPE_NUMBER) {
+			memcpy(rec, field->sort_value, sizeof(uint64_t));
+			rec += sizeof(uint64_t);
+		} else {
+			strcpy(rec, field->sort_value);
+			rec += strlen(rec) + 1;
+		}
+	}
+
+	memcpy(rec, rh->line, rh->line_len);
+
+	return 1;
+}
+
+static uint32_t _record_len(const char *rec)
+{
+	uint32_t len;
+
+	memcpy(&len, rec, sizeof(len));
+
+	return len;
+}
+
+static int _record_print(const struct dm_report *rh, const char *rec)
+{
+	uint32_t keys_len;
+
+	memcpy(&keys_len, rec + sizeof(uint32_t), sizeof(keys_len));
+
+	return _write_output(rh, rec + 2 * sizeof(uint32_t) + keys_len,
+			     _record_len(rec) - 2 * sizeof(uint32_t) - keys_len);
+}
+
+/* Same order as _row_compare() */
+static int _record_compare(const struct dm_report *rh, const char *reca,
+			   const char *recb)
+{
+	const struct dm_report_field *sf;
+	uint64_t numa, numb;
+	uint32_t cnt;
+	int cmp;
+
+	reca += 2 * sizeof(uint32_t);
+	recb += 2 * sizeof(uint32_t);
+
+	for (cnt = 0; cnt < rh->keys_count; cnt++) {
+		sf = rh->stream_keys[cnt];
+		if (sf->props->flags & DM_REPORT_FIELD_TYPE_NUMBER) {
+			memcpy(&numa, reca, sizeof(numa));
+			memcpy(&numb, recb, sizeof(numb));
+			reca += sizeof(numa);
+			recb += sizeof(numb);
+			if (numa == numb)
+				continue;
+			cmp = (numa > numb) ? 1 : -1;
+		} else {
+			cmp = strcmp(reca, recb);
+			reca += strlen(reca) + 1;
+			recb += strlen(recb) + 1;
+			if (!cmp)
+				continue;
+			cmp = (cmp > 0) ? 1 : -1;
+		}
+
+		return (sf->props->flags & FLD_ASCENDING) ? cmp : -cmp;
+	}
+
+	return 0;		/* Identical */
+}
+
+struct sort_record {
+	const struct dm_report *rh;
+	const char *rec;
+};
+
+static int _sort_record_compare(const void *a, const void *b)
+{
+	const struct sort_record *sra = a, *srb = b;
+
+	return _record_compare(sra->rh, sra->rec, srb->rec);
+}
+
+/*
+ * Sorts the records in the run and prints them, or with spill set,
+ * appends them to the spill file as another sorted run.
+ */
+static int _flush_run(struct dm_report *rh, int spill)
+{
+	struct sort_record *recs;
+	off_t *ends;
+	size_t pos, count = 0, i;
+	int r = 0;
+
+	for (pos = 0; pos < rh->run_len; pos += _record_len(rh->run + pos))
+		count++;
+
+	if (!count)
+		return 1;
+
+	if (!(recs = dm_malloc(sizeof(*recs) * count))) {
+		log_error("dm_report: sort array allocation failed");
+		return 0;
+	}
+
+	for (pos = i = 0; pos < rh->run_len; pos += _record_len(rh->run + pos), i++) {
+		recs[i].rh = rh;
+		recs[i].rec = rh->run + pos;
+	}
+
+	qsort(recs, count, sizeof(*recs), _sort_record_compare);
+
+	if (!spill) {
+		for (i = 0; i < count; i++)
+			if (!_record_print(rh, recs[i].rec))
+				goto_out;
+		r = 1;
+		goto out;
+	}
+
+	if (!rh->spill && !(rh->spill = tmpfile())) {
+		log_sys_error("tmpfile", "report spill file");
+		goto out;
+	}
+
+	for (i = 0; i < count; i++)
+		if (fwrite(recs[i].rec, 1, _record_len(recs[i].rec), rh->spill) !=
+		    _record_len(recs[i].rec)) {
+			log_sys_error("fwrite", "report spill file");
+			goto out;
+		}
+
+	if (!(ends = dm_realloc(rh->spill_ends, sizeof(*ends) * (rh->spill_count + 1)))) {
+		log_error("dm_report: spill run allocation failed");
+		goto out;
+	}
+
+	rh->spill_ends = ends;
+	rh->spill_ends[rh->spill_count++] = ftello(rh->spill);
+	r = 1;
+out:
+	rh->run_len = 0;
+	dm_free(recs);
+
+	return r;
+}
+
+/*
+ * Reads one sorted run back from the spill file, a buffer at a time.
+ */
+struct run_reader {
+	int fd;
+	off_t pos;
+	off_t end;
+	char *buf;
+	size_t size;
+	size_t start;	/* Current record */
+	size_t len;	/* Valid bytes in buf */
+};
+
+static int _reader_fill(struct run_reader *rd, size_t needed)
+{
+	size_t want;
+	ssize_t got;
+
+	if (rd->len - rd->start >= needed)
+		return 1;
+
+	memmove(rd->buf, rd->buf + rd->start, rd->len - rd->start);
+	rd->len -= rd->start;
+	rd->start = 0;
+
+	if ((needed > rd->size) && !_grow_buffer(&rd->buf, &rd->size, needed))
+		return_0;
+
+	while (rd->len < needed) {
+		want = rd->size - rd->len;
+		if ((off_t) want > rd->end - rd->pos)
+			want = (size_t) (rd->end - rd->pos);
+		if (!want) {
+			log_error(INTERNAL_ERROR "dm_report: truncated spill run");
+			return 0;
+		}
+		if ((got = pread(rd->fd, rd->buf + rd->len, want, rd->pos)) <= 0) {
+			log_sys_error("pread", "report spill file");
+			return 0;
+		}
+		rd->len += (size_t) got;
+		rd->pos += got;
+	}
+
+	return 1;
+}
+
+/* Returns the next record of the run, or NULL at its end */
+static const char *_reader_next(struct run_reader *rd, int *error)
+{
+	if (rd->len - rd->start) {
+		rd->start += _record_len(rd->buf + rd->start);
+		if (rd->start == rd->len && rd->pos == rd->end)
+			return NULL;
+	} else if (rd->pos == rd->end)
+		return NULL;
+
+	if (!_reader_fill(rd, sizeof(uint32_t)) ||
+	    !_reader_fill(rd, _record_len(rd->buf + rd->start))) {
+		*error = 1;
+		return NULL;
+	}
+
+	return rd->buf + rd->start;
+}
+
+static int _merge_spill(struct dm_report *rh)
+{
+	struct run_reader *rds;
+	const char **recs;
+	unsigned i, min;
+	int error = 0;
+
+	if (fflush(rh->spill)) {
+		log_sys_error("fflush", "report spill file");
+		return 0;
+	}
+
+	if (!(rds = dm_zalloc(sizeof(*rds) * rh->spill_count)) ||
+	    !(recs = dm_zalloc(sizeof(*recs) * rh->spill_count))) {
+		log_error("dm_report: merge allocation failed");
+		dm_free(rds);
+		return 0;
+	}
+
+	for (i = 0; i < rh->spill_count; i++) {
+		rds[i].fd = fileno(rh->spill);
+		rds[i].pos = i ? rh->spill_ends[i - 1] : 0;
+		rds[i].end = rh->spill_ends[i];
+		recs[i] = _reader_next(&rds[i], &error);
+	}
+
+	/* Few runs, so look through them all for the next record */
+	while (!error) {
+		for (i = 0, min = rh->spill_count; i < rh->spill_count; i++)
+			if (recs[i] && ((min == rh->spill_count) ||
+					(_record_compare(rh, recs[i], recs[min]) < 0)))
+				min = i;
+
+		if (min == rh->spill_count)
+			break;
+
+		if (!_record_print(rh, recs[min]))
+			error = 1;
+		else
+			recs[min] = _reader_next(&rds[min], &error);
+	}
+
+	for (i = 0; i < rh->spill_count; i++)
+		dm_free(rds[i].buf);
+	dm_free(rds);
+	dm_free(recs);
+
+	rh->spill_count = 0;
+	if (fclose(rh->spill))
+		log_sys_error("fclose", "report spill file");
+	rh->spill = NULL;
+
+	return error ? 0 : 1;
+}
+
+static int _stream_object(struct dm_report *rh, void *object)
+{
+	struct dm_report_field *field;
+	unsigned first = 1;
+	void *data, *mark;
+	size_t i, count = dm_list_size(&rh->field_props);
+	int r = 0;
+
+	/* Everything the report functions allocate goes with the row */
+	if (!(mark = dm_pool_alloc(rh->mem, 1))) {
+		log_error("dm_report_object: row allocation failed");
+		return 0;
+	}
+
+	rh->line_len = 0;
+
+	for (i = 0; i < count; i++) {
+		field = &rh->stream_fields[i];
+		field->report_string = NULL;
+		field->sort_value = NULL;
+
+		if (!(data = _report_get_field_data(rh, field->props, object)))
+			goto_out;
+
+		if (!rh->fields[field->props->field_num].report_fn(rh, rh->mem,
+								   field, data,
+								   rh->private)) {
+			log_error("dm_report_object: "
+				  "report function failed for field %s",
+				  rh->fields[field->props->field_num].id);
+			goto out;
+		}
+
+		if (field->props->flags & FLD_HIDDEN)
+			continue;
+
+		if (!_line_add_field(rh, first, rh->fields[field->props->field_num].id,
+				     field->report_string))
+			goto_out;
+		first = 0;
+	}
+
+	if (!_line_end(rh))
+		goto_out;
+
+	if (rh->flags & RH_SORT_REQUIRED) {
+		if (!_run_add_record(rh))
+			goto_out;
+		if ((rh->run_len >= RH_RUN_SIZE) && !_flush_run(rh, 1))
+			goto_out;
+	} else if (!_stream_headings(rh) || !_write_output(rh, rh->line, rh->line_len))
+		goto_out;
+
+	r = 1;
+out:
+	dm_pool_free(rh->mem, mark);
+
+	return r;
+}
+
+static int _stream_output(struct dm_report *rh)
+{
+	if (!rh->run_len && !rh->spill_count)
+		return 1;
+
+	if (!_stream_headings(rh))
+		return_0;
+
+	if (!rh->spill_count)
+		return _flush_run(rh, 0);
+
+	if (!_flush_run(rh, 1))
+		return_0;
+
+	return _merge_spill(rh);
+}
+
 int dm_report_object(struct dm_report *rh, void *object)
 {
 	struct field_properties *fp;
@@ -700,6 +1290,9 @@ int dm_report_object(struct dm_report *rh, void *object)
 		return 0;
 	}
 
+	if (rh->flags & RH_STREAM)
+		return _stream_object(rh, object);
+
 	if (!(row = dm_pool_zalloc(rh->mem, sizeof(*row)))) {
 		log_error("dm_report_object: struct row allocation failed");
 		return 0;
@@ -1119,6 +1712,9 @@ static int _output_as_columns(struct dm_report *rh)
 
 int dm_report_output(struct dm_report *rh)
 {
+	if (rh->flags & RH_STREAM)
+		return _stream_output(rh);
+
 	if (dm_list_empty(&rh->rows))
 		return 1;
 
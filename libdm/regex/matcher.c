@@ -18,15 +18,31 @@
 #include "ttree.h"
 #include "assert.h"
 
+/*
+ * The DFA is a flat transition table indexed by state number and input
+ * class, where characters that appear in exactly the same charsets share a
+ * class.  States are numbered from 1; row 0 is unused.  A transition holds
+ * the offset of the next state's row, so matching needs no multiply.
+ * States and their transitions are calculated on demand.
+ */
+#define DFA_UNKNOWN	0	/* transition not calculated yet */
+#define DFA_DEAD	-1	/* no transition: nothing can match any more */
+#define DFA_START	1
+
 struct dfa_state {
-	struct dfa_state *next;
-	int final;
+	int final;		/* -1 until calculated */
 	dm_bitset_t bits;
-	struct dfa_state *lookup[256];
 };
 
 struct dm_regex {		/* Instance variables for the lexer */
-	struct dfa_state *start;
+	unsigned num_states;
+	unsigned max_states;
+	int32_t *trans;
+	struct dfa_state *states;
+	unsigned num_classes;
+	unsigned row_shift;	/* rows are padded to a power of 2 */
+	uint8_t classes[256];
+
 	unsigned num_nodes;
         unsigned num_charsets;
 	int nodes_entered;
@@ -35,12 +51,17 @@ struct dm_regex {		/* Instance variables for the lexer */
         struct rx_node **charsets;
 	struct dm_pool *scratch, *mem;
 
+	/* The joined patterns, identifying a saved dfa */
+	const char *pattern;
+	size_t pattern_len;
+	unsigned num_patterns;
+
         /* stuff for on the fly dfa calculation */
         dm_bitset_t charmap[256];
         dm_bitset_t dfa_copy;
         struct ttree *tt;
         dm_bitset_t bs;
-        struct dfa_state *h, *t;
+        unsigned forced;	/* states below this have all transitions */
 };
 
 static int _count_nodes(struct rx_node *rx)
@@ -203,30 +224,63 @@ static void _calc_functions(struct dm_regex *m)
 	}
 }
 
-static struct dfa_state *_create_dfa_state(struct dm_pool *mem)
+static int _grow_states(struct dm_regex *m)
 {
-	return dm_pool_zalloc(mem, sizeof(struct dfa_state));
+	unsigned max = m->max_states ? m->max_states * 2 : 64;
+	int32_t *trans;
+	struct dfa_state *states;
+
+	/* The old tables stay in the pool: at most as much again */
+	if (!(trans = dm_pool_alloc(m->mem, sizeof(*trans) * (max << m->row_shift))) ||
+	    !(states = dm_pool_alloc(m->mem, sizeof(*states) * max)))
+		return_0;
+
+	if (m->max_states) {
+		memcpy(trans, m->trans, sizeof(*trans) * (m->num_states << m->row_shift));
+		memcpy(states, m->states, sizeof(*states) * m->num_states);
+	}
+
+	m->trans = trans;
+	m->states = states;
+	m->max_states = max;
+
+	return 1;
 }
 
-static struct dfa_state *_create_state_queue(struct dm_pool *mem,
-                                             struct dfa_state *dfa,
-                                             dm_bitset_t bits)
+/*
+ * Add a state for the given set of positions, returning its number.
+ */
+static unsigned _add_state(struct dm_regex *m, dm_bitset_t bits)
 {
-	if (!(dfa->bits = dm_bitset_create(mem, bits[0])))  /* first element is the size */
-		return_NULL;
+	unsigned s = m->num_states;
+	struct dfa_state *dfa;
+
+	if (s == m->max_states && !_grow_states(m))
+		return_0;
+
+	dfa = m->states + s;
+	if (!(dfa->bits = dm_bitset_create(m->scratch, bits[0])))  /* first element is the size */
+		return_0;
 
 	dm_bit_copy(dfa->bits, bits);
-	dfa->next = 0;
 	dfa->final = -1;
+	memset(m->trans + (s << m->row_shift), 0, sizeof(*m->trans) << m->row_shift);
+
+	if (!ttree_insert(m->tt, dfa->bits + 1, (void *) (uintptr_t) s))
+		return_0;
+
+	m->num_states++;
 
-	return dfa;
+	return s;
 }
 
-static int _calc_state(struct dm_regex *m, struct dfa_state *dfa, int a)
+static int _calc_state(struct dm_regex *m, unsigned s, int a)
 {
         int set_bits = 0, i;
-        dm_bitset_t dfa_bits = dfa->bits;
-        dm_bit_and(m->dfa_copy, m->charmap[a], dfa_bits);
+        uintptr_t ns;
+        struct dfa_state *dfa = m->states + s;
+
+        dm_bit_and(m->dfa_copy, m->charmap[a], dfa->bits);
 
         /* iterate through all the states in firstpos */
         for (i = dm_bit_get_first(m->dfa_copy); i >= 0; i = dm_bit_get_next(m->dfa_copy, i)) {
@@ -237,36 +291,54 @@ static int _calc_state(struct dm_regex *m, struct dfa_state *dfa, int a)
                 set_bits = 1;
         }
 
-        if (set_bits) {
-                struct dfa_state *tmp;
-                struct dfa_state *ldfa = ttree_lookup(m->tt, m->bs + 1);
-                if (!ldfa) {
-                        /* push */
-			if (!(ldfa = _create_dfa_state(m->mem)))
-				return_0;
-
-			ttree_insert(m->tt, m->bs + 1, ldfa);
-			if (!(tmp = _create_state_queue(m->scratch, ldfa, m->bs)))
-				return_0;
-                        if (!m->h)
-                                m->h = m->t = tmp;
-                        else {
-                                m->t->next = tmp;
-                                m->t = tmp;
-                        }
-                }
+        /* Not final, and no need to look again */
+        if (a == TARGET_TRANS && dfa->final < 0)
+                dfa->final = 0;
 
-                dfa->lookup[a] = ldfa;
-                dm_bit_clear_all(m->bs);
+        if (!set_bits) {
+                m->trans[(s << m->row_shift) + m->classes[a]] = DFA_DEAD;
+                return 1;
         }
 
+        if (!(ns = (uintptr_t) ttree_lookup(m->tt, m->bs + 1)) &&
+            !(ns = _add_state(m, m->bs)))
+                return_0;
+
+        m->trans[(s << m->row_shift) + m->classes[a]] = (int32_t) (ns << m->row_shift);
+        dm_bit_clear_all(m->bs);
+
 	return 1;
 }
 
+/*
+ * Characters in exactly the same charsets always lead to the same state.
+ */
+static void _calc_classes(struct dm_regex *m)
+{
+	size_t len = (m->num_charsets / DM_BITS_PER_INT + 1) * sizeof(int);
+	int first[256];
+	unsigned c;
+	int a;
+
+	m->num_classes = 0;
+	for (a = 0; a < 256; a++) {
+		for (c = 0; c < m->num_classes; c++)
+			if (!memcmp(m->charmap[a] + 1, m->charmap[first[c]] + 1, len))
+				break;
+
+		if (c == m->num_classes)
+			first[m->num_classes++] = a;
+
+		m->classes[a] = (uint8_t) c;
+	}
+
+	for (m->row_shift = 0; (1U << m->row_shift) < m->num_classes; m->row_shift++)
+		;
+}
+
 static int _calc_states(struct dm_regex *m, struct rx_node *rx)
 {
 	unsigned iwidth = (m->num_charsets / DM_BITS_PER_INT) + 1;
-	struct dfa_state *dfa;
 	struct rx_node *n;
 	unsigned i;
 	int a;
@@ -291,15 +363,12 @@ static int _calc_states(struct dm_regex *m, struct rx_node *rx)
                 }
         }
 
-	/* create first state */
-	if (!(dfa = _create_dfa_state(m->mem)))
-		return_0;
-
-	m->start = dfa;
-	ttree_insert(m->tt, rx->firstpos + 1, dfa);
+	_calc_classes(m);
 
-	/* prime the queue */
-	if (!(m->h = m->t = _create_state_queue(m->scratch, dfa, rx->firstpos)))
+	/* create first state, after the unused row 0 */
+	m->num_states = DFA_START;
+	m->forced = DFA_START;
+	if (!_grow_states(m) || _add_state(m, rx->firstpos) != DFA_START)
 		return_0;
 
 	if (!(m->dfa_copy = dm_bitset_create(m->scratch, m->num_charsets)))
@@ -311,48 +380,45 @@ static int _calc_states(struct dm_regex *m, struct rx_node *rx)
 /*
  * Forces all the dfa states to be calculated up front, ie. what
  * _calc_states() used to do before we switched to calculating on demand.
+ * Gives up early, still returning 1, once there are more than max_states.
  */
-static int _force_states(struct dm_regex *m)
+static int _force_states(struct dm_regex *m, unsigned max_states)
 {
         int a;
 
-        /* keep processing until there's nothing in the queue */
-        struct dfa_state *s;
-        while ((s = m->h)) {
-                /* pop state off front of the queue */
-                m->h = m->h->next;
-
+        /* keep processing until there are no new states */
+        for (; m->forced < m->num_states && m->num_states <= max_states; m->forced++) {
                 /* iterate through all the inputs for this state */
                 dm_bit_clear_all(m->bs);
                 for (a = 0; a < 256; a++)
-			if (!_calc_state(m, s, a))
+			if (m->trans[(m->forced << m->row_shift) + m->classes[a]] == DFA_UNKNOWN &&
+			    !_calc_state(m, m->forced, a))
 				return_0;
+
+		/* the target trans may have been reached through its class */
+		if (m->states[m->forced].final < 0 &&
+		    !_calc_state(m, m->forced, TARGET_TRANS))
+			return_0;
         }
 
         return 1;
 }
 
-struct dm_regex *dm_regex_create(struct dm_pool *mem, const char * const *patterns,
-				 unsigned num_patterns)
+/*
+ * Join the regexps together, delimiting with zero.
+ */
+static char *_join_patterns(struct dm_pool *mem, const char * const *patterns,
+			    unsigned num_patterns, size_t *size)
 {
 	char *all, *ptr;
 	unsigned i;
 	size_t len = 0;
-	struct rx_node *rx;
-	struct dm_regex *m;
-	struct dm_pool *scratch = mem;
-
-	if (!(m = dm_pool_zalloc(mem, sizeof(*m))))
-		return_NULL;
 
-	/* join the regexps together, delimiting with zero */
 	for (i = 0; i < num_patterns; i++)
 		len += strlen(patterns[i]) + 8;
 
-	ptr = all = dm_pool_alloc(scratch, len + 1);
-
-	if (!all)
-		goto_bad;
+	if (!(ptr = all = dm_pool_alloc(mem, len + 1)))
+		return_NULL;
 
 	for (i = 0; i < num_patterns; i++) {
 		ptr += sprintf(ptr, "(.*(%s)%c)", patterns[i], TARGET_TRANS);
@@ -360,14 +426,37 @@ struct dm_regex *dm_regex_create(struct dm_pool *mem, const char * const *patter
 			*ptr++ = '|';
 	}
 
+	*size = ptr - all;
+
+	return all;
+}
+
+struct dm_regex *dm_regex_create(struct dm_pool *mem, const char * const *patterns,
+				 unsigned num_patterns)
+{
+	char *all;
+	size_t len;
+	struct rx_node *rx;
+	struct dm_regex *m;
+	struct dm_pool *scratch = mem;
+
+	if (!(m = dm_pool_zalloc(mem, sizeof(*m))))
+		return_NULL;
+
+	if (!(all = _join_patterns(scratch, patterns, num_patterns, &len)))
+		goto_bad;
+
 	/* parse this expression */
-	if (!(rx = rx_parse_tok(scratch, all, ptr))) {
+	if (!(rx = rx_parse_tok(scratch, all, all + len))) {
 		log_error("Couldn't parse regex");
 		goto bad;
 	}
 
 	m->mem = mem;
 	m->scratch = scratch;
+	m->pattern = all;
+	m->pattern_len = len;
+	m->num_patterns = num_patterns;
 	m->num_nodes = _count_nodes(rx);
 	m->num_charsets = _count_charsets(rx);
 	_enumerate_charsets(rx);
@@ -395,49 +484,268 @@ struct dm_regex *dm_regex_create(struct dm_pool *mem, const char * const *patter
 	return NULL;
 }
 
-static struct dfa_state *_step_matcher(struct dm_regex *m, int c, struct dfa_state *cs, int *r)
+static unsigned _step_matcher(struct dm_regex *m, int c, unsigned cs, int *r)
 {
-        struct dfa_state *ns;
+	int32_t ns = m->trans[(cs << m->row_shift) + m->classes[(unsigned char) c]];
+	struct dfa_state *dfa;
 
-	if (!(ns = cs->lookup[(unsigned char) c])) {
+	if (ns == DFA_UNKNOWN) {
 		if (!_calc_state(m, cs, (unsigned char) c))
-                        return_NULL;
+			return_0;
 
-		if (!(ns = cs->lookup[(unsigned char) c]))
-			return NULL;
+		/* the table may have moved */
+		ns = m->trans[(cs << m->row_shift) + m->classes[(unsigned char) c]];
 	}
 
+	if (ns == DFA_DEAD)
+		return 0;
+
+	ns >>= m->row_shift;
+
         // yuck, we have to special case the target trans
-	if ((ns->final == -1) &&
+	dfa = m->states + ns;
+	if ((dfa->final == -1) &&
 	    !_calc_state(m, ns, TARGET_TRANS))
-                return_NULL;
+                return_0;
 
-	if (ns->final && (ns->final > *r))
-		*r = ns->final;
+	dfa = m->states + ns;
+	if (dfa->final > *r)
+		*r = dfa->final;
 
-	return ns;
+	return (unsigned) ns;
 }
 
 int dm_regex_match(struct dm_regex *regex, const char *s)
 {
-	struct dfa_state *cs = regex->start;
-	int r = 0;
+	const uint8_t *classes = regex->classes;
+	unsigned shift = regex->row_shift;
+	const struct dfa_state *states;
+	const int32_t *trans;
+	unsigned cs = DFA_START;	/* then the offset of its row */
+	int32_t ns;
+	int r = 0, final, slow_r;
+
+	/* A dfa loaded by dm_regex_import() has nothing left to calculate */
+	if (regex->bs)
+		dm_bit_clear_all(regex->bs);
 
-        dm_bit_clear_all(regex->bs);
 	if (!(cs = _step_matcher(regex, HAT_CHAR, cs, &r)))
 		goto out;
 
-	for (; *s; s++)
-		if (!(cs = _step_matcher(regex, *s, cs, &r)))
+	cs <<= shift;
+	trans = regex->trans;
+	states = regex->states;
+
+	for (; *s; s++) {
+		/* Fast path: transition and final value already known */
+		if ((ns = trans[cs + classes[(unsigned char) *s]]) > 0 &&
+		    (final = states[ns >> shift].final) >= 0) {
+			if (final > r)
+				r = final;
+			cs = (unsigned) ns;
+			continue;
+		}
+
+		slow_r = r;
+		cs = _step_matcher(regex, *s, cs >> shift, &slow_r) << shift;
+		r = slow_r;
+		if (!cs)
 			goto out;
 
-	_step_matcher(regex, DOLLAR_CHAR, cs, &r);
+		/* the tables may have moved */
+		trans = regex->trans;
+		states = regex->states;
+	}
+
+	_step_matcher(regex, DOLLAR_CHAR, cs >> shift, &r);
 
       out:
 	/* subtract 1 to get back to zero index */
 	return r - 1;
 }
 
+/*
+ * Saved dfa, in native byte order: a header, the joined patterns, the
+ * class of each character, the final value of each state, then the
+ * transition rows.  Row 0 is never
+ * saved.  Every state is calculated first, so the parse tree is not
+ * needed to load it again.
+ */
+#define DFA_MAGIC	0x44465842	/* "DFXB" */
+#define DFA_MAX_SAVED	4096		/* at most 4MB of transitions */
+
+struct dfa_header {
+	uint32_t magic;
+	uint32_t pattern_len;
+	uint32_t num_patterns;
+	uint32_t num_classes;
+	uint32_t row_shift;
+	uint32_t num_states;
+	uint32_t checksum;	/* of everything after the header */
+};
+
+/* FNV-1a, a word at a time */
+static uint32_t _checksum(const void *data, size_t size)
+{
+	const unsigned char *p = data;
+	uint32_t sum = 2166136261U, w;
+
+	for (; size >= sizeof(w); size -= sizeof(w), p += sizeof(w)) {
+		memcpy(&w, p, sizeof(w));
+		sum = (sum ^ w) * 16777619U;
+	}
+
+	while (size--)
+		sum = (sum ^ *p++) * 16777619U;
+
+	return sum;
+}
+
+static size_t _export_size(size_t pattern_len, unsigned row_shift,
+			   unsigned num_states)
+{
+	return sizeof(struct dfa_header) + pattern_len + 256 +
+		(num_states - DFA_START) * sizeof(int32_t) * (1 + (1U << row_shift));
+}
+
+size_t dm_regex_export(struct dm_regex *regex, struct dm_pool *mem, void **data)
+{
+	struct dfa_header hdr = {
+		.magic = DFA_MAGIC,
+		.pattern_len = regex->pattern_len,
+		.num_patterns = regex->num_patterns,
+		.num_classes = regex->num_classes,
+		.row_shift = regex->row_shift,
+	};
+	size_t size;
+	int32_t final;
+	char *ptr;
+	unsigned s;
+
+	if (!regex->nodes) {
+		log_error(INTERNAL_ERROR "Regex loaded from saved data cannot be saved again.");
+		return 0;
+	}
+
+	if (!_force_states(regex, DFA_MAX_SAVED))
+		return_0;
+
+	if (regex->num_states > DFA_MAX_SAVED) {
+		log_debug("Not saving regex with more than %u states.", DFA_MAX_SAVED);
+		return 0;
+	}
+
+	hdr.num_states = regex->num_states;
+	size = _export_size(regex->pattern_len, regex->row_shift, regex->num_states);
+	if (!(ptr = *data = dm_pool_alloc(mem, size)))
+		return_0;
+
+	memcpy(ptr, &hdr, sizeof(hdr));
+	ptr += sizeof(hdr);
+	memcpy(ptr, regex->pattern, regex->pattern_len);
+	ptr += regex->pattern_len;
+	memcpy(ptr, regex->classes, 256);
+	ptr += 256;
+
+	for (s = DFA_START; s < regex->num_states; s++) {
+		final = regex->states[s].final;
+		memcpy(ptr, &final, sizeof(final));
+		ptr += sizeof(final);
+	}
+
+	memcpy(ptr, regex->trans + (DFA_START << regex->row_shift),
+	       sizeof(int32_t) * ((regex->num_states - DFA_START) << regex->row_shift));
+
+	hdr.checksum = _checksum((char *) *data + sizeof(hdr), size - sizeof(hdr));
+	memcpy(*data, &hdr, sizeof(hdr));
+
+	return size;
+}
+
+struct dm_regex *dm_regex_import(struct dm_pool *mem, const char * const *patterns,
+				 unsigned num_patterns, const void *data, size_t size)
+{
+	struct dfa_header hdr;
+	const char *ptr = data;
+	struct dm_regex *m;
+	char *all;
+	size_t len, i;
+	unsigned s;
+	int32_t t;
+
+	if (size < sizeof(hdr))
+		return NULL;
+
+	memcpy(&hdr, ptr, sizeof(hdr));
+	ptr += sizeof(hdr);
+
+	if (hdr.magic != DFA_MAGIC ||
+	    hdr.num_patterns != num_patterns ||
+	    !hdr.num_classes || hdr.num_classes > 256 || hdr.row_shift > 8 ||
+	    (1U << hdr.row_shift) < hdr.num_classes ||
+	    hdr.num_states <= DFA_START || hdr.num_states > DFA_MAX_SAVED ||
+	    size < _export_size(0, hdr.row_shift, hdr.num_states) ||
+	    size - _export_size(0, hdr.row_shift, hdr.num_states) != hdr.pattern_len ||
+	    hdr.checksum != _checksum(ptr, size - sizeof(hdr)))
+		return NULL;
+
+	if (!(m = dm_pool_zalloc(mem, sizeof(*m))))
+		return_NULL;
+
+	if (!(all = _join_patterns(mem, patterns, num_patterns, &len)))
+		goto_bad;
+
+	if (len != hdr.pattern_len || memcmp(ptr, all, len))
+		goto bad;
+
+	ptr += len;
+
+	m->mem = mem;
+	m->pattern = all;
+	m->pattern_len = len;
+	m->num_patterns = num_patterns;
+	m->num_classes = hdr.num_classes;
+	m->row_shift = hdr.row_shift;
+	m->max_states = m->num_states = m->forced = hdr.num_states;
+
+	memcpy(m->classes, ptr, 256);
+	ptr += 256;
+	for (i = 0; i < 256; i++)
+		if (m->classes[i] >= m->num_classes)
+			goto bad;
+
+	if (!(m->states = dm_pool_zalloc(mem, sizeof(*m->states) * hdr.num_states)) ||
+	    !(m->trans = dm_pool_alloc(mem, sizeof(*m->trans) * (hdr.num_states << m->row_shift))))
+		goto_bad;
+
+	for (s = DFA_START; s < hdr.num_states; s++) {
+		memcpy(&m->states[s].final, ptr, sizeof(int32_t));
+		ptr += sizeof(int32_t);
+		if (m->states[s].final < 0 || m->states[s].final > (int) num_patterns)
+			goto bad;
+	}
+
+	memcpy(m->trans + (DFA_START << m->row_shift), ptr,
+	       sizeof(int32_t) * ((hdr.num_states - DFA_START) << m->row_shift));
+
+	/* Every transition must be known, as nothing is left to calculate it */
+	for (s = DFA_START; s < hdr.num_states; s++)
+		for (i = 0; i < m->num_classes; i++) {
+			t = m->trans[(s << m->row_shift) + i];
+			if (t != DFA_DEAD &&
+			    (t <= 0 || (t & ((1 << m->row_shift) - 1)) ||
+			     (t >> m->row_shift) >= (int32_t) hdr.num_states))
+				goto bad;
+		}
+
+	return m;
+
+      bad:
+	dm_pool_free(mem, m);
+
+	return NULL;
+}
+
 /*
  * The next block of code concerns calculating a fingerprint for the dfa.
  *
@@ -452,7 +760,7 @@ int dm_regex_match(struct dm_regex *regex, const char *s)
  */
 struct node_list {
         unsigned node_id;
-        struct dfa_state *node;
+        unsigned node;
         struct node_list *next;
 };
 
@@ -470,7 +778,7 @@ static uint32_t _randomise(uint32_t n)
         return n * prime;
 }
 
-static int _seen(struct node_list *n, struct dfa_state *node, uint32_t *i)
+static int _seen(struct node_list *n, unsigned node, uint32_t *i)
 {
         while (n) {
                 if (n->node == node) {
@@ -486,7 +794,7 @@ static int _seen(struct node_list *n, struct dfa_state *node, uint32_t *i)
 /*
  * Push node if it's not been seen before, returning a unique index.
  */
-static uint32_t _push_node(struct printer *p, struct dfa_state *node)
+static uint32_t _push_node(struct printer *p, unsigned node)
 {
         uint32_t i;
 	struct node_list *n;
@@ -508,10 +816,11 @@ static uint32_t _push_node(struct printer *p, struct dfa_state *node)
 
 /*
  * Pop the front node, and fill out it's previously assigned index.
+ * Node 0 stands for a dead transition.
  */
-static struct dfa_state *_pop_node(struct printer *p)
+static unsigned _pop_node(struct printer *p)
 {
-        struct dfa_state *node = NULL;
+        unsigned node = 0;
 	struct node_list *n;
 
 	if (p->pending) {
@@ -531,17 +840,20 @@ static uint32_t _combine(uint32_t n1, uint32_t n2)
         return ((n1 << 8) | (n1 >> 24)) ^ _randomise(n2);
 }
 
-static uint32_t _fingerprint(struct printer *p)
+static uint32_t _fingerprint(struct dm_regex *m, struct printer *p)
 {
         int c;
         uint32_t result = 0;
-        struct dfa_state *node;
+        unsigned node;
+        int32_t ns;
 
         while ((node = _pop_node(p))) {
-                result = _combine(result, (node->final < 0) ? 0 : node->final);
-                for (c = 0; c < 256; c++)
+                result = _combine(result, (m->states[node].final < 0) ? 0 : m->states[node].final);
+                for (c = 0; c < 256; c++) {
+                        ns = m->trans[(node << m->row_shift) + m->classes[c]];
                         result = _combine(result,
-                                          _push_node(p, node->lookup[c]));
+                                          _push_node(p, (ns < 0) ? 0 : (unsigned) ns >> m->row_shift));
+                }
         }
 
         return result;
@@ -556,7 +868,7 @@ uint32_t dm_regex_fingerprint(struct dm_regex *regex)
 	if (!mem)
 		return_0;
 
-	if (!_force_states(regex))
+	if (!_force_states(regex, UINT_MAX))
 		goto_out;
 
         p.mem = mem;
@@ -564,10 +876,10 @@ uint32_t dm_regex_fingerprint(struct dm_regex *regex)
         p.processed = NULL;
         p.next_index = 0;
 
-	if (!_push_node(&p, regex->start))
+	if (!_push_node(&p, DFA_START))
 		goto_out;
 
-	result = _fingerprint(&p);
+	result = _fingerprint(regex, &p);
 out:
         dm_pool_destroy(mem);
 
@@ -49,15 +49,26 @@ static struct node **_lookup_single(struct node **c, unsigned int k)
 
 void *ttree_lookup(struct ttree *tt, unsigned *key)
 {
-	struct node **c = &tt->root;
+	struct node *c = tt->root;
 	int count = tt->klen;
+	unsigned k = *key++;
 
-	while (*c && count) {
-		c = _lookup_single(c, *key++);
-		count--;
+	/* The data is held by the node matching the last word of the key */
+	while (c) {
+		if (k < c->k)
+			c = c->l;
+
+		else if (k > c->k)
+			c = c->r;
+
+		else if (--count) {
+			c = c->m;
+			k = *key++;
+		} else
+			return c->data;
 	}
 
-	return *c ? (*c)->data : NULL;
+	return NULL;
 }
 
 static struct node *_tree_node(struct dm_pool *mem, unsigned int k)
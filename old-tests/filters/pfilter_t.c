@@ -69,12 +69,12 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	if (!(rfilter = regex_filter_create(cn->v))) {
+	if (!(rfilter = regex_filter_create(cn->v, NULL))) {
 		fprintf(stderr, "couldn't build filter\n");
 		exit(1);
 	}
 
-	if (!(pfilter = persistent_filter_create(rfilter, "./pfilter.cfg"))) {
+	if (!(pfilter = persistent_filter_create(rfilter, "./pfilter.cfg", "/proc", "/sys", 0))) {
 		fprintf(stderr, "couldn't build filter\n");
 		exit(1);
 	}
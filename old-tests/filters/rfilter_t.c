@@ -67,7 +67,7 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	if (!(filter = regex_filter_create(cn->v))) {
+	if (!(filter = regex_filter_create(cn->v, NULL))) {
 		fprintf(stderr, "couldn't build filter\n");
 		exit(1);
 	}
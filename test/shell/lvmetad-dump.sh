@@ -36,3 +36,10 @@ lvmetad_dump() {
 lvmetad_dump ./lvmetad.socket | tee lvmetad.txt
 
 grep $vg1 lvmetad.txt
+
+# lookups and updates are counted per lock
+vgs $vg1
+lvmetad_dump ./lvmetad.socket | tee lvmetad.txt
+grep "LOCK CONTENTION" lvmetad.txt
+grep -A4 "vgid_to_metadata {" lvmetad.txt | grep "reads = [1-9]"
+grep -A4 "vgid_to_metadata {" lvmetad.txt | grep "writes = [1-9]"
@@ -0,0 +1,96 @@
+#!/bin/sh
+# Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+. lib/test
+
+test -e LOCAL_LVMETAD || skip
+aux prepare_devs 3
+pvcreate $dev1 $dev2
+
+lvmetad_dump() {
+    if type -p socat >& /dev/null; then
+	(echo 'request="dump"'; echo '##') | socat "unix-connect:$1" -
+    else
+	(echo 'request="dump"'; echo '##') | nc -U "$1"
+    fi
+}
+(echo | lvmetad_dump ./lvmetad.socket) || skip
+
+stop_lvmetad() {
+    local pid=$(cat LOCAL_LVMETAD)
+    kill $pid
+    while kill -0 $pid 2>/dev/null; do sleep .1; done
+    rm -f lvmetad.socket
+}
+
+start_lvmetad() {
+    aux prepare_lvmetad -c "$TESTDIR/lvmetad.snapshot"
+}
+
+# the devices are checked in the background once the snapshot is loaded
+wait_for_drop() {
+    for i in $(seq 1 50); do
+	lvmetad_dump ./lvmetad.socket > lvmetad.txt
+	grep $vg1 lvmetad.txt || return 0
+	sleep .2
+    done
+    return 1
+}
+
+stop_lvmetad
+start_lvmetad
+vgcreate $vg1 $dev1 $dev2
+
+# the state is written out on exit and read back in on start
+stop_lvmetad
+start_lvmetad
+test -s lvmetad.snapshot
+lvmetad_dump ./lvmetad.socket | tee lvmetad.txt
+grep $vg1 lvmetad.txt
+vgs $vg1
+
+# VG metadata changed while lvmetad was not running drops it again
+stop_lvmetad
+lvcreate --config 'global { use_lvmetad = 0 }' -l1 -n $lv1 $vg1
+start_lvmetad
+wait_for_drop
+check lv_exists $vg1 $lv1
+
+# and a PV created on a device the snapshot has none on
+stop_lvmetad
+vgcreate --config 'global { use_lvmetad = 0 }' $vg2 $dev3
+start_lvmetad
+wait_for_drop
+vgs $vg2
+
+# a damaged snapshot is thrown away and lvmetad starts empty: one cut
+# short, and one with every id key renamed, which keeps it well formed
+stop_lvmetad
+cp lvmetad.snapshot lvmetad.snapshot.good
+head -c $(( $(wc -c < lvmetad.snapshot) - 16 )) lvmetad.snapshot.good > lvmetad.snapshot
+start_lvmetad
+lvmetad_dump ./lvmetad.socket > lvmetad.txt
+not grep $vg1 lvmetad.txt
+vgs $vg1 $vg2
+
+stop_lvmetad
+sed 's/\x02id\x01/\x02xd\x01/g' lvmetad.snapshot.good > lvmetad.snapshot
+not cmp lvmetad.snapshot lvmetad.snapshot.good
+start_lvmetad
+lvmetad_dump ./lvmetad.socket > lvmetad.txt
+not grep $vg1 lvmetad.txt
+vgs $vg1 $vg2
+
+# a PV label that is gone invalidates the whole snapshot
+stop_lvmetad
+dd if=/dev/zero of="$dev2" bs=512 count=2
+start_lvmetad
+wait_for_drop
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+# Report the io buffer allocations and bytes copied by metadata updates
+# and check that buffers are reused rather than allocated for each PV.
+
+. lib/test
+
+io_buffers() {
+	"$@" -vvvv 2> debug.log
+	grep "Io buffers:" debug.log | sed -e 's/.*Io buffers: //'
+	sed -ne 's/.*Io buffers: \([0-9]*\) allocated.*/\1/p' debug.log > allocs
+}
+
+# At most 4 buffers allocated, and the command must have reported them
+check_allocs() {
+	test -s allocs
+	test "$(cat allocs)" -le 4
+}
+
+aux prepare_vg 8
+
+for i in 1 2 3; do
+	echo "vgchange --addtag on 8 PVs: $(io_buffers vgchange --addtag tag$i $vg)"
+	check_allocs
+done
+
+echo "vgchange --deltag on 8 PVs: $(io_buffers vgchange --deltag tag1 $vg)"
+check_allocs
+
+echo "pvchange on 1 PV: $(io_buffers pvchange --addtag pvtag "$dev1")"
+check_allocs
+
+check vg_field $vg vg_tags "tag2,tag3"
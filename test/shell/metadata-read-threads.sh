@@ -0,0 +1,58 @@
+#!/bin/sh
+# Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+# Check that reading VG metadata ahead with global/metadata_read_threads
+# gives the same results as reading it one VG at a time.
+
+. lib/test
+
+aux prepare_devs 6
+
+vgcreate -c n $vg1 "$dev1" "$dev2" "$dev3"
+vgcreate -c n $vg2 "$dev4" "$dev5"
+vgcreate -c n $vg3 "$dev6"
+
+lvcreate -l 6 -i 3 -n $lv1 $vg1
+lvcreate -l 2 -n $lv2 $vg1 "$dev2"
+lvcreate -l 4 -i 2 -n $lv1 $vg2
+lvcreate -l 1 -n $lv1 $vg3
+
+report() {
+	vgs -o vg_all > "vgs.$1"
+	lvs -a -o lv_all,seg_all > "lvs.$1"
+	vgdisplay -v > "vgdisplay.$1"
+}
+
+aux lvmconf 'global/metadata_read_threads = 0'
+report serial
+not grep "Using metadata read ahead" debug.log
+
+aux lvmconf 'global/metadata_read_threads = 4'
+report threads
+grep "Using metadata read ahead" debug.log
+
+for i in vgs lvs vgdisplay; do
+	diff "$i.serial" "$i.threads"
+done
+
+# Updates read the metadata ahead as well
+vgchange --addtag tag1
+for i in $vg1 $vg2 $vg3; do
+	check vg_field $i vg_tags tag1
+done
+
+aux lvmconf 'global/metadata_read_threads = 0'
+lvs -a -o lv_all,seg_all > lvs.serial
+aux lvmconf 'global/metadata_read_threads = 4'
+lvs -a -o lv_all,seg_all > lvs.threads
+diff lvs.serial lvs.threads
+
+vgremove -ff $vg1 $vg2 $vg3
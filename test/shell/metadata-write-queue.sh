@@ -0,0 +1,43 @@
+#!/bin/sh
+# Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+# Metadata written to all metadata areas at once must read back the
+# same as metadata written to each area in turn.
+
+. lib/test
+
+aux prepare_devs 8
+pvcreate --metadatacopies 2 "$dev1" "$dev2" "$dev3" "$dev4"
+pvcreate "$dev5" "$dev6" "$dev7" "$dev8"
+vgcreate -c n $vg $(cat DEVICES)
+
+for depth in 1 4 64; do
+	vgchange --config "metadata{write_queue_depth=$depth}" \
+		--addtag depth$depth $vg
+	lvcreate --config "metadata{write_queue_depth=$depth}" \
+		-l 1 -n lv$depth $vg
+done
+
+# Repeated updates move the metadata around the circular buffer
+vgchange --addtag tag0 $vg
+for i in $(seq 1 40); do
+	vgchange --config "metadata{write_queue_depth=8}" \
+		--addtag tag$i --deltag tag$(($i - 1)) $vg
+done
+
+check vg_field $vg vg_tags "depth1,depth4,depth64,tag40"
+check lv_exists $vg lv1 lv4 lv64
+
+# Nothing may reach the disk in test mode
+vgchange --config "metadata{write_queue_depth=8}" -t --addtag testmode $vg
+check vg_field $vg vg_tags "depth1,depth4,depth64,tag40"
+
+vgremove -ff $vg
@@ -17,6 +17,7 @@
 #include "lvm2cmdline.h"
 #include "label.h"
 #include "memlock.h"
+#include "dev-sysfs.h"
 
 #include "lvm2cmd.h"
 
@@ -38,6 +39,37 @@ void *cmdlib_lvm2_init(unsigned static_compile)
 	return (void *) cmd;
 }
 
+/*
+ * A handle kept between commands keeps its device cache and labels.
+ * Most uevents only report a change to an existing device, such as the
+ * suspend and resume from the last lvextend, so all devices are scanned
+ * again only when some appeared or went.  That is left to the command's
+ * first label scan, which runs with its configuration and locking set up.
+ * With lvmetad running, that keeps them up to date itself and the label
+ * scan just clears the request.
+ * Nothing else carries over: each command still reads the VG metadata
+ * again once it holds the VG lock, and commands still run one at a time.
+ */
+static void _check_devices(struct cmd_context *cmd)
+{
+	uint64_t seqnum, stamp = 0;
+	int have_stamp;
+
+	if (!dev_sysfs_uevent_seqnum(cmd->sysfs_dir, &seqnum) ||
+	    seqnum == cmd->uevent_seqnum)
+		return;
+
+	have_stamp = dev_sysfs_block_devices_stamp(cmd->sysfs_dir, &stamp);
+
+	if (cmd->uevent_seqnum && (!have_stamp || stamp != cmd->block_devices)) {
+		log_debug("Block devices changed: rescanning.");
+		cmd->rescan_devices = 1;
+	}
+
+	cmd->uevent_seqnum = seqnum;
+	cmd->block_devices = stamp;
+}
+
 int lvm2_run(void *handle, const char *cmdline)
 {
 	int argc, ret, oneoff = 0;
@@ -82,8 +114,11 @@ int lvm2_run(void *handle, const char *cmdline)
 		memlock_inc_daemon(cmd);
 	else if (!strcmp(cmdline, "_memlock_dec"))
 		memlock_dec_daemon(cmd);
-	else
+	else {
+		if (!oneoff)
+			_check_devices(cmd);
 		ret = lvm_run_command(cmd, argc, argv);
+	}
 
       out:
 	dm_free(cmdcopy);
@@ -16,6 +16,7 @@
 #include "tools.h"
 #include "lvm2cmdline.h"
 #include "label.h"
+#include "dev-bcache.h"
 #include "lvm-version.h"
 
 #include "stub.h"
@@ -1124,6 +1125,9 @@ int lvm_run_command(struct cmd_context *cmd, int argc, char **argv)
 	fin_locking();
 
       out:
+	dev_bcache_reset();
+	dev_io_release_buffers();
+
 	if (test_mode()) {
 		log_verbose("Test mode: Wiping internal cache");
 		lvmcache_destroy(cmd, 1);
@@ -205,6 +205,16 @@ static int _lvresize_params(struct cmd_context *cmd, int argc, char **argv,
 		lp->extents = 0;
 		lp->sign = SIGN_PLUS;
 		lp->percent = PERCENT_LV;
+
+		/* A relative size is the least to extend by */
+		if (arg_count(cmd, size_ARG)) {
+			if (arg_sign_value(cmd, size_ARG, SIGN_NONE) != SIGN_PLUS) {
+				log_error("Only a relative size may be given "
+					  "with --use-policies.");
+				return 0;
+			}
+			lp->size = arg_uint64_value(cmd, size_ARG, 0);
+		}
 	} else {
 		/*
 		 * Allow omission of extents and size if the user has given us
@@ -285,6 +295,11 @@ static int _adjust_policy_params(struct cmd_context *cmd,
 {
 	percent_t percent;
 	int policy_threshold, policy_amount;
+	uint64_t min_size = lp->size;
+	uint32_t min_extents;
+
+	/* Nothing is extended unless the policy says so */
+	lp->size = 0;
 
 	if (lv_is_thin_pool(lv)) {
 		policy_threshold =
@@ -331,6 +346,19 @@ static int _adjust_policy_params(struct cmd_context *cmd,
 
 	lp->extents = policy_amount;
 
+	if (min_size) {
+		lp->extents = percent_of_extents(policy_amount, lv->le_count, 1);
+		lp->percent = PERCENT_NONE;
+		min_extents = (uint32_t) ((min_size + lv->vg->extent_size - 1) /
+					  lv->vg->extent_size);
+		if (lp->extents < min_extents) {
+			log_verbose("Extending %s/%s by %s instead of %d%%.",
+				    lp->vg_name, lp->lv_name,
+				    display_size(cmd, min_size), policy_amount);
+			lp->extents = min_extents;
+		}
+	}
+
 	return 1;
 }
 
@@ -228,7 +228,7 @@ static int _report(struct cmd_context *cmd, int argc, char **argv,
 	void *report_handle;
 	const char *opts;
 	char *str;
-	const char *keys = NULL, *options = NULL, *separator;
+	const char *keys = NULL, *options = NULL, *separator, *output_format;
 	int r = ECMD_PROCESSED;
 	int aligned, buffered, headings, field_prefixes, quoted;
 	int columns_as_rows;
@@ -248,6 +248,8 @@ static int _report(struct cmd_context *cmd, int argc, char **argv,
 				     DEFAULT_REP_QUOTED);
 	columns_as_rows = find_config_tree_int(cmd, "report/columns_as_rows",
 					       DEFAULT_REP_COLUMNS_AS_ROWS);
+	output_format = find_config_tree_str(cmd, "report/output_format",
+					     DEFAULT_REP_OUTPUT_FORMAT);
 
 	args_are_pvs = (report_type == PVS ||
 			report_type == LABEL ||
@@ -361,11 +363,12 @@ static int _report(struct cmd_context *cmd, int argc, char **argv,
 		quoted = 0;
 	if (arg_count(cmd, rows_ARG))
 		columns_as_rows = 1;
+	output_format = arg_str_value(cmd, reportformat_ARG, output_format);
 
 	if (!(report_handle = report_init(cmd, options, keys, &report_type,
 					  separator, aligned, buffered,
 					  headings, field_prefixes, quoted,
-					  columns_as_rows))) {
+					  columns_as_rows, output_format))) {
 		if (!strcasecmp(options, "help") || !strcmp(options, "?"))
 			return r;
 		stack;
@@ -14,6 +14,7 @@
  */
 
 #include "tools.h"
+#include "format-text.h"
 #include <sys/stat.h>
 
 const char *command_name(struct cmd_context *cmd)
@@ -194,6 +195,24 @@ int process_each_lv_in_vg(struct cmd_context *cmd,
 	return ret_max;
 }
 
+/*
+ * Read the metadata of the VGs ahead of processing them one by one,
+ * if configured.  Only a hint: failures just leave it to vg_read.
+ */
+static void _prefetch_vgs(struct cmd_context *cmd, struct dm_list *vgnames)
+{
+	int threads = find_config_tree_int(cmd, "global/metadata_read_threads",
+					   DEFAULT_METADATA_READ_THREADS);
+
+	if (threads <= 0 || lvmetad_active() || dm_list_size(vgnames) < 2)
+		return;
+
+	lvmcache_label_scan(cmd, 0);
+
+	if (!text_prefetch_vgs(cmd, vgnames, (unsigned) threads))
+		stack;
+}
+
 int process_each_lv(struct cmd_context *cmd, int argc, char **argv,
 		    uint32_t flags, void *handle,
 		    process_single_lv_fn_t process_single_lv)
@@ -317,13 +336,16 @@ int process_each_lv(struct cmd_context *cmd, int argc, char **argv,
 		}
 	}
 
+	_prefetch_vgs(cmd, vgnames);
+
 	dm_list_iterate_items(strl, vgnames) {
 		vgname = strl->str;
 		dm_list_init(&cmd_vgs);
 		if (!(cvl_vg = cmd_vg_add(cmd->mem, &cmd_vgs,
 					  vgname, NULL, flags))) {
 			stack;
-			return ECMD_FAILED;
+			ret_max = ECMD_FAILED;
+			goto out;
 		}
 
 		if (!cmd_vg_read(cmd, &cmd_vgs)) {
@@ -354,7 +376,8 @@ int process_each_lv(struct cmd_context *cmd, int argc, char **argv,
 								 lv_name + 1))) {
 					log_error("strlist allocation failed");
 					free_cmd_vgs(&cmd_vgs);
-					return ECMD_FAILED;
+					ret_max = ECMD_FAILED;
+					goto out;
 				}
 			}
 		}
@@ -389,10 +412,14 @@ int process_each_lv(struct cmd_context *cmd, int argc, char **argv,
 		/* FIXME: logic for breaking command is not consistent */
 		if (sigint_caught()) {
 			stack;
-			return ECMD_FAILED;
+			ret_max = ECMD_FAILED;
+			goto out;
 		}
 	}
 
+out:
+	text_prefetch_destroy();
+
 	return ret_max;
 }
 
@@ -593,6 +620,8 @@ int process_each_vg(struct cmd_context *cmd, int argc, char **argv,
 			log_error("No volume groups found");
 			return ret_max;
 		}
+		if ((vgnames = get_vgnames(cmd, 0)))
+			_prefetch_vgs(cmd, vgnames);
 		dm_list_iterate_items(sl, vgids) {
 			vgid = sl->str;
 			if (!(vgid) || !(vg_name = lvmcache_vgname_from_vgid(cmd->mem, vgid)))
@@ -602,9 +631,10 @@ int process_each_vg(struct cmd_context *cmd, int argc, char **argv,
 						  flags, handle,
 					  	  ret_max, process_single_vg);
 			if (sigint_caught())
-				return ret_max;
+				break;
 		}
 	} else {
+		_prefetch_vgs(cmd, vgnames);
 		dm_list_iterate_items(sl, vgnames) {
 			vg_name = sl->str;
 			if (is_orphan_vg(vg_name))
@@ -614,10 +644,12 @@ int process_each_vg(struct cmd_context *cmd, int argc, char **argv,
 						  flags, handle,
 					  	  ret_max, process_single_vg);
 			if (sigint_caught())
-				return ret_max;
+				break;
 		}
 	}
 
+	text_prefetch_destroy();
+
 	return ret_max;
 }
 
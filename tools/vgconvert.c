@@ -22,6 +22,7 @@ static int vgconvert_single(struct cmd_context *cmd, const char *vg_name,
 	struct physical_volume *pv, *existing_pv;
 	struct logical_volume *lv;
 	struct lv_list *lvl;
+	union lvid lvid;
 	int pvmetadatacopies = 0;
 	uint64_t pvmetadatasize = 0;
 	uint64_t pe_start = 0;
@@ -103,7 +104,11 @@ static int vgconvert_single(struct cmd_context *cmd, const char *vg_name,
 				active++;
 				continue;
 			}
-			lvid_from_lvnum(&lv->lvid, &lv->vg->id, find_free_lvnum(lv));
+			lvid_from_lvnum(&lvid, &lv->vg->id, find_free_lvnum(lv));
+			if (!lv_set_lvid(lv, &lvid)) {
+				stack;
+				return ECMD_FAILED;
+			}
 
 		}
 	}
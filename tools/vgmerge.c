@@ -96,16 +96,18 @@ static int _vgmerge_single(struct cmd_context *cmd, const char *vg_name_to,
 		char uuid[64] __attribute__((aligned(8)));
 
 		dm_list_iterate_items(lvl2, &vg_from->lvs) {
-			union lvid *lvid2 = &lvl2->lv->lvid;
+			union lvid lvid2 = lvl2->lv->lvid;
 
-			if (id_equal(&lvid1->id[1], &lvid2->id[1])) {
-				if (!id_create(&lvid2->id[1])) {
+			if (id_equal(&lvid1->id[1], &lvid2.id[1])) {
+				if (!id_create(&lvid2.id[1])) {
 					log_error("Failed to generate new "
 						  "random LVID for %s",
 						  lvl2->lv->name);
 					goto bad;
 				}
-				if (!id_write_format(&lvid2->id[1], uuid,
+				if (!lv_set_lvid(lvl2->lv, &lvid2))
+					goto_bad;
+				if (!id_write_format(&lvid2.id[1], uuid,
 						     sizeof(uuid)))
 					goto_bad;
 
@@ -115,14 +117,11 @@ static int _vgmerge_single(struct cmd_context *cmd, const char *vg_name_to,
 		}
 	}
 
-	dm_list_iterate_items(lvl1, &vg_from->lvs) {
-		lvl1->lv->vg = vg_to;
-	}
-
 	while (!dm_list_empty(&vg_from->lvs)) {
 		struct dm_list *lvh = vg_from->lvs.n;
 
-		dm_list_move(&vg_to->lvs, lvh);
+		if (!move_lv_to_vg(vg_to, dm_list_item(lvh, struct lv_list)))
+			goto_bad;
 	}
 
 	while (!dm_list_empty(&vg_from->fid->metadata_areas_in_use)) {
@@ -31,10 +31,11 @@ static int _move_one_lv(struct volume_group *vg_from,
 			 struct volume_group *vg_to,
 			 struct dm_list *lvh)
 {
-	struct logical_volume *lv = dm_list_item(lvh, struct lv_list)->lv;
+	struct lv_list *lvl = dm_list_item(lvh, struct lv_list);
+	struct logical_volume *lv = lvl->lv;
 
-	dm_list_move(&vg_to->lvs, lvh);
-	lv->vg = vg_to;
+	if (!move_lv_to_vg(vg_to, lvl))
+		return_0;
 
 	if (lv_is_active(lv)) {
 		log_error("Logical volume \"%s\" must be inactive", lv->name);
@@ -0,0 +1,299 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Check that the binary wire encoding round trips and that readers do not
+ * trust the length it advertises, and compare its cost with the text
+ * encoding for the metadata of a VG with 1000 LVs.
+ */
+
+#include "daemon-io.h"
+#include "config-util.h"
+#include "timing.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+enum {
+	NR_PVS = 16,
+	NR_LVS = 1000,
+	ROUNDS = 20
+};
+
+static void _append(struct buffer *buf, const char *fmt, ...)
+	__attribute__ ((format(printf, 2, 3)));
+
+static void _append(struct buffer *buf, const char *fmt, ...)
+{
+	char *line;
+	va_list ap;
+
+	va_start(ap, fmt);
+	assert(dm_vasprintf(&line, fmt, ap) >= 0);
+	va_end(ap);
+
+	assert(buffer_append(buf, line));
+	dm_free(line);
+}
+
+static struct dm_config_tree *_make_vg(void)
+{
+	struct dm_config_tree *cft;
+	struct buffer buf;
+	int i;
+
+	buffer_init(&buf);
+
+	_append(&buf, "response = \"OK\"\nname = \"vg0\"\nmetadata {\n"
+		"id = \"Ss1W3p-Yv2I-fZtS-PNkh-bw8T-J0Lu-DDz0Oq\"\n"
+		"seqno = 1000\nformat = \"lvm2\"\n"
+		"status = [\"RESIZEABLE\", \"READ\", \"WRITE\"]\nflags = []\n"
+		"extent_size = 8192\nmax_lv = 0\nmax_pv = 0\nmetadata_copies = 0\n"
+		"physical_volumes {\n");
+
+	for (i = 0; i < NR_PVS; i++)
+		_append(&buf, "pv%d {\nid = \"0Aeb6I-gHHg-zxBv-fXMw-TtxK-q8%04d-pv%04d\"\n"
+			"device = \"/dev/sd%c\"\nstatus = [\"ALLOCATABLE\"]\n"
+			"flags = []\ndev_size = 2147483648\npe_start = 2048\n"
+			"pe_count = 262143\n}\n", i, i, i, 'a' + i);
+
+	_append(&buf, "}\nlogical_volumes {\n");
+
+	for (i = 0; i < NR_LVS; i++)
+		_append(&buf, "lvol%d {\nid = \"gD2h4p-Dd0P-m3Mv-dTz1-3sEv-Xo%04d-lv%04d\"\n"
+			"status = [\"READ\", \"WRITE\", \"VISIBLE\"]\nflags = []\n"
+			"creation_host = \"host.example.com\"\n"
+			"creation_time = 1349347200\nsegment_count = 1\n"
+			"segment1 {\nstart_extent = 0\nextent_count = 256\n"
+			"type = \"striped\"\nstripe_count = 1\n"
+			"stripes = [\"pv%d\", %d]\n}\n}\n",
+			i, i, i, i % NR_PVS, (i / NR_PVS) * 256);
+
+	_append(&buf, "}\n}\n");
+
+	assert((cft = dm_config_from_string(buf.mem)));
+	buffer_destroy(&buf);
+
+	return cft;
+}
+
+static void _encode(const struct dm_config_tree *cft, int binary,
+		    struct buffer *buf)
+{
+	buffer_init(buf);
+
+	if (binary)
+		assert(config_write_binary(cft->root, buf));
+	else {
+		assert(dm_config_write_node(cft->root, buffer_line, buf));
+		assert(buffer_append(buf, "\n\n"));
+	}
+}
+
+static void _decode(struct buffer *buf)
+{
+	struct dm_config_tree *cft;
+
+	assert((cft = config_from_buffer(buf)));
+	dm_config_destroy(cft);
+}
+
+struct sender {
+	int fd;
+	struct buffer *buf;
+};
+
+static void *_send_all(void *arg)
+{
+	struct sender *s = arg;
+	char ack;
+	int i;
+
+	/* One message at a time, as clients wait for each reply */
+	for (i = 0; i < ROUNDS; i++) {
+		assert(buffer_write(s->fd, s->buf));
+		assert(read(s->fd, &ack, 1) == 1);
+	}
+
+	return NULL;
+}
+
+static double _transfer(struct buffer *buf)
+{
+	struct sender s = { .buf = buf };
+	struct buffer in;
+	pthread_t thread;
+	int fds[2], i;
+	double start;
+
+	assert(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+	s.fd = fds[0];
+
+	start = timing_now();
+	assert(!pthread_create(&thread, NULL, _send_all, &s));
+
+	for (i = 0; i < ROUNDS; i++) {
+		buffer_init(&in);
+		assert(buffer_read(fds[1], &in));
+		_decode(&in);
+		buffer_destroy(&in);
+		assert(write(fds[1], "", 1) == 1);
+	}
+
+	assert(!pthread_join(thread, NULL));
+	close(fds[0]);
+	close(fds[1]);
+
+	return timing_now() - start;
+}
+
+static void _bench(const struct dm_config_tree *cft, int binary)
+{
+	struct buffer buf;
+	double start, encode, decode, transfer;
+	int i, size;
+
+	start = timing_now();
+	for (i = 0; i < ROUNDS; i++) {
+		_encode(cft, binary, &buf);
+		buffer_destroy(&buf);
+	}
+	encode = timing_now() - start;
+
+	_encode(cft, binary, &buf);
+	size = buf.used;
+
+	start = timing_now();
+	for (i = 0; i < ROUNDS; i++)
+		_decode(&buf);
+	decode = timing_now() - start;
+
+	/* The receiving end decodes each message as a client would */
+	transfer = _transfer(&buf) - decode;
+	buffer_destroy(&buf);
+
+	printf("%-6s %8d bytes  encode %8.0f us  decode %8.0f us  transfer %8.0f us\n",
+	       binary ? "binary" : "text", size, encode * 1e6 / ROUNDS,
+	       decode * 1e6 / ROUNDS, transfer * 1e6 / ROUNDS);
+}
+
+static void _check_values(void)
+{
+	struct dm_config_tree *cft, *copy;
+	struct buffer text, binary, copy_text;
+
+	assert((cft = dm_config_from_string("neg = -9223372036854775807\n"
+					    "zero = 0\nf = 1.5\nempty = []\n"
+					    "mixed = [1, \"two\", \"\"]\n"
+					    "section {\n}\n")));
+
+	_encode(cft, 0, &text);
+	_encode(cft, 1, &binary);
+	assert((copy = config_read_binary(&binary)));
+	_encode(copy, 0, &copy_text);
+	assert(!strcmp(text.mem, copy_text.mem));
+
+	dm_config_destroy(cft);
+	dm_config_destroy(copy);
+	buffer_destroy(&text);
+	buffer_destroy(&binary);
+	buffer_destroy(&copy_text);
+}
+
+static void _check_round_trip(const struct dm_config_tree *cft)
+{
+	struct dm_config_tree *copy;
+	struct buffer text, binary, copy_text;
+
+	_encode(cft, 0, &text);
+	_encode(cft, 1, &binary);
+
+	assert(buffer_is_binary(&binary));
+	assert(!buffer_is_binary(&text));
+
+	assert((copy = config_read_binary(&binary)));
+	_encode(copy, 0, &copy_text);
+	assert(!strcmp(text.mem, copy_text.mem));
+	assert(!strcmp(dm_config_find_str(copy->root, "metadata/logical_volumes/lvol999/segment1/type", ""),
+		       "striped"));
+	dm_config_destroy(copy);
+
+	/* A truncated message must be rejected */
+	binary.used--;
+	assert(!config_read_binary(&binary));
+
+	buffer_destroy(&text);
+	buffer_destroy(&binary);
+	buffer_destroy(&copy_text);
+}
+
+/*
+ * Send a binary header advertising len bytes, and the first few of them.
+ */
+static int _send_header(uint32_t len, struct buffer *in, int *complete)
+{
+	unsigned char msg[64] = { 0, len, len >> 8, len >> 16, len >> 24 };
+	int fds[2], r;
+
+	assert(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+	assert(!fcntl(fds[1], F_SETFL, O_NONBLOCK));
+	assert(write(fds[0], msg, sizeof(msg)) == sizeof(msg));
+
+	buffer_init(in);
+	r = buffer_read_some(fds[1], in, complete);
+
+	close(fds[0]);
+	close(fds[1]);
+
+	return r;
+}
+
+static void _check_size_limit(void)
+{
+	struct buffer in;
+	int complete;
+
+	/* The buffer grows with what arrives, not with what is advertised */
+	assert(_send_header(DAEMON_MAX_MESSAGE / 2, &in, &complete));
+	assert(!complete && in.used == 64 && in.allocated < 4096);
+	buffer_destroy(&in);
+
+	/* Over the limit, the message is refused */
+	assert(!_send_header(INT32_MAX, &in, &complete));
+	assert(errno == EMSGSIZE && in.allocated < 4096);
+	buffer_destroy(&in);
+}
+
+int main(int argc, char **argv)
+{
+	struct dm_config_tree *cft = _make_vg();
+
+	_check_values();
+	_check_round_trip(cft);
+	_check_size_limit();
+
+	printf("VG with %d LVs, mean of %d rounds:\n", NR_LVS, ROUNDS);
+	_bench(cft, 0);
+	_bench(cft, 1);
+
+	dm_config_destroy(cft);
+
+	return 0;
+}
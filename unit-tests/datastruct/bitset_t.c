@@ -13,8 +13,10 @@
  */
 
 #include "libdevmapper.h"
+#include "timing.h"
 
 #include <assert.h>
+#include <stdio.h>
 
 enum {
         NR_BITS = 137
@@ -111,13 +113,98 @@ static void test_and(struct dm_pool *mem)
                 assert(!dm_bit(bs3, i));
 }
 
+static void test_get_next_clear(struct dm_pool *mem)
+{
+        int i, j, last;
+        dm_bitset_t bs = dm_bitset_create(mem, NR_BITS);
+
+        dm_bit_set_all(bs);
+        assert(dm_bit_get_next_clear(bs, -1) == -1);
+
+        for (i = 0, j = 1; i < NR_BITS; i += j, j++)
+                dm_bit_clear(bs, i);
+
+        last = -1;
+        for (i = 0, j = 1; i < NR_BITS; i += j, j++) {
+                last = dm_bit_get_next_clear(bs, last);
+                assert(last == i);
+        }
+
+        assert(dm_bit_get_next_clear(bs, last) == -1);
+}
+
+static void test_range(struct dm_pool *mem)
+{
+        int start, count, i;
+        dm_bitset_t bs = dm_bitset_create(mem, NR_BITS);
+
+        for (start = 0; start < NR_BITS; start += 7)
+                for (count = 0; start + count <= NR_BITS; count += 5) {
+                        dm_bit_clear_all(bs);
+                        dm_bit_set_range(bs, start, count);
+                        for (i = 0; i < NR_BITS; i++)
+                                assert(!dm_bit(bs, i) == (i < start || i >= start + count));
+                        assert(dm_bit_count(bs) == count);
+
+                        dm_bit_set_all(bs);
+                        dm_bit_clear_range(bs, start, count);
+                        for (i = 0; i < NR_BITS; i++)
+                                assert(!dm_bit(bs, i) == (i >= start && i < start + count));
+                        assert(dm_bit_count(bs) == NR_BITS - count);
+                }
+}
+
+/*
+ * Time a search for the one clear bit of a large bitset, as cmirrord
+ * does to find resync work, and counting the bits, against doing
+ * either a bit at a time.
+ */
+static void test_large(struct dm_pool *mem)
+{
+        const int nr_bits = 1 << 24;
+        dm_bitset_t bs = dm_bitset_create(mem, nr_bits);
+        double start, by_bit, by_word, count_bit, count_word;
+        int i;
+        unsigned count;
+
+        dm_bit_set_all(bs);
+        dm_bit_clear(bs, nr_bits - 3);
+
+        start = timing_now();
+        for (i = 0; dm_bit(bs, i); i++)
+                ;
+        by_bit = timing_now() - start;
+        assert(i == nr_bits - 3);
+
+        start = timing_now();
+        assert(dm_bit_get_next_clear(bs, -1) == nr_bits - 3);
+        by_word = timing_now() - start;
+
+        start = timing_now();
+        for (i = count = 0; i < nr_bits; i++)
+                if (dm_bit(bs, i))
+                        count++;
+        count_bit = timing_now() - start;
+
+        start = timing_now();
+        assert(dm_bit_count(bs) == count);
+        count_word = timing_now() - start;
+
+        printf("%d bits: find clear %.2f ms (%.2f ms by bit)  "
+               "count %.2f ms (%.2f ms by bit)\n", nr_bits,
+               by_word * 1e3, by_bit * 1e3, count_word * 1e3, count_bit * 1e3);
+}
+
 int main(int argc, char **argv)
 {
         typedef void (*test_fn)(struct dm_pool *);
         static test_fn tests[] = {
                 test_get_next,
                 test_equal,
-                test_and
+                test_and,
+                test_get_next_clear,
+                test_range,
+                test_large
         };
 
         int i;
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Parse VG metadata shaped like what lvm writes, check values, escapes
+ * and the written-out form survive, and time parsing and lookups for
+ * VGs of 1000 and 10000 LVs.
+ */
+
+#include "libdevmapper.h"
+#include "timing.h"
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+enum {
+	NR_PVS = 8,
+	ROUNDS = 10
+};
+
+struct buf {
+	char *mem;
+	size_t len, size;
+};
+
+static void _append(struct buf *b, const char *fmt, ...)
+	__attribute__ ((format(printf, 2, 3)));
+
+static void _append(struct buf *b, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(b->mem + b->len, b->size - b->len, fmt, ap);
+		va_end(ap);
+		assert(n >= 0);
+
+		if (b->len + n < b->size)
+			break;
+
+		b->size = b->size * 2 + n;
+		assert((b->mem = dm_realloc(b->mem, b->size)));
+	}
+
+	b->len += n;
+}
+
+static void _write_metadata(struct buf *b, int nr_lvs)
+{
+	int i;
+
+	b->len = 0;
+	_append(b, "# Generated by LVM2\n\ncontents = \"Text Format Volume Group\"\n"
+		"version = 1\n\ndescription = \"\"\n\n"
+		"vg {\n\tid = \"d5N3Xc-0c8e-gs3D-4bCq-HP1x-gcLr-M1lcnT\"\n"
+		"\tseqno = 42\n\tformat = \"lvm2\"\n"
+		"\tstatus = [\"RESIZEABLE\", \"READ\", \"WRITE\"]\n\tflags = []\n"
+		"\textent_size = 8192\n\tmax_lv = 0\n\tmax_pv = 0\n"
+		"\tmetadata_copies = 0\n\n\tphysical_volumes {\n");
+
+	for (i = 0; i < NR_PVS; i++)
+		_append(b, "\n\t\tpv%d {\n\t\t\tid = \"ff3DcX-uYr2-%06d-ddr4-1JlE-kbn3-ZlzZ4k\"\n"
+			"\t\t\tdevice = \"/dev/sd%c\"\t# Hint only\n\n"
+			"\t\t\tstatus = [\"ALLOCATABLE\"]\n\t\t\tflags = []\n"
+			"\t\t\tdev_size = 2147483648\n\t\t\tpe_start = 2048\n"
+			"\t\t\tpe_count = 262143\n\t\t}\n", i, i, 'a' + i);
+
+	_append(b, "\t}\n\n\tlogical_volumes {\n");
+
+	for (i = 0; i < nr_lvs; i++)
+		_append(b, "\n\t\tlvol%d {\n\t\t\tid = \"Qh2Zpa-Ib3l-%06d-0Ld2-3o5E-C2vS-0iUxIF\"\n"
+			"\t\t\tstatus = [\"READ\", \"WRITE\", \"VISIBLE\"]\n\t\t\tflags = []\n"
+			"\t\t\ttags = [\"owner=\\\"team %d\\\"\", \"backup\"]\n"
+			"\t\t\tcreation_host = \"host.example.com\"\n"
+			"\t\t\tcreation_time = 1349867710\t# 2012-10-10 12:15:10 +0100\n"
+			"\t\t\tsegment_count = 1\n\n\t\t\tsegment1 {\n"
+			"\t\t\t\tstart_extent = 0\n\t\t\t\textent_count = %d\n\n"
+			"\t\t\t\ttype = \"striped\"\n\t\t\t\tstripe_count = 1\t# linear\n\n"
+			"\t\t\t\tstripes = [\n\t\t\t\t\t\"pv%d\", %d\n\t\t\t\t]\n"
+			"\t\t\t}\n\t\t}\n", i, i, i, 1 + i % 100, i % NR_PVS, i * 100);
+
+	_append(b, "\t}\n}\n");
+}
+
+static int _putline(const char *line, void *baton)
+{
+	_append(baton, "%s\n", line);
+
+	return 1;
+}
+
+static struct dm_config_tree *_parse(struct buf *b)
+{
+	struct dm_config_tree *cft;
+
+	assert((cft = dm_config_create()));
+	assert(dm_config_parse(cft, b->mem, b->mem + b->len));
+
+	return cft;
+}
+
+static void _check(struct buf *b, int nr_lvs)
+{
+	struct dm_config_tree *cft = _parse(b), *again;
+	const struct dm_config_node *cn;
+	const struct dm_config_value *cv;
+	struct buf out1 = { 0 }, out2 = { 0 };
+	const char *str;
+	uint32_t u;
+
+	assert(dm_config_get_uint32(cft->root, "vg/seqno", &u) && u == 42);
+	assert(dm_config_get_str(cft->root, "vg/physical_volumes/pv3/device", &str));
+	assert(!strcmp(str, "/dev/sdd"));
+
+	assert((cn = dm_config_find_node(cft->root, "vg/logical_volumes/lvol7")));
+	assert(!strcmp(cn->key, "lvol7"));
+
+	/* Lookups search a list of siblings, like import_vsn1.c does */
+	cn = cn->child;
+	assert(dm_config_get_uint32(cn, "segment1/extent_count", &u) && u == 8);
+	assert(dm_config_get_list(cn, "tags", &cv));
+	assert(cv->type == DM_CFG_STRING && !strcmp(cv->v.str, "owner=\"team 7\""));
+	assert(cv->next && !strcmp(cv->next->v.str, "backup") && !cv->next->next);
+	assert(dm_config_get_list(cn, "status", &cv) && !strcmp(cv->v.str, "READ"));
+	assert(dm_config_get_list(cn, "flags", &cv) && cv->type == DM_CFG_EMPTY_ARRAY);
+	assert(dm_config_get_list(cn, "segment1/stripes", &cv));
+	assert(!strcmp(cv->v.str, "pv7") && cv->next->v.i == 700);
+	assert(!strcmp(dm_config_parent_name(cn), "lvol7"));
+	assert(!dm_config_find_node(cn, "segment2"));
+	assert(!dm_config_find_node(cn, "segment"));
+
+	cn = dm_config_find_node(cft->root, "vg/logical_volumes");
+	for (u = 0, cn = cn->child; cn; cn = cn->sib)
+		u++;
+	assert(u == nr_lvs);
+
+	/* What is written out parses back to the same thing */
+	assert(dm_config_write_node(cft->root, _putline, &out1));
+	again = _parse(&out1);
+	assert(dm_config_write_node(again->root, _putline, &out2));
+	assert(out1.len == out2.len && !memcmp(out1.mem, out2.mem, out1.len));
+
+	dm_config_destroy(again);
+	dm_config_destroy(cft);
+	dm_free(out1.mem);
+	dm_free(out2.mem);
+}
+
+/*
+ * The lookups import_vsn1.c makes for each LV.
+ */
+static void _lookup_lvs(struct dm_config_tree *cft)
+{
+	static const char *const _paths[] = {
+		"id", "status", "flags", "creation_host", "creation_time",
+		"allocation_policy", "read_ahead", "tags", "segment_count",
+		"segment1/start_extent", "segment1/extent_count",
+		"segment1/type", "segment1/stripe_count", "segment1/stripes"
+	};
+	const struct dm_config_node *cn;
+	unsigned i;
+
+	assert(dm_config_get_section(cft->root, "vg/logical_volumes", &cn));
+
+	for (cn = cn->child; cn; cn = cn->sib)
+		for (i = 0; i < sizeof(_paths) / sizeof(*_paths); i++)
+			(void) dm_config_find_node(cn->child, _paths[i]);
+}
+
+static void _time(struct buf *b, int nr_lvs)
+{
+	struct dm_config_tree *cft;
+	double parse = 0, lookup = 0, start;
+	int i;
+
+	for (i = 0; i < ROUNDS; i++) {
+		start = timing_now();
+		cft = _parse(b);
+		parse += timing_now() - start;
+
+		start = timing_now();
+		_lookup_lvs(cft);
+		lookup += timing_now() - start;
+
+		dm_config_destroy(cft);
+	}
+
+	printf("%5d LVs, %8zu bytes: parse %8.0f us  lookups %6.0f us\n",
+	       nr_lvs, b->len, parse * 1e6 / ROUNDS, lookup * 1e6 / ROUNDS);
+}
+
+int main(int argc, char **argv)
+{
+	static const int _nr_lvs[] = { 1000, 10000 };
+	struct buf b = { 0 };
+	unsigned i;
+
+	for (i = 0; i < sizeof(_nr_lvs) / sizeof(*_nr_lvs); i++) {
+		_write_metadata(&b, _nr_lvs[i]);
+		_check(&b, _nr_lvs[i]);
+		_time(&b, _nr_lvs[i]);
+	}
+
+	dm_free(b.mem);
+
+	return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Check lookups and iteration while the table grows, and time insert,
+ * lookup and iteration with the small size hint lvmetad uses.
+ */
+
+#include "libdevmapper.h"
+#include "timing.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+enum {
+	KEY_LEN = 40,
+	SIZE_HINT = 32,
+	MAX_KEYS = 100000
+};
+
+static char _keys[MAX_KEYS][KEY_LEN];
+
+static void _make_keys(void)
+{
+	int i;
+
+	/* Shaped like the PV and VG UUIDs lvmetad hashes */
+	for (i = 0; i < MAX_KEYS; i++)
+		snprintf(_keys[i], KEY_LEN, "Ss1W3p-Yv2I-fZtS-PNkh-bw8T-J0Lu-%06d", i);
+}
+
+/*
+ * Every key inserted so far must be found and visited exactly once.
+ */
+static void _check_contents(struct dm_hash_table *t, int nr_keys)
+{
+	static char seen[MAX_KEYS];
+	struct dm_hash_node *n;
+	long i;
+	int count = 0;
+
+	assert(dm_hash_get_num_entries(t) == (unsigned) nr_keys);
+
+	memset(seen, 0, sizeof(seen));
+	dm_hash_iterate(n, t) {
+		i = (long) dm_hash_get_data(t, n);
+		assert(i >= 0 && i < nr_keys);
+		assert(!seen[i]);
+		assert(!strcmp(dm_hash_get_key(t, n), _keys[i]));
+		seen[i] = 1;
+		count++;
+	}
+	assert(count == nr_keys);
+
+	for (i = 0; i < nr_keys; i++)
+		assert(dm_hash_lookup(t, _keys[i]) == (void *) i);
+}
+
+static void test_growth(void)
+{
+	struct dm_hash_table *t = dm_hash_create(SIZE_HINT);
+	long i;
+
+	assert(t);
+
+	/* Look at the table part-way through moving entries, too */
+	for (i = 0; i < 5000; i++) {
+		assert(dm_hash_insert(t, _keys[i], (void *) i));
+		if (i % 97 == 0 || (i & (i + 1)) == 0)
+			_check_contents(t, i + 1);
+	}
+	_check_contents(t, 5000);
+
+	/* Replacing data leaves the number of entries alone */
+	assert(dm_hash_insert(t, _keys[7], (void *) 7L));
+	assert(dm_hash_get_num_entries(t) == 5000);
+
+	for (i = 4999; i >= 2500; i--) {
+		dm_hash_remove(t, _keys[i]);
+		assert(!dm_hash_lookup(t, _keys[i]));
+	}
+	_check_contents(t, 2500);
+
+	dm_hash_wipe(t);
+	_check_contents(t, 0);
+
+	assert(dm_hash_insert(t, _keys[0], NULL));
+	assert(dm_hash_insert_binary(t, _keys[0], 4, (void *) 1L));
+	assert(!dm_hash_lookup(t, _keys[0]));
+	assert(dm_hash_lookup_binary(t, _keys[0], 4) == (void *) 1L);
+
+	dm_hash_destroy(t);
+}
+
+static void bench(int nr_keys)
+{
+	struct dm_hash_table *t = dm_hash_create(SIZE_HINT);
+	struct dm_hash_node *n;
+	double start, insert, lookup, iterate;
+	long i, sum = 0;
+
+	assert(t);
+
+	start = timing_now();
+	for (i = 0; i < nr_keys; i++)
+		assert(dm_hash_insert(t, _keys[i], (void *) i));
+	insert = timing_now() - start;
+
+	start = timing_now();
+	for (i = 0; i < nr_keys; i++)
+		assert(dm_hash_lookup(t, _keys[i]) == (void *) i);
+	lookup = timing_now() - start;
+
+	start = timing_now();
+	dm_hash_iterate(n, t)
+		sum += (long) dm_hash_get_data(t, n);
+	iterate = timing_now() - start;
+	assert(sum == (long) nr_keys * (nr_keys - 1) / 2);
+
+	printf("%6d keys  insert %7.1f ns  lookup %7.1f ns  iterate %6.1f ns (per key)\n",
+	       nr_keys, insert * 1e9 / nr_keys, lookup * 1e9 / nr_keys,
+	       iterate * 1e9 / nr_keys);
+
+	dm_hash_destroy(t);
+}
+
+int main(int argc, char **argv)
+{
+	_make_keys();
+
+	test_growth();
+
+	bench(1000);
+	bench(10000);
+	bench(100000);
+
+	return 0;
+}
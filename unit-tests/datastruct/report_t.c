@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Check streaming JSON and NUL-delimited report output, sorted through
+ * runs spilled to a file, against the buffered report, and time them.
+ */
+
+#include "libdevmapper.h"
+#include "log.h"
+#include "timing.h"
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+enum {
+	NR_ROWS = 200000,	/* Enough for several spilled runs */
+	NR_VGS = 97
+};
+
+struct obj {
+	const char *name;
+	const char *vg;
+	uint64_t size;
+};
+
+static struct obj *_objs;
+static char _dir[PATH_MAX];
+
+static void *_obj_data(void *object)
+{
+	return object;
+}
+
+static const struct dm_report_object_type _types[] = {
+	{ 1, "Object", "obj_", _obj_data },
+	{ 0, "", "", NULL }
+};
+
+static int _str_disp(struct dm_report *rh, struct dm_pool *mem,
+		     struct dm_report_field *field, const void *data,
+		     void *private)
+{
+	return dm_report_field_string(rh, field, (const char *const *) data);
+}
+
+static int _size_disp(struct dm_report *rh, struct dm_pool *mem,
+		      struct dm_report_field *field, const void *data,
+		      void *private)
+{
+	return dm_report_field_uint64(rh, field, (const uint64_t *) data);
+}
+
+static const struct dm_report_field_type _fields[] = {
+	{ 1, DM_REPORT_FIELD_TYPE_STRING, offsetof(struct obj, name), 4,
+	  "name", "Name", _str_disp, "Name." },
+	{ 1, DM_REPORT_FIELD_TYPE_STRING, offsetof(struct obj, vg), 2,
+	  "vg", "VG", _str_disp, "VG name." },
+	{ 1, DM_REPORT_FIELD_TYPE_NUMBER, offsetof(struct obj, size), 4,
+	  "size", "Size", _size_disp, "Size." },
+	{ 0, 0, 0, 0, "", "", NULL, NULL }
+};
+
+static void _make_objs(void)
+{
+	char buf[64];
+	unsigned i;
+
+	assert((_objs = malloc(sizeof(*_objs) * NR_ROWS)));
+
+	for (i = 0; i < NR_ROWS; i++) {
+		snprintf(buf, sizeof(buf), "lvol%u", (i * 7919) % NR_ROWS);
+		assert((_objs[i].name = strdup(buf)));
+		snprintf(buf, sizeof(buf), "vg%u", (i * 31) % NR_VGS);
+		assert((_objs[i].vg = strdup(buf)));
+		_objs[i].size = (uint64_t) ((i * 104729) % 1000) << 20;
+	}
+
+	/* Something that needs escaping */
+	free((void *) _objs[0].name);
+	_objs[0].name = "a\"b\\c\td";
+}
+
+/*
+ * Reports all the objects to the file and returns how long it took.
+ */
+static double _report(const char *file, uint32_t flags, const char *keys)
+{
+	struct dm_report *rh;
+	double start = timing_now();
+	unsigned i;
+
+	assert(freopen(file, "w", stdout));
+
+	assert((rh = dm_report_init(NULL, _types, _fields, "name,vg,size",
+				    " ", flags | DM_REPORT_OUTPUT_HEADINGS,
+				    keys, NULL)));
+	for (i = 0; i < NR_ROWS; i++)
+		assert(dm_report_object(rh, &_objs[i]));
+	assert(dm_report_output(rh));
+	dm_report_free(rh);
+
+	assert(!fflush(stdout));
+
+	return timing_now() - start;
+}
+
+static char *_read_file(const char *file, size_t *len)
+{
+	FILE *fp;
+	char *buf;
+	long size;
+
+	assert((fp = fopen(file, "r")));
+	assert(!fseek(fp, 0, SEEK_END));
+	assert((size = ftell(fp)) >= 0);
+	rewind(fp);
+	assert((buf = malloc(size + 1)));
+	assert(fread(buf, 1, size, fp) == (size_t) size);
+	buf[size] = '\0';
+	assert(!fclose(fp));
+	*len = (size_t) size;
+
+	return buf;
+}
+
+/*
+ * Turns each NUL-delimited line back into the space separated
+ * unaligned output, which is what the buffered report printed.
+ */
+static void _check_nul(const char *nul_file, const char *basic_file)
+{
+	size_t nul_len, basic_len, i;
+	char *nul = _read_file(nul_file, &nul_len);
+	char *basic = _read_file(basic_file, &basic_len);
+
+	assert(nul_len == basic_len);
+	for (i = 0; i < nul_len; i++)
+		if (!nul[i])
+			nul[i] = ' ';
+	assert(!memcmp(nul, basic, nul_len));
+
+	free(nul);
+	free(basic);
+}
+
+static void _check_json(const char *file)
+{
+	char line[256], prev_vg[64] = "", vg[64];
+	unsigned long long size, prev_size = 0;
+	unsigned rows = 0, escaped = 0;
+	int cmp;
+	FILE *fp;
+
+	assert((fp = fopen(file, "r")));
+
+	while (fgets(line, sizeof(line), fp)) {
+		assert(line[0] == '{');
+		if (strstr(line, "\"name\":\"a\\\"b\\\\c\\u0009d\""))
+			escaped++;
+		assert(sscanf(strstr(line, "\"vg\":"), "\"vg\":\"%63[^\"]\",\"size\":\"%llu\"}",
+			      vg, &size) == 2);
+
+		/* Sorted by vg, then by size descending */
+		cmp = strcmp(prev_vg, vg);
+		assert(cmp < 0 || (!cmp && prev_size >= size));
+		strcpy(prev_vg, vg);
+		prev_size = size;
+		rows++;
+	}
+
+	assert(!fclose(fp));
+	assert(rows == NR_ROWS);
+	assert(escaped == 1);
+}
+
+static unsigned _logged_rows;
+
+static void _count_rows(int level, const char *file, int line,
+			int dm_errno_or_class, const char *f, ...)
+{
+	va_list ap;
+	const char *row;
+
+	if ((level & ~_LOG_STDERR) != _LOG_WARN)
+		return;
+
+	va_start(ap, f);
+	(void) va_arg(ap, int);
+	row = va_arg(ap, const char *);
+	va_end(ap);
+
+	if (row[0] == '{')
+		_logged_rows++;
+}
+
+/*
+ * Sorted JSON rows reach a log function, as the rows of other reports do.
+ */
+static void _check_log_fn(void)
+{
+	struct dm_report *rh;
+	unsigned i;
+
+	dm_log_with_errno_init(_count_rows);
+
+	assert((rh = dm_report_init(NULL, _types, _fields, "name,vg,size", " ",
+				    DM_REPORT_OUTPUT_BUFFERED | DM_REPORT_OUTPUT_JSON,
+				    "vg,-size,name", NULL)));
+	for (i = 0; i < NR_ROWS; i++)
+		assert(dm_report_object(rh, &_objs[i]));
+	assert(dm_report_output(rh));
+	dm_report_free(rh);
+
+	dm_log_with_errno_init(NULL);
+
+	assert(_logged_rows == NR_ROWS);
+}
+
+int main(int argc, char **argv)
+{
+	const char *tmp = getenv("TMPDIR");
+	char basic[PATH_MAX], json[PATH_MAX], nul[PATH_MAX];
+	double t_basic, t_json, t_nul, t_unsorted;
+
+	snprintf(_dir, sizeof(_dir), "%s/report_t.XXXXXX", tmp ? : "/tmp");
+	assert(mkdtemp(_dir));
+	assert(snprintf(basic, sizeof(basic), "%s/basic", _dir) < (int) sizeof(basic));
+	assert(snprintf(json, sizeof(json), "%s/json", _dir) < (int) sizeof(json));
+	assert(snprintf(nul, sizeof(nul), "%s/nul", _dir) < (int) sizeof(nul));
+
+	_make_objs();
+
+	t_basic = _report(basic, DM_REPORT_OUTPUT_BUFFERED, "vg,-size,name");
+	t_nul = _report(nul, DM_REPORT_OUTPUT_BUFFERED | DM_REPORT_OUTPUT_NUL_DELIMITED,
+			"vg,-size,name");
+	t_json = _report(json, DM_REPORT_OUTPUT_BUFFERED | DM_REPORT_OUTPUT_JSON,
+			 "vg,-size,name");
+	_check_nul(nul, basic);
+	_check_json(json);
+
+	t_unsorted = _report(json, DM_REPORT_OUTPUT_JSON, NULL);
+	_check_log_fn();
+
+	/* Both formats at once make no sense */
+	assert(!dm_report_init(NULL, _types, _fields, "name", " ",
+			       DM_REPORT_OUTPUT_JSON | DM_REPORT_OUTPUT_NUL_DELIMITED,
+			       NULL, NULL));
+
+	assert(!unlink(basic) && !unlink(json) && !unlink(nul) && !rmdir(_dir));
+
+	fprintf(stderr, "%d rows sorted: buffered %.0f ms  nul %.0f ms  json %.0f ms  "
+		"json unsorted %.0f ms\n", NR_ROWS, t_basic * 1e3, t_nul * 1e3,
+		t_json * 1e3, t_unsorted * 1e3);
+
+	return 0;
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Check that asynchronous io hands every read and write back to its
+ * caller in order, also when completions cannot be collected from the
+ * kernel, and that each failed io is counted once.
+ */
+
+#include "dev_fixture.h"
+#include "dev-cache.h"
+
+#include <assert.h>
+#include <dlfcn.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+
+enum {
+	BLOCK = 4096,
+	NR_BLOCKS = 64,
+	DEPTH = 8
+};
+
+static int _aio_available;
+static int _fail_getevents;
+static unsigned _getevents_calls;
+static unsigned _next;
+
+/*
+ * dev-io calls the aio syscalls through syscall(), so this definition
+ * lets the test see them and make io_getevents fail.
+ */
+long syscall(long number, ...)
+{
+	static long (*_syscall)(long, ...);
+	long a[6], r;
+	va_list ap;
+	int i;
+
+	if (!_syscall)
+		assert((_syscall = (long (*)(long, ...)) dlsym(RTLD_NEXT, "syscall")));
+
+	va_start(ap, number);
+	for (i = 0; i < 6; i++)
+		a[i] = va_arg(ap, long);
+	va_end(ap);
+
+#ifdef __NR_io_getevents
+	if (number == __NR_io_getevents) {
+		_getevents_calls++;
+		if (_fail_getevents) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+#endif
+
+	r = _syscall(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+
+#ifdef __NR_io_setup
+	if (number == __NR_io_setup && !r)
+		_aio_available = 1;
+#endif
+
+	return r;
+}
+
+static void _fill(char *buf, unsigned block, char c)
+{
+	memset(buf, c, BLOCK);
+	snprintf(buf, BLOCK, "block %u", block);
+}
+
+/* Reads complete in submission order with the right data */
+static void _read_done(struct device *dev, void *buf, void *context)
+{
+	unsigned block = (unsigned) (uintptr_t) context;
+	char expect[BLOCK];
+
+	assert(block == _next++);
+
+	if (block < NR_BLOCKS) {
+		_fill(expect, block, 'r');
+		assert(buf && !memcmp(buf, expect, BLOCK));
+	} else
+		assert(!buf);
+}
+
+static void _write_done(struct device *dev, void *buf, void *context)
+{
+	assert((unsigned) (uintptr_t) context == _next++);
+	assert(buf);
+}
+
+static void _read_all(struct device *dev, unsigned nr_missing)
+{
+	struct dev_aio *aio;
+	unsigned i;
+
+	_next = 0;
+	assert((aio = dev_aio_create(DEPTH)));
+
+	for (i = 0; i < NR_BLOCKS + nr_missing; i++)
+		assert(dev_aio_read(aio, dev, (uint64_t) i * BLOCK, BLOCK,
+				    _read_done, (void *) (uintptr_t) i));
+
+	assert(dev_aio_wait(aio));
+	assert(_next == NR_BLOCKS + nr_missing);
+	dev_aio_destroy(aio);
+}
+
+static void _check_written(const char *path)
+{
+	char buf[BLOCK], expect[BLOCK];
+	unsigned i;
+	FILE *fp;
+
+	assert((fp = fopen(path, "r")));
+	for (i = 0; i < NR_BLOCKS; i++) {
+		assert(fread(buf, BLOCK, 1, fp) == 1);
+		_fill(expect, i, 'w');
+		assert(!memcmp(buf, expect, BLOCK));
+	}
+	assert(!fclose(fp));
+}
+
+static void _check(const char *path)
+{
+	char buf[BLOCK];
+	struct dev_aio *aio;
+	struct device *dev;
+	unsigned i;
+	FILE *fp;
+
+	assert((fp = fopen(path, "w")));
+	for (i = 0; i < NR_BLOCKS; i++) {
+		_fill(buf, i, 'r');
+		assert(fwrite(buf, BLOCK, 1, fp) == 1);
+	}
+	assert(!fclose(fp));
+
+	assert((dev = dev_create_file(path, NULL, NULL, 1)));
+	assert(dev_open(dev));
+
+	/* Reads past the end fail, and are counted once each */
+	_read_all(dev, 3);
+	assert(dev->error_count == 3);
+
+	if (!_aio_available) {
+		printf("Asynchronous io unavailable: only synchronous io checked.\n");
+		goto out;
+	}
+	assert(_getevents_calls);
+
+	/* All of them are redone synchronously if the kernel fails us */
+	_fail_getevents = 1;
+	_read_all(dev, 3);
+	assert(dev->error_count == 6);
+
+	/* Writes too, and later ones go straight to the device */
+	_fail_getevents = 0;
+	_next = 0;
+	assert((aio = dev_aio_create(DEPTH)));
+	for (i = 0; i < NR_BLOCKS; i++) {
+		if (i == DEPTH / 2)
+			_fail_getevents = 1;
+		_fill(buf, i, 'w');
+		assert(dev_aio_write(aio, dev, (uint64_t) i * BLOCK, BLOCK, buf,
+				     _write_done, (void *) (uintptr_t) i));
+	}
+	assert(dev_aio_wait(aio));
+	assert(_next == NR_BLOCKS);
+	dev_aio_destroy(aio);
+	assert(dev->error_count == 6);
+
+	_check_written(path);
+out:
+	/* Frees the device too */
+	assert(dev_close(dev));
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = dev_fixture_create_dir("aio_t");
+	char path[PATH_MAX];
+
+	dev_fixture_path(path, sizeof(path), dir, "disk");
+	_check(path);
+
+	dev_fixture_remove_dir();
+
+	return 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Check when the block cache serves reads, and that taking a VG lock
+ * drops the cached blocks of that VG's devices only.
+ */
+
+#include "dev_fixture.h"
+#include "dev-bcache.h"
+#include "dev-cache.h"
+#include "lvmcache.h"
+#include "locking.h"
+#include "metadata.h"
+
+#include <assert.h>
+
+enum {
+	NR_DEVS = 3
+};
+
+static struct device *_devs[NR_DEVS];
+
+static void _insert(struct device *dev, char c)
+{
+	char buf[2 * BCACHE_BLOCK_SIZE];
+
+	memset(buf, c, sizeof(buf));
+	dev_bcache_insert(dev, 0, sizeof(buf), buf);
+}
+
+static int _cached(struct device *dev)
+{
+	char buf[16];
+
+	return dev_bcache_read(dev, 100, sizeof(buf), buf);
+}
+
+static void _check_blocks(void)
+{
+	struct device *dev = _devs[0];
+	char buf[BCACHE_BLOCK_SIZE];
+
+	/* Miss until inserted, then hit within the cached blocks only */
+	assert(!dev_bcache_read(dev, 0, 512, buf));
+	_insert(dev, 'a');
+	assert(dev_bcache_read(dev, 512, 512, buf) && buf[0] == 'a');
+	assert(dev_bcache_read(dev, BCACHE_BLOCK_SIZE - 256, 512, buf));
+	assert(!dev_bcache_read(dev, 2 * BCACHE_BLOCK_SIZE - 256, 512, buf));
+	assert(!_cached(_devs[1]));
+
+	/* Writes go through the cache, or drop what they cannot update */
+	memset(buf, 'b', 512);
+	dev_bcache_write(dev, 1024, 512, buf);
+	assert(dev_bcache_read(dev, 1024, 512, buf) && buf[0] == 'b' && buf[511] == 'b');
+	assert(dev_bcache_read(dev, 1536, 1, buf) && buf[0] == 'a');
+	dev_bcache_write(dev, 1024, 512, NULL);
+	assert(!dev_bcache_read(dev, 1024, 512, buf));
+	assert(dev_bcache_read(dev, BCACHE_BLOCK_SIZE, 512, buf));
+
+	/* Invalidation of one device leaves the others */
+	_insert(_devs[1], 'c');
+	dev_bcache_invalidate_dev(dev);
+	assert(!dev_bcache_read(dev, BCACHE_BLOCK_SIZE, 512, buf));
+	assert(_cached(_devs[1]));
+
+	dev_bcache_invalidate();
+	assert(!_cached(_devs[1]));
+}
+
+static void _insert_all(void)
+{
+	unsigned i;
+
+	for (i = 0; i < NR_DEVS; i++)
+		_insert(_devs[i], 'x');
+}
+
+static void _check_locks(struct cmd_context *cmd)
+{
+	struct lvmcache_info *info;
+	const char *orphan = cmd->fmt->orphan_vg_name;
+
+	/* _devs[0] is in vg1, _devs[1] in vg2 and _devs[2] is an orphan */
+	assert((info = lvmcache_add(cmd->fmt->labeller, "pvid0000000000000000000000000000",
+				    _devs[0], "vg1", "vgid1000000000000000000000000000", 0)));
+	assert(lvmcache_add(cmd->fmt->labeller, "pvid1111111111111111111111111111",
+			    _devs[1], "vg2", "vgid2000000000000000000000000000", 0));
+	assert(lvmcache_add(cmd->fmt->labeller, "pvid2222222222222222222222222222",
+			    _devs[2], orphan, orphan, 0));
+
+	_insert_all();
+	lvmcache_lock_vgname("vg1", 0);
+	assert(!_cached(_devs[0]) && _cached(_devs[1]) && _cached(_devs[2]));
+	lvmcache_unlock_vgname("vg1");
+
+	/* Unlocking, and closing the devices with it, keeps the blocks */
+	assert(_cached(_devs[1]) && _cached(_devs[2]));
+
+	_insert_all();
+	lvmcache_lock_vgname(VG_ORPHANS, 0);
+	assert(_cached(_devs[0]) && _cached(_devs[1]) && !_cached(_devs[2]));
+
+	/* A device found to be in a locked VG is read again */
+	_insert_all();
+	assert(lvmcache_update_vgname_and_id(info, orphan, orphan, 0, NULL));
+	assert(!_cached(_devs[0]) && _cached(_devs[1]));
+	lvmcache_unlock_vgname(VG_ORPHANS);
+
+	_insert_all();
+	lvmcache_lock_vgname(VG_GLOBAL, 0);
+	assert(!_cached(_devs[0]) && !_cached(_devs[1]) && !_cached(_devs[2]));
+	lvmcache_unlock_vgname(VG_GLOBAL);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = dev_fixture_create_dir("bcache_t");
+	struct cmd_context *cmd;
+	char path[PATH_MAX], name[16];
+	unsigned i;
+
+	dev_fixture_mkdir(dir, "dev");
+	dev_fixture_path(path, sizeof(path), dir, "dev");
+	cmd = dev_fixture_create_cmd(path);
+
+	/* Devices that are never opened: only their blocks are cached */
+	for (i = 0; i < NR_DEVS; i++) {
+		snprintf(name, sizeof(name), "dev/sd%u", i);
+		dev_fixture_path(path, sizeof(path), dir, name);
+		assert((_devs[i] = dev_create_file(path, NULL, NULL, 1)));
+		_devs[i]->flags &= ~DEV_REGULAR;
+		_devs[i]->dev = makedev(8, i * 16);
+	}
+
+	_check_blocks();
+	_check_locks(cmd);
+
+	lvmcache_destroy(cmd, 0);
+	destroy_toolcontext(cmd);
+	dev_fixture_remove_dir();
+
+	return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "dev_fixture.h"
+
+#include <assert.h>
+#include <ftw.h>
+#include <stdio.h>
+
+static char _dir[PATH_MAX];
+
+const char *dev_fixture_create_dir(const char *name)
+{
+	const char *tmp = getenv("TMPDIR");
+
+	assert(snprintf(_dir, sizeof(_dir), "%s/%s.XXXXXX", tmp ? : "/tmp", name) <
+	       (int) sizeof(_dir));
+	assert(mkdtemp(_dir));
+
+	return _dir;
+}
+
+static int _remove_one(const char *path, const struct stat *sb, int flag,
+		       struct FTW *ftw)
+{
+	return remove(path);
+}
+
+void dev_fixture_remove_dir(void)
+{
+	nftw(_dir, _remove_one, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+void dev_fixture_path(char *path, size_t size, const char *dir, const char *name)
+{
+	assert(snprintf(path, size, "%s/%s", dir, name) < (int) size);
+}
+
+void dev_fixture_mkdir(const char *dir, const char *name)
+{
+	char path[PATH_MAX];
+
+	dev_fixture_path(path, sizeof(path), dir, name);
+	assert(!mkdir(path, 0755));
+}
+
+void dev_fixture_write(const char *dir, const char *name, const char *text)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+
+	dev_fixture_path(path, sizeof(path), dir, name);
+	assert((fp = fopen(path, "w")));
+	fputs(text, fp);
+	assert(!fclose(fp));
+}
+
+struct cmd_context *dev_fixture_create_cmd(const char *dev_dir)
+{
+	struct cmd_context *cmd;
+	char path[PATH_MAX];
+	FILE *fp;
+
+	dev_fixture_path(path, sizeof(path), _dir, "lvm.conf");
+	assert((fp = fopen(path, "w")));
+	fprintf(fp, "devices {\n\tdir = \"%s\"\n\tscan = [ \"%s\" ]\n"
+		"\tobtain_device_list_from_udev = 0\n\tsysfs_scan = 0\n"
+		"\twrite_cache_state = 0\n}\n", dev_dir, dev_dir);
+	assert(!fclose(fp));
+
+	assert(!setenv("LVM_SYSTEM_DIR", _dir, 1));
+	assert((cmd = create_toolcontext(0, NULL, 0, 0)));
+
+	return cmd;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * A scratch directory for fake /dev, proc and sysfs trees, shared by
+ * the device tests.
+ */
+
+#ifndef _LVM_UNIT_DEV_FIXTURE_H
+#define _LVM_UNIT_DEV_FIXTURE_H
+
+#include "lib.h"
+#include "toolcontext.h"
+
+/*
+ * Create the scratch directory, named after the test, and return its path.
+ */
+const char *dev_fixture_create_dir(const char *name);
+
+/*
+ * Remove the scratch directory with everything in it.
+ */
+void dev_fixture_remove_dir(void);
+
+void dev_fixture_path(char *path, size_t size, const char *dir, const char *name);
+void dev_fixture_mkdir(const char *dir, const char *name);
+void dev_fixture_write(const char *dir, const char *name, const char *text);
+
+/*
+ * A command context that scans dev_dir only, configured by an lvm.conf
+ * in the scratch directory.
+ */
+struct cmd_context *dev_fixture_create_cmd(const char *dev_dir);
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Build a synthetic /dev tree laid out the way udev does it, check that
+ * the device cache finds each disk under its preferred name with all its
+ * aliases, and time full scans of it.
+ */
+
+#include "dev_fixture.h"
+#include "dev-cache.h"
+#include "timing.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+enum {
+	NR_DISKS = 4000,
+	NR_ALIASES = 5,		/* Node, by-id, by-path, by-uuid and block */
+	ROUNDS = 5
+};
+
+static const char *_dir;
+static char _dev_dir[PATH_MAX];
+
+static void _path(char *buf, const char *fmt, unsigned i)
+{
+	char name[PATH_MAX];
+
+	snprintf(name, sizeof(name), fmt, i, i, i);
+	assert(snprintf(buf, PATH_MAX, "%s/%s", _dev_dir, name) < PATH_MAX);
+}
+
+static void _symlink(const char *target, const char *name, unsigned i)
+{
+	char path[PATH_MAX], dest[PATH_MAX];
+
+	snprintf(dest, sizeof(dest), target, i);
+	_path(path, name, i);
+	assert(!symlink(dest, path));
+}
+
+static dev_t _devno(unsigned i)
+{
+	return makedev(8 + i / 256, i % 256);
+}
+
+/*
+ * Returns 0 if device nodes cannot be created here.
+ */
+static int _make_tree(void)
+{
+	char path[PATH_MAX], name[32];
+	unsigned i;
+
+	dev_fixture_mkdir(_dir, "dev");
+	dev_fixture_mkdir(_dev_dir, "disk");
+	dev_fixture_mkdir(_dev_dir, "disk/by-id");
+	dev_fixture_mkdir(_dev_dir, "disk/by-path");
+	dev_fixture_mkdir(_dev_dir, "disk/by-uuid");
+	dev_fixture_mkdir(_dev_dir, "block");
+	dev_fixture_mkdir(_dev_dir, "pts");
+
+	for (i = 0; i < NR_DISKS; i++) {
+		_path(path, "sd%u", i);
+		if (mknod(path, S_IFBLK | 0600, _devno(i)))
+			return 0;
+
+		_path(path, "tty%u", i);
+		assert(!mknod(path, S_IFCHR | 0600, _devno(i)));
+
+		_symlink("../../sd%u", "disk/by-id/wwn-0x5000c500%08x", i);
+		_symlink("../../sd%u", "disk/by-path/pci-0000:00:1f.2-scsi-0:0:%u:0", i);
+		_symlink("../../sd%u", "disk/by-uuid/%08x-1234-5678-9abc-def012345678", i);
+		snprintf(name, sizeof(name), "block/%d:%d", (int) major(_devno(i)),
+			 (int) minor(_devno(i)));
+		_symlink("../sd%u", name, i);
+	}
+
+	/* Links to directories are not followed */
+	_symlink("disk", "disk-link", 0);
+
+	return 1;
+}
+
+static void _scan(struct cmd_context *cmd)
+{
+	dev_cache_exit();
+	assert(dev_cache_init(cmd));
+	assert(dev_cache_add_dir(_dev_dir));
+	dev_cache_scan(1);
+}
+
+static void _check(void)
+{
+	char path[PATH_MAX];
+	struct dev_iter *iter;
+	struct device *dev;
+	unsigned i, count = 0;
+
+	assert((iter = dev_iter_create(NULL, 0)));
+
+	while ((dev = dev_iter_get(iter))) {
+		count++;
+		assert(dm_list_size(&dev->aliases) == NR_ALIASES);
+	}
+
+	dev_iter_destroy(iter);
+	assert(count == NR_DISKS);
+
+	for (i = 0; i < NR_DISKS; i++) {
+		_path(path, "disk/by-id/wwn-0x5000c500%08x", i);
+		assert((dev = dev_cache_get(path, NULL)));
+		assert(dev->dev == _devno(i));
+
+		/* Plain node names win over the udev links */
+		_path(path, "sd%u", i);
+		assert(!strcmp(dev_name(dev), path));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct cmd_context *cmd;
+	double start, best = 0;
+	int i;
+
+	_dir = dev_fixture_create_dir("devcache_t");
+	dev_fixture_path(_dev_dir, sizeof(_dev_dir), _dir, "dev");
+
+	if (!_make_tree()) {
+		printf("Cannot create device nodes: skipping.\n");
+		dev_fixture_remove_dir();
+		return 0;
+	}
+
+	cmd = dev_fixture_create_cmd(_dev_dir);
+
+	_scan(cmd);
+	_check();
+
+	/* Best of several rounds, as other processes easily disturb a single one */
+	for (i = 0; i < ROUNDS; i++) {
+		start = timing_now();
+		_scan(cmd);
+		best = timing_best(best, start);
+	}
+
+	printf("%d disks, %d entries: full scan %.0f us\n", NR_DISKS,
+	       NR_DISKS * (NR_ALIASES + 1), best * 1e6);
+
+	destroy_toolcontext(cmd);
+	dev_fixture_remove_dir();
+
+	return 0;
+}
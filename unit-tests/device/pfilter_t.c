@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Check which verdicts the persistent filter cache keeps across device
+ * changes, full scans and filter changes, using fake proc and sysfs files,
+ * and time loading it and filtering every device with it.
+ */
+
+#include "dev_fixture.h"
+#include "dev-cache.h"
+#include "filter-persistent.h"
+#include "timing.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+enum {
+	NR_DISKS = 10000,
+	ROUNDS = 5
+};
+
+static const char *_dir;
+static char _dev_dir[PATH_MAX];
+static char _proc_dir[PATH_MAX];
+static char _sysfs_dir[PATH_MAX];
+static char _cache_file[PATH_MAX];
+static unsigned _calls;
+static unsigned _big_disk = NR_DISKS;	/* Has grown since it was cached */
+static uint32_t _config_hash = 1;
+
+static dev_t _devno(unsigned i)
+{
+	return makedev(8 + i / 256, i % 256);
+}
+
+static void _write_partitions(void)
+{
+	char path[PATH_MAX];
+	unsigned i;
+	FILE *fp;
+
+	dev_fixture_path(path, sizeof(path), _proc_dir, "partitions");
+	assert((fp = fopen(path, "w")));
+	fprintf(fp, "major minor  #blocks  name\n\n");
+	for (i = 0; i < NR_DISKS; i++)
+		fprintf(fp, "%4u %7u %10u sd%u\n", major(_devno(i)),
+			minor(_devno(i)), i == _big_disk ? 2097152 : 1048576, i);
+	assert(!fclose(fp));
+}
+
+/*
+ * Returns 0 if device nodes cannot be created here.
+ */
+static int _make_tree(void)
+{
+	char path[PATH_MAX];
+	unsigned i;
+
+	dev_fixture_mkdir(_dir, "dev");
+	dev_fixture_mkdir(_dir, "proc");
+	dev_fixture_mkdir(_dir, "proc/sys");
+	dev_fixture_mkdir(_dir, "proc/sys/kernel");
+	dev_fixture_mkdir(_dir, "proc/sys/kernel/random");
+	dev_fixture_mkdir(_dir, "sys");
+	dev_fixture_mkdir(_dir, "sys/kernel");
+
+	for (i = 0; i < NR_DISKS; i++) {
+		assert(snprintf(path, sizeof(path), "%s/sd%u", _dev_dir, i) < (int) sizeof(path));
+		if (mknod(path, S_IFBLK | 0600, _devno(i)))
+			return 0;
+	}
+
+	dev_fixture_write(_proc_dir, "sys/kernel/random/boot_id",
+	       "a51fad39-4e7a-4a44-8da7-ec7007a24d62\n");
+	dev_fixture_write(_sysfs_dir, "kernel/uevent_seqnum", "1000\n");
+	_write_partitions();
+
+	return 1;
+}
+
+/* Even minor numbers pass */
+static int _passes(struct dev_filter *f, struct device *dev)
+{
+	_calls++;
+
+	return !(minor(dev->dev) & 1);
+}
+
+static void _destroy(struct dev_filter *f)
+{
+}
+
+static struct dev_filter _real = {
+	.passes_filter = _passes,
+	.destroy = _destroy
+};
+
+static struct dev_filter *_create(struct cmd_context *cmd)
+{
+	struct dev_filter *f;
+
+	dev_cache_exit();
+	assert(dev_cache_init(cmd));
+	assert(dev_cache_add_dir(_dev_dir));
+	assert((f = persistent_filter_create(&_real, _cache_file,
+					     _proc_dir, _sysfs_dir,
+					     _config_hash)));
+	_calls = 0;
+
+	return f;
+}
+
+static void _filter_all(struct dev_filter *f)
+{
+	struct dev_iter *iter;
+	struct device *dev;
+	unsigned good = 0;
+
+	assert((iter = dev_iter_create(NULL, 0)));
+	while ((dev = dev_iter_get(iter)))
+		good += f->passes_filter(f, dev);
+	dev_iter_destroy(iter);
+
+	assert(good == NR_DISKS / 2);
+}
+
+static ino_t _cache_ino(void)
+{
+	struct stat info;
+
+	assert(!stat(_cache_file, &info));
+
+	return info.st_ino;
+}
+
+static void _check(struct cmd_context *cmd)
+{
+	struct dev_filter *f;
+	ino_t ino;
+	FILE *fp;
+	int md;
+
+	/* Nothing cached yet */
+	f = _create(cmd);
+	dev_cache_scan(1);
+	_filter_all(f);
+	assert(_calls == NR_DISKS);
+	assert(persistent_filter_dump(f, 0));
+	f->destroy(f);
+
+	/* All verdicts hold while no device changed */
+	f = _create(cmd);
+	assert(persistent_filter_load(f));
+	dev_cache_scan(1);
+	_filter_all(f);
+	assert(!_calls);
+
+	/* And nothing is written back */
+	ino = _cache_ino();
+	assert(persistent_filter_dump(f, 0));
+	assert(_cache_ino() == ino);
+
+	/* Even across a full scan */
+	f->wipe(f);
+	_filter_all(f);
+	assert(!_calls);
+
+	/* Unless md filtering is overridden, when nothing is cached */
+	md = md_filtering();
+	init_md_filtering(!md);
+	_filter_all(f);
+	assert(_calls == NR_DISKS);
+	init_md_filtering(md);
+	_calls = 0;
+	_filter_all(f);
+	assert(!_calls);
+	f->destroy(f);
+
+	/* Verdicts reached with other filters are ignored */
+	_config_hash = 2;
+	f = _create(cmd);
+	assert(!persistent_filter_load(f));
+	dev_cache_scan(1);
+	_filter_all(f);
+	assert(_calls == NR_DISKS);
+	assert(persistent_filter_dump(f, 0));
+	f->destroy(f);
+
+	/* After a uevent, only devices that passed and kept their size are */
+	dev_fixture_write(_sysfs_dir, "kernel/uevent_seqnum", "1001\n");
+	_big_disk = 2;
+	_write_partitions();
+
+	f = _create(cmd);
+	assert(persistent_filter_load(f));
+	dev_cache_scan(1);
+	_filter_all(f);
+	assert(_calls == NR_DISKS / 2 + 1);
+	assert(persistent_filter_dump(f, 0));
+	f->destroy(f);
+
+	/* The new verdicts are cached under the new stamp */
+	f = _create(cmd);
+	assert(persistent_filter_load(f));
+	dev_cache_scan(1);
+	_filter_all(f);
+	assert(!_calls);
+	f->destroy(f);
+
+	/* A damaged cache is ignored */
+	assert((fp = fopen(_cache_file, "r+")));
+	assert(!fseek(fp, 100, SEEK_SET));
+	assert(fputc(0xff, fp) != EOF);
+	assert(!fclose(fp));
+
+	f = _create(cmd);
+	assert(!persistent_filter_load(f));
+	f->destroy(f);
+}
+
+/*
+ * Best of several rounds, as other processes easily disturb a single one.
+ */
+static void _bench(struct cmd_context *cmd)
+{
+	struct dev_filter *f;
+	double start, load = 0, filter = 0;
+	int i;
+
+	/* Cache the current state again */
+	f = _create(cmd);
+	dev_cache_scan(1);
+	_filter_all(f);
+	assert(persistent_filter_dump(f, 0));
+	f->destroy(f);
+
+	for (i = 0; i < ROUNDS; i++) {
+		f = _create(cmd);
+
+		start = timing_now();
+		assert(persistent_filter_load(f));
+		load = timing_best(load, start);
+
+		/* Full scans go through every device */
+		dev_cache_scan(1);
+
+		start = timing_now();
+		_filter_all(f);
+		filter = timing_best(filter, start);
+		assert(!_calls);
+
+		f->destroy(f);
+	}
+
+	printf("%d devices: load cache %.0f us  filter all %.0f us\n",
+	       NR_DISKS, load * 1e6, filter * 1e6);
+}
+
+int main(int argc, char **argv)
+{
+	struct cmd_context *cmd;
+
+	_dir = dev_fixture_create_dir("pfilter_t");
+	dev_fixture_path(_dev_dir, sizeof(_dev_dir), _dir, "dev");
+	dev_fixture_path(_proc_dir, sizeof(_proc_dir), _dir, "proc");
+	dev_fixture_path(_sysfs_dir, sizeof(_sysfs_dir), _dir, "sys");
+	dev_fixture_path(_cache_file, sizeof(_cache_file), _dir, ".cache");
+
+	if (!_make_tree()) {
+		printf("Cannot create device nodes: skipping.\n");
+		dev_fixture_remove_dir();
+		return 0;
+	}
+
+	cmd = dev_fixture_create_cmd(_dev_dir);
+
+	_check(cmd);
+	_bench(cmd);
+
+	destroy_toolcontext(cmd);
+	dev_fixture_remove_dir();
+
+	return 0;
+}
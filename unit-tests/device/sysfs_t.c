@@ -0,0 +1,315 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Build a fake sysfs tree, check what the sysfs snapshot tells about its
+ * devices, and compare the time to query all of them with probing each
+ * device's own sysfs files.
+ */
+
+#include "dev_fixture.h"
+#include "dev-sysfs.h"
+#include "timing.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <stdio.h>
+
+enum {
+	NR_DISKS = 10000,
+	NR_DM = 3,
+	ROUNDS = 5
+};
+
+static const char *_dir;
+static char _sysfs_dir[PATH_MAX];
+static char _old_sysfs_dir[PATH_MAX];
+
+static dev_t _disk(unsigned i)
+{
+	return makedev(100 + i / 128, (i % 128) * 2);
+}
+
+/* Every fourth disk has a partition */
+static dev_t _part(unsigned i)
+{
+	return _disk(i) + 1;
+}
+
+static void _write_dev(const char *dir, dev_t dev)
+{
+	char text[32];
+
+	snprintf(text, sizeof(text), "%u:%u\n", major(dev), minor(dev));
+	dev_fixture_write(dir, "dev", text);
+}
+
+/*
+ * Adds a device directory in devices/virtual/block and its link in
+ * dev/block.  Partitions go inside their whole device.
+ */
+static void _add(const char *name, const char *parent, dev_t dev)
+{
+	char rel[PATH_MAX], path[PATH_MAX];
+
+	if (parent)
+		snprintf(rel, sizeof(rel), "devices/virtual/block/%s/%s", parent, name);
+	else
+		snprintf(rel, sizeof(rel), "devices/virtual/block/%s", name);
+
+	dev_fixture_mkdir(_sysfs_dir, rel);
+	dev_fixture_path(path, sizeof(path), _sysfs_dir, rel);
+	_write_dev(path, dev);
+	dev_fixture_mkdir(path, "holders");
+
+	if (parent)
+		dev_fixture_write(path, "partition", "1\n");
+
+	assert(snprintf(path, sizeof(path), "%s/dev/block/%u:%u", _sysfs_dir,
+			major(dev), minor(dev)) < (int) sizeof(path));
+	snprintf(rel, sizeof(rel), "../../devices/virtual/block/%s%s%s",
+		 parent ? : "", parent ? "/" : "", name);
+	assert(!symlink(rel, path));
+}
+
+static void _hold(const char *name, const char *holder)
+{
+	char path[PATH_MAX];
+
+	assert(snprintf(path, sizeof(path), "%s/devices/virtual/block/%s/holders/%s",
+			_sysfs_dir, name, holder) < (int) sizeof(path));
+	assert(!symlink("../../dm-0", path));
+}
+
+static void _set_uuid(const char *name, const char *uuid)
+{
+	char path[PATH_MAX];
+
+	assert(snprintf(path, sizeof(path), "%s/devices/virtual/block/%s",
+			_sysfs_dir, name) < (int) sizeof(path));
+	dev_fixture_mkdir(path, "dm");
+	dev_fixture_write(path, "dm/uuid", uuid);
+}
+
+static void _make_tree(void)
+{
+	char name[32], part[32], path[PATH_MAX];
+	unsigned i;
+
+	dev_fixture_mkdir(_dir, "sys");
+	dev_fixture_mkdir(_sysfs_dir, "devices");
+	dev_fixture_mkdir(_sysfs_dir, "devices/virtual");
+	dev_fixture_mkdir(_sysfs_dir, "devices/virtual/block");
+	dev_fixture_mkdir(_sysfs_dir, "dev");
+	dev_fixture_mkdir(_sysfs_dir, "dev/block");
+
+	for (i = 0; i < NR_DISKS; i++) {
+		snprintf(name, sizeof(name), "sd%u", i);
+		_add(name, NULL, _disk(i));
+		if (!(i % 4)) {
+			snprintf(part, sizeof(part), "sd%up1", i);
+			_add(part, name, _part(i));
+		}
+	}
+
+	for (i = 0; i < NR_DM; i++) {
+		snprintf(name, sizeof(name), "dm-%u", i);
+		_add(name, NULL, makedev(253, i));
+	}
+	_add("md0", NULL, makedev(9, 0));
+
+	/* sd1 is a multipath leg, sd2 is under LVM, sd3 is in an md array */
+	_set_uuid("dm-0", "mpath-3600508b400105e210000900000490000\n");
+	_set_uuid("dm-1", "LVM-Ss1W3pYv2IfZtSPNkhbw8TJ0LuDDz0Oq\n");
+	_hold("sd1", "dm-0");
+	_hold("sd2", "dm-1");
+	_hold("sd3", "md0");
+	_hold("sd5", "dm-0");
+	_hold("sd5", "dm-1");
+
+	/* The old nested layout without /sys/dev/block */
+	dev_fixture_mkdir(_dir, "oldsys");
+	dev_fixture_mkdir(_old_sysfs_dir, "block");
+	dev_fixture_mkdir(_old_sysfs_dir, "block/sda");
+	dev_fixture_path(path, sizeof(path), _old_sysfs_dir, "block/sda");
+	_write_dev(path, makedev(8, 0));
+	dev_fixture_mkdir(_old_sysfs_dir, "block/sda/sda1");
+	dev_fixture_path(path, sizeof(path), _old_sysfs_dir, "block/sda/sda1");
+	_write_dev(path, makedev(8, 1));
+}
+
+static void _check(void)
+{
+	const dev_t *holders;
+	char path[PATH_MAX];
+	uint64_t stamp, stamp2;
+	dev_t primary;
+
+	assert(dev_sysfs_present(_sysfs_dir, _disk(NR_DISKS - 1)) == 1);
+	assert(dev_sysfs_present(_sysfs_dir, _part(4)) == 1);
+	assert(dev_sysfs_present(_sysfs_dir, _part(5)) == 0);
+
+	/* Partitions and their whole devices */
+	assert(dev_sysfs_primary(_sysfs_dir, _part(4), &primary) == 1);
+	assert(primary == _disk(4));
+	assert(dev_sysfs_primary(_sysfs_dir, _disk(4), &primary) == 0);
+	assert(dev_sysfs_partitioned(_sysfs_dir, _disk(4)) == 1);
+	assert(dev_sysfs_partitioned(_sysfs_dir, _disk(5)) == 0);
+
+	/* Not in sysfs is an answer, unlike no sysfs */
+	assert(dev_sysfs_primary(_sysfs_dir, _part(5), &primary) == 0);
+	assert(dev_sysfs_partitioned(_sysfs_dir, _part(5)) == 0);
+	assert(dev_sysfs_holders(_sysfs_dir, _part(5), &holders) == 0);
+
+	/* Holders and what they are */
+	assert(dev_sysfs_holders(_sysfs_dir, _disk(0), &holders) == 0);
+	assert(dev_sysfs_holders(_sysfs_dir, _disk(1), &holders) == 1);
+	assert(holders[0] == makedev(253, 0));
+	assert(dev_sysfs_dm_uuid_prefix(_sysfs_dir, holders[0], "mpath-") == 1);
+	assert(dev_sysfs_holders(_sysfs_dir, _disk(2), &holders) == 1);
+	assert(dev_sysfs_dm_uuid_prefix(_sysfs_dir, holders[0], "mpath-") == 0);
+	assert(dev_sysfs_dm_uuid_prefix(_sysfs_dir, holders[0], "LVM-") == 1);
+	assert(dev_sysfs_holders(_sysfs_dir, _disk(3), &holders) == 1);
+	assert(holders[0] == makedev(9, 0));
+	assert(dev_sysfs_holders(_sysfs_dir, _disk(5), &holders) == 2);
+
+	/* No uuid to tell */
+	assert(dev_sysfs_dm_uuid_prefix(_sysfs_dir, makedev(253, 2), "mpath-") == -1);
+
+	/* The old layout gives the same answers */
+	assert(dev_sysfs_present(_old_sysfs_dir, makedev(8, 0)) == 1);
+	assert(dev_sysfs_primary(_old_sysfs_dir, makedev(8, 1), &primary) == 1);
+	assert(primary == makedev(8, 0));
+	assert(dev_sysfs_partitioned(_old_sysfs_dir, makedev(8, 0)) == 1);
+
+	/* Nothing to tell without sysfs */
+	assert(dev_sysfs_present(_dir, makedev(8, 0)) == -1);
+	assert(dev_sysfs_present("", makedev(8, 0)) == -1);
+	assert(dev_sysfs_primary(_dir, makedev(8, 1), &primary) == -1);
+	assert(dev_sysfs_holders(_dir, makedev(8, 0), &holders) == -1);
+
+	/* The stamp of the block devices only changes as they come and go */
+	assert(dev_sysfs_block_devices_stamp(_sysfs_dir, &stamp));
+	dev_fixture_path(path, sizeof(path), _sysfs_dir, "devices/virtual/block/sd0");
+	dev_fixture_write(path, "uevent", "MAJOR=100\n");
+	assert(dev_sysfs_block_devices_stamp(_sysfs_dir, &stamp2) && stamp2 == stamp);
+	_add("sdnew", NULL, makedev(99, 0));
+	assert(dev_sysfs_block_devices_stamp(_sysfs_dir, &stamp2) && stamp2 != stamp);
+	dev_fixture_path(path, sizeof(path), _sysfs_dir, "dev/block/99:0");
+	assert(!unlink(path));
+	assert(dev_sysfs_block_devices_stamp(_sysfs_dir, &stamp2) && stamp2 == stamp);
+	assert(!dev_sysfs_block_devices_stamp(_dir, &stamp2));
+
+	dev_sysfs_reset();
+}
+
+/*
+ * What the filters did before: the sysfs filter read each device's dev
+ * file, then the others looked for partitions and holders separately.
+ */
+static unsigned _probe(dev_t dev)
+{
+	char path[PATH_MAX], buffer[64];
+	struct stat info;
+	struct dirent *d;
+	unsigned found = 0;
+	FILE *fp;
+	DIR *dr;
+
+	assert(snprintf(path, sizeof(path), "%s/dev/block/%u:%u/dev", _sysfs_dir,
+			major(dev), minor(dev)) < (int) sizeof(path));
+	assert(!stat(path, &info));
+	assert((fp = fopen(path, "r")));
+	assert(fgets(buffer, sizeof(buffer), fp));
+	assert(!fclose(fp));
+
+	assert(snprintf(path, sizeof(path), "%s/dev/block/%u:%u/partition", _sysfs_dir,
+			major(dev), minor(dev)) < (int) sizeof(path));
+	if (!stat(path, &info))
+		return 0;
+
+	assert(snprintf(path, sizeof(path), "%s/dev/block/%u:%u/holders", _sysfs_dir,
+			major(dev), minor(dev)) < (int) sizeof(path));
+	assert((dr = opendir(path)));
+	while ((d = readdir(dr)))
+		if (strcmp(d->d_name, ".") && strcmp(d->d_name, ".."))
+			found++;
+	assert(!closedir(dr));
+
+	return found;
+}
+
+static unsigned _query(dev_t dev)
+{
+	const dev_t *holders;
+	dev_t primary;
+
+	assert(dev_sysfs_present(_sysfs_dir, dev) == 1);
+
+	if (dev_sysfs_primary(_sysfs_dir, dev, &primary))
+		return 0;
+
+	return (unsigned) dev_sysfs_holders(_sysfs_dir, dev, &holders);
+}
+
+/*
+ * Best of several rounds, as other processes easily disturb a single one.
+ */
+static void _bench(void)
+{
+	double start, probe = 0, snapshot = 0, again = 0;
+	unsigned i, held;
+	int round;
+
+	for (round = 0; round < ROUNDS; round++) {
+		start = timing_now();
+		for (i = held = 0; i < NR_DISKS; i++)
+			held += _probe(_disk(i));
+		probe = timing_best(probe, start);
+		assert(held == 5);
+
+		start = timing_now();
+		for (i = held = 0; i < NR_DISKS; i++)
+			held += _query(_disk(i));
+		snapshot = timing_best(snapshot, start);
+		assert(held == 5);
+
+		/* Other filters asking again */
+		start = timing_now();
+		for (i = held = 0; i < NR_DISKS; i++)
+			held += _query(_disk(i));
+		again = timing_best(again, start);
+		assert(held == 5);
+
+		dev_sysfs_reset();
+	}
+
+	printf("%d disks: probe each %.0f us  snapshot %.0f us  query again %.0f us\n",
+	       NR_DISKS, probe * 1e6, snapshot * 1e6, again * 1e6);
+}
+
+int main(int argc, char **argv)
+{
+	_dir = dev_fixture_create_dir("sysfs_t");
+	dev_fixture_path(_sysfs_dir, sizeof(_sysfs_dir), _dir, "sys");
+	dev_fixture_path(_old_sysfs_dir, sizeof(_old_sysfs_dir), _dir, "oldsys");
+
+	_make_tree();
+	_check();
+	_bench();
+
+	dev_fixture_remove_dir();
+
+	return 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Allocate LVs with the normal, contiguous and cling policies in a
+ * synthetic VG whose PVs are riddled with small free areas, check the
+ * VG stays valid, and time each policy.
+ */
+
+#include "vg_fixture.h"
+#include "metadata.h"
+#include "segtype.h"
+#include "archiver.h"
+#include "crc.h"
+#include "timing.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+enum {
+	NR_PVS = 200,
+	PE_COUNT = 16384,
+	MAX_RUN = 16,		/* Longest used or free run of extents */
+	NR_LVS = 40
+};
+
+static struct device _devs[NR_PVS];
+
+static uint32_t _random(void)
+{
+	static uint32_t seed = 12345;
+
+	seed = seed * 1103515245 + 12345;
+
+	return (seed >> 16) & 0x7fff;
+}
+
+/*
+ * Fill each PV with alternating used and free runs of 1 to MAX_RUN
+ * extents, the used ones belonging to one LV per PV.
+ */
+static void _write_vg(const char *file)
+{
+	uint32_t pe, len, le, segs;
+	unsigned i;
+	FILE *fp;
+
+	fp = vg_fixture_begin(file, NR_PVS, PE_COUNT);
+
+	for (i = 0; i < NR_PVS; i++) {
+		fprintf(fp, "frag%u {\nid = ", i);
+		vg_fixture_id(fp, 1, i);
+		fprintf(fp, "\nstatus = [\"READ\", \"WRITE\", \"VISIBLE\"]\n");
+
+		for (pe = le = segs = 0; pe < PE_COUNT; pe += len + 1 + _random() % MAX_RUN) {
+			len = 1 + _random() % MAX_RUN;
+			if (pe + len > PE_COUNT)
+				len = PE_COUNT - pe;
+			fprintf(fp, "segment%u {\nstart_extent = %u\nextent_count = %u\n"
+				"type = \"striped\"\nstripe_count = 1\n"
+				"stripes = [\"pv%u\", %u]\n}\n", ++segs, le, len, i, pe);
+			le += len;
+		}
+
+		fprintf(fp, "segment_count = %u\n}\n", segs);
+	}
+
+	vg_fixture_end(fp);
+}
+
+static struct volume_group *_read_vg(struct cmd_context *cmd)
+{
+	struct volume_group *vg;
+	struct pv_list *pvl;
+	char file[PATH_MAX];
+	unsigned i = 0;
+
+	vg_fixture_path(file, sizeof(file), "vg");
+	_write_vg(file);
+	assert((vg = backup_read_vg(cmd, "vg", file)));
+
+	/* The allocator only looks at PVs that are present */
+	dm_list_iterate_items(pvl, &vg->pvs) {
+		dm_list_init(&_devs[i].aliases);
+		pvl->pv->dev = &_devs[i++];
+		pvl->pv->status &= ~MISSING_PV;
+	}
+
+	return vg;
+}
+
+/*
+ * Where the LVs ended up, so runs with different allocator
+ * implementations can be compared.
+ */
+static uint32_t _digest(struct volume_group *vg, uint32_t crc)
+{
+	struct lv_list *lvl;
+	struct lv_segment *seg;
+	uint32_t s, v[4];
+
+	dm_list_iterate_items(lvl, &vg->lvs) {
+		if (!strncmp(lvl->lv->name, "frag", 4))
+			continue;
+		dm_list_iterate_items(seg, &lvl->lv->segments)
+			for (s = 0; s < seg->area_count; s++) {
+				v[0] = seg->le;
+				v[1] = seg->len;
+				v[2] = (uint32_t) (seg_dev(seg, s) - _devs);
+				v[3] = seg_pe(seg, s);
+				crc = calc_crc(crc, (const uint8_t *) v, sizeof(v));
+			}
+	}
+
+	return crc;
+}
+
+/*
+ * Allocates extents for each of NR_LVS LVs and returns how long
+ * that took.  Contiguous and cling extensions may find no space.
+ */
+static double _allocate(struct volume_group *vg, const char *name,
+			alloc_policy_t alloc, uint32_t stripes, uint32_t extents)
+{
+	const struct segment_type *striped = get_segtype_from_string(vg->cmd, "striped");
+	struct logical_volume *lv;
+	char lv_name[NAME_LEN];
+	double start, t = 0;
+	unsigned i;
+
+	for (i = 0; i < NR_LVS; i++) {
+		snprintf(lv_name, sizeof(lv_name), "%s%u", name, i);
+		if (!(lv = find_lv(vg, lv_name)))
+			assert((lv = lv_create_empty(lv_name, NULL, LVM_READ | LVM_WRITE | VISIBLE_LV,
+						     ALLOC_INHERIT, vg)));
+		start = timing_now();
+		if (!lv_extend(lv, striped, stripes, stripes > 1 ? 128 : 0, 1, 0,
+			       extents, NULL, &vg->pvs, alloc))
+			assert(alloc == ALLOC_CONTIGUOUS || alloc == ALLOC_CLING);
+		t += timing_now() - start;
+	}
+
+	assert(vg_validate(vg));
+
+	return t;
+}
+
+int main(int argc, char **argv)
+{
+	struct cmd_context *cmd;
+	struct volume_group *vg;
+	double t_small, t_normal, t_striped, t_contiguous, t_cling;
+
+	cmd = vg_fixture_create_cmd("alloc_t");
+
+	/* Neither devices for the PVs nor space for every extension */
+	log_suppress(2);
+	vg = _read_vg(cmd);
+
+	/* Each LV fits in one free area, or needs to be split up */
+	t_small = _allocate(vg, "small", ALLOC_NORMAL, 1, MAX_RUN / 2);
+	t_normal = _allocate(vg, "lv", ALLOC_NORMAL, 1, MAX_RUN * 8);
+	t_striped = _allocate(vg, "striped", ALLOC_NORMAL, 4, MAX_RUN * 4);
+	t_contiguous = _allocate(vg, "lv", ALLOC_CONTIGUOUS, 1, 1);
+	t_cling = _allocate(vg, "lv", ALLOC_CLING, 1, MAX_RUN);
+
+	printf("%u PVs, %u free areas each, %u LVs: normal %.0f/%.0f ms  "
+	       "striped %.0f ms  contiguous %.0f ms  cling %.0f ms  (layout %08x)\n",
+	       NR_PVS, PE_COUNT / (MAX_RUN + 1), NR_LVS, t_small * 1e3,
+	       t_normal * 1e3, t_striped * 1e3, t_contiguous * 1e3,
+	       t_cling * 1e3, _digest(vg, INITIAL_CRC));
+
+	release_vg(vg);
+	vg_fixture_destroy_cmd(cmd);
+
+	return 0;
+}
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Export a VG with many LVs the way vg_write() and vg_commit() do,
+ * check that an export kept for reuse and exports spliced from cached
+ * PV and LV text match a full one byte for byte, and time them.
+ */
+
+#include "vg_fixture.h"
+#include "metadata.h"
+#include "archiver.h"
+#include "str_list.h"
+#include "timing.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+enum {
+	NR_PVS = 16,
+	NR_LVS = 5000,
+	ROUNDS = 10
+};
+
+
+static void _write_vg(const char *file)
+{
+	unsigned i;
+	FILE *fp;
+
+	fp = vg_fixture_begin(file, NR_PVS, 65536);
+
+	for (i = 0; i < NR_LVS; i++) {
+		fprintf(fp, "lvol%u {\nid = ", i);
+		vg_fixture_id(fp, 1, i);
+		fprintf(fp, "\nstatus = [\"READ\", \"WRITE\", \"VISIBLE\"]\n"
+			"tags = [\"owner=team%u\"]\n"
+			"creation_host = \"host.example.com\"\n"
+			"creation_time = %u\nsegment_count = 1\n"
+			"segment1 {\nstart_extent = 0\nextent_count = %u\n"
+			"type = \"striped\"\nstripe_count = 1\n"
+			"stripes = [\"pv%u\", %u]\n}\n}\n",
+			i % 10, 1349867710 + i, 1 + i % 100,
+			i % NR_PVS, (i / NR_PVS) * 100);
+	}
+
+	vg_fixture_end(fp);
+}
+
+/*
+ * The length of the export up to the trailing header, which holds
+ * the time it was made.
+ */
+static size_t _body_len(const char *buf)
+{
+	const char *header = strstr(buf, "# Generated by LVM2");
+
+	assert(header);
+
+	return header - buf;
+}
+
+static void _check_same(const char *buf1, const char *buf2)
+{
+	size_t len = _body_len(buf1);
+
+	assert(len == _body_len(buf2));
+	assert(!memcmp(buf1, buf2, len));
+}
+
+/*
+ * Export without the kept export or the cached PV and LV text.
+ */
+static char *_full_export(struct volume_group *vg)
+{
+	struct export_cache *cache = vg->export_cache;
+	unsigned keep = vg->keep_export;
+	char *buf;
+
+	vg->export_cache = NULL;
+	vg->keep_export = 0;
+	assert(export_vg_to_buffer(vg, &buf));
+	assert(!vg->export_cache);
+	vg->export_cache = cache;
+	vg->keep_export = keep;
+
+	return buf;
+}
+
+/*
+ * The next vg_write() after a change.
+ */
+static void _check_cached(struct volume_group *vg)
+{
+	char *full, *cached;
+
+	drop_vg_export(vg);
+	keep_vg_export(vg);
+	assert(export_vg_to_buffer(vg, &cached));
+	assert(vg->export_cache);
+	drop_vg_export(vg);
+
+	full = _full_export(vg);
+	_check_same(full, cached);
+
+	dm_free(full);
+	dm_free(cached);
+}
+
+static void _check_changes(struct volume_group *vg)
+{
+	struct logical_volume *lv;
+	struct lv_list *lvl;
+	struct pv_list *pvl;
+
+	/* Fills the cache */
+	_check_cached(vg);
+	_check_cached(vg);
+
+	assert((lv = find_lv(vg, "lvol43")));
+	lv->status &= ~LVM_WRITE;
+	_check_cached(vg);
+
+	assert((lv = find_lv(vg, "lvol44")));
+	lv->name = "renamed44";
+	_check_cached(vg);
+
+	assert((lv = find_lv(vg, "lvol45")));
+	assert(str_list_add(vg->vgmem, &lv->tags, "new_tag"));
+	_check_cached(vg);
+
+	assert((lv = find_lv(vg, "lvol46")));
+	first_seg(lv)->len++;
+	lv->le_count++;
+	_check_cached(vg);
+
+	/* Gone LVs are left out */
+	assert((lvl = find_lv_in_vg(vg, "lvol47")));
+	dm_list_del(&lvl->list);
+	_check_cached(vg);
+
+	pvl = dm_list_item(dm_list_first(&vg->pvs), struct pv_list);
+	assert(str_list_add(vg->vgmem, &pvl->pv->tags, "pv_tag"));
+	_check_cached(vg);
+
+	/* Renumbers the PVs, which changes the text of every LV */
+	dm_list_del(&pvl->list);
+	dm_list_add(&vg->pvs, &pvl->list);
+	_check_cached(vg);
+
+	vg->extent_size *= 2;
+	_check_cached(vg);
+}
+
+static void _check(struct volume_group *vg)
+{
+	struct logical_volume *lv;
+	char *full, *kept, *reused, *changed;
+	size_t size;
+
+	assert(export_vg_to_buffer(vg, &full));
+	assert(!vg->export_buf);
+
+	/* vg_write() makes the export, vg_commit() reuses it */
+	keep_vg_export(vg);
+	assert((size = export_vg_to_buffer(vg, &kept)));
+	assert(vg->export_buf && vg->export_size == size);
+	assert(export_vg_to_buffer(vg, &reused) == size);
+	assert(!memcmp(kept, reused, size));
+	_check_same(full, kept);
+
+	/* A change between commits is seen by the next vg_write() */
+	drop_vg_export(vg);
+	assert((lv = find_lv(vg, "lvol42")));
+	lv->status &= ~LVM_WRITE;
+	keep_vg_export(vg);
+	assert(export_vg_to_buffer(vg, &changed));
+	assert(strstr(changed, "lvol42 {\nid = \"000042-0001-0000-0000-0000-0000-000000\"\n"
+		      "status = [\"READ\", \"VISIBLE\"]"));
+	drop_vg_export(vg);
+	assert(!vg->export_buf && !vg->keep_export);
+
+	lv->status |= LVM_WRITE;
+	dm_free(full);
+	assert(export_vg_to_buffer(vg, &full));
+	_check_same(full, kept);
+
+	dm_free(full);
+	dm_free(kept);
+	dm_free(reused);
+	dm_free(changed);
+}
+
+/*
+ * vg_write() and vg_commit() export the VG for the metadata areas,
+ * lvmetad and the metadata cache.  Without keep, the cached PV and LV
+ * text is not used either.
+ */
+static double _write_and_commit(struct volume_group *vg, int keep)
+{
+	struct export_cache *cache = vg->export_cache;
+	double start = timing_now();
+	char *buf;
+	int i;
+
+	if (keep)
+		keep_vg_export(vg);
+	else
+		vg->export_cache = NULL;
+
+	for (i = 0; i < 3; i++) {
+		assert(export_vg_to_buffer(vg, &buf));
+		dm_free(buf);
+	}
+
+	drop_vg_export(vg);
+	vg->export_cache = cache;
+
+	return timing_now() - start;
+}
+
+int main(int argc, char **argv)
+{
+	struct cmd_context *cmd;
+	struct volume_group *vg;
+	struct logical_volume *lv;
+	char file[PATH_MAX], *buf;
+	double full = 0, kept = 0, changed = 0;
+	size_t size;
+	int i;
+
+	cmd = vg_fixture_create_cmd("export_t");
+
+	/* No devices for the PVs */
+	log_suppress(2);
+	vg_fixture_path(file, sizeof(file), "vg");
+	_write_vg(file);
+	assert((vg = backup_read_vg(cmd, "vg", file)));
+
+	_check(vg);
+	_check_changes(vg);
+
+	assert((lv = find_lv(vg, "lvol100")));
+
+	for (i = 0; i < ROUNDS; i++) {
+		full += _write_and_commit(vg, 0);
+		kept += _write_and_commit(vg, 1);
+		lv->status ^= LVM_WRITE;
+		changed += _write_and_commit(vg, 1);
+	}
+
+	assert((size = export_vg_to_buffer(vg, &buf)));
+	dm_free(buf);
+
+	printf("VG with %u LVs, %" PRIsize_t " bytes, write and commit: "
+	       "full exports %.0f us  unchanged %.0f us  one LV changed %.0f us\n",
+	       NR_LVS, size, full * 1e6 / ROUNDS, kept * 1e6 / ROUNDS,
+	       changed * 1e6 / ROUNDS);
+
+	release_vg(vg);
+	vg_fixture_destroy_cmd(cmd);
+
+	return 0;
+}
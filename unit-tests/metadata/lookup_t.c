@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Check LV and PV lookups in a VG stay right as LVs are created,
+ * renamed and removed, and time what lvcreate and lvs do in VGs of
+ * 1000 to 50000 LVs against searching the lists.
+ */
+
+#include "vg_fixture.h"
+#include "metadata.h"
+#include "archiver.h"
+#include "timing.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+enum {
+	NR_PVS = 64,
+	NR_CREATE = 100,
+	NR_LOOKUPS = 1000
+};
+
+
+static void _write_vg(const char *file, unsigned nr_lvs)
+{
+	unsigned i;
+	FILE *fp;
+
+	fp = vg_fixture_begin(file, NR_PVS, 65536);
+
+	for (i = 0; i < nr_lvs; i++) {
+		fprintf(fp, "lvol%u {\nid = ", i);
+		vg_fixture_id(fp, 1, i);
+		fprintf(fp, "\nstatus = [\"READ\", \"WRITE\", \"VISIBLE\"]\n"
+			"segment_count = 1\nsegment1 {\nstart_extent = 0\n"
+			"extent_count = 1\ntype = \"striped\"\nstripe_count = 1\n"
+			"stripes = [\"pv%u\", %u]\n}\n}\n",
+			i % NR_PVS, i / NR_PVS);
+	}
+
+	vg_fixture_end(fp);
+}
+
+static struct volume_group *_read_vg(struct cmd_context *cmd, unsigned nr_lvs)
+{
+	struct volume_group *vg;
+	char file[PATH_MAX];
+
+	vg_fixture_path(file, sizeof(file), "vg");
+	_write_vg(file, nr_lvs);
+	assert((vg = backup_read_vg(cmd, "vg", file)));
+
+	return vg;
+}
+
+/* How the lookups used to be done */
+static struct lv_list *_scan_name(struct volume_group *vg, const char *name)
+{
+	struct lv_list *lvl;
+
+	dm_list_iterate_items(lvl, &vg->lvs)
+		if (!strcmp(lvl->lv->name, name))
+			return lvl;
+
+	return NULL;
+}
+
+static struct lv_list *_scan_lvid(struct volume_group *vg, const union lvid *lvid)
+{
+	struct lv_list *lvl;
+
+	dm_list_iterate_items(lvl, &vg->lvs)
+		if (!strncmp(lvl->lv->lvid.s, lvid->s, sizeof(*lvid)))
+			return lvl;
+
+	return NULL;
+}
+
+static void _check(struct cmd_context *cmd)
+{
+	struct volume_group *vg = _read_vg(cmd, 1000), *vg2;
+	struct logical_volume *lv, *lv2;
+	struct lv_list *lvl;
+	struct pv_list *pvl;
+	union lvid lvid;
+
+	dm_list_iterate_items(lvl, &vg->lvs) {
+		assert(find_lv(vg, lvl->lv->name) == lvl->lv);
+		assert(find_lv_in_vg_by_lvid(vg, &lvl->lv->lvid) == lvl);
+	}
+
+	dm_list_iterate_items(pvl, &vg->pvs) {
+		assert(find_pv_in_vg_by_uuid(vg, &pvl->pv->id) == pvl);
+		assert(pv_is_in_vg(vg, pvl->pv));
+	}
+
+	assert(find_lv(vg, "vg/lvol7") == find_lv(vg, "lvol7"));
+	assert(!find_lv(vg, "lvol1000"));
+
+	/* New LVs get their uuid after they are linked into the VG */
+	assert((lv = lv_create_empty("lvol%d", NULL, LVM_READ | LVM_WRITE | VISIBLE_LV,
+				     ALLOC_INHERIT, vg)));
+	assert(!strcmp(lv->name, "lvol1000"));
+	assert(find_lv(vg, "lvol1000") == lv);
+	assert(find_lv_in_vg_by_lvid(vg, &lv->lvid)->lv == lv);
+
+	/* Some code renames LVs in place */
+	lv->name = "renamed";
+	assert(!find_lv(vg, "lvol1000"));
+	assert(find_lv(vg, "renamed") == lv);
+
+	/* ... or changes their uuid */
+	lvid = lv->lvid;
+	assert(id_create(&lvid.id[1]));
+	assert(!find_lv_in_vg_by_lvid(vg, &lvid));
+	assert(lv_set_lvid(lv, &lvid));
+	assert(find_lv_in_vg_by_lvid(vg, &lvid)->lv == lv);
+
+	/* Swapping names */
+	lv2 = find_lv(vg, "lvol5");
+	lv2->name = "renamed";
+	lv->name = "lvol5";
+	assert(find_lv(vg, "lvol5") == lv);
+	assert(find_lv(vg, "renamed") == lv2);
+	lv2->name = "lvol1000";
+
+	assert(unlink_lv_from_vg(lv));
+	assert(!find_lv(vg, "lvol5"));
+	assert(!find_lv_in_vg_by_lvid(vg, &lv->lvid));
+	assert(find_lv(vg, "lvol1000") == lv2);
+
+	/* vgsplit and vgmerge move LVs between VGs */
+	vg2 = _read_vg(cmd, 0);
+	lvl = find_lv_in_vg(vg, "lvol1000");
+	assert(move_lv_to_vg(vg2, lvl));
+	assert(!find_lv(vg, "lvol1000"));
+	assert(!find_lv_in_vg_by_lvid(vg, &lv2->lvid));
+	assert(find_lv(vg2, "lvol1000") == lv2);
+	assert(find_lv_in_vg_by_lvid(vg2, &lv2->lvid) == lvl);
+	release_vg(vg2);
+
+	pvl = dm_list_item(dm_list_first(&vg->pvs), struct pv_list);
+	del_pvl_from_vgs(vg, pvl);
+	assert(!find_pv_in_vg_by_uuid(vg, &pvl->pv->id));
+	assert(!pv_is_in_vg(vg, pvl->pv));
+	add_pvl_to_vgs(vg, pvl);
+	assert(find_pv_in_vg_by_uuid(vg, &pvl->pv->id) == pvl);
+
+	release_vg(vg);
+}
+
+/*
+ * lvcreate: name and create an LV, check the VG; lvs: find LVs by
+ * name and by uuid, as for command line arguments and activation.
+ */
+static void _time(struct cmd_context *cmd, unsigned nr_lvs)
+{
+	struct volume_group *vg;
+	struct logical_volume **lvs;
+	struct lv_list *lvl;
+	double start, t_read, t_create, t_validate, t_name, t_lvid, t_miss, t_scan;
+	union lvid missing;
+	unsigned i = 0;
+
+	start = timing_now();
+	vg = _read_vg(cmd, nr_lvs);
+	t_read = timing_now() - start;
+
+	assert((lvs = dm_malloc(nr_lvs * sizeof(*lvs))));
+	dm_list_iterate_items(lvl, &vg->lvs)
+		lvs[i++] = lvl->lv;
+
+	start = timing_now();
+	for (i = 0; i < NR_CREATE; i++)
+		assert(lv_create_empty("lvol%d", NULL, LVM_READ | LVM_WRITE | VISIBLE_LV,
+				       ALLOC_INHERIT, vg));
+	t_create = timing_now() - start;
+
+	start = timing_now();
+	assert(vg_validate(vg));
+	t_validate = timing_now() - start;
+
+	start = timing_now();
+	for (i = 0; i < NR_LOOKUPS; i++)
+		assert(find_lv(vg, lvs[i * 7919 % nr_lvs]->name));
+	t_name = timing_now() - start;
+
+	start = timing_now();
+	for (i = 0; i < NR_LOOKUPS; i++)
+		assert(find_lv_in_vg_by_lvid(vg, &lvs[i * 7919 % nr_lvs]->lvid));
+	t_lvid = timing_now() - start;
+
+	missing = lvs[0]->lvid;
+	assert(id_create(&missing.id[1]));
+	start = timing_now();
+	for (i = 0; i < NR_LOOKUPS; i++)
+		assert(!find_lv_in_vg_by_lvid(vg, &missing));
+	t_miss = timing_now() - start;
+
+	start = timing_now();
+	for (i = 0; i < NR_LOOKUPS; i++) {
+		assert(_scan_name(vg, lvs[i * 7919 % nr_lvs]->name));
+		assert(_scan_lvid(vg, &lvs[i * 7919 % nr_lvs]->lvid));
+	}
+	t_scan = timing_now() - start;
+
+	printf("%5u LVs: read %6.1f ms  lvcreate %6.1f us + validate %5.1f ms  "
+	       "lookup by name %5.2f us  by uuid %5.2f us  miss %5.2f us  "
+	       "(scanning %7.2f us)\n",
+	       nr_lvs, t_read * 1e3, t_create * 1e6 / NR_CREATE, t_validate * 1e3,
+	       t_name * 1e6 / NR_LOOKUPS, t_lvid * 1e6 / NR_LOOKUPS,
+	       t_miss * 1e6 / NR_LOOKUPS,
+	       t_scan * 1e6 / NR_LOOKUPS);
+
+	dm_free(lvs);
+	release_vg(vg);
+}
+
+int main(int argc, char **argv)
+{
+	static const unsigned _nr_lvs[] = { 1000, 10000, 50000 };
+	struct cmd_context *cmd;
+	unsigned i;
+
+	cmd = vg_fixture_create_cmd("lookup_t");
+
+	/* No devices for the PVs */
+	log_suppress(2);
+
+	_check(cmd);
+
+	for (i = 0; i < sizeof(_nr_lvs) / sizeof(*_nr_lvs); i++)
+		_time(cmd, _nr_lvs[i]);
+
+	vg_fixture_destroy_cmd(cmd);
+
+	return 0;
+}
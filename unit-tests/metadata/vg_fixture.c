@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "vg_fixture.h"
+
+#include <assert.h>
+#include <ftw.h>
+
+static char _dir[PATH_MAX];
+
+static int _remove_one(const char *path, const struct stat *sb, int flag,
+		       struct FTW *ftw)
+{
+	return remove(path);
+}
+
+struct cmd_context *vg_fixture_create_cmd(const char *name)
+{
+	const char *tmp = getenv("TMPDIR");
+	struct cmd_context *cmd;
+	char path[PATH_MAX];
+	FILE *fp;
+
+	assert(snprintf(_dir, sizeof(_dir), "%s/%s.XXXXXX", tmp ? : "/tmp", name) <
+	       (int) sizeof(_dir));
+	assert(mkdtemp(_dir));
+
+	vg_fixture_path(path, sizeof(path), "dev");
+	assert(!mkdir(path, 0755));
+
+	vg_fixture_path(path, sizeof(path), "lvm.conf");
+	assert((fp = fopen(path, "w")));
+	fprintf(fp, "devices {\n\tdir = \"%s/dev\"\n\tscan = [ \"%s/dev\" ]\n"
+		"\tobtain_device_list_from_udev = 0\n\tsysfs_scan = 0\n"
+		"\twrite_cache_state = 0\n}\n", _dir, _dir);
+	assert(!fclose(fp));
+
+	assert(!setenv("LVM_SYSTEM_DIR", _dir, 1));
+	assert((cmd = create_toolcontext(0, NULL, 0, 0)));
+
+	return cmd;
+}
+
+void vg_fixture_destroy_cmd(struct cmd_context *cmd)
+{
+	destroy_toolcontext(cmd);
+	nftw(_dir, _remove_one, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+void vg_fixture_path(char *path, size_t size, const char *name)
+{
+	assert(snprintf(path, size, "%s/%s", _dir, name) < (int) size);
+}
+
+void vg_fixture_id(FILE *fp, unsigned kind, unsigned i)
+{
+	fprintf(fp, "\"%06u-%04u-0000-0000-0000-0000-000000\"", i, kind);
+}
+
+FILE *vg_fixture_begin(const char *file, unsigned nr_pvs, uint32_t pe_count)
+{
+	unsigned i;
+	FILE *fp;
+
+	assert((fp = fopen(file, "w")));
+	fprintf(fp, "contents = \"Text Format Volume Group\"\nversion = 1\n"
+		"vg {\nid = ");
+	vg_fixture_id(fp, 9999, 0);
+	fprintf(fp, "\nseqno = 1\nstatus = [\"RESIZEABLE\", \"READ\", \"WRITE\"]\n"
+		"extent_size = 8192\nmax_lv = 0\nmax_pv = 0\n"
+		"physical_volumes {\n");
+
+	for (i = 0; i < nr_pvs; i++) {
+		fprintf(fp, "pv%u {\nid = ", i);
+		vg_fixture_id(fp, 0, i);
+		fprintf(fp, "\ndevice = \"/dev/fake%u\"\nstatus = [\"ALLOCATABLE\"]\n"
+			"dev_size = %u\npe_start = 2048\npe_count = %u\n}\n",
+			i, pe_count * 8192 + 2048, pe_count);
+	}
+
+	fprintf(fp, "}\nlogical_volumes {\n");
+
+	return fp;
+}
+
+void vg_fixture_end(FILE *fp)
+{
+	fprintf(fp, "}\n}\n");
+	assert(!fclose(fp));
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * A scratch LVM system directory with no devices and synthetic VG
+ * metadata files, shared by the metadata tests.
+ */
+
+#ifndef _LVM_UNIT_VG_FIXTURE_H
+#define _LVM_UNIT_VG_FIXTURE_H
+
+#include "lib.h"
+#include "toolcontext.h"
+
+#include <stdio.h>
+
+/*
+ * Create the scratch directory, named after the test, and a
+ * command context using it.
+ */
+struct cmd_context *vg_fixture_create_cmd(const char *name);
+
+/*
+ * Destroy the command context and remove the scratch directory.
+ */
+void vg_fixture_destroy_cmd(struct cmd_context *cmd);
+
+/*
+ * The path of a file in the scratch directory.
+ */
+void vg_fixture_path(char *path, size_t size, const char *name);
+
+/*
+ * Write the UUID of the i-th object of a kind: 0 for PVs, 1 for LVs.
+ */
+void vg_fixture_id(FILE *fp, unsigned kind, unsigned i);
+
+/*
+ * Start the metadata file of VG "vg" with nr_pvs PVs of pe_count
+ * extents each.  The caller writes the LVs, then calls vg_fixture_end.
+ */
+FILE *vg_fixture_begin(const char *file, unsigned nr_pvs, uint32_t pe_count);
+void vg_fixture_end(FILE *fp);
+
+#endif
@@ -0,0 +1,335 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Check that a saved dfa gives the same matches as the one it came from,
+ * and time matching device paths against a typical filter with and
+ * without one.  Then time command start-up, which loads the saved dfa
+ * from a file instead of compiling the patterns, for a filter of the
+ * size sites with many multipath LUNs use.
+ */
+
+#include "libdevmapper.h"
+#include "timing.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+enum {
+	NR_PATHS = 50000,
+	ROUNDS = 5,
+	NR_LUNS = 32,		/* Accepted one by one in the site filter */
+	NR_COMMANDS = 20
+};
+
+static const char * const _patterns[] = {
+	"^/dev/sd[a-z]+[0-9]*$",
+	"^/dev/nvme[0-9]+n[0-9]+(p[0-9]+)?$",
+	"^/dev/disk/by-id/(wwn|scsi)-",
+	"^/dev/mapper/vg[0-9]+-",
+	"^/dev/md[0-9]+$",
+	"/dev/cdrom",
+	"loop",
+	".*"
+};
+
+#define NR_PATTERNS (sizeof(_patterns) / sizeof(*_patterns))
+
+static const char * const _site_rejects[] = {
+	"^/dev/mapper/mpath[a-z]+$",
+	"^/dev/md[0-9]+$",
+	"^/dev/sd[a-z]+[0-9]*$",
+	"^/dev/nvme[0-9]+n[0-9]+(p[0-9]+)?$",
+	"/dev/cdrom",
+	"^/dev/loop",
+	"^/dev/ram",
+	"^/dev/disk/by-path/",
+	"^/dev/disk/by-uuid/",
+	"^/dev/disk/by-id/(wwn|scsi)-",
+	"^/dev/block/",
+	"^/dev/dm-[0-9]+$",
+	".*"
+};
+
+#define NR_SITE_REJECTS (sizeof(_site_rejects) / sizeof(*_site_rejects))
+#define NR_SITE_PATTERNS (NR_LUNS + NR_SITE_REJECTS)
+
+static char *_paths[NR_PATHS];
+static const char *_site_patterns[NR_SITE_PATTERNS];
+
+static void _make_paths(void)
+{
+	char path[128];
+	unsigned i;
+
+	for (i = 0; i < NR_PATHS; i++) {
+		switch (i % 7) {
+		case 0:
+			sprintf(path, "/dev/sd%c%c%u", 'a' + (i / 6) % 26,
+				'a' + (i / 156) % 26, i % 16);
+			break;
+		case 1:
+			sprintf(path, "/dev/nvme%un%up%u", i % 8, i % 4, i % 10);
+			break;
+		case 2:
+			sprintf(path, "/dev/disk/by-id/wwn-0x5000c500%08x", i);
+			break;
+		case 3:
+			sprintf(path, "/dev/mapper/vg%u-lvol%u", i % 32, i);
+			break;
+		case 4:
+			sprintf(path, "/dev/block/%u:%u", 8 + i % 64, i % 256);
+			break;
+		case 5:
+			sprintf(path, "/dev/disk/by-id/dm-uuid-mpath-3600507680181052348%010u",
+				i % (4 * NR_LUNS));
+			break;
+		default:
+			sprintf(path, "/dev/disk/by-path/pci-0000:%02x:00.0-scsi-0:0:%u:0",
+				i % 256, i % 64);
+		}
+
+		assert((_paths[i] = dm_strdup(path)));
+	}
+}
+
+static struct dm_regex *_create(struct dm_pool *mem, const char * const *patterns)
+{
+	struct dm_regex *rx;
+
+	assert((rx = dm_regex_create(mem, patterns, NR_PATTERNS)));
+
+	return rx;
+}
+
+static void _match(struct dm_regex *rx, int *results, unsigned nr_paths)
+{
+	unsigned i;
+
+	for (i = 0; i < nr_paths; i++)
+		results[i] = dm_regex_match(rx, _paths[i]);
+}
+
+static void _check(void)
+{
+	static int expected[NR_PATHS], results[NR_PATHS];
+	const char *other[NR_PATTERNS];
+	struct dm_pool *mem;
+	struct dm_regex *rx;
+	void *data;
+	size_t size;
+
+	assert((mem = dm_pool_create("cache_t", 1024)));
+
+	rx = _create(mem, _patterns);
+	_match(rx, expected, NR_PATHS);
+	assert((size = dm_regex_export(rx, mem, &data)));
+
+	/* The saved dfa gives the same answers and fingerprint */
+	assert((rx = dm_regex_import(mem, _patterns, NR_PATTERNS, data, size)));
+	_match(rx, results, NR_PATHS);
+	assert(!memcmp(expected, results, sizeof(results)));
+
+	/* Fingerprints are only comparable before any matching */
+	rx = _create(mem, _patterns);
+	assert((size = dm_regex_export(rx, mem, &data)));
+	assert(dm_regex_fingerprint(rx) ==
+	       dm_regex_fingerprint(dm_regex_import(mem, _patterns, NR_PATTERNS, data, size)));
+
+	/* Damaged data is rejected */
+	assert(!dm_regex_import(mem, _patterns, NR_PATTERNS, data, size - 1));
+	((char *) data)[0] ^= 1;
+	assert(!dm_regex_import(mem, _patterns, NR_PATTERNS, data, size));
+	((char *) data)[0] ^= 1;
+
+	/* And so is a dfa for other patterns */
+	memcpy(other, _patterns, sizeof(other));
+	other[0] = "^/dev/sd[a-y]+[0-9]*$";
+	assert(!dm_regex_import(mem, other, NR_PATTERNS, data, size));
+	assert(!dm_regex_import(mem, _patterns, NR_PATTERNS - 1, data, size));
+
+	/* A dfa with too many states is not saved, but still matches */
+	other[0] = "a[ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab]$";
+	assert((rx = dm_regex_create(mem, other, 1)));
+	assert(!dm_regex_export(rx, mem, &data));
+	assert(dm_regex_match(rx, "/dev/babbbbbbbbbbbbb") == 0);
+	assert(dm_regex_match(rx, "/dev/bbbbbbbbbbbbbbb") < 0);
+
+	dm_pool_destroy(mem);
+}
+
+static int _saved_size(void)
+{
+	struct dm_pool *mem;
+	void *data;
+	size_t size;
+
+	assert((mem = dm_pool_create("cache_t", 1024)));
+	assert((size = dm_regex_export(_create(mem, _patterns), mem, &data)));
+	dm_pool_destroy(mem);
+
+	return (int) size;
+}
+
+static void _make_site_patterns(void)
+{
+	char pattern[128];
+	unsigned i;
+
+	for (i = 0; i < NR_LUNS; i++) {
+		sprintf(pattern, "^/dev/disk/by-id/dm-uuid-mpath-3600507680181052348%010u$",
+			i * 4);
+		assert((_site_patterns[i] = dm_strdup(pattern)));
+	}
+
+	for (i = 0; i < NR_SITE_REJECTS; i++)
+		_site_patterns[NR_LUNS + i] = _site_rejects[i];
+}
+
+/*
+ * Best of several rounds, as other processes easily disturb a single one.
+ */
+static void _bench(unsigned nr_paths)
+{
+	static int results[NR_PATHS];
+	double start, cold = 0, warm = 0, loaded = 0;
+	struct dm_pool *mem;
+	struct dm_regex *rx;
+	void *data;
+	size_t size;
+	int i;
+
+	for (i = 0; i < ROUNDS; i++) {
+		assert((mem = dm_pool_create("cache_t", 1024)));
+
+		start = timing_now();
+		rx = _create(mem, _patterns);
+		_match(rx, results, nr_paths);
+		cold = timing_best(cold, start);
+
+		start = timing_now();
+		_match(rx, results, nr_paths);
+		warm = timing_best(warm, start);
+
+		assert((size = dm_regex_export(rx, mem, &data)));
+
+		start = timing_now();
+		assert((rx = dm_regex_import(mem, _patterns, NR_PATTERNS, data, size)));
+		_match(rx, results, nr_paths);
+		loaded = timing_best(loaded, start);
+
+		dm_pool_destroy(mem);
+	}
+
+	printf("%6u paths  create and match %7.0f us  match again %7.0f us  "
+	       "load and match %7.0f us\n", nr_paths, cold * 1e6, warm * 1e6,
+	       loaded * 1e6);
+}
+
+/* Read the whole file, as lvm-regex.c does at command start-up */
+static struct dm_regex *_load(struct dm_pool *mem, const char *file)
+{
+	struct dm_regex *rx;
+	static char data[256 * 1024];
+	size_t size;
+	FILE *fp;
+
+	assert((fp = fopen(file, "r")));
+	size = fread(data, 1, sizeof(data), fp);
+	assert(size && size < sizeof(data) && !fclose(fp));
+	assert((rx = dm_regex_import(mem, _site_patterns, NR_SITE_PATTERNS, data, size)));
+
+	return rx;
+}
+
+/*
+ * Each command compiles the filter, or loads the saved dfa, and then
+ * matches every alias of every device once.
+ */
+static void _bench_startup(unsigned nr_paths)
+{
+	static int expected[NR_PATHS], results[NR_PATHS];
+	double start, compiled = 0, loaded = 0;
+	char file[] = "/tmp/cache_t.XXXXXX";
+	struct dm_pool *mem;
+	struct dm_regex *rx;
+	void *data;
+	size_t size;
+	FILE *fp;
+	int fd, i, j;
+
+	assert((mem = dm_pool_create("cache_t", 1024)));
+	assert((rx = dm_regex_create(mem, _site_patterns, NR_SITE_PATTERNS)));
+	_match(rx, expected, nr_paths);
+	assert((size = dm_regex_export(rx, mem, &data)));
+	assert((fd = mkstemp(file)) >= 0 && (fp = fdopen(fd, "w")));
+	assert(fwrite(data, size, 1, fp) == 1 && !fclose(fp));
+	dm_pool_destroy(mem);
+
+	for (i = 0; i < ROUNDS; i++) {
+		start = timing_now();
+		for (j = 0; j < NR_COMMANDS; j++) {
+			assert((mem = dm_pool_create("cache_t", 1024)));
+			assert((rx = dm_regex_create(mem, _site_patterns, NR_SITE_PATTERNS)));
+			_match(rx, results, nr_paths);
+			dm_pool_destroy(mem);
+		}
+		compiled = timing_best(compiled, start);
+
+		start = timing_now();
+		for (j = 0; j < NR_COMMANDS; j++) {
+			assert((mem = dm_pool_create("cache_t", 1024)));
+			_match(_load(mem, file), results, nr_paths);
+			dm_pool_destroy(mem);
+		}
+		loaded = timing_best(loaded, start);
+
+		assert(!memcmp(expected, results, nr_paths * sizeof(*results)));
+	}
+
+	assert(!unlink(file));
+
+	printf("%6u paths  per command: compile and match %7.0f us  "
+	       "load and match %7.0f us\n", nr_paths,
+	       compiled * 1e6 / NR_COMMANDS, loaded * 1e6 / NR_COMMANDS);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned i;
+
+	_make_paths();
+	_make_site_patterns();
+	_check();
+
+	printf("%u patterns, %d byte dfa:\n", (unsigned) NR_PATTERNS, _saved_size());
+	_bench(200);
+	_bench(NR_PATHS);
+
+	printf("%u patterns, repeated command start-up:\n",
+	       (unsigned) NR_SITE_PATTERNS);
+	_bench_startup(200);
+	_bench_startup(2000);
+
+	for (i = 0; i < NR_PATHS; i++)
+		dm_free(_paths[i]);
+
+	for (i = 0; i < NR_LUNS; i++)
+		dm_free((void *) _site_patterns[i]);
+
+	return 0;
+}
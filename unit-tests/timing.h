@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc. All rights reserved.
+ *
+ * This file is part of LVM2.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v.2.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Wall clock timing for the unit tests that report how fast they run.
+ * Not inline: gcc may decline and -Winline would say so.
+ */
+
+#ifndef _LVM_UNIT_TEST_TIMING_H
+#define _LVM_UNIT_TEST_TIMING_H
+
+#include <sys/time.h>
+
+/* Seconds since the epoch */
+static double __attribute__((unused)) timing_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*
+ * The shorter of best and the time since start.
+ */
+static double __attribute__((unused)) timing_best(double best, double start)
+{
+	double t = timing_now() - start;
+
+	return (!best || t < best) ? t : best;
+}
+
+#endif